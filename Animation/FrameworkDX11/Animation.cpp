@@ -1,4 +1,5 @@
 #include "Animation.h"
+#include "QuaternionInterp.h"
 #include <algorithm>
 
 using namespace std;
@@ -16,7 +17,7 @@ void ReadDataFromAccessor(const tinygltf::Model& model, int accessorIndex, std::
     memcpy(outData.data(), dataPtr, accessor.count * sizeof(T));
 }
 
-bool Animation::LoadFromGltf(const tinygltf::Model& model, const std::map<int, int>& nodeToJointMap, const unsigned int animationIndex)
+bool Animation::LoadFromGltf(const tinygltf::Model& model, const unsigned int animationIndex)
 {
     if (model.animations.empty()) {
         return false;
@@ -27,6 +28,7 @@ bool Animation::LoadFromGltf(const tinygltf::Model& model, const std::map<int, i
 
     const tinygltf::Animation& anim = model.animations[animationIndex]; // Load the first animation
     m_name = anim.name;
+    m_sourceIndex = (int)animationIndex;
 
     // Load Samplers
     m_samplers.resize(anim.samplers.size());
@@ -35,16 +37,26 @@ bool Animation::LoadFromGltf(const tinygltf::Model& model, const std::map<int, i
         const tinygltf::AnimationSampler& gltfSampler = anim.samplers[i];
         AnimationSampler& sampler = m_samplers[i];
 
-        if (gltfSampler.interpolation == "LINEAR") {
-            sampler.interpolation = AnimationSampler::LINEAR;
-        } // Add cases for STEP and CUBICSPLINE if needed
+        if (gltfSampler.interpolation == "STEP") {
+            sampler.interpolation = AnimationSampler::STEP;
+        }
+        else if (gltfSampler.interpolation == "CUBICSPLINE") {
+            sampler.interpolation = AnimationSampler::CUBICSPLINE; // outputs are (in-tangent, value, out-tangent) triplets
+        }
+        else {
+            sampler.interpolation = AnimationSampler::LINEAR; // glTF default
+        }
 
         // Read timestamps
         ReadDataFromAccessor(model, gltfSampler.input, sampler.timestamps);
 
         // Read keyframe values
         const tinygltf::Accessor& outputAccessor = model.accessors[gltfSampler.output];
-        if (outputAccessor.type == TINYGLTF_TYPE_VEC3)
+        if (outputAccessor.type == TINYGLTF_TYPE_SCALAR)
+        {
+            ReadDataFromAccessor(model, gltfSampler.output, sampler.scalar_values);
+        }
+        else if (outputAccessor.type == TINYGLTF_TYPE_VEC3)
         {
             ReadDataFromAccessor(model, gltfSampler.output, sampler.vec3_values);
         }
@@ -60,15 +72,15 @@ bool Animation::LoadFromGltf(const tinygltf::Model& model, const std::map<int, i
         const tinygltf::AnimationChannel& gltfChannel = anim.channels[i];
         AnimationChannel channel;
 
-        // Find which joint this channel targets using the map we built earlier
-        auto it = nodeToJointMap.find(gltfChannel.target_node);
-        if (it == nodeToJointMap.end()) {
-            continue; // This channel animates a node that isn't a joint, so we skip it.
-        }
-        channel.jointIndex = it->second;
+        channel.nodeIndex = gltfChannel.target_node;
         channel.samplerIndex = gltfChannel.sampler;
 
-        if (gltfChannel.target_path == "translation") {
+        // Joints are resolved from nodeIndex by each skeleton the clip is bound to,
+        // channels on other nodes are driven by the scene graph.
+        if (gltfChannel.target_path == "weights") {
+            channel.path = AnimationChannel::WEIGHTS;
+        }
+        else if (gltfChannel.target_path == "translation") {
             channel.path = AnimationChannel::TRANSLATION;
         }
         else if (gltfChannel.target_path == "rotation") {
@@ -77,12 +89,198 @@ bool Animation::LoadFromGltf(const tinygltf::Model& model, const std::map<int, i
         else if (gltfChannel.target_path == "scale") {
             channel.path = AnimationChannel::SCALE;
         }
+        else {
+            continue; // unknown path (e.g. from an extension)
+        }
         m_channels.push_back(channel);
     }
 
     return true;
 }
 
+void AnimationSampler::FindKeys(float time, size_t& prevFrame, size_t& nextFrame, float& t) const
+{
+    prevFrame = 0;
+    auto it = std::upper_bound(timestamps.begin(), timestamps.end(), time);
+    if (it != timestamps.begin()) {
+        prevFrame = std::distance(timestamps.begin(), it) - 1;
+    }
+    nextFrame = std::min(prevFrame + 1, timestamps.size() - 1);
+
+    float frameDuration = timestamps[nextFrame] - timestamps[prevFrame];
+    t = (frameDuration > 0.0f) ? ((time - timestamps[prevFrame]) / frameDuration) : 0.0f;
+}
+
+namespace
+{
+    using namespace DirectX;
+
+    // How the values of each path are stored and combined
+    template <AnimationChannel::PathType Path>
+    struct TrackTraits
+    {
+        static XMVECTOR Load(const AnimationSampler& sampler, size_t i) { return XMLoadFloat3(&sampler.vec3_values[i]); }
+        static XMVECTOR Lerp(FXMVECTOR a, FXMVECTOR b, float t) { return XMVectorLerp(a, b, t); }
+        static XMVECTOR Finish(FXMVECTOR v) { return v; }
+    };
+
+    template <>
+    struct TrackTraits<AnimationChannel::ROTATION>
+    {
+        static XMVECTOR Load(const AnimationSampler& sampler, size_t i) { return XMLoadFloat4(&sampler.vec4_values[i]); }
+        static XMVECTOR Lerp(FXMVECTOR a, FXMVECTOR b, float t)
+        {
+            // Shortest path, at the precision tier currently selected
+            return QuatInterp::Interpolate(a, b, t, QuatInterp::GetPrecision());
+        }
+        static XMVECTOR Finish(FXMVECTOR v) { return XMQuaternionNormalize(v); }
+    };
+
+    // One kernel per (path, interpolation) pair, picked through a table so the
+    // per-key evaluation carries no runtime switch on either.
+    template <AnimationChannel::PathType Path, AnimationSampler::InterpolationType Interp>
+    struct TrackKernel;
+
+    template <AnimationChannel::PathType Path>
+    struct TrackKernel<Path, AnimationSampler::STEP>
+    {
+        static XMVECTOR Evaluate(const AnimationSampler& sampler, float time)
+        {
+            size_t prevFrame, nextFrame;
+            float t;
+            sampler.FindKeys(time, prevFrame, nextFrame, t);
+            return TrackTraits<Path>::Load(sampler, prevFrame);
+        }
+    };
+
+    template <AnimationChannel::PathType Path>
+    struct TrackKernel<Path, AnimationSampler::LINEAR>
+    {
+        static XMVECTOR Evaluate(const AnimationSampler& sampler, float time)
+        {
+            size_t prevFrame, nextFrame;
+            float t;
+            sampler.FindKeys(time, prevFrame, nextFrame, t);
+            return TrackTraits<Path>::Lerp(TrackTraits<Path>::Load(sampler, prevFrame),
+                                           TrackTraits<Path>::Load(sampler, nextFrame), t);
+        }
+    };
+
+    template <AnimationChannel::PathType Path>
+    struct TrackKernel<Path, AnimationSampler::CUBICSPLINE>
+    {
+        static XMVECTOR Evaluate(const AnimationSampler& sampler, float time)
+        {
+            size_t prevFrame, nextFrame;
+            float t;
+            sampler.FindKeys(time, prevFrame, nextFrame, t);
+            const float dt = sampler.timestamps[nextFrame] - sampler.timestamps[prevFrame];
+
+            // Hermite basis; tangents are scaled by the key interval as the spec requires
+            const float t2 = t * t;
+            const float t3 = t2 * t;
+            const XMVECTOR v0 = TrackTraits<Path>::Load(sampler, prevFrame * 3 + 1);
+            const XMVECTOR b0 = TrackTraits<Path>::Load(sampler, prevFrame * 3 + 2);
+            const XMVECTOR a1 = TrackTraits<Path>::Load(sampler, nextFrame * 3 + 0);
+            const XMVECTOR v1 = TrackTraits<Path>::Load(sampler, nextFrame * 3 + 1);
+
+            XMVECTOR r = XMVectorScale(v0, 2.0f * t3 - 3.0f * t2 + 1.0f);
+            r = XMVectorMultiplyAdd(b0, XMVectorReplicate((t3 - 2.0f * t2 + t) * dt), r);
+            r = XMVectorMultiplyAdd(v1, XMVectorReplicate(-2.0f * t3 + 3.0f * t2), r);
+            r = XMVectorMultiplyAdd(a1, XMVectorReplicate((t3 - t2) * dt), r);
+            return TrackTraits<Path>::Finish(r);
+        }
+    };
+
+    typedef XMVECTOR (*TrackEvaluator)(const AnimationSampler&, float);
+
+    // Indexed by [PathType][InterpolationType]
+    const TrackEvaluator sTrackEvaluators[3][3] =
+    {
+        { TrackKernel<AnimationChannel::TRANSLATION, AnimationSampler::LINEAR>::Evaluate,
+          TrackKernel<AnimationChannel::TRANSLATION, AnimationSampler::STEP>::Evaluate,
+          TrackKernel<AnimationChannel::TRANSLATION, AnimationSampler::CUBICSPLINE>::Evaluate },
+        { TrackKernel<AnimationChannel::ROTATION, AnimationSampler::LINEAR>::Evaluate,
+          TrackKernel<AnimationChannel::ROTATION, AnimationSampler::STEP>::Evaluate,
+          TrackKernel<AnimationChannel::ROTATION, AnimationSampler::CUBICSPLINE>::Evaluate },
+        { TrackKernel<AnimationChannel::SCALE, AnimationSampler::LINEAR>::Evaluate,
+          TrackKernel<AnimationChannel::SCALE, AnimationSampler::STEP>::Evaluate,
+          TrackKernel<AnimationChannel::SCALE, AnimationSampler::CUBICSPLINE>::Evaluate },
+    };
+
+    // Morph weights are plain scalars, one run of 'count' values per key (or per tangent/value triplet)
+    template <AnimationSampler::InterpolationType Interp>
+    void EvaluateWeights(const AnimationSampler& sampler, size_t targetCount, float time, float* out, size_t count)
+    {
+        size_t prevFrame, nextFrame;
+        float t;
+        sampler.FindKeys(time, prevFrame, nextFrame, t);
+
+        if constexpr (Interp == AnimationSampler::STEP)
+        {
+            const float* w = &sampler.scalar_values[prevFrame * targetCount];
+            for (size_t i = 0; i < count; ++i)
+                out[i] = w[i];
+        }
+        else if constexpr (Interp == AnimationSampler::LINEAR)
+        {
+            const float* w1 = &sampler.scalar_values[prevFrame * targetCount];
+            const float* w2 = &sampler.scalar_values[nextFrame * targetCount];
+            for (size_t i = 0; i < count; ++i)
+                out[i] = w1[i] + (w2[i] - w1[i]) * t;
+        }
+        else
+        {
+            const float dt = sampler.timestamps[nextFrame] - sampler.timestamps[prevFrame];
+            const float t2 = t * t;
+            const float t3 = t2 * t;
+            const float h00 = 2.0f * t3 - 3.0f * t2 + 1.0f;
+            const float h10 = (t3 - 2.0f * t2 + t) * dt;
+            const float h01 = -2.0f * t3 + 3.0f * t2;
+            const float h11 = (t3 - t2) * dt;
+            const float* v0 = &sampler.scalar_values[(prevFrame * 3 + 1) * targetCount];
+            const float* b0 = &sampler.scalar_values[(prevFrame * 3 + 2) * targetCount];
+            const float* a1 = &sampler.scalar_values[(nextFrame * 3 + 0) * targetCount];
+            const float* v1 = &sampler.scalar_values[(nextFrame * 3 + 1) * targetCount];
+            for (size_t i = 0; i < count; ++i)
+                out[i] = h00 * v0[i] + h10 * b0[i] + h01 * v1[i] + h11 * a1[i];
+        }
+    }
+}
+
+void Animation::SampleChannel(const AnimationChannel& channel, float time,
+                              DirectX::XMVECTOR& outScale, DirectX::XMVECTOR& outRot, DirectX::XMVECTOR& outTrans) const
+{
+    if (channel.path == AnimationChannel::WEIGHTS) return;
+
+    const AnimationSampler& sampler = m_samplers[channel.samplerIndex];
+    if (sampler.timestamps.empty()) return;
+
+    // Indexed by PathType
+    DirectX::XMVECTOR* const outputs[3] = { &outTrans, &outRot, &outScale };
+    *outputs[channel.path] = sTrackEvaluators[channel.path][sampler.interpolation](sampler, time);
+}
+
+bool Animation::SampleWeights(const AnimationChannel& channel, float time, float* outWeights, size_t count) const
+{
+    if (channel.path != AnimationChannel::WEIGHTS) return false;
+
+    const AnimationSampler& sampler = m_samplers[channel.samplerIndex];
+    if (sampler.timestamps.empty()) return false;
+
+    const size_t valuesPerKey = (sampler.interpolation == AnimationSampler::CUBICSPLINE) ? 3 : 1;
+    const size_t targetCount = sampler.scalar_values.size() / (sampler.timestamps.size() * valuesPerKey);
+    const size_t n = std::min(count, targetCount);
+
+    switch (sampler.interpolation)
+    {
+    case AnimationSampler::STEP:        EvaluateWeights<AnimationSampler::STEP>(sampler, targetCount, time, outWeights, n); break;
+    case AnimationSampler::CUBICSPLINE: EvaluateWeights<AnimationSampler::CUBICSPLINE>(sampler, targetCount, time, outWeights, n); break;
+    default:                            EvaluateWeights<AnimationSampler::LINEAR>(sampler, targetCount, time, outWeights, n); break;
+    }
+    return true;
+}
+
 float Animation::GetStartTime() const {
     // For simplicity, assuming start time is 0. A more robust implementation
     // would find the minimum timestamp across all samplers.
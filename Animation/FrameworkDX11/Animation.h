@@ -5,6 +5,7 @@
 #include <DirectXMath.h>
 #include "tiny_gltf.h" // For loading
 #include <map>
+#include <cstdint>
 
 // Represents a single animation curve (e.g., the translations for one bone).
 struct AnimationSampler
@@ -13,16 +14,22 @@ struct AnimationSampler
     InterpolationType interpolation = LINEAR;
     std::vector<float> timestamps;
        // Have separate vectors for each possible data type
+       // CUBICSPLINE samplers store (in-tangent, value, out-tangent) per key, so 3x as many values
     std::vector<DirectX::XMFLOAT3> vec3_values;
     std::vector<DirectX::XMFLOAT4> vec4_values;
+    std::vector<float> scalar_values; // morph weights, timestamps.size() * target count
+
+    // Finds the keyframes surrounding 'time' and the interpolation factor between them.
+    void FindKeys(float time, size_t& prevFrame, size_t& nextFrame, float& t) const;
 };
 
 // Connects an animation sampler to a specific joint.
 struct AnimationChannel
 {
-    enum PathType { TRANSLATION, ROTATION, SCALE };
+    enum PathType { TRANSLATION, ROTATION, SCALE, WEIGHTS };
     PathType path = TRANSLATION;
-    int jointIndex;       // The index of the joint in our skeleton to animate.
+    int jointIndex = -1;  // Explicit joint target for clips built in code, -1 to bind by nodeIndex.
+    int nodeIndex = -1;   // The glTF node the channel targets. Skeletons map it to their joints when binding the clip.
     int samplerIndex;     // The index of the sampler to use for keyframe data.
 };
 
@@ -31,16 +38,18 @@ class Animation
 {
 public:
     Animation() = default;
-    // Copy Constructor
-    Animation(const Animation& other)
-        : m_samplers(other.m_samplers), // This will call std::vector's copy constructor
-        m_channels(other.m_channels), // This will call std::vector's copy constructor
-        m_name(other.m_name)          // This will call std::string's copy constructor
-    {
-    }
 
-    // Loads the first animation from the glTF model.
-    bool LoadFromGltf(const tinygltf::Model& model, const std::map<int, int>& nodeToJointMap, const unsigned int animationIndex);
+    // Loads animation 'animationIndex' from the glTF model.
+    // The clip does not depend on any skin, so one copy can drive every skeleton of the file.
+    bool LoadFromGltf(const tinygltf::Model& model, const unsigned int animationIndex);
+
+    // Overwrites the component the channel animates (weights channels are ignored).
+    // Dispatches to a kernel specialised for the channel's path and the sampler's interpolation.
+    void SampleChannel(const AnimationChannel& channel, float time,
+                       DirectX::XMVECTOR& outScale, DirectX::XMVECTOR& outRot, DirectX::XMVECTOR& outTrans) const;
+
+    // Samples a WEIGHTS channel into outWeights (at most 'count' values). Returns false for other paths.
+    bool SampleWeights(const AnimationChannel& channel, float time, float* outWeights, size_t count) const;
 
     float GetStartTime() const;
     float GetEndTime() const;
@@ -49,4 +58,6 @@ public:
     std::vector<AnimationSampler> m_samplers;
     std::vector<AnimationChannel> m_channels;
     std::string m_name;
+    uint32_t m_nameId = UINT32_MAX; // interned by the AnimationLibrary
+    int m_sourceIndex = -1;         // glTF animation index it was loaded from, -1 for clips built in code
 };
\ No newline at end of file
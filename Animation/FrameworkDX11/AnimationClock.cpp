@@ -0,0 +1,40 @@
+#include "AnimationClock.h"
+
+#include <cmath>
+
+void AnimationClock::SetStepRate(double ticksPerSecond)
+{
+    if (ticksPerSecond < 10.0) ticksPerSecond = 10.0;
+    if (ticksPerSecond > 1000.0) ticksPerSecond = 1000.0;
+
+    // Keep the interpolation position when the rate changes at runtime
+    const double alpha = m_accumulator / m_step;
+    m_step = 1.0 / ticksPerSecond;
+    m_accumulator = alpha * m_step;
+}
+
+unsigned int AnimationClock::Advance(double frameDeltaSeconds)
+{
+    if (!(frameDeltaSeconds > 0.0))
+        return 0;
+
+    m_accumulator += frameDeltaSeconds;
+
+    unsigned int ticks = (unsigned int)std::floor(m_accumulator / m_step);
+    if (ticks > m_maxTicksPerFrame)
+    {
+        m_droppedTime += (ticks - m_maxTicksPerFrame) * m_step;
+        ticks = m_maxTicksPerFrame;
+    }
+
+    m_accumulator = std::fmod(m_accumulator, m_step);
+    m_tickCount += ticks;
+    return ticks;
+}
+
+void AnimationClock::Reset()
+{
+    m_accumulator = 0.0;
+    m_tickCount = 0;
+    m_droppedTime = 0.0;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+// Fixed-step clock for animation/simulation.
+// The frame delta is accumulated and consumed in whole steps, so the number of animation
+// ticks per second (and therefore their cost) does not depend on the render frame rate.
+// The remainder is exposed as an interpolation factor between the last two ticks.
+class AnimationClock
+{
+public:
+
+    AnimationClock(double stepSeconds = 1.0 / 60.0) { SetStepRate(1.0 / stepSeconds); }
+
+    // Ticks per second, clamped to [10, 1000]
+    void SetStepRate(double ticksPerSecond);
+    double GetStepRate() const { return 1.0 / m_step; }
+    float GetStep() const { return (float)m_step; }
+
+    // Adds a frame delta and returns how many fixed steps to run this frame.
+    // Never more than GetMaxTicksPerFrame(): after a long stall the excess time is dropped
+    // instead of being caught up, which would only make the next frame longer.
+    unsigned int Advance(double frameDeltaSeconds);
+
+    // Fraction of a step left in the accumulator, [0, 1).
+    // Blend factor between the last two ticks: 0 = previous tick, 1 = latest tick.
+    float GetAlpha() const { return (float)(m_accumulator / m_step); }
+
+    unsigned int GetMaxTicksPerFrame() const { return m_maxTicksPerFrame; }
+    void SetMaxTicksPerFrame(unsigned int maxTicks) { m_maxTicksPerFrame = maxTicks > 0 ? maxTicks : 1; }
+
+    unsigned long long GetTickCount() const { return m_tickCount; }
+    double GetDroppedTime() const { return m_droppedTime; }
+
+    void Reset();
+
+private:
+
+    double              m_step = 1.0 / 60.0;
+    double              m_accumulator = 0.0;
+    unsigned int        m_maxTicksPerFrame = 8;
+    unsigned long long  m_tickCount = 0;
+    double              m_droppedTime = 0.0;
+};
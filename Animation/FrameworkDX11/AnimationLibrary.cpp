@@ -0,0 +1,160 @@
+#include "AnimationLibrary.h"
+#include "utils.hpp"
+#include "log.hpp"
+
+namespace
+{
+    std::string MakeKey(const std::wstring& source, const std::string& clip)
+    {
+        return Utils::WstringToString(source) + "#" + clip;
+    }
+
+    // Clips loaded from glTF are keyed by their animation index (names are optional and need
+    // not be unique), clips built in code by their name. The prefixes keep the two apart.
+    std::string MakeClipKey(const std::wstring& source, int sourceIndex, const std::string& name)
+    {
+        return (sourceIndex >= 0) ? MakeKey(source, "i:" + std::to_string(sourceIndex)) : MakeKey(source, "n:" + name);
+    }
+}
+
+AnimationLibrary& AnimationLibrary::Get()
+{
+    static AnimationLibrary library;
+    return library;
+}
+
+size_t AnimationLibrary::GetKeyframeBytes(const Animation& clip)
+{
+    size_t bytes = 0;
+    for (const auto& sampler : clip.m_samplers)
+    {
+        bytes += sampler.timestamps.size() * sizeof(float);
+        bytes += sampler.vec3_values.size() * sizeof(DirectX::XMFLOAT3);
+        bytes += sampler.vec4_values.size() * sizeof(DirectX::XMFLOAT4);
+        bytes += sampler.scalar_values.size() * sizeof(float);
+    }
+    return bytes + clip.m_channels.size() * sizeof(AnimationChannel);
+}
+
+ClipNameId AnimationLibrary::Intern(const std::string& name)
+{
+    auto it = m_nameIds.find(name);
+    if (it != m_nameIds.end())
+        return it->second;
+
+    const ClipNameId id = (ClipNameId)m_names.size();
+    m_names.push_back(name);
+    m_clipsByName.emplace_back();
+    m_nameIds.emplace(name, id);
+    return id;
+}
+
+const std::string& AnimationLibrary::GetName(ClipNameId id) const
+{
+    static const std::string empty;
+    return (id < m_names.size()) ? m_names[id] : empty;
+}
+
+ClipHandle AnimationLibrary::Find(const std::string& name) const
+{
+    auto it = m_nameIds.find(name);
+    if (it == m_nameIds.end())
+        return nullptr;
+    return m_clipsByName[it->second].lock();
+}
+
+ClipHandle AnimationLibrary::Lookup(const std::string& key)
+{
+    auto it = m_clips.find(key);
+    if (it == m_clips.end())
+        return nullptr;
+
+    ClipHandle clip = it->second.clip.lock();
+    if (!clip)
+        m_clips.erase(it); // every holder released it
+    return clip;
+}
+
+ClipHandle AnimationLibrary::Share(const ClipHandle& clip)
+{
+    m_requests++;
+    m_sharedRequests++;
+    m_sharedBytes += GetKeyframeBytes(*clip);
+    return clip;
+}
+
+ClipHandle AnimationLibrary::FindOrInsert(const std::string& key, Animation&& clip)
+{
+    if (ClipHandle existing = Lookup(key))
+        return Share(existing);
+
+    m_requests++;
+    clip.m_nameId = Intern(clip.m_name);
+    ClipHandle handle = std::make_shared<const Animation>(std::move(clip));
+
+    Entry& entry = m_clips[key];
+    entry.clip = handle;
+    entry.name = handle->m_nameId;
+    m_clipsByName[handle->m_nameId] = handle;
+    return handle;
+}
+
+std::vector<ClipHandle> AnimationLibrary::LoadFromGltf(const tinygltf::Model& model, const std::wstring& source)
+{
+    std::vector<ClipHandle> clips;
+    clips.reserve(model.animations.size());
+
+    size_t loaded = 0;
+    for (unsigned int i = 0; i < (unsigned int)model.animations.size(); ++i)
+    {
+        const std::string key = source.empty() ?
+            MakeKey(L"", "anonymous" + std::to_string(m_anonymousCount++)) :
+            MakeClipKey(source, (int)i, model.animations[i].name);
+
+        if (ClipHandle existing = Lookup(key))
+        {
+            clips.push_back(Share(existing));
+            continue;
+        }
+
+        Animation clip;
+        if (!clip.LoadFromGltf(model, i))
+        {
+            Log::Warning(L"AnimationLibrary: failed to load animation %d of \"%s\"", i, source.c_str());
+            continue;
+        }
+        clips.push_back(FindOrInsert(key, std::move(clip)));
+        loaded++;
+    }
+
+    if (!clips.empty())
+        Log::Debug(L"AnimationLibrary: \"%s\" %d clip(s), %d loaded, %d shared",
+                   source.c_str(), clips.size(), loaded, clips.size() - loaded);
+
+    return clips;
+}
+
+ClipHandle AnimationLibrary::Add(Animation&& clip, const std::wstring& source)
+{
+    const std::string key = source.empty() ?
+        MakeKey(L"", "anonymous" + std::to_string(m_anonymousCount++)) :
+        MakeClipKey(source, clip.m_sourceIndex, clip.m_name);
+    return FindOrInsert(key, std::move(clip));
+}
+
+AnimationLibrary::Stats AnimationLibrary::GetStats() const
+{
+    Stats stats;
+    for (const auto& entry : m_clips)
+    {
+        ClipHandle clip = entry.second.clip.lock();
+        if (!clip)
+            continue;
+        stats.liveClips++;
+        stats.keyframeBytes += GetKeyframeBytes(*clip);
+    }
+    stats.requests = m_requests;
+    stats.sharedRequests = m_sharedRequests;
+    stats.sharedBytes = m_sharedBytes;
+    return stats;
+}
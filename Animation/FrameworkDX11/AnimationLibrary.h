@@ -0,0 +1,77 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include <cstdint>
+#include "tiny_gltf.h"
+
+#include "Animation.h"
+
+// Shared, immutable clip. Skeletons and scene graphs hold these instead of copies,
+// the clip is freed when the last holder lets go of it.
+using ClipHandle = std::shared_ptr<const Animation>;
+
+// Interned clip name, compares as an integer
+using ClipNameId = uint32_t;
+static const ClipNameId InvalidClipName = UINT32_MAX;
+
+// Owns every loaded animation clip once.
+// Clips are keyed by their source (file path) and animation index, so loading the same glTF
+// again, or binding its clips to more skeletons, returns the existing keyframes.
+class AnimationLibrary
+{
+public:
+
+    static AnimationLibrary& Get();
+
+    // Every animation of the model. 'source' identifies the file; an empty source never shares.
+    std::vector<ClipHandle> LoadFromGltf(const tinygltf::Model& model, const std::wstring& source);
+
+    // Takes over a clip. Clips added under the same source and name are shared, clips loaded
+    // from glTF with the same animation index, whichever way they were added.
+    ClipHandle Add(Animation&& clip, const std::wstring& source);
+
+    ClipNameId Intern(const std::string& name);
+    const std::string& GetName(ClipNameId id) const;
+
+    // Most recently added live clip with the name, or nullptr
+    ClipHandle Find(const std::string& name) const;
+
+    struct Stats
+    {
+        size_t liveClips = 0;
+        size_t keyframeBytes = 0;   // held by the live clips
+        size_t requests = 0;        // clips handed out since start
+        size_t sharedRequests = 0;  // ...of which were already loaded
+        size_t sharedBytes = 0;     // keyframe memory those would have duplicated
+    };
+    Stats GetStats() const;
+
+    static size_t GetKeyframeBytes(const Animation& clip);
+
+private:
+
+    AnimationLibrary() = default;
+
+    ClipHandle FindOrInsert(const std::string& key, Animation&& clip);
+    ClipHandle Lookup(const std::string& key);
+    ClipHandle Share(const ClipHandle& clip);
+
+    struct Entry
+    {
+        std::weak_ptr<const Animation>  clip;
+        ClipNameId                      name = InvalidClipName;
+    };
+
+    std::unordered_map<std::string, Entry>      m_clips;        // by source key
+    std::unordered_map<std::string, ClipNameId> m_nameIds;
+    std::vector<std::string>                    m_names;
+    std::vector<std::weak_ptr<const Animation>> m_clipsByName;  // latest clip of each name
+
+    size_t m_requests = 0;
+    size_t m_sharedRequests = 0;
+    size_t m_sharedBytes = 0;
+    size_t m_anonymousCount = 0;
+};
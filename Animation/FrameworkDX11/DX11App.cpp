@@ -75,16 +75,20 @@ HRESULT DX11App::initWindow(HINSTANCE hInstance, int nCmdShow)
 
 float DX11App::calculateDeltaTime()
 {
-    // Update our time
-    static float deltaTime = 0.0f;
-    static ULONGLONG timeStart = 0;
-    ULONGLONG timeCur = GetTickCount64();
-    if (timeStart == 0)
+    // Update our time (QueryPerformanceCounter, GetTickCount64 only has 10-16ms resolution)
+    static LARGE_INTEGER frequency = {};
+    static LARGE_INTEGER timeStart = {};
+    LARGE_INTEGER timeCur;
+    QueryPerformanceCounter(&timeCur);
+    if (frequency.QuadPart == 0)
+    {
+        QueryPerformanceFrequency(&frequency);
         timeStart = timeCur;
-    deltaTime = (timeCur - timeStart) / 1000.0f;
+    }
+    const double deltaTime = (double)(timeCur.QuadPart - timeStart.QuadPart) / (double)frequency.QuadPart;
     timeStart = timeCur;
 
-    return deltaTime;
+    return (float)deltaTime;
 }
 
 //--------------------------------------------------------------------------------------
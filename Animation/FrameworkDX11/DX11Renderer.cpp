@@ -1,5 +1,8 @@
 #include "DX11Renderer.h"
 #include "Scene.h"
+#include "benchmark.hpp"
+#include "log.hpp"
+#include "QuaternionInterp.h"
 
 #include "imgui/imgui.h"
 #include "imgui/imgui_impl_win32.h"
@@ -14,9 +17,19 @@ constexpr bool PBR_MODE = true;
 HRESULT DX11Renderer::init(HWND hwnd)
 {
     initDevice(hwnd);
+    m_stateCache.Init(m_pImmediateContext.Get());
+    m_commandExecutor.Init(&m_stateCache);
+    UINT streamStrides[VertexStreams::eStreamCount];
+    for (UINT stream = 0; stream < VertexStreams::eStreamCount; ++stream)
+        streamStrides[stream] = VertexStreams::GetStride((VertexStreams::Stream)stream);
+    if (!m_geometryPool.Init(m_pd3dDevice.Get(), m_pImmediateContext.Get(), streamStrides, VertexStreams::GetStreamCount(false)) ||
+        !m_skinnedGeometryPool.Init(m_pd3dDevice.Get(), m_pImmediateContext.Get(), streamStrides, VertexStreams::GetStreamCount(true)))
+        Log::Warning(L"No geometry pool, every primitive gets buffers of its own");
 
     m_pScene = new Scene;
     m_pScene->init(hwnd, m_pd3dDevice, m_pImmediateContext, this);
+    if (!m_deferredExecutor.Init(m_pd3dDevice.Get(), m_pImmediateContext.Get(), m_pScene->m_threadPool.GetThreadCount()))
+        Log::Warning(L"No deferred contexts, draws recorded in parallel run on the immediate context");
 
     RECT rc;
     GetClientRect(hwnd, &rc);
@@ -25,53 +38,72 @@ HRESULT DX11Renderer::init(HWND hwnd)
     constexpr float fovAngleY = XMConvertToRadians(60.0f);
     XMStoreFloat4x4(&m_matProjection, XMMatrixPerspectiveFovLH(fovAngleY, width / (FLOAT)height, 0.01f, 100.0f));
 
+    if (FAILED(initConstantBuffers()))
+        return E_FAIL;
+
     initIMGUI(hwnd);
     HRESULT hr;
-    // Compile the vertex shader
-    ID3DBlob* pVSBlob = nullptr;
-    if constexpr (PBR_MODE) 
-        hr = DX11Renderer::compileShaderFromFile(L"pbr_shader.hlsl", "VS", "vs_4_0", &pVSBlob);
-    else
-        hr = DX11Renderer::compileShaderFromFile(L"skinned_shader.hlsl", "VS", "vs_4_0", &pVSBlob);
-    
-
-    if (FAILED(hr))
+    // Compile a vertex shader per stream layout. The forward ones are required, without
+    // the depth-only ones there is just no depth prepass. Those come from pbr_shader.hlsl
+    // and share its ModelToClip(), which the depth EQUAL test of the forward pass relies
+    // on, so skinned_shader.hlsl goes without a prepass.
+    struct LayoutShader
     {
-        MessageBox(nullptr,
-            L"The FX file cannot be compiled.  Please run this executable from the directory that contains the FX file.", L"Error", MB_OK);
-        return hr;
-    }
-
-    // Create the vertex shader
-    hr = m_pd3dDevice->CreateVertexShader(pVSBlob->GetBufferPointer(), pVSBlob->GetBufferSize(), nullptr, &m_pVertexShader);
-    if (FAILED(hr))
+        const WCHAR*    file;
+        LPCSTR          entry;
+        bool            isRequired;
+    };
+    const WCHAR* forwardFile = PBR_MODE ? L"pbr_shader.hlsl" : L"skinned_shader.hlsl";
+    const WCHAR* depthFile = PBR_MODE ? L"pbr_shader.hlsl" : nullptr;
+    const LayoutShader layoutShaders[VertexStreams::eLayoutCount] =
     {
-        pVSBlob->Release();
-        return hr;
-    }
+        { forwardFile,  "VS_Static",        true  },    // eStaticLayout
+        { forwardFile,  "VS",               true  },    // eSkinnedLayout
+        { depthFile,    "VS_Depth",         false },    // eDepthLayout
+        { depthFile,    "VS_DepthSkinned",  false },    // eSkinnedDepthLayout
+    };
 
-    // Define the input layout
-    D3D11_INPUT_ELEMENT_DESC layout[] =
+    for (int l = 0; l < VertexStreams::eLayoutCount; ++l)
     {
-        { "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, D3D11_APPEND_ALIGNED_ELEMENT , D3D11_INPUT_PER_VERTEX_DATA, 0 },
-        { "NORMAL", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, D3D11_APPEND_ALIGNED_ELEMENT , D3D11_INPUT_PER_VERTEX_DATA, 0 },
-        { "TANGENT", 0, DXGI_FORMAT_R32G32B32A32_FLOAT, 0, D3D11_APPEND_ALIGNED_ELEMENT , D3D11_INPUT_PER_VERTEX_DATA, 0 },
-        { "TEXCOORD", 0, DXGI_FORMAT_R32G32_FLOAT, 0, D3D11_APPEND_ALIGNED_ELEMENT, D3D11_INPUT_PER_VERTEX_DATA, 0 },
-        { "BLENDINDICES", 0, DXGI_FORMAT_R32G32B32A32_UINT,  0, D3D11_APPEND_ALIGNED_ELEMENT, D3D11_INPUT_PER_VERTEX_DATA, 0 },
-        { "BLENDWEIGHT",  0, DXGI_FORMAT_R32G32B32A32_FLOAT, 0, D3D11_APPEND_ALIGNED_ELEMENT, D3D11_INPUT_PER_VERTEX_DATA, 0 }
-    };
+        const VertexStreams::Layout layoutType = (VertexStreams::Layout)l;
+        if (!layoutShaders[l].file)
+            continue;
 
-    UINT numElements = ARRAYSIZE(layout);
+        ID3DBlob* pVSBlob = nullptr;
+        hr = DX11Renderer::compileShaderFromFile(layoutShaders[l].file, layoutShaders[l].entry, "vs_4_0", &pVSBlob);
+        if (FAILED(hr))
+        {
+            if (!layoutShaders[l].isRequired)
+                continue;
+            MessageBox(nullptr,
+                L"The FX file cannot be compiled.  Please run this executable from the directory that contains the FX file.", L"Error", MB_OK);
+            return hr;
+        }
 
-    // Create the input layout
-    hr = m_pd3dDevice->CreateInputLayout(layout, numElements, pVSBlob->GetBufferPointer(),
-        pVSBlob->GetBufferSize(), &m_pVertexLayout);
-    pVSBlob->Release();
-    if (FAILED(hr))
-        return hr;
+        // Define the input layout
+        D3D11_INPUT_ELEMENT_DESC layout[VertexStreams::MaxInputElements + 1];
+        UINT numElements = (UINT)VertexStreams::GetInputLayout(layoutType, layout);
+        // The draw's start instance picks its entry of the material table's index stream
+        if (!VertexStreams::IsDepthOnly(layoutType))
+            layout[numElements++] = { "MATERIALINDEX", 0, DXGI_FORMAT_R32_UINT, MaterialIndexStreamSlot, 0, D3D11_INPUT_PER_INSTANCE_DATA, 1 };
+
+        // Create the vertex shader and its input layout
+        hr = m_pd3dDevice->CreateVertexShader(pVSBlob->GetBufferPointer(), pVSBlob->GetBufferSize(), nullptr, &m_vertexShaders[l]);
+        if (SUCCEEDED(hr))
+            hr = m_pd3dDevice->CreateInputLayout(layout, numElements, pVSBlob->GetBufferPointer(),
+                pVSBlob->GetBufferSize(), &m_vertexLayouts[l]);
+        pVSBlob->Release();
+        if (FAILED(hr))
+        {
+            m_vertexShaders[l].Reset();
+            m_vertexLayouts[l].Reset();
+            if (layoutShaders[l].isRequired)
+                return hr;
+        }
+    }
 
     // Set the input layout
-    m_pImmediateContext->IASetInputLayout(m_pVertexLayout.Get());
+    m_stateCache.IASetInputLayout(m_vertexLayouts[VertexStreams::eStaticLayout].Get());
 
     // Compile the pixel shader
     ID3DBlob* pPSBlob = nullptr;
@@ -95,6 +127,48 @@ HRESULT DX11Renderer::init(HWND hwnd)
     if (FAILED(hr))
         return hr;
 
+    // Instanced variants of the skinned and the static vertex shader. Optional: without them
+    // every instance is drawn on its own.
+    auto createInstanced = [&](LPCSTR entry, VertexStreams::Layout streamLayout,
+                               Microsoft::WRL::ComPtr<ID3D11VertexShader> &vertexShader,
+                               Microsoft::WRL::ComPtr<ID3D11InputLayout> &inputLayout)
+    {
+        ID3DBlob* pInstancedVSBlob = nullptr;
+        if (FAILED(DX11Renderer::compileShaderFromFile(L"pbr_shader.hlsl", entry, "vs_4_0", &pInstancedVSBlob)))
+            return false;
+
+        // InstanceData
+        const D3D11_INPUT_ELEMENT_DESC instanceElements[] =
+        {
+            { "INSTANCEWORLD", 0, DXGI_FORMAT_R32G32B32A32_FLOAT, 1, 0,  D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+            { "INSTANCEWORLD", 1, DXGI_FORMAT_R32G32B32A32_FLOAT, 1, 16, D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+            { "INSTANCEWORLD", 2, DXGI_FORMAT_R32G32B32A32_FLOAT, 1, 32, D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+            { "INSTANCEWORLD", 3, DXGI_FORMAT_R32G32B32A32_FLOAT, 1, 48, D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+            { "INSTANCEPALETTE", 0, DXGI_FORMAT_R32_UINT, 1, 64, D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+            { "INSTANCEMATERIAL", 0, DXGI_FORMAT_R32_UINT, 1, 68, D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+        };
+        D3D11_INPUT_ELEMENT_DESC instancedLayout[VertexStreams::MaxInputElements + ARRAYSIZE(instanceElements)];
+        UINT numElements = (UINT)VertexStreams::GetInputLayout(streamLayout, instancedLayout);
+        for (const D3D11_INPUT_ELEMENT_DESC &element : instanceElements)
+            instancedLayout[numElements++] = element;
+
+        const bool isCreated =
+            SUCCEEDED(m_pd3dDevice->CreateVertexShader(pInstancedVSBlob->GetBufferPointer(), pInstancedVSBlob->GetBufferSize(), nullptr, &vertexShader)) &&
+            SUCCEEDED(m_pd3dDevice->CreateInputLayout(instancedLayout, numElements, pInstancedVSBlob->GetBufferPointer(),
+                                                      pInstancedVSBlob->GetBufferSize(), &inputLayout));
+        pInstancedVSBlob->Release();
+        return isCreated;
+    };
+
+    if (!createInstanced("VS_Instanced", VertexStreams::eSkinnedLayout, m_pInstancedVertexShader, m_pInstancedVertexLayout) ||
+        !createInstanced("VS_InstancedStatic", VertexStreams::eStaticLayout, m_pStaticInstancedVertexShader, m_pStaticInstancedVertexLayout))
+    {
+        m_pInstancedVertexShader.Reset();
+        m_pInstancedVertexLayout.Reset();
+        m_pStaticInstancedVertexShader.Reset();
+        m_pStaticInstancedVertexLayout.Reset();
+    }
+
 
     return hr;
 }
@@ -286,6 +360,19 @@ HRESULT DX11Renderer::initDevice(HWND hwnd)
         return hr;
     }
 
+    // The default LESS would reject the forward pass where the depth prepass already wrote
+    D3D11_DEPTH_STENCIL_DESC descDSS = {};
+    descDSS.DepthEnable = TRUE;
+    descDSS.DepthWriteMask = D3D11_DEPTH_WRITE_MASK_ALL;
+    descDSS.DepthFunc = D3D11_COMPARISON_LESS_EQUAL;
+    hr = m_pd3dDevice->CreateDepthStencilState(&descDSS, &m_pDepthStencilState);
+    if (FAILED(hr))
+    {
+        MessageBox(nullptr,
+            L"Failed to create a depth / stencil state.", L"Error", MB_OK);
+        return hr;
+    }
+
     // Get the raw pointer.
     ID3D11RenderTargetView* rtv = m_pRenderTargetView.Get();
     m_pImmediateContext->OMSetRenderTargets(1, &rtv, m_pDepthStencilView.Get());
@@ -303,6 +390,63 @@ HRESULT DX11Renderer::initDevice(HWND hwnd)
     return S_OK;
 }
 
+HRESULT DX11Renderer::initConstantBuffers()
+{
+    D3D11_BUFFER_DESC bd = {};
+    bd.Usage = D3D11_USAGE_DEFAULT;
+    bd.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+    bd.CPUAccessFlags = 0;
+
+    bd.ByteWidth = sizeof(FrameConstants);
+    HRESULT hr = m_pd3dDevice->CreateBuffer(&bd, nullptr, &m_pFrameConstantBuffer);
+    if (FAILED(hr))
+        return hr;
+
+    bd.ByteWidth = sizeof(ViewConstants);
+    hr = m_pd3dDevice->CreateBuffer(&bd, nullptr, &m_pViewConstantBuffer);
+    if (FAILED(hr))
+        return hr;
+
+    // Optional, the scene graphs fall back to a buffer per node without it
+    m_constantRing.Init(m_pd3dDevice.Get(), m_pImmediateContext.Get(), 2 * 1024 * 1024);
+
+    // Forces the first upload
+    m_viewConstants.mProjection = XMMatrixSet(0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+    m_frameConstants.vOutputColor = XMFLOAT4(0, 0, 0, 0);
+    m_pImmediateContext->UpdateSubresource(m_pFrameConstantBuffer.Get(), 0, nullptr, &m_frameConstants, 0, 0);
+
+    return S_OK;
+}
+
+void DX11Renderer::updateFrameConstants()
+{
+    m_frameConstantBytes = 0;
+    m_constantRing.BeginFrame();
+
+    ViewConstants view;
+    view.mView = XMMatrixTranspose(m_pScene->m_pCamera->getViewMatrix());
+    view.mProjection = XMMatrixTranspose(XMLoadFloat4x4(&m_matProjection));
+    if (memcmp(&view, &m_viewConstants, sizeof(view)) != 0)
+    {
+        m_viewConstants = view;
+        m_pImmediateContext->UpdateSubresource(m_pViewConstantBuffer.Get(), 0, nullptr, &m_viewConstants, 0, 0);
+        m_frameConstantBytes += sizeof(ViewConstants);
+    }
+
+    ID3D11Buffer* frameCb = m_pFrameConstantBuffer.Get();
+    ID3D11Buffer* viewCb = m_pViewConstantBuffer.Get();
+    m_stateCache.VSSetConstantBuffer(FrameConstantsSlot, frameCb);
+    m_stateCache.PSSetConstantBuffer(FrameConstantsSlot, frameCb);
+    m_stateCache.VSSetConstantBuffer(ViewConstantsSlot, viewCb);
+
+    // Uploaded once, and again only after more materials were loaded
+    if (m_materialTable.Upload(m_pd3dDevice.Get(), m_pImmediateContext.Get()))
+    {
+        m_stateCache.PSSetConstantBuffer(MaterialConstantsSlot, m_materialTable.GetBuffer());
+        m_stateCache.IASetVertexBuffer(MaterialIndexStreamSlot, m_materialTable.GetIndexStream(), sizeof(uint32_t));
+    }
+}
+
 void DX11Renderer::cleanUp()
 {
     cleanupDevice();
@@ -328,6 +472,14 @@ void DX11Renderer::cleanupDevice()
     m_pImmediateContext->Flush();
 
     // no need to release DX assets as they are com pointers
+    m_constantRing.Destroy();
+    m_commandExecutor.Destroy();
+    m_deferredExecutor.Destroy();
+    m_stateCache.Destroy();
+    m_materialTable.Destroy();
+    // The scene is destroyed later, its primitives' handles are ignored by then
+    m_geometryPool.Destroy();
+    m_skinnedGeometryPool.Destroy();
 
     ID3D11Debug* debugDevice = nullptr;
     m_pd3dDevice->QueryInterface(__uuidof(ID3D11Debug), reinterpret_cast<void**>(&debugDevice));
@@ -517,6 +669,11 @@ void DX11Renderer::startIMGUIDraw(const unsigned int FPS)
     if (ImGui::CollapsingHeader("Animation Blending", ImGuiTreeNodeFlags_DefaultOpen))
     {
         ImGui::SliderFloat("Anim Speed", &m_pScene->m_foxAnimationSpeed, 0.0f, 1.0f);
+
+        int tickRate = (int)(m_pScene->m_animationClock.GetStepRate() + 0.5);
+        if (ImGui::SliderInt("Tick Rate (Hz)", &tickRate, 10, 240))
+            m_pScene->m_animationClock.SetStepRate(tickRate);
+        ImGui::Text("Ticks %u/s, %.3f ms/s", m_pScene->m_animTicksPerSecond, m_pScene->m_animCostMsPerSecond);
         ImGui::Text("Blend Control");
         ImGui::SliderFloat("Blend Ratio", &m_pScene->m_blendRatio, 0.0f, 1.0f, "%.2f");
 
@@ -552,6 +709,143 @@ void DX11Renderer::startIMGUIDraw(const unsigned int FPS)
         ImGui::BulletText("Anim B (%s): %d%%", nameB, pctB);
 
         ImGui::Separator();
+
+        int precision = (int)QuatInterp::GetPrecision();
+        if (ImGui::Combo("Rotation Interp", &precision, "Slerp\0Corrected nlerp\0Nlerp\0"))
+            QuatInterp::SetPrecision((RotationPrecision)precision);
+    }
+    if (ImGui::CollapsingHeader("Frame Stats"))
+    {
+        const SceneGraph::FrameStats& stats = m_pScene->m_frameStats;
+        ImGui::Text("Transforms updated: %zu", stats.transformsUpdated);
+        ImGui::Text("Object CB uploads: %zu (skipped %zu)", stats.cbUploads, stats.cbSkipped);
+        const ConstantRing::Stats& ringStats = m_constantRing.GetStats();
+        ImGui::Text("Constant bytes: %zu (%zu with one monolithic buffer), frame/view %zu",
+                    stats.cbBytes, stats.cbBytesMonolithic, m_frameConstantBytes);
+        if (m_constantRing.IsValid())
+            ImGui::Text("Constant ring: %zu allocations, %.1f/%.1f KB used, %zu failed",
+                        ringStats.allocations, ringStats.bytesUsed / 1024.0f, m_constantRing.GetSize() / 1024.0f, ringStats.failed);
+        else
+            ImGui::Text("Constant ring: unsupported, one buffer per node");
+        ImGui::Text("Primitives: %zu visible, %zu culled, %zu occluded",
+                    stats.primitivesVisible, stats.primitivesCulled, stats.primitivesOccluded);
+        ImGui::Text("Draw calls: %zu, state changes: %zu (saved %zu)",
+                    stats.drawCalls, stats.stateChanges, stats.stateChangesSaved);
+        ImGui::Text("Static batches: %zu draws for %zu primitives", stats.staticDraws, stats.staticPrimitives);
+        const MaterialTable::Stats& materialStats = m_materialTable.GetStats();
+        ImGui::Text("Materials: %zu table entries for %zu primitive materials, %zu uploads (%.1f KB)",
+                    m_materialTable.GetCount(), materialStats.requests, materialStats.uploads,
+                    materialStats.uploadBytes / 1024.0f);
+        const MeshCache::Stats meshStats = m_meshCache.GetStats();
+        ImGui::Text("Meshes: %zu live (%.1f KB), %zu/%zu requests shared (%zu by content), saved %.1f KB and %.1f ms",
+                    meshStats.liveMeshes, meshStats.geometryBytes / 1024.0f, meshStats.keyHits + meshStats.contentHits,
+                    meshStats.requests, meshStats.contentHits, meshStats.sharedBytes / 1024.0f, meshStats.savedMs);
+        ImGui::Text("Parallel recording: %zu streams%s", stats.parallelChunks,
+                    m_deferredExecutor.IsValid() ? " (deferred contexts)" : "");
+        const GeometryPool* geometryPools[] = { &m_geometryPool, &m_skinnedGeometryPool };
+        const char* geometryPoolNames[] = { "Static", "Skinned" };
+        for (size_t p = 0; p < ARRAYSIZE(geometryPools); ++p)
+        {
+            const GeometryPool::Stats geometryStats = geometryPools[p]->GetStats();
+            ImGui::Text("%s geometry pool: %zu ranges in %zu pages (%.1f MB, %u bytes/vertex), fragmentation %.0f%% vertices, %.0f%% indices",
+                        geometryPoolNames[p], geometryStats.ranges, geometryStats.pages, geometryStats.bufferBytes / (1024.0f * 1024.0f),
+                        geometryPools[p]->GetVertexSize(), geometryStats.vertexFragmentation * 100.0f, geometryStats.indexFragmentation * 100.0f);
+        }
+        if (ImGui::Button("Defragment Geometry"))
+        {
+            m_geometryPool.Defragment();
+            m_skinnedGeometryPool.Defragment();
+        }
+        const StateCache::Stats& bindStats = m_stateCache.GetLastFrameStats();
+        ImGui::Text("Bindings: %zu issued, %zu filtered as redundant", bindStats.totalIssued, bindStats.totalFiltered);
+        if (ImGui::TreeNode("Bindings by type"))
+        {
+            for (int b = 0; b < StateCache::eBindingCount; ++b)
+                ImGui::BulletText("%s: %zu issued, %zu filtered", StateCache::BindingToString((StateCache::Binding)b),
+                                  bindStats.issued[b], bindStats.filtered[b]);
+            ImGui::TreePop();
+        }
+        if (ImGui::Button("Dump Binding Stats"))
+            m_stateCache.DumpStats(L"binding_stats.json");
+
+        ImGui::Checkbox("Instanced Foxes", &m_pScene->m_foxInstancing);
+        ImGui::Text("Instances: %zu in %zu instanced draws%s", stats.instances, stats.instancedDraws,
+                    m_pInstancedVertexShader ? "" : " (instanced shader unavailable)");
+        ImGui::Checkbox("Depth Prepass", &m_pScene->m_depthPrepass);
+        ImGui::Text("Depth prepass: %zu draws, positions only%s", stats.depthDraws,
+                    m_vertexShaders[VertexStreams::eDepthLayout] ? "" : " (depth shader unavailable)");
+
+        const OcclusionCuller& occlusion = m_pScene->m_occlusionCuller;
+        ImGui::Checkbox("Occlusion Culling", &m_pScene->m_occlusionCulling);
+        ImGui::Text("Occluders: %zu (%zu triangles, %dx%d depth, %u threads)",
+                    occlusion.GetStats().occluders, occlusion.GetStats().triangles,
+                    occlusion.GetWidth(), occlusion.GetHeight(), m_pScene->m_threadPool.GetThreadCount());
+        if (ImGui::Button("Capture Command Streams"))
+        {
+            m_pScene->m_foxobject.GetLastCommands().Save(L"commands_fox.bin");
+            m_pScene->m_sceneobject.GetLastCommands().Save(L"commands_scene.bin");
+            m_pScene->m_armobject.GetLastCommands().Save(L"commands_arm.bin");
+            m_pScene->m_propobject.GetLastCommands().Save(L"commands_prop.bin");
+        }
+        if (ImGui::Button("Dump Occlusion Depth"))
+        {
+            occlusion.DumpDepth(L"occlusion_depth.png", 0);
+            occlusion.DumpDepth(L"occlusion_depth_hiz3.png", 3);
+        }
+    }
+    if (ImGui::CollapsingHeader("Benchmarks"))
+    {
+        Skeleton* sFox = m_pScene->m_foxobject.GetRootNode(0)->GetSkeleton();
+
+        if (ImGui::Button("Track Evaluation"))
+            Benchmark::RunTrackEvaluation(sFox->GetAnimations());
+        ImGui::SameLine();
+        if (ImGui::Button("Rotation Interpolation"))
+            Benchmark::RunRotationInterpolation(sFox->GetAnimations());
+        ImGui::SameLine();
+        if (ImGui::Button("Transforms"))
+            Benchmark::RunTransformHierarchy();
+        ImGui::SameLine();
+        if (ImGui::Button("Culling"))
+            Benchmark::RunFrustumCulling();
+        ImGui::SameLine();
+        if (ImGui::Button("BVH"))
+            Benchmark::RunBvh();
+        ImGui::SameLine();
+        if (ImGui::Button("Occlusion"))
+            Benchmark::RunOcclusionCulling();
+        ImGui::SameLine();
+        if (ImGui::Button("Render Queue"))
+            Benchmark::RunRenderQueue();
+        ImGui::SameLine();
+        if (ImGui::Button("Instancing"))
+            Benchmark::RunInstancing();
+        ImGui::SameLine();
+        if (ImGui::Button("Commands"))
+            Benchmark::RunCommandStream();
+        ImGui::SameLine();
+        if (ImGui::Button("Parallel Recording"))
+            Benchmark::RunParallelRecording();
+        ImGui::SameLine();
+        if (ImGui::Button("Static Batching"))
+            Benchmark::RunStaticBatching();
+        ImGui::SameLine();
+        if (ImGui::Button("Geometry Allocator"))
+            Benchmark::RunGeometryAllocator();
+        ImGui::SameLine();
+        if (ImGui::Button("Vertex Compression"))
+            Benchmark::RunVertexCompression();
+        ImGui::SameLine();
+        if (ImGui::Button("Clear"))
+            Benchmark::ClearReport();
+
+        const AnimationLibrary::Stats clipStats = AnimationLibrary::Get().GetStats();
+        ImGui::Text("Clips: %zu live, %.1f KB keyframes, %zu/%zu requests shared (%.1f KB)",
+                    clipStats.liveClips, clipStats.keyframeBytes / 1024.0f,
+                    clipStats.sharedRequests, clipStats.requests, clipStats.sharedBytes / 1024.0f);
+
+        for (const auto& line : Benchmark::GetReport())
+            ImGui::TextUnformatted(line.c_str());
     }
 }
 
@@ -587,9 +881,13 @@ void DX11Renderer::update(const float deltaTime)
     m_pImmediateContext->ClearDepthStencilView(m_pDepthStencilView.Get(), D3D11_CLEAR_DEPTH, 1.0f, 0);
 
 
-    m_pImmediateContext->VSSetShader(m_pVertexShader.Get(), nullptr, 0);
-    m_pImmediateContext->PSSetShader(m_pPixelShader.Get(), nullptr, 0);
+    m_pImmediateContext->OMSetDepthStencilState(m_pDepthStencilState.Get(), 0);
+
+    m_stateCache.BeginFrame();
+    m_stateCache.VSSetShader(m_vertexShaders[VertexStreams::eStaticLayout].Get());
+    m_stateCache.PSSetShader(m_pPixelShader.Get());
 
+    updateFrameConstants();
 
     m_pScene->update(deltaTime);
 
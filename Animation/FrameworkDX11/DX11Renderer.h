@@ -20,6 +20,12 @@
 #include "Camera.h"
 #include "wrl.h"
 #include "structures.h"
+#include "constant_ring.hpp"
+#include "d3d11_command_executor.hpp"
+#include "material_table.hpp"
+#include "geometry_pool.hpp"
+#include "vertex_streams.hpp"
+#include "mesh_cache.hpp"
 #include <vector>
 
 class Scene;
@@ -53,6 +59,8 @@ private: // methods
 	void	startIMGUIDraw(const unsigned int FPS);
 	void	completeIMGUIDraw();
 	void	CentreMouseInWindow(HWND hWnd);
+	HRESULT initConstantBuffers();
+	void	updateFrameConstants();
 
 
 public: // properties
@@ -68,13 +76,50 @@ public: // properties
 	Microsoft::WRL::ComPtr <ID3D11RenderTargetView> m_pRenderTargetView;
 	Microsoft::WRL::ComPtr <ID3D11Texture2D>		m_pDepthStencil;
 	Microsoft::WRL::ComPtr <ID3D11DepthStencilView> m_pDepthStencilView;
+	// LESS_EQUAL, so the forward pass still draws over its own depth prepass
+	Microsoft::WRL::ComPtr <ID3D11DepthStencilState> m_pDepthStencilState;
 
-	Microsoft::WRL::ComPtr <ID3D11VertexShader>		m_pVertexShader;
+	// Vertex shader and input layout per VertexStreams::Layout. The depth-only ones are
+	// null if they failed to build, there is no depth prepass then.
+	Microsoft::WRL::ComPtr <ID3D11VertexShader>		m_vertexShaders[VertexStreams::eLayoutCount];
+	Microsoft::WRL::ComPtr <ID3D11InputLayout>		m_vertexLayouts[VertexStreams::eLayoutCount];
 	Microsoft::WRL::ComPtr <ID3D11PixelShader>		m_pPixelShader;
-	Microsoft::WRL::ComPtr <ID3D11InputLayout>		m_pVertexLayout;
+
+	// Instanced draws (pbr_shader.hlsl VS_Instanced, VS_InstancedStatic), null if the shaders failed to build
+	Microsoft::WRL::ComPtr <ID3D11VertexShader>		m_pInstancedVertexShader;
+	Microsoft::WRL::ComPtr <ID3D11InputLayout>		m_pInstancedVertexLayout;
+	Microsoft::WRL::ComPtr <ID3D11VertexShader>		m_pStaticInstancedVertexShader;
+	Microsoft::WRL::ComPtr <ID3D11InputLayout>		m_pStaticInstancedVertexLayout;
 
 	XMFLOAT4X4				m_matProjection;
-	ConstantBuffer			m_ConstantBufferData;
+
+	// Frame and view constants, uploaded and bound once per frame by updateFrameConstants()
+	FrameConstants			m_frameConstants = {};
+	ViewConstants			m_viewConstants = {};
+	Microsoft::WRL::ComPtr <ID3D11Buffer>			m_pFrameConstantBuffer;
+	Microsoft::WRL::ComPtr <ID3D11Buffer>			m_pViewConstantBuffer;
+	size_t					m_frameConstantBytes = 0;	// uploaded this frame
+
+	// Object and skin constants, invalid if the device can't bind constant buffers with offsets
+	ConstantRing			m_constantRing;
+
+	// Materials of every loaded scene, draws refer to them by index
+	MaterialTable			m_materialTable;
+
+	// Vertex and index data of every scene primitive, suballocated from a few shared buffers:
+	// static meshes have position and attribute streams, skinned ones a skin stream too
+	GeometryPool			m_geometryPool;
+	GeometryPool			m_skinnedGeometryPool;
+	// Primitives loaded once and shared by every node and scene drawing the same mesh
+	MeshCache				m_meshCache;
+
+	// Bindings on the immediate context go through here, so repeated ones are dropped
+	StateCache				m_stateCache;
+
+	// Runs the scene graphs' command streams on the immediate context
+	D3D11CommandExecutor	m_commandExecutor;
+	// Plays draws recorded in parallel on deferred contexts, one per thread of the scene's pool
+	D3D11DeferredExecutor	m_deferredExecutor;
 
 
 	Scene* m_pScene;
@@ -0,0 +1,269 @@
+#include "MorphTargets.h"
+#include "gltf_utils.hpp"
+#include "log.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace DirectX;
+
+namespace
+{
+    // Reads a float VEC3 accessor into a dense array, honouring byteStride and sparse substitution.
+    // glTF allows morph target accessors without a bufferView (all zeros + sparse values).
+    bool ReadDenseVec3Accessor(const tinygltf::Model& model,
+                               int accessorIdx,
+                               size_t vertexCount,
+                               std::vector<XMFLOAT3>& out,
+                               const std::wstring& logPrefix)
+    {
+        if ((accessorIdx < 0) || (accessorIdx >= (int)model.accessors.size()))
+        {
+            Log::Error(L"%sInvalid morph target accessor index (%d/%d)!",
+                       logPrefix.c_str(), accessorIdx, model.accessors.size());
+            return false;
+        }
+
+        const auto& accessor = model.accessors[accessorIdx];
+        if ((accessor.componentType != TINYGLTF_COMPONENT_TYPE_FLOAT) ||
+            (accessor.type != TINYGLTF_TYPE_VEC3))
+        {
+            Log::Error(L"%sUnsupported morph target data type!", logPrefix.c_str());
+            return false;
+        }
+        if (accessor.count != vertexCount)
+        {
+            Log::Error(L"%sMorph target count (%d) is different from position count (%d)!",
+                       logPrefix.c_str(), accessor.count, vertexCount);
+            return false;
+        }
+
+        out.assign(vertexCount, XMFLOAT3(0.0f, 0.0f, 0.0f));
+
+        if (accessor.bufferView >= 0)
+        {
+            size_t stride;
+            const unsigned char* ptr = GltfUtils::GetBufferViewData(model, accessor.bufferView, accessor.byteOffset,
+                                                                    vertexCount, sizeof(XMFLOAT3), stride,
+                                                                    logPrefix.c_str(), L"morph target");
+            if (!ptr)
+                return false;
+
+            if (stride == sizeof(XMFLOAT3))
+                memcpy(out.data(), ptr, vertexCount * sizeof(XMFLOAT3));
+            else
+                for (size_t i = 0; i < vertexCount; ++i, ptr += stride)
+                    memcpy(&out[i], ptr, sizeof(XMFLOAT3));
+        }
+
+        return GltfUtils::IterateSparseValues(model, accessor, sizeof(XMFLOAT3),
+            [&](size_t vertex, const unsigned char* value) {
+                memcpy(&out[vertex], value, sizeof(XMFLOAT3));
+            },
+            logPrefix.c_str(), L"morph target");
+    }
+
+    inline bool IsZero(const XMFLOAT3& v)
+    {
+        return (v.x == 0.0f) && (v.y == 0.0f) && (v.z == 0.0f);
+    }
+}
+
+bool MorphTargetSet::LoadFromGltf(const tinygltf::Model& model,
+                                  const tinygltf::Primitive& primitive,
+                                  size_t vertexCount,
+                                  const std::wstring& logPrefix)
+{
+    Clear();
+
+    if (primitive.targets.empty())
+        return true;
+
+    const size_t targetCount = primitive.targets.size();
+    std::vector<std::vector<XMFLOAT3>> positions(targetCount);
+    std::vector<std::vector<XMFLOAT3>> normals(targetCount);
+
+    // Pass 1: dense read, so that we know which vertices are touched by any target
+    std::vector<uint8_t> touched(vertexCount, 0);
+    for (size_t t = 0; t < targetCount; ++t)
+    {
+        const auto& attrs = primitive.targets[t];
+
+        const auto posIt = attrs.find("POSITION");
+        if (posIt != attrs.end())
+            if (!ReadDenseVec3Accessor(model, posIt->second, vertexCount, positions[t], logPrefix))
+                return false;
+
+        const auto nrmIt = attrs.find("NORMAL");
+        if (nrmIt != attrs.end())
+        {
+            if (!ReadDenseVec3Accessor(model, nrmIt->second, vertexCount, normals[t], logPrefix))
+                return false;
+            m_hasNormals = true;
+        }
+
+        for (size_t v = 0; v < vertexCount; ++v)
+            if ((!positions[t].empty() && !IsZero(positions[t][v])) ||
+                (!normals[t].empty() && !IsZero(normals[t][v])))
+                touched[v] = 1;
+    }
+
+    std::vector<uint32_t> slotOfVertex(vertexCount, UINT32_MAX);
+    for (size_t v = 0; v < vertexCount; ++v)
+    {
+        if (!touched[v])
+            continue;
+        slotOfVertex[v] = (uint32_t)m_affectedVertices.size();
+        m_affectedVertices.push_back((uint32_t)v);
+    }
+
+    // Pass 2: keep only the non-zero deltas of every target
+    m_targets.resize(targetCount);
+    for (size_t t = 0; t < targetCount; ++t)
+    {
+        MorphTarget& target = m_targets[t];
+        const bool hasPos = !positions[t].empty();
+        const bool hasNrm = !normals[t].empty();
+
+        for (size_t v = 0; v < vertexCount; ++v)
+        {
+            const XMFLOAT3 dp = hasPos ? positions[t][v] : XMFLOAT3(0.0f, 0.0f, 0.0f);
+            const XMFLOAT3 dn = hasNrm ? normals[t][v] : XMFLOAT3(0.0f, 0.0f, 0.0f);
+            if (IsZero(dp) && IsZero(dn))
+                continue;
+
+            target.slots.push_back(slotOfVertex[v]);
+            target.dx.push_back(dp.x);
+            target.dy.push_back(dp.y);
+            target.dz.push_back(dp.z);
+            if (m_hasNormals)
+            {
+                target.nx.push_back(dn.x);
+                target.ny.push_back(dn.y);
+                target.nz.push_back(dn.z);
+            }
+        }
+    }
+
+    const size_t affected = m_affectedVertices.size();
+    m_accPosX.resize(affected);
+    m_accPosY.resize(affected);
+    m_accPosZ.resize(affected);
+    if (m_hasNormals)
+    {
+        m_accNrmX.resize(affected);
+        m_accNrmY.resize(affected);
+        m_accNrmZ.resize(affected);
+    }
+
+    Log::Debug(L"%sMorph targets: %d target(s), %d/%d vertices affected, %d deltas stored",
+               logPrefix.c_str(), targetCount, affected, vertexCount, GetDeltaCount());
+
+    return true;
+}
+
+size_t MorphTargetSet::GetDeltaCount() const
+{
+    size_t count = 0;
+    for (const auto& target : m_targets)
+        count += target.slots.size();
+    return count;
+}
+
+void MorphTargetSet::GetDeltaBounds(XMFLOAT3& outMin, XMFLOAT3& outMax) const
+{
+    outMin = XMFLOAT3(0.0f, 0.0f, 0.0f);
+    outMax = XMFLOAT3(0.0f, 0.0f, 0.0f);
+    for (const auto& target : m_targets)
+    {
+        if (target.slots.empty())
+            continue;
+        outMin.x += (std::min)(0.0f, *std::min_element(target.dx.begin(), target.dx.end()));
+        outMin.y += (std::min)(0.0f, *std::min_element(target.dy.begin(), target.dy.end()));
+        outMin.z += (std::min)(0.0f, *std::min_element(target.dz.begin(), target.dz.end()));
+        outMax.x += (std::max)(0.0f, *std::max_element(target.dx.begin(), target.dx.end()));
+        outMax.y += (std::max)(0.0f, *std::max_element(target.dy.begin(), target.dy.end()));
+        outMax.z += (std::max)(0.0f, *std::max_element(target.dz.begin(), target.dz.end()));
+    }
+}
+
+void MorphTargetSet::Clear()
+{
+    m_targets.clear();
+    m_affectedVertices.clear();
+    m_hasNormals = false;
+    m_accPosX.clear(); m_accPosY.clear(); m_accPosZ.clear();
+    m_accNrmX.clear(); m_accNrmY.clear(); m_accNrmZ.clear();
+}
+
+// acc[slots[i]] += weight * delta[i] for each component.
+// Slots within one target are unique, so a group of four never aliases.
+void MorphTargetSet::Accumulate(const uint32_t* slots,
+                                const float* x, const float* y, const float* z,
+                                size_t count, float weight,
+                                float* accX, float* accY, float* accZ)
+{
+    const XMVECTOR w = XMVectorReplicate(weight);
+
+    auto ScatterAdd4 = [&w](const uint32_t* s, const float* delta, float* acc)
+    {
+        XMVECTOR a = XMVectorSet(acc[s[0]], acc[s[1]], acc[s[2]], acc[s[3]]);
+        a = XMVectorMultiplyAdd(XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(delta)), w, a);
+        XMFLOAT4 r;
+        XMStoreFloat4(&r, a);
+        acc[s[0]] = r.x;
+        acc[s[1]] = r.y;
+        acc[s[2]] = r.z;
+        acc[s[3]] = r.w;
+    };
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        ScatterAdd4(slots + i, x + i, accX);
+        ScatterAdd4(slots + i, y + i, accY);
+        ScatterAdd4(slots + i, z + i, accZ);
+    }
+    for (; i < count; ++i)
+    {
+        accX[slots[i]] += weight * x[i];
+        accY[slots[i]] += weight * y[i];
+        accZ[slots[i]] += weight * z[i];
+    }
+}
+
+bool MorphTargetSet::Evaluate(const float* weights, size_t weightCount)
+{
+    const size_t affected = m_affectedVertices.size();
+    std::fill_n(m_accPosX.begin(), affected, 0.0f);
+    std::fill_n(m_accPosY.begin(), affected, 0.0f);
+    std::fill_n(m_accPosZ.begin(), affected, 0.0f);
+    if (m_hasNormals)
+    {
+        std::fill_n(m_accNrmX.begin(), affected, 0.0f);
+        std::fill_n(m_accNrmY.begin(), affected, 0.0f);
+        std::fill_n(m_accNrmZ.begin(), affected, 0.0f);
+    }
+
+    bool anyActive = false;
+    const size_t count = (std::min)(weightCount, m_targets.size());
+    for (size_t t = 0; t < count; ++t)
+    {
+        const float w = weights[t];
+        if (std::fabs(w) < 1e-6f)
+            continue; // inactive target - nothing to stream
+
+        const MorphTarget& target = m_targets[t];
+        if (target.slots.empty())
+            continue;
+
+        anyActive = true;
+        Accumulate(target.slots.data(), target.dx.data(), target.dy.data(), target.dz.data(),
+                   target.slots.size(), w, m_accPosX.data(), m_accPosY.data(), m_accPosZ.data());
+        if (target.HasNormals())
+            Accumulate(target.slots.data(), target.nx.data(), target.ny.data(), target.nz.data(),
+                       target.slots.size(), w, m_accNrmX.data(), m_accNrmY.data(), m_accNrmZ.data());
+    }
+
+    return anyActive;
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <DirectXMath.h>
+#include "tiny_gltf.h"
+
+// A single blend shape. Only the vertices the target actually displaces are kept,
+// stored as structure-of-arrays so the evaluator can stream four deltas at a time.
+struct MorphTarget
+{
+    // Slot of each delta in the set's affected-vertex list (not the raw vertex index).
+    std::vector<uint32_t> slots;
+
+    std::vector<float> dx, dy, dz;   // position deltas
+    std::vector<float> nx, ny, nz;   // normal deltas, empty if the target has no NORMAL
+
+    bool HasNormals() const { return !nx.empty(); }
+};
+
+// All the morph targets of one primitive, plus the accumulators the CPU evaluator writes into.
+class MorphTargetSet
+{
+public:
+
+    // Reads primitive.targets. Deltas that are zero for every component are dropped.
+    bool LoadFromGltf(const tinygltf::Model& model,
+                      const tinygltf::Primitive& primitive,
+                      size_t vertexCount,
+                      const std::wstring& logPrefix);
+
+    // Accumulates weights[i] * target[i] into the delta buffers. Targets with a zero weight are skipped.
+    // Returns false if every weight is zero (no delta to apply).
+    bool Evaluate(const float* weights, size_t weightCount);
+
+    bool IsEmpty() const { return m_targets.empty(); }
+    size_t GetTargetCount() const { return m_targets.size(); }
+    size_t GetAffectedCount() const { return m_affectedVertices.size(); }
+    size_t GetDeltaCount() const;
+
+    // Largest displacement all targets together can add, per axis, with weights in [0, 1]
+    void GetDeltaBounds(DirectX::XMFLOAT3& outMin, DirectX::XMFLOAT3& outMax) const;
+
+    // Vertex indices touched by at least one target, sorted ascending.
+    const std::vector<uint32_t>& GetAffectedVertices() const { return m_affectedVertices; }
+
+    // Results of the last Evaluate(), one entry per affected vertex.
+    const float* GetPositionDeltaX() const { return m_accPosX.data(); }
+    const float* GetPositionDeltaY() const { return m_accPosY.data(); }
+    const float* GetPositionDeltaZ() const { return m_accPosZ.data(); }
+    const float* GetNormalDeltaX() const { return m_accNrmX.data(); }
+    const float* GetNormalDeltaY() const { return m_accNrmY.data(); }
+    const float* GetNormalDeltaZ() const { return m_accNrmZ.data(); }
+    bool HasNormalDeltas() const { return m_hasNormals; }
+
+    void Clear();
+
+private:
+
+    static void Accumulate(const uint32_t* slots,
+                           const float* x, const float* y, const float* z,
+                           size_t count, float weight,
+                           float* accX, float* accY, float* accZ);
+
+    std::vector<MorphTarget>    m_targets;
+    std::vector<uint32_t>       m_affectedVertices;
+    bool                        m_hasNormals = false;
+
+    std::vector<float>          m_accPosX, m_accPosY, m_accPosZ;
+    std::vector<float>          m_accNrmX, m_accNrmY, m_accNrmZ;
+};
@@ -0,0 +1,149 @@
+#include "QuaternionInterp.h"
+
+#include <cmath>
+
+using namespace DirectX;
+
+namespace
+{
+    RotationPrecision sPrecision = RotationPrecision::Slerp;
+
+    // Adjusts t so that nlerp follows slerp's constant angular velocity more closely.
+    // The coefficients are a least squares fit over |cos(angle)| in [0, 1].
+    inline float CorrectT(float t, float absCos)
+    {
+        const float a = 1.0904f + absCos * (-3.2452f + absCos * (3.55645f - absCos * 1.43519f));
+        const float b = 0.848013f + absCos * (-1.06021f + absCos * 0.215638f);
+        const float k = a * (t - 0.5f) * (t - 0.5f) + b;
+        return t + t * (t - 0.5f) * (t - 1.0f) * k;
+    }
+
+    // Same as CorrectT, four lanes at a time
+    inline XMVECTOR XM_CALLCONV CorrectT4(FXMVECTOR t, FXMVECTOR absCos)
+    {
+        const XMVECTOR half = XMVectorReplicate(0.5f);
+        const XMVECTOR one = XMVectorReplicate(1.0f);
+
+        XMVECTOR a = XMVectorMultiplyAdd(absCos, XMVectorReplicate(-1.43519f), XMVectorReplicate(3.55645f));
+        a = XMVectorMultiplyAdd(absCos, a, XMVectorReplicate(-3.2452f));
+        a = XMVectorMultiplyAdd(absCos, a, XMVectorReplicate(1.0904f));
+        XMVECTOR b = XMVectorMultiplyAdd(absCos, XMVectorReplicate(0.215638f), XMVectorReplicate(-1.06021f));
+        b = XMVectorMultiplyAdd(absCos, b, XMVectorReplicate(0.848013f));
+
+        const XMVECTOR tMinusHalf = XMVectorSubtract(t, half);
+        const XMVECTOR k = XMVectorMultiplyAdd(XMVectorMultiply(a, tMinusHalf), tMinusHalf, b);
+        const XMVECTOR poly = XMVectorMultiply(XMVectorMultiply(t, tMinusHalf), XMVectorSubtract(t, one));
+        return XMVectorMultiplyAdd(poly, k, t);
+    }
+}
+
+void QuatInterp::SetPrecision(RotationPrecision precision)
+{
+    sPrecision = precision;
+}
+
+RotationPrecision QuatInterp::GetPrecision()
+{
+    return sPrecision;
+}
+
+const char* QuatInterp::PrecisionToString(RotationPrecision precision)
+{
+    switch (precision)
+    {
+    case RotationPrecision::Slerp:          return "slerp";
+    case RotationPrecision::CorrectedNlerp: return "corrected nlerp";
+    case RotationPrecision::Nlerp:          return "nlerp";
+    default:                                return "unknown";
+    }
+}
+
+XMVECTOR XM_CALLCONV QuatInterp::Interpolate(FXMVECTOR a, FXMVECTOR b, float t, RotationPrecision precision)
+{
+    const XMVECTOR dot = XMVector4Dot(a, b);
+    const float cosAngle = XMVectorGetX(dot);
+
+    if (precision == RotationPrecision::Slerp)
+    {
+        const XMVECTOR bShortest = (cosAngle < 0.0f) ? XMVectorNegate(b) : b;
+        return XMQuaternionSlerp(a, bShortest, t);
+    }
+
+    if (precision == RotationPrecision::CorrectedNlerp)
+        t = CorrectT(t, fabsf(cosAngle));
+
+    const float tb = (cosAngle < 0.0f) ? -t : t;
+    const XMVECTOR r = XMVectorMultiplyAdd(b, XMVectorReplicate(tb), XMVectorScale(a, 1.0f - t));
+    return XMQuaternionNormalize(r);
+}
+
+void QuatInterp::InterpolateN(const XMFLOAT4* a, const XMFLOAT4* b, float t,
+                              XMFLOAT4* out, size_t count, RotationPrecision precision)
+{
+    size_t i = 0;
+
+    if (precision != RotationPrecision::Slerp)
+    {
+        const XMVECTOR zero = XMVectorZero();
+        const XMVECTOR one = XMVectorReplicate(1.0f);
+        const XMVECTOR tv = XMVectorReplicate(t);
+
+        for (; i + 4 <= count; i += 4)
+        {
+            // Transpose to structure-of-arrays: rows hold x, y, z, w of the four quaternions
+            const XMMATRIX qa = XMMatrixTranspose(XMMATRIX(XMLoadFloat4(&a[i + 0]), XMLoadFloat4(&a[i + 1]),
+                                                           XMLoadFloat4(&a[i + 2]), XMLoadFloat4(&a[i + 3])));
+            const XMMATRIX qb = XMMatrixTranspose(XMMATRIX(XMLoadFloat4(&b[i + 0]), XMLoadFloat4(&b[i + 1]),
+                                                           XMLoadFloat4(&b[i + 2]), XMLoadFloat4(&b[i + 3])));
+
+            XMVECTOR dot = XMVectorMultiply(qa.r[0], qb.r[0]);
+            dot = XMVectorMultiplyAdd(qa.r[1], qb.r[1], dot);
+            dot = XMVectorMultiplyAdd(qa.r[2], qb.r[2], dot);
+            dot = XMVectorMultiplyAdd(qa.r[3], qb.r[3], dot);
+
+            const XMVECTOR t4 = (precision == RotationPrecision::CorrectedNlerp)
+                ? CorrectT4(tv, XMVectorAbs(dot))
+                : tv;
+
+            // Shortest path: flip b's weight where the quaternions are in opposite hemispheres
+            const XMVECTOR wa = XMVectorSubtract(one, t4);
+            const XMVECTOR wb = XMVectorSelect(t4, XMVectorNegate(t4), XMVectorLess(dot, zero));
+
+            XMMATRIX r;
+            r.r[0] = XMVectorMultiplyAdd(qb.r[0], wb, XMVectorMultiply(qa.r[0], wa));
+            r.r[1] = XMVectorMultiplyAdd(qb.r[1], wb, XMVectorMultiply(qa.r[1], wa));
+            r.r[2] = XMVectorMultiplyAdd(qb.r[2], wb, XMVectorMultiply(qa.r[2], wa));
+            r.r[3] = XMVectorMultiplyAdd(qb.r[3], wb, XMVectorMultiply(qa.r[3], wa));
+
+            XMVECTOR lenSq = XMVectorMultiply(r.r[0], r.r[0]);
+            lenSq = XMVectorMultiplyAdd(r.r[1], r.r[1], lenSq);
+            lenSq = XMVectorMultiplyAdd(r.r[2], r.r[2], lenSq);
+            lenSq = XMVectorMultiplyAdd(r.r[3], r.r[3], lenSq);
+            const XMVECTOR invLen = XMVectorReciprocalSqrt(lenSq);
+
+            r.r[0] = XMVectorMultiply(r.r[0], invLen);
+            r.r[1] = XMVectorMultiply(r.r[1], invLen);
+            r.r[2] = XMVectorMultiply(r.r[2], invLen);
+            r.r[3] = XMVectorMultiply(r.r[3], invLen);
+
+            r = XMMatrixTranspose(r);
+            XMStoreFloat4(&out[i + 0], r.r[0]);
+            XMStoreFloat4(&out[i + 1], r.r[1]);
+            XMStoreFloat4(&out[i + 2], r.r[2]);
+            XMStoreFloat4(&out[i + 3], r.r[3]);
+        }
+    }
+
+    for (; i < count; ++i)
+        XMStoreFloat4(&out[i], Interpolate(XMLoadFloat4(&a[i]), XMLoadFloat4(&b[i]), t, precision));
+}
+
+float QuatInterp::AngularDistance(FXMVECTOR a, FXMVECTOR b)
+{
+    // acos of the dot product can't resolve angles below a few hundredths of a degree in
+    // float; the chord lengths between the 4D points keep full precision
+    const XMVECTOR bNear = (XMVectorGetX(XMVector4Dot(a, b)) < 0.0f) ? XMVectorNegate(b) : b;
+    const float chord = XMVectorGetX(XMVector4Length(XMVectorSubtract(a, bNear)));
+    const float opposite = XMVectorGetX(XMVector4Length(XMVectorAdd(a, bNear)));
+    return 4.0f * atan2f(chord, opposite);
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <DirectXMath.h>
+
+// Precision tiers for rotation interpolation, from exact to fastest.
+enum class RotationPrecision
+{
+    Slerp,          // exact, trig per call
+    CorrectedNlerp, // nlerp with a polynomial-adjusted t (max error well below a tenth of a degree)
+    Nlerp,          // normalised lerp, error grows with the angle between the inputs
+};
+
+namespace QuatInterp
+{
+    // Process-wide tier used by the track evaluators and the skeleton blend
+    void SetPrecision(RotationPrecision precision);
+    RotationPrecision GetPrecision();
+    const char* PrecisionToString(RotationPrecision precision);
+
+    // Shortest-path interpolation from a to b; the result is normalised.
+    DirectX::XMVECTOR XM_CALLCONV Interpolate(DirectX::FXMVECTOR a, DirectX::FXMVECTOR b, float t,
+                                              RotationPrecision precision);
+
+    // out[i] = Interpolate(a[i], b[i], t). The nlerp tiers run four quaternions per SIMD step.
+    void InterpolateN(const DirectX::XMFLOAT4* a, const DirectX::XMFLOAT4* b, float t,
+                      DirectX::XMFLOAT4* out, size_t count, RotationPrecision precision);
+
+    // Angle in radians between the rotations two unit quaternions represent
+    float AngularDistance(DirectX::FXMVECTOR a, DirectX::FXMVECTOR b);
+}
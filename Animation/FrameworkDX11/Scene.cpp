@@ -1,5 +1,7 @@
 #include "Scene.h"
+#include "DX11Renderer.h"
 #include "DDSTextureLoader.h"
+#include "benchmark.hpp"
 
 DirectX::XMFLOAT3 BakeTranslationOntoBindPose(const DirectX::XMMATRIX& bindPose, const DirectX::XMFLOAT3& animTranslation);
 DirectX::XMFLOAT4 BakeRotationOntoBindPose(const DirectX::XMMATRIX& bindPose, const DirectX::XMFLOAT3& axis, float angleRadians);
@@ -17,6 +19,8 @@ HRESULT Scene::init(HWND hwnd, const Microsoft::WRL::ComPtr<ID3D11Device>& devic
     HRESULT hr;
 
     m_ctx.Init(device.Get(), context.Get(), renderer);
+    m_ctx.SetCommandExecutor(&renderer->m_commandExecutor);
+    m_ctx.SetParallelSubmit(&m_threadPool, &renderer->m_deferredExecutor);
     //bool ok = m_sceneobject.LoadSphere(m_ctx);
     //bool ok = m_sceneobject.LoadGLTF(m_ctx, L"Resources\\sphere.gltf");
     //bool ok = m_sceneobject.LoadGLTF(m_ctx, L"Resources\\FlightHelmet.gltf");
@@ -25,47 +29,47 @@ HRESULT Scene::init(HWND hwnd, const Microsoft::WRL::ComPtr<ID3D11Device>& devic
 
     m_sceneobject.GetRootNode(0)->AddTranslation({ -3.0f, 0.0f, 0.0f });
 
+    // Nothing plays on the prop, so everything but its skinned parts can be batched
+    if (m_propobject.LoadGLTFWithSkeleton(m_ctx, L"Resources\\scene.gltf"))
+    {
+        m_propobject.GetRootNode(0)->AddTranslation({ 3.0f, 0.0f, 0.0f });
+        if (m_staticBatching)
+            m_propobject.BuildStaticBatches(m_ctx);
+    }
+
     Skeleton* s = m_sceneobject.GetRootNode(0)->GetSkeleton();
     CreateWaveAnimation(s);
 
-    //skeleton Hierarchy
+    //arm hierarchy - each segment is a node parented to the previous one
     const float segmentLength = 2.0f;
 
-    DirectX::XMFLOAT4X4 shoulderTransform;
-
-    DirectX::XMStoreFloat4x4(&shoulderTransform, DirectX::XMMatrixIdentity());
-    int shoulderIndex = m_robotArmSkeleton.AddJoint(-1, shoulderTransform);
-
     //scale elbow and hand nodes
     DirectX::XMMATRIX scale = DirectX::XMMatrixScaling(0.75, 0.75, 0.75);
+    DirectX::XMMATRIX translation = DirectX::XMMatrixTranslation(0.0f, segmentLength, 0.0f);
+
+    SceneNode* shoulderNode = m_armobject.CreateRootNode();
+    shoulderNode->LoadCube(m_ctx);
+    shoulderNode->SetNodeIdx(0);
+    m_armSegmentNodes.push_back(shoulderNode);
 
     //elbow is child of the shoulder
-    DirectX::XMFLOAT4X4 elbowTransform;
-    DirectX::XMStoreFloat4x4(&elbowTransform, scale * DirectX::XMMatrixTranslation(0.0f, segmentLength, 0.0f));
-    int elbowIndex = m_robotArmSkeleton.AddJoint(shoulderIndex, elbowTransform);
+    SceneNode* elbowNode = shoulderNode->CreateChildNode();
+    elbowNode->LoadCube(m_ctx);
+    elbowNode->SetMatrix(scale * translation);
+    elbowNode->SetNodeIdx(1);
+    m_armSegmentNodes.push_back(elbowNode);
 
     //hand is child of the elbow
-    DirectX::XMFLOAT4X4 handTransform;
-    DirectX::XMMATRIX translation = DirectX::XMMatrixTranslation(0.0f,segmentLength, 0.0f);
-
-    DirectX::XMStoreFloat4x4(&handTransform, scale * translation);
-    int handIndex = m_robotArmSkeleton.AddJoint(elbowIndex, handTransform);
+    SceneNode* handNode = elbowNode->CreateChildNode();
+    handNode->LoadCube(m_ctx);
+    handNode->SetMatrix(scale * translation);
+    handNode->SetNodeIdx(2);
+    m_armSegmentNodes.push_back(handNode);
 
-    for (int i = 0; i < m_robotArmSkeleton.GetBoneCount(); ++i) {
-        m_armobject.CreateRootNode();
-    }
-
-    for (int i = 0; i < m_robotArmSkeleton.GetBoneCount(); ++i) {
-        SceneNode* segmentNode = m_armobject.GetRootNode(i);
-        segmentNode->LoadCube(m_ctx);
-        segmentNode->AddTranslation({ i * 2.0f, 0, 0 });
-        m_armSegmentNodes.push_back(segmentNode);
-    }
-
-    Animation anim = CreateWaveArmAnimation();
-    m_robotArmAnimations.push_back(&anim);
+    m_armobject.AddNodeAnimation(CreateWaveArmAnimation());
 
-    m_robotArmSkeleton.AddAnimation(&anim);
+    for (SceneNode* segment : m_armSegmentNodes)
+        segment->SetOccluder(true);
 
 
 
@@ -76,7 +80,7 @@ HRESULT Scene::init(HWND hwnd, const Microsoft::WRL::ComPtr<ID3D11Device>& devic
     // Create the constant buffer
     D3D11_BUFFER_DESC bd = {};
     bd.Usage = D3D11_USAGE_DEFAULT;
-    bd.ByteWidth = sizeof(ConstantBuffer);
+    bd.ByteWidth = sizeof(ObjectConstants);
     bd.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
     bd.CPUAccessFlags = 0;
     hr = m_pd3dDevice->CreateBuffer(&bd, nullptr, &m_pConstantBuffer);
@@ -139,10 +143,34 @@ void Scene::setupLightProperties()
     m_lightProperties.Lights[0] = light;
 }
 
+void Scene::tickAnimation(const float stepTime)
+{
+    Skeleton* sFox = m_foxobject.GetRootNode(0)->GetSkeleton();
+    if (sFox)
+    {
+        sFox->SetBlend(m_blendAnimA, m_blendAnimB, m_blendRatio);
+        sFox->SetPlaybackSpeed(m_foxAnimationSpeed);
+    }
+
+    m_foxobject.TickAnimation(stepTime);
+    m_sceneobject.TickAnimation(stepTime);
+    m_armobject.TickAnimation(stepTime);
+    m_propobject.TickAnimation(stepTime);
+
+    //moving fox in circle
+    m_prevFoxAngle = m_foxAngle;
+    m_foxAngle += m_moveSpeed * stepTime;
+    if (m_foxAngle > DirectX::XM_2PI)
+    {
+        // wrap both, so the interpolation between them stays continuous
+        m_foxAngle -= DirectX::XM_2PI;
+        m_prevFoxAngle -= DirectX::XM_2PI;
+    }
+}
+
 void Scene::update(const float deltaTime)
 {
     Skeleton* s = m_sceneobject.GetRootNode(0)->GetSkeleton();
-    Skeleton* sFox = m_foxobject.GetRootNode(0)->GetSkeleton();
 
     static bool doOnce = true;
     if (doOnce)
@@ -151,45 +179,67 @@ void Scene::update(const float deltaTime)
         if (s->CurrentAnimation()) {
             s->PlayAnimation(s->CurrentAnimation());
         }
-        if (m_robotArmSkeleton.GetAnimationCount() > 0) {
-            m_robotArmSkeleton.PlayAnimation(static_cast<unsigned int>(0));
+        if (m_armobject.GetNodeAnimationCount() > 0) {
+            m_armobject.PlayNodeAnimation(0);
         }
     }
-    s->Update(deltaTime);
-    m_robotArmSkeleton.Update(deltaTime);
 
-    for (int i = 0; i < m_robotArmSkeleton.GetBoneCount(); ++i)
+    // Animation runs at a fixed rate, independent of the frame rate.
+    // Rendering interpolates between the last two ticks.
+    const unsigned int ticks = m_animationClock.Advance(deltaTime);
+    const float step = m_animationClock.GetStep();
+
+    Benchmark::Timer tickTimer;
+    for (unsigned int i = 0; i < ticks; ++i)
+        tickAnimation(step);
+
+    const float alpha = m_animationClock.GetAlpha();
+    m_foxobject.InterpolateAnimation(alpha);
+    m_sceneobject.InterpolateAnimation(alpha);
+    m_armobject.InterpolateAnimation(alpha);
+    m_propobject.InterpolateAnimation(alpha);
+
+    m_animStatsCostMs += tickTimer.ElapsedMs();
+    m_animStatsTicks += ticks;
+    m_animStatsTimer += deltaTime;
+    if (m_animStatsTimer >= 1.0f)
     {
-        DirectX::XMFLOAT4X4 boneTransform = m_robotArmSkeleton.GetJoint(i)->finalTransform;
-        DirectX::XMMATRIX matrix = DirectX::XMLoadFloat4x4(&boneTransform);
-
-        if (m_armobject.GetRootNode(i))
-        {
-            m_armobject.GetRootNode(i)->SetMatrix(matrix);
-        }
+        m_animTicksPerSecond = (unsigned int)(m_animStatsTicks / m_animStatsTimer);
+        m_animCostMsPerSecond = (float)(m_animStatsCostMs / m_animStatsTimer);
+        m_animStatsTimer = 0.0f;
+        m_animStatsTicks = 0;
+        m_animStatsCostMs = 0.0;
     }
-    
-    static int lastPlayedIndex = -1;
 
-    if (sFox)
+    // Occluders are rasterised before anything is drawn, every graph then tests its
+    // primitives against the result
+    const OcclusionCuller* occlusionCuller = nullptr;
+    if (m_occlusionCulling)
     {
-        sFox->SetBlend(m_blendAnimA, m_blendAnimB, m_blendRatio);
-        sFox->Update(deltaTime * m_foxAnimationSpeed);
+        m_occlusionCuller.BeginFrame(getCamera()->getViewMatrix() * XMLoadFloat4x4(&m_ctx.getDXRenderer()->m_matProjection));
+        m_armobject.AddOccluders(m_occlusionCuller);
+        m_sceneobject.AddOccluders(m_occlusionCuller);
+        m_occlusionCuller.Render(&m_threadPool);
+        occlusionCuller = &m_occlusionCuller;
+    }
+    for (SceneGraph* graph : { &m_foxobject, &m_sceneobject, &m_armobject, &m_propobject })
+    {
+        graph->SetOcclusionCuller(occlusionCuller);
+        graph->SetDepthPrepass(m_depthPrepass);
     }
 
-
-
-	//moving fox in circle
-    static float currentAngle = 0.0f;
 	float radius = 5.0f;
-
-    currentAngle += m_moveSpeed * deltaTime;
-    if (currentAngle > DirectX::XM_2PI) currentAngle -= DirectX::XM_2PI;
+    const float currentAngle = m_prevFoxAngle + (m_foxAngle - m_prevFoxAngle) * alpha;
 
     float angleSpacing = DirectX::XM_2PI / m_numFoxes;
 
-    ConstantBuffer cb1;
+    // Shared by every fox
+    m_pImmediateContext->UpdateSubresource(m_pLightConstantBuffer.Get(), 0, nullptr, &m_lightProperties, 0, 0);
+    StateCache& state = m_ctx.getDXRenderer()->m_stateCache;
+    state.PSSetShaderResource(0, m_pTextureDiffuse);
+    state.PSSetConstantBuffer(1, m_pLightConstantBuffer.Get());
 
+    m_foxMatrices.resize(m_numFoxes);
     for (int i = 0; i < m_numFoxes; ++i)
     {
         float instanceAngle = currentAngle + (i * angleSpacing);
@@ -199,65 +249,83 @@ void Scene::update(const float deltaTime)
 
         float rotationY = instanceAngle + DirectX::XM_PIDIV2;
 
-        DirectX::XMMatrixRotationY(rotationY);
         DirectX::XMMATRIX mRotate = DirectX::XMMatrixRotationY(rotationY);
         DirectX::XMMATRIX mTranslate = DirectX::XMMatrixTranslation(x, 0, z);
 
-        DirectX::XMMATRIX worldMatrix = mRotate * mTranslate;
-        m_foxobject.GetRootNode(0)->SetMatrix(worldMatrix);
-
-
-        //rendering
-        cb1.mView = XMMatrixTranspose(getCamera()->getViewMatrix());
-        cb1.mProjection = XMMatrixTranspose(getCamera()->getProjectionMatrix());
-
-        cb1.mWorld = XMMatrixTranspose(m_foxobject.GetRootNode(0)->GetWorldMtrx());
-        cb1.vOutputColor = XMFLOAT4(0, 0, 0, 0);
+        m_foxMatrices[i] = mRotate * mTranslate;
+    }
 
-        if (sFox) {
-            sFox->GetSkinningMatrices(cb1.boneTransforms, 100);
+    if (m_foxInstancing)
+    {
+        m_foxobject.RenderInstances(m_ctx, m_foxMatrices.data(), m_foxMatrices.size(), deltaTime);
+    }
+    else
+    {
+        for (const XMMATRIX& worldMatrix : m_foxMatrices)
+        {
+            m_foxobject.GetRootNode(0)->SetMatrix(worldMatrix);
+            m_foxobject.AnimateFrame(m_ctx);
+            m_foxobject.RenderFrame(m_ctx, deltaTime);
         }
-
-        m_pImmediateContext->UpdateSubresource(m_pLightConstantBuffer.Get(), 0, nullptr, &m_lightProperties, 0, 0);
-
-        m_pImmediateContext->PSSetShaderResources(0, 1, &m_pTextureDiffuse);
-        ID3D11Buffer* buf = m_pLightConstantBuffer.Get();
-        m_pImmediateContext->PSSetConstantBuffers(1, 1, &buf);
-
-        m_foxobject.AnimateFrame(m_ctx);
-        m_foxobject.RenderFrame(m_ctx, deltaTime / m_numFoxes);
     }
 
-   
-
     m_sceneobject.AnimateFrame(m_ctx);
     m_sceneobject.RenderFrame(m_ctx, deltaTime);
 
 	m_armobject.AnimateFrame(m_ctx);
 	m_armobject.RenderFrame(m_ctx, deltaTime);
+
+    m_propobject.AnimateFrame(m_ctx);
+    m_propobject.RenderFrame(m_ctx, deltaTime);
+
+    m_frameStats = SceneGraph::FrameStats();
+    for (SceneGraph* graph : { &m_foxobject, &m_sceneobject, &m_armobject, &m_propobject })
+    {
+        const SceneGraph::FrameStats& stats = graph->GetStats();
+        m_frameStats.transformsUpdated += stats.transformsUpdated;
+        m_frameStats.cbUploads += stats.cbUploads;
+        m_frameStats.cbSkipped += stats.cbSkipped;
+        m_frameStats.cbBytes += stats.cbBytes;
+        m_frameStats.cbBytesMonolithic += stats.cbBytesMonolithic;
+        m_frameStats.primitivesVisible += stats.primitivesVisible;
+        m_frameStats.primitivesCulled += stats.primitivesCulled;
+        m_frameStats.primitivesOccluded += stats.primitivesOccluded;
+        m_frameStats.drawCalls += stats.drawCalls;
+        m_frameStats.stateChanges += stats.stateChanges;
+        m_frameStats.stateChangesSaved += stats.stateChangesSaved;
+        m_frameStats.instances += stats.instances;
+        m_frameStats.instancedDraws += stats.instancedDraws;
+        m_frameStats.parallelChunks += stats.parallelChunks;
+        m_frameStats.staticDraws += stats.staticDraws;
+        m_frameStats.staticPrimitives += stats.staticPrimitives;
+        m_frameStats.depthDraws += stats.depthDraws;
+        graph->ResetStats();
+    }
 }
 
-Animation Scene::CreateWaveAnimation(Skeleton* s) {
+ClipHandle Scene::CreateWaveAnimation(Skeleton* s) {
     Animation anim;
     anim.m_name = "waveHand_Simple";
 
     CreateWaveAnimationSamplerForPreSkin(1, &anim, s);
 
-    s->AddAnimation(&anim);
+    // baked on this skeleton's bind pose, so it isn't shared with anything
+    ClipHandle clip = AnimationLibrary::Get().Add(std::move(anim), std::wstring());
+    s->AddAnimation(clip);
 
     s->PlayAnimation(s->GetAnimationCount() - 1);;
 
-    return anim;
+    return clip;
 }
 
-Animation Scene::CreateWaveArmAnimation()
+ClipHandle Scene::CreateWaveArmAnimation()
 {
     Animation anim;
     anim.m_name = "waveHand_Simple";
 
     CreateWaveAnimationSampler(1, &anim);
 
-    return anim;
+    return AnimationLibrary::Get().Add(std::move(anim), std::wstring());
 }
 
 // Helper for Translation
@@ -346,7 +414,7 @@ void Scene::CreateWaveAnimationSampler(int nodeIndex, Animation* anim)
     // Samplers for the hand's translation and rotation.
     AnimationSampler nodeTranslationSampler, nodeRotationSampler;
     // Get the hand's structural bind pose.
-    DirectX::XMMATRIX nodeBindPose = DirectX::XMLoadFloat4x4(&m_robotArmSkeleton.GetJoint(nodeIndex)->localBindTransform);
+    DirectX::XMMATRIX nodeBindPose = m_armSegmentNodes[nodeIndex]->GetLocalMtrx();
 
     // --- Keyframe 1: The Start Pose (t = 0.0s) ---
     // The hand is in its default, non-animated state.
@@ -385,11 +453,11 @@ void Scene::CreateWaveAnimationSampler(int nodeIndex, Animation* anim)
     AnimationChannel transChannel;
     transChannel.path = AnimationChannel::TRANSLATION;
     transChannel.samplerIndex = nodeTranslationSamplerIndex;
-    transChannel.jointIndex = nodeIndex;
+    transChannel.nodeIndex = nodeIndex;
     anim->m_channels.push_back(transChannel);
     AnimationChannel rotChannel;
     rotChannel.path = AnimationChannel::ROTATION;
     rotChannel.samplerIndex = nodeRotationSamplerIndex;
-    rotChannel.jointIndex = nodeIndex;
+    rotChannel.nodeIndex = nodeIndex;
     anim->m_channels.push_back(rotChannel);
 }
\ No newline at end of file
@@ -22,6 +22,8 @@
 #include "wrl.h"
 #include "structures.h"
 #include "scenegraph.h"
+#include "AnimationClock.h"
+#include "thread_pool.hpp"
 
 class DX11Renderer;
 
@@ -43,11 +45,12 @@ public:
 
 	void CreateWaveAnimationSampler(int nodeIndex, Animation* anim);
 	void CreateWaveAnimationSamplerForPreSkin(int nodeIndex, Animation* anim, Skeleton* skeleton);
-	Animation CreateWaveAnimation(Skeleton* s);
-	Animation CreateWaveArmAnimation();
+	ClipHandle CreateWaveAnimation(Skeleton* s);
+	ClipHandle CreateWaveArmAnimation();
 
 private:
 	void setupLightProperties();
+	void tickAnimation(const float stepTime);
 
 public:
 	Camera* m_pCamera;
@@ -64,10 +67,12 @@ public:
 	SceneGraph m_sceneobject;
 	SceneGraph m_armobject;
 	SceneGraph m_foxobject;
+	SceneGraph m_propobject;	// posed, not animated: its rigid parts go into static batches
+
+	// Read by init(): merge the static primitives of the prop into batches
+	bool m_staticBatching = true;
 
-	Skeleton m_robotArmSkeleton;
 	std::vector<SceneNode*> m_armSegmentNodes;
-	std::vector<Animation*> m_robotArmAnimations;
 
 	//ImGui controllable parameters
 	//fox
@@ -75,6 +80,23 @@ public:
 	int m_foxAnimIndex = 1;
 	float m_foxAnimationSpeed = 0.5f;
 	float m_moveSpeed = 0.5f;
+	bool m_foxInstancing = true; // one instanced draw per fox primitive instead of a pass per fox
+
+	//animation clock
+	AnimationClock m_animationClock;
+	unsigned int m_animTicksPerSecond = 0; // measured over the last second
+	float m_animCostMsPerSecond = 0.0f;    // CPU time of the ticks + interpolation, per second
+
+	// transform / constant buffer counters of the last frame, summed over the scene graphs
+	SceneGraph::FrameStats m_frameStats;
+
+	// CPU occlusion culling, the arm segments are the occluders
+	ThreadPool m_threadPool;
+	OcclusionCuller m_occlusionCuller;
+	bool m_occlusionCulling = true;
+
+	// Depth-only pass over the opaque geometry before shading it
+	bool m_depthPrepass = false;
 
 	int m_blendAnimA = 2; //to Walk
 	int m_blendAnimB = 0; //to Run
@@ -93,5 +115,14 @@ private:
 
 
 	ID3D11SamplerState* m_pSamplerLinear;
+
+	// fox circle, the angle of the last two animation ticks
+	float m_foxAngle = 0.0f;
+	float m_prevFoxAngle = 0.0f;
+	std::vector<XMMATRIX> m_foxMatrices; // root matrix of every fox, this frame
+
+	float m_animStatsTimer = 0.0f;
+	unsigned int m_animStatsTicks = 0;
+	double m_animStatsCostMs = 0.0;
 };
 
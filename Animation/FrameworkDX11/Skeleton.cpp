@@ -1,12 +1,16 @@
 #include "Skeleton.h"
 #include "Animation.h"
+#include "QuaternionInterp.h"
+#include "gltf_utils.hpp"
+#include "log.hpp"
 
-#include <map>
+#include <cstring>
+#include <algorithm>
 
 using namespace DirectX;
 
 
-Skeleton::Skeleton() : m_currentAnimationTime(0), m_pCurrentAnimation(nullptr), m_animationCount(0)
+Skeleton::Skeleton() : m_currentAnimationTime(0), m_animationCount(0)
 {
     XMStoreFloat4x4(&m_rootTransform, XMMatrixIdentity());
 }
@@ -16,14 +20,32 @@ void Skeleton::PlayAnimation(const unsigned int animation)
     if (animation >= GetAnimationCount())
         return;
 
-    m_pCurrentAnimation = &m_animations[animation];
-    m_currentAnimationTime = m_pCurrentAnimation->GetStartTime();
+    m_currentAnimIndex = (int)animation;
+    m_currentAnimationTime = m_animations[animation]->GetStartTime();
 }
 
-void Skeleton::PlayAnimation(Animation* anim)
+void Skeleton::PlayAnimation(const Animation* anim)
 {
-    m_pCurrentAnimation = anim;
-    m_currentAnimationTime = anim->GetStartTime();
+    for (unsigned int i = 0; i < m_animations.size(); ++i)
+    {
+        if (m_animations[i].get() == anim)
+        {
+            PlayAnimation(i);
+            return;
+        }
+    }
+}
+
+int Skeleton::FindAnimation(const std::string& name) const
+{
+    ClipHandle clip = AnimationLibrary::Get().Find(name);
+    if (!clip)
+        return -1;
+
+    for (size_t i = 0; i < m_animations.size(); ++i)
+        if (m_animations[i]->m_nameId == clip->m_nameId)
+            return (int)i;
+    return -1;
 }
 
 int Skeleton::AddJoint(int parentIndex, const DirectX::XMFLOAT4X4& localBindTransform)
@@ -44,16 +66,61 @@ int Skeleton::AddJoint(int parentIndex, const DirectX::XMFLOAT4X4& localBindTran
 
     m_joints.push_back(newJoint);
     m_skinningMatrices.push_back({}); // Add a placeholder skinning matrix
+    m_clipBindings.assign(m_animations.size(), ClipBinding()); // joint count changed, rebind lazily
     m_isLoaded = true;
     return newJointIndex;
 }
 
-void Skeleton::AddAnimation(Animation* animation)
+void Skeleton::AddAnimation(const ClipHandle& animation)
 {
-    m_animations.push_back(*animation);
+    if (!animation)
+        return;
+
+    m_animations.push_back(animation);
+    m_clipBindings.emplace_back();
     m_animationCount = m_animations.size();
 }
 
+void Skeleton::BindClip(const Animation& anim, ClipBinding& binding) const
+{
+    const size_t jointCount = m_joints.size();
+
+    // Counting sort of the TRS channels by joint
+    std::vector<int> jointOfChannel(anim.m_channels.size(), -1);
+    binding.jointFirst.assign(jointCount + 1, 0);
+    for (size_t i = 0; i < anim.m_channels.size(); ++i)
+    {
+        const AnimationChannel& channel = anim.m_channels[i];
+        if (channel.path == AnimationChannel::WEIGHTS)
+            continue;
+
+        int joint = channel.jointIndex;
+        if (joint < 0 && channel.nodeIndex >= 0 && channel.nodeIndex < (int)m_nodeToJoint.size())
+            joint = m_nodeToJoint[channel.nodeIndex];
+        if (joint < 0 || joint >= (int)jointCount)
+            continue;
+
+        jointOfChannel[i] = joint;
+        binding.jointFirst[joint + 1]++;
+    }
+    for (size_t j = 0; j < jointCount; ++j)
+        binding.jointFirst[j + 1] += binding.jointFirst[j];
+
+    binding.channels.assign(binding.jointFirst[jointCount], -1);
+    std::vector<int> fill(binding.jointFirst.begin(), binding.jointFirst.end() - 1);
+    for (size_t i = 0; i < jointOfChannel.size(); ++i)
+        if (jointOfChannel[i] >= 0)
+            binding.channels[fill[jointOfChannel[i]]++] = (int)i;
+}
+
+const Skeleton::ClipBinding& Skeleton::GetBinding(int clip)
+{
+    ClipBinding& binding = m_clipBindings[clip];
+    if (binding.jointFirst.size() != m_joints.size() + 1)
+        BindClip(*m_animations[clip], binding);
+    return binding;
+}
+
 void Skeleton::SetBlend(int animA, int animB, float alpha)
 {
     m_animIndexA = animA;
@@ -64,7 +131,7 @@ void Skeleton::SetBlend(int animA, int animB, float alpha)
     if (m_blendAlpha > 1.0f) m_blendAlpha = 1.0f;
 
     if (m_animIndexA >= 0 && m_animIndexA < m_animations.size()) {
-        m_pCurrentAnimation = &m_animations[m_animIndexA];
+        m_currentAnimIndex = m_animIndexA;
     }
 }
 
@@ -120,92 +187,131 @@ const void Skeleton::GetSkinningMatrices(DirectX::XMMATRIX* matrixlist, unsigned
     }
 }
 
-bool Skeleton::LoadFromGltf(const tinygltf::Model& model)
+bool Skeleton::LoadFromGltf(const tinygltf::Model& model, int skinIndex, const std::wstring& source)
 {
     // --- PART 1 load the joints
-    if (model.skins.empty()) {
+    if (skinIndex < 0 || skinIndex >= (int)model.skins.size()) {
         return false;
     }
 
-    const tinygltf::Skin& skin = model.skins[0];
-    m_skinningMatrices.resize(skin.joints.size());
-    std::map<int, int> nodeToJointMap;
-    for (size_t i = 0; i < skin.joints.size(); ++i) {
-        m_joints.emplace_back(); // Use emplace_back for efficiency
-        nodeToJointMap[skin.joints[i]] = static_cast<int>(i);
+    const tinygltf::Skin& skin = model.skins[skinIndex];
+    const size_t jointCount = skin.joints.size();
+
+    m_joints.clear();
+    m_rootJointIndices.clear();
+    m_animations.clear();
+    m_clipBindings.clear();
+    m_currentAnimIndex = -1;
+    m_joints.resize(jointCount);
+    m_skinningMatrices.resize(jointCount);
+
+    // One pass over the nodes gives every node its parent, so the joint hierarchy
+    // can be built without searching the children lists of the other joints.
+    std::vector<int> nodeParent(model.nodes.size(), -1);
+    for (size_t n = 0; n < model.nodes.size(); ++n) {
+        for (int childNodeIndex : model.nodes[n].children) {
+            if (childNodeIndex >= 0 && childNodeIndex < (int)nodeParent.size())
+                nodeParent[childNodeIndex] = static_cast<int>(n);
+        }
+    }
+
+    std::vector<int>& nodeToJoint = m_nodeToJoint;
+    nodeToJoint.assign(model.nodes.size(), -1);
+    for (size_t i = 0; i < jointCount; ++i) {
+        nodeToJoint[skin.joints[i]] = static_cast<int>(i);
     }
-    for (size_t i = 0; i < skin.joints.size(); ++i) {
-        int nodeIndex = skin.joints[i];
-        const tinygltf::Node& node = model.nodes[nodeIndex];
+
+    for (size_t i = 0; i < jointCount; ++i) {
+        const tinygltf::Node& node = model.nodes[skin.joints[i]];
         Joint& joint = m_joints[i];
         joint.name = node.name;
         joint.localBindTransform = GetNodeLocalTransform(node); // Use helper
-        const tinygltf::Accessor& ibmAccessor = model.accessors[skin.inverseBindMatrices];
-        const tinygltf::BufferView& ibmBufferView = model.bufferViews[ibmAccessor.bufferView];
-        const tinygltf::Buffer& ibmBuffer = model.buffers[ibmBufferView.buffer];
-        const float* ibmPtr = reinterpret_cast<const float*>(&ibmBuffer.data[ibmBufferView.byteOffset + ibmAccessor.byteOffset]);
-        XMStoreFloat4x4(&joint.inverseBindMatrix, XMMATRIX(&ibmPtr[i * 16]));
+
+        // Closest ancestor that belongs to this skin (usually the direct parent)
+        int parentNodeIndex = nodeParent[skin.joints[i]];
+        while (parentNodeIndex >= 0 && nodeToJoint[parentNodeIndex] < 0)
+            parentNodeIndex = nodeParent[parentNodeIndex];
+
+        if (parentNodeIndex < 0)
+            m_rootJointIndices.push_back(static_cast<int>(i));
+        else
+            m_joints[nodeToJoint[parentNodeIndex]].children.push_back(static_cast<int>(i));
     }
-    for (size_t i = 0; i < m_joints.size(); ++i) {
-        int nodeIndex = skin.joints[i];
-        const tinygltf::Node& node = model.nodes[nodeIndex];
-        for (int childNodeIndex : node.children) {
-            auto it = nodeToJointMap.find(childNodeIndex);
-            if (it != nodeToJointMap.end()) {
-                m_joints[i].children.push_back(it->second);
-            }
+
+    // Inverse bind matrices - resolved once, copied in bulk. Missing ones (no accessor, no
+    // buffer view, fewer than joints) stay identity; sparse values are applied on top.
+    for (auto& joint : m_joints)
+        XMStoreFloat4x4(&joint.inverseBindMatrix, XMMatrixIdentity());
+
+    if (skin.inverseBindMatrices >= 0) {
+        const wchar_t* logPrefix = L"Skeleton::LoadFromGltf: ";
+        if (skin.inverseBindMatrices >= (int)model.accessors.size()) {
+            Log::Error(L"%sInvalid inverse bind matrices accessor index (%d/%d)!",
+                       logPrefix, skin.inverseBindMatrices, model.accessors.size());
+            return false;
         }
-        bool isRoot = true;
-        for (size_t j = 0; j < m_joints.size(); ++j) {
-            if (i == j) continue;
-            int parentNodeIndex = skin.joints[j];
-            const tinygltf::Node& parentNode = model.nodes[parentNodeIndex];
-            for (int childNodeIndex : parentNode.children) {
-                if (childNodeIndex == nodeIndex) {
-                    isRoot = false;
-                    break;
-                }
-            }
-            if (!isRoot) break;
+        const tinygltf::Accessor& ibmAccessor = model.accessors[skin.inverseBindMatrices];
+        if ((ibmAccessor.componentType != TINYGLTF_COMPONENT_TYPE_FLOAT) || (ibmAccessor.type != TINYGLTF_TYPE_MAT4)) {
+            Log::Error(L"%sUnsupported inverse bind matrices data type!", logPrefix);
+            return false;
         }
-        if (isRoot) {
-            m_rootJointIndices.push_back(static_cast<int>(i));
+        if (ibmAccessor.count != jointCount)
+            Log::Warning(L"%s%d inverse bind matrices for %d joints, the others are identity",
+                         logPrefix, ibmAccessor.count, jointCount);
+
+        const size_t count = std::min<size_t>(ibmAccessor.count, jointCount);
+        if (ibmAccessor.bufferView >= 0) {
+            size_t stride;
+            const unsigned char* ibmPtr = GltfUtils::GetBufferViewData(model, ibmAccessor.bufferView, ibmAccessor.byteOffset,
+                                                                       count, sizeof(XMFLOAT4X4), stride,
+                                                                       logPrefix, L"inverse bind matrices");
+            if (!ibmPtr)
+                return false;
+            for (size_t i = 0; i < count; ++i, ibmPtr += stride)
+                memcpy(&m_joints[i].inverseBindMatrix, ibmPtr, sizeof(XMFLOAT4X4));
         }
-    }
 
-    // now load the animations
-    m_animationCount = model.animations.size();
-
-    for (unsigned int i = 0; i < m_animationCount; i++)
-    {
-        Animation a;
-        a.LoadFromGltf(model, nodeToJointMap, i);
-        m_animations.push_back(a);
+        if (!GltfUtils::IterateSparseValues(model, ibmAccessor, sizeof(XMFLOAT4X4),
+                [&](size_t joint, const unsigned char* ptr) {
+                    if (joint < jointCount)
+                        memcpy(&m_joints[joint].inverseBindMatrix, ptr, sizeof(XMFLOAT4X4));
+                },
+                logPrefix, L"inverse bind matrices"))
+            return false;
     }
 
+    // now the animations - shared with every other skeleton loaded from the same file
+    m_animations = AnimationLibrary::Get().LoadFromGltf(model, source);
+    m_animationCount = m_animations.size();
+    m_clipBindings.assign(m_animationCount, ClipBinding());
+
     m_isLoaded = true;
     return true;
 }
 
 void Skeleton::Update(float deltaTime)
 {
-    // Load the root transform we found during loading.
-    DirectX::XMMATRIX rootTransform = DirectX::XMLoadFloat4x4(&m_rootTransform);
+    Tick(deltaTime);
+    BuildPalette(1.0f);
+}
 
-    if (m_pCurrentAnimation)
+void Skeleton::Tick(float stepTime)
+{
+    const Animation* current = CurrentAnimation();
+    if (current)
     {
         float durationA = 0.0f;
         float durationB = 0.0f;
 
         if (m_animIndexA >= 0) {
-            durationA = m_animations[m_animIndexA].GetEndTime() - m_animations[m_animIndexA].GetStartTime();
+            durationA = m_animations[m_animIndexA]->GetEndTime() - m_animations[m_animIndexA]->GetStartTime();
         }
-        else if (m_pCurrentAnimation) {
-            durationA = m_pCurrentAnimation->GetEndTime() - m_pCurrentAnimation->GetStartTime();
+        else {
+            durationA = current->GetEndTime() - current->GetStartTime();
         }
 
         if (m_animIndexB >= 0) {
-            durationB = m_animations[m_animIndexB].GetEndTime() - m_animations[m_animIndexB].GetStartTime();
+            durationB = m_animations[m_animIndexB]->GetEndTime() - m_animations[m_animIndexB]->GetStartTime();
         }
         else {
             durationB = durationA;
@@ -216,7 +322,7 @@ void Skeleton::Update(float deltaTime)
 
         if (currentDuration < 0.001f) currentDuration = 1.0f;
 
-        m_globalPhase += deltaTime / currentDuration;
+        m_globalPhase += (stepTime * m_playbackSpeed) / currentDuration;
 
         m_globalPhase = fmod(m_globalPhase, 1.0f);
         if (m_globalPhase < 0.0f) m_globalPhase += 1.0f;
@@ -224,15 +330,51 @@ void Skeleton::Update(float deltaTime)
         m_currentAnimationTime = m_globalPhase * currentDuration;
     }
 
+    const bool firstTick = m_poses[m_currentPose].Size() != m_joints.size();
+
+    m_currentPose ^= 1;
+    SampleLocalPose(m_globalPhase, m_poses[m_currentPose]);
+
+    // Nothing to interpolate from yet
+    if (firstTick)
+        m_poses[m_currentPose ^ 1] = m_poses[m_currentPose];
+}
+
+void Skeleton::BuildPalette(float alpha)
+{
+    const size_t jointCount = m_joints.size();
+    if (m_poses[m_currentPose].Size() != jointCount)
+        Tick(0.0f);
+
+    const JointPoseBuffer& prev = m_poses[m_currentPose ^ 1];
+    const JointPoseBuffer& curr = m_poses[m_currentPose];
+
+    if (alpha < 0.0f) alpha = 0.0f;
+    if (alpha > 1.0f) alpha = 1.0f;
+
+    m_localPose.resize(jointCount);
+    m_paletteRot.resize(jointCount);
+    QuatInterp::InterpolateN(prev.rotation.data(), curr.rotation.data(), alpha,
+                             m_paletteRot.data(), jointCount, QuatInterp::GetPrecision());
+
+    for (size_t i = 0; i < jointCount; ++i)
+    {
+        XMVECTOR s = XMVectorLerp(XMLoadFloat3(&prev.scale[i]), XMLoadFloat3(&curr.scale[i]), alpha);
+        XMVECTOR t = XMVectorLerp(XMLoadFloat3(&prev.translation[i]), XMLoadFloat3(&curr.translation[i]), alpha);
+        XMStoreFloat4x4(&m_localPose[i],
+            XMMatrixScalingFromVector(s) * XMMatrixRotationQuaternion(XMLoadFloat4(&m_paletteRot[i])) * XMMatrixTranslationFromVector(t));
+    }
+
     for (int rootIndex : m_rootJointIndices) {
-        UpdateJointTransform(rootIndex, m_pCurrentAnimation, m_globalPhase, DirectX::XMMatrixIdentity());
+        UpdateJointTransform(rootIndex, DirectX::XMMatrixIdentity());
     }
-    for (size_t i = 0; i < m_joints.size(); ++i) {
+    for (size_t i = 0; i < jointCount; ++i) {
         XMMATRIX inv = XMLoadFloat4x4(&m_joints[i].inverseBindMatrix);
         XMMATRIX finalTransform = XMLoadFloat4x4(&m_joints[i].finalTransform);
         XMMATRIX out = inv * finalTransform;
         XMStoreFloat4x4(&m_skinningMatrices[i], out);
     }
+    m_paletteVersion++;
 }
 
 DirectX::XMMATRIX GetLocalAnimatedMatrixForJoint(
@@ -308,104 +450,136 @@ DirectX::XMMATRIX GetLocalAnimatedMatrixForJoint(
 
 
 
-void Skeleton::GetAnimTRS(int jointIndex, const Animation* anim, float time, DirectX::XMVECTOR& outScale, DirectX::XMVECTOR& outRot, DirectX::XMVECTOR& outTrans)
+void Skeleton::GetAnimTRS(int jointIndex, int clip, float time, DirectX::XMVECTOR& outScale, DirectX::XMVECTOR& outRot, DirectX::XMVECTOR& outTrans)
 {
     Joint& joint = m_joints[jointIndex];
 
     DirectX::XMMatrixDecompose(&outScale, &outRot, &outTrans, DirectX::XMLoadFloat4x4(&joint.localBindTransform));
 
-    if (!anim) return;
+    if (clip < 0) return;
 
-    //itterate and apply channels
-    for (const auto& channel : anim->m_channels)
+    // apply just the channels bound to this joint
+    const Animation& anim = *m_animations[clip];
+    const ClipBinding& binding = GetBinding(clip);
+    for (int i = binding.jointFirst[jointIndex]; i < binding.jointFirst[jointIndex + 1]; ++i)
     {
-        if (channel.jointIndex != jointIndex) continue;
-
-        const AnimationSampler& sampler = anim->m_samplers[channel.samplerIndex];
-
-		// get keyframes
-        size_t prevFrame = 0;
-        auto it = std::upper_bound(sampler.timestamps.begin(), sampler.timestamps.end(), time);
-        if (it != sampler.timestamps.begin()) {
-            prevFrame = std::distance(sampler.timestamps.begin(), it) - 1;
-        }
-        size_t nextFrame = std::min(prevFrame + 1, sampler.timestamps.size() - 1);
+        anim.SampleChannel(anim.m_channels[binding.channels[i]], time, outScale, outRot, outTrans);
+    }
+}
 
-        float frameDuration = sampler.timestamps[nextFrame] - sampler.timestamps[prevFrame];
-        float t = (frameDuration > 0.0f) ? ((time - sampler.timestamps[prevFrame]) / frameDuration) : 0.0f;
+bool Skeleton::GetAnimWeights(int nodeIndex, const Animation* anim, float time, float* outWeights, size_t count) const
+{
+    if (!anim) return false;
 
+    for (const auto& channel : anim->m_channels)
+    {
+        if (channel.path != AnimationChannel::WEIGHTS || channel.nodeIndex != nodeIndex) continue;
 
-        if (channel.path == AnimationChannel::TRANSLATION) {
-            DirectX::XMVECTOR v1 = DirectX::XMLoadFloat3(&sampler.vec3_values[prevFrame]);
-            DirectX::XMVECTOR v2 = DirectX::XMLoadFloat3(&sampler.vec3_values[nextFrame]);
-            outTrans = DirectX::XMVectorLerp(v1, v2, t);
-        }
-        else if (channel.path == AnimationChannel::ROTATION) {
-            DirectX::XMVECTOR q1 = DirectX::XMLoadFloat4(&sampler.vec4_values[prevFrame]);
-            DirectX::XMVECTOR q2 = DirectX::XMLoadFloat4(&sampler.vec4_values[nextFrame]);
-            if (DirectX::XMVectorGetX(DirectX::XMVector4Dot(q1, q2)) < 0.0f) {
-                q2 = DirectX::XMVectorNegate(q2);
-            }
-            outRot = DirectX::XMQuaternionSlerp(q1, q2, t);
-        }
-        else if (channel.path == AnimationChannel::SCALE) {
-            DirectX::XMVECTOR v1 = DirectX::XMLoadFloat3(&sampler.vec3_values[prevFrame]);
-            DirectX::XMVECTOR v2 = DirectX::XMLoadFloat3(&sampler.vec3_values[nextFrame]);
-            outScale = DirectX::XMVectorLerp(v1, v2, t);
-        }
+        return anim->SampleWeights(channel, time, outWeights, count);
     }
-}
-void Skeleton::UpdateJointTransform(int jointIndex, const Animation* anim, float phase, const DirectX::XMMATRIX& parentTransform)
-{
-    if (jointIndex < 0 || jointIndex >= m_joints.size()) return;
 
-    Joint& currentJoint = m_joints[jointIndex];
-    DirectX::XMMATRIX localMat = DirectX::XMMatrixIdentity();
+    return false;
+}
 
-    //errors without this check
+bool Skeleton::SampleMorphWeights(int nodeIndex, float* outWeights, float* scratchWeights, size_t count) const
+{
     bool validBlend = (m_animIndexA >= 0 && m_animIndexA < m_animations.size()) &&
         (m_animIndexB >= 0 && m_animIndexB < m_animations.size());
 
     if (validBlend)
     {
-        //anim a
-        float startA = m_animations[m_animIndexA].GetStartTime();
-        float endA = m_animations[m_animIndexA].GetEndTime();
-        float timeA = startA + (phase * (endA - startA));
+        const Animation& animA = *m_animations[m_animIndexA];
+        const Animation& animB = *m_animations[m_animIndexB];
+        float timeA = animA.GetStartTime() + (m_globalPhase * (animA.GetEndTime() - animA.GetStartTime()));
+        float timeB = animB.GetStartTime() + (m_globalPhase * (animB.GetEndTime() - animB.GetStartTime()));
+
+        // Channels missing from one clip keep the caller's default weights for that side
+        bool hasA = GetAnimWeights(nodeIndex, &animA, timeA, outWeights, count);
+        bool hasB = GetAnimWeights(nodeIndex, &animB, timeB, scratchWeights, count);
+        if (!hasA && !hasB)
+            return false;
+
+        for (size_t i = 0; i < count; ++i)
+            outWeights[i] += (scratchWeights[i] - outWeights[i]) * m_blendAlpha;
+        return true;
+    }
 
-        DirectX::XMVECTOR sA, rA, tA;
-        GetAnimTRS(jointIndex, &m_animations[m_animIndexA], timeA, sA, rA, tA);
+    const Animation* current = CurrentAnimation();
+    if (!current)
+        return false;
 
-        //anim b
-        float startB = m_animations[m_animIndexB].GetStartTime();
-        float endB = m_animations[m_animIndexB].GetEndTime();
-        float timeB = startB + (phase * (endB - startB));
+    float time = current->GetStartTime() +
+        (m_globalPhase * (current->GetEndTime() - current->GetStartTime()));
+    return GetAnimWeights(nodeIndex, current, time, outWeights, count);
+}
 
-        DirectX::XMVECTOR sB, rB, tB;
-        GetAnimTRS(jointIndex, &m_animations[m_animIndexB], timeB, sB, rB, tB);
+void Skeleton::SampleLocalPose(float phase, JointPoseBuffer& pose)
+{
+    const size_t jointCount = m_joints.size();
+    pose.Resize(jointCount);
 
-        DirectX::XMVECTOR finalS = DirectX::XMVectorLerp(sA, sB, m_blendAlpha);
-        DirectX::XMVECTOR finalT = DirectX::XMVectorLerp(tA, tB, m_blendAlpha);
-        DirectX::XMVECTOR finalR = DirectX::XMQuaternionSlerp(rA, rB, m_blendAlpha);
+    //errors without this check
+    bool validBlend = (m_animIndexA >= 0 && m_animIndexA < m_animations.size()) &&
+        (m_animIndexB >= 0 && m_animIndexB < m_animations.size());
 
-        localMat = DirectX::XMMatrixScalingFromVector(finalS) * DirectX::XMMatrixRotationQuaternion(finalR) * DirectX::XMMatrixTranslationFromVector(finalT);
-    }
-    else if (anim)///fallback
+    if (validBlend)
     {
-        float start = anim->GetStartTime();
-        float end = anim->GetEndTime();
-        float time = start + (phase * (end - start));
+        const Animation& animA = *m_animations[m_animIndexA];
+        const Animation& animB = *m_animations[m_animIndexB];
+        float timeA = animA.GetStartTime() + (phase * (animA.GetEndTime() - animA.GetStartTime()));
+        float timeB = animB.GetStartTime() + (phase * (animB.GetEndTime() - animB.GetStartTime()));
+
+        m_blendRotB.resize(jointCount);
+
+        for (size_t i = 0; i < jointCount; ++i)
+        {
+            DirectX::XMVECTOR sA, rA, tA;
+            GetAnimTRS((int)i, m_animIndexA, timeA, sA, rA, tA);
+            DirectX::XMVECTOR sB, rB, tB;
+            GetAnimTRS((int)i, m_animIndexB, timeB, sB, rB, tB);
+
+            XMStoreFloat3(&pose.scale[i], DirectX::XMVectorLerp(sA, sB, m_blendAlpha));
+            XMStoreFloat3(&pose.translation[i], DirectX::XMVectorLerp(tA, tB, m_blendAlpha));
+            XMStoreFloat4(&pose.rotation[i], rA);
+            XMStoreFloat4(&m_blendRotB[i], rB);
+        }
 
-        DirectX::XMVECTOR s, r, t;
-        GetAnimTRS(jointIndex, anim, time, s, r, t);
-        localMat = DirectX::XMMatrixScalingFromVector(s) * DirectX::XMMatrixRotationQuaternion(r) * DirectX::XMMatrixTranslationFromVector(t);
+        // All joints share the blend factor, so the rotations are blended in one batch
+        QuatInterp::InterpolateN(pose.rotation.data(), m_blendRotB.data(), m_blendAlpha,
+                                 pose.rotation.data(), jointCount, QuatInterp::GetPrecision());
+    }
+    else if (m_currentAnimIndex >= 0)///fallback
+    {
+        const Animation* anim = CurrentAnimation();
+        float time = anim->GetStartTime() + (phase * (anim->GetEndTime() - anim->GetStartTime()));
+
+        for (size_t i = 0; i < jointCount; ++i)
+        {
+            DirectX::XMVECTOR s, r, t;
+            GetAnimTRS((int)i, m_currentAnimIndex, time, s, r, t);
+            XMStoreFloat3(&pose.scale[i], s);
+            XMStoreFloat4(&pose.rotation[i], r);
+            XMStoreFloat3(&pose.translation[i], t);
+        }
+    }
+    else
+    {
+        std::fill(pose.scale.begin(), pose.scale.end(), XMFLOAT3(1.0f, 1.0f, 1.0f));
+        std::fill(pose.rotation.begin(), pose.rotation.end(), XMFLOAT4(0.0f, 0.0f, 0.0f, 1.0f));
+        std::fill(pose.translation.begin(), pose.translation.end(), XMFLOAT3(0.0f, 0.0f, 0.0f));
     }
+}
+
+void Skeleton::UpdateJointTransform(int jointIndex, const DirectX::XMMATRIX& parentTransform)
+{
+    if (jointIndex < 0 || jointIndex >= m_joints.size()) return;
 
-    DirectX::XMMATRIX finalTransform = localMat * parentTransform;
+    Joint& currentJoint = m_joints[jointIndex];
+
+    DirectX::XMMATRIX finalTransform = XMLoadFloat4x4(&m_localPose[jointIndex]) * parentTransform;
     XMStoreFloat4x4(&currentJoint.finalTransform, finalTransform);
 
     for (int childIndex : currentJoint.children) {
-        UpdateJointTransform(childIndex, anim, phase, finalTransform);
+        UpdateJointTransform(childIndex, finalTransform);
     }
 }
-
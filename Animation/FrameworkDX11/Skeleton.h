@@ -6,6 +6,7 @@
 #include "tiny_gltf.h"
 
 #include "Animation.h"
+#include "AnimationLibrary.h"
 
 struct Joint
 {
@@ -26,41 +27,83 @@ struct Joint
     DirectX::XMFLOAT4X4 finalTransform{};
 };
 
+// Local scale / rotation / translation of every joint at one animation tick
+struct JointPoseBuffer
+{
+    std::vector<DirectX::XMFLOAT3> scale;
+    std::vector<DirectX::XMFLOAT4> rotation;
+    std::vector<DirectX::XMFLOAT3> translation;
+
+    void Resize(size_t jointCount)
+    {
+        scale.resize(jointCount);
+        rotation.resize(jointCount);
+        translation.resize(jointCount);
+    }
+    size_t Size() const { return rotation.size(); }
+};
+
 class Skeleton
 {
 public:
 
     Skeleton();
 
-    // Loads the skeleton hierarchy and matrices from a glTF model.
-    // Returns true on success.
-    bool LoadFromGltf(const tinygltf::Model& model);
+    // Loads the skeleton hierarchy and matrices of skin 'skinIndex' from a glTF model.
+    // The clips come from the AnimationLibrary, 'source' (the file path) lets skeletons loaded
+    // from the same file share them. Returns true on success.
+    bool LoadFromGltf(const tinygltf::Model& model, int skinIndex = 0, const std::wstring& source = std::wstring());
 
     // Updates the pose of the skeleton based on the animation time.
+    // Same as Tick(deltaTime) followed by BuildPalette(1), i.e. no interpolation.
     void Update(float deltaTime);
 
+    // Advances the animation by one fixed step and samples the new pose.
+    // The previous tick's pose is kept so the palette can be interpolated.
+    void Tick(float stepTime);
+
+    // Interpolates between the last two ticks (alpha 0 = previous, 1 = latest)
+    // and rebuilds the skinning matrices from the result.
+    void BuildPalette(float alpha);
+
+    // Scales the step passed to Tick()/Update()
+    void SetPlaybackSpeed(float speed) { m_playbackSpeed = speed; }
+    float GetPlaybackSpeed() const { return m_playbackSpeed; }
+
     // Returns the final skinning matrices ready to be sent to the GPU.
     const void GetSkinningMatrices(DirectX::XMMATRIX* matrixlist, unsigned int arraylength) const;
-    const unsigned int GetBoneCount() { return m_skinningMatrices.size(); }
+    const unsigned int GetBoneCount() const { return (unsigned int)m_skinningMatrices.size(); }
+
+    // Incremented by every BuildPalette(), lets renderers skip re-uploading an unchanged palette
+    uint64_t GetPaletteVersion() const { return m_paletteVersion; }
     const DirectX::XMMATRIX& GetRootTransform() const { return XMLoadFloat4x4(&m_rootTransform); }
 
     unsigned int GetAnimationCount() { return m_animationCount; }
     void PlayAnimation(const unsigned int animation);
-    void PlayAnimation(Animation* anim);
+    void PlayAnimation(const Animation* anim); // must be one of GetAnimations()
     bool IsLoaded() { return m_isLoaded; }
-    Animation* CurrentAnimation() { return m_pCurrentAnimation; }
+    const Animation* CurrentAnimation() const { return (m_currentAnimIndex >= 0) ? m_animations[m_currentAnimIndex].get() : nullptr; }
 
     int AddJoint(int parentIndex, const DirectX::XMFLOAT4X4& localBindTransform);
     Joint* GetJoint(unsigned int joint) {
         return &m_joints[joint];
     }
-    void AddAnimation(Animation* animation);
+    void AddAnimation(const ClipHandle& animation);
+    const std::vector<ClipHandle>& GetAnimations() const { return m_animations; }
+
+    // Index of the clip with the given name, -1 if none (compares interned names)
+    int FindAnimation(const std::string& name) const;
 
 
 
 
     void SetBlend(int animA, int animB, float alpha);
 
+    // Samples the morph target weights the current animation (or blend) sets on glTF node 'nodeIndex'.
+    // outWeights and scratchWeights must both hold the node's default weights, the blend samples its
+    // second clip into scratchWeights. Returns false if no clip animates them.
+    bool SampleMorphWeights(int nodeIndex, float* outWeights, float* scratchWeights, size_t count) const;
+
 private:
 
 
@@ -69,14 +112,45 @@ private:
     float m_blendAlpha = 0.0f; // The slider value
 
 
-    //get raw value from animation
-    void GetAnimTRS(int jointIndex, const Animation* anim, float time, DirectX::XMVECTOR& outScale, DirectX::XMVECTOR& outRot, DirectX::XMVECTOR& outTrans);
+    //get raw value from animation (clip -1 gives the bind pose)
+    void GetAnimTRS(int jointIndex, int clip, float time, DirectX::XMVECTOR& outScale, DirectX::XMVECTOR& outRot, DirectX::XMVECTOR& outTrans);
+
+    // The channels of a clip grouped per joint: channels[jointFirst[j] .. jointFirst[j + 1]).
+    // Clips are shared, so the joint mapping lives with the skeleton, not the clip.
+    struct ClipBinding
+    {
+        std::vector<int> jointFirst;
+        std::vector<int> channels;
+    };
+    void BindClip(const Animation& anim, ClipBinding& binding) const;
+    const ClipBinding& GetBinding(int clip);
+
+    std::vector<ClipBinding> m_clipBindings; // parallel to m_animations
+    std::vector<int>         m_nodeToJoint;  // glTF node -> joint, empty for skeletons built in code
+
+    bool GetAnimWeights(int nodeIndex, const Animation* anim, float time, float* outWeights, size_t count) const;
 
     float m_globalPhase = 0.0f;
 
 
-    // Change the signature to accept a pointer.
-    void UpdateJointTransform(int jointIndex, const Animation* anim, float time, const DirectX::XMMATRIX& parentTransform);
+    float m_playbackSpeed = 1.0f;
+
+    // Samples the current clip (or the A/B blend) into 'pose'.
+    void SampleLocalPose(float phase, JointPoseBuffer& pose);
+
+    // Composes m_localPose down the hierarchy into Joint::finalTransform.
+    void UpdateJointTransform(int jointIndex, const DirectX::XMMATRIX& parentTransform);
+
+    // Poses of the last two ticks, m_poses[m_currentPose] is the latest
+    JointPoseBuffer m_poses[2];
+    int             m_currentPose = 0;
+
+    // Interpolated local matrices the palette is built from
+    std::vector<DirectX::XMFLOAT4X4> m_localPose;
+
+    // Scratch, one entry per joint
+    std::vector<DirectX::XMFLOAT4> m_blendRotB;
+    std::vector<DirectX::XMFLOAT4> m_paletteRot;
 
     // The flat list of all joints that make up this skeleton.
     std::vector<Joint> m_joints;
@@ -87,12 +161,13 @@ private:
     // The final matrices sent to the shader, calculated by multiplying the
     // inverse bind matrix by the final animated transform for each joint.
     std::vector<DirectX::XMFLOAT4X4> m_skinningMatrices;
+    uint64_t m_paletteVersion = 0;
 
     DirectX::XMFLOAT4X4 m_rootTransform;
 
     unsigned int            m_animationCount;
-    std::vector<Animation>  m_animations;
-    Animation* m_pCurrentAnimation;
+    std::vector<ClipHandle> m_animations;
+    int                     m_currentAnimIndex = -1;
     float                   m_currentAnimationTime;
     bool                    m_isLoaded = false;
 };
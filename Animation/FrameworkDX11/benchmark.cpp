@@ -0,0 +1,1197 @@
+#include "benchmark.hpp"
+#include "log.hpp"
+#include "utils.hpp"
+#include "Animation.h"
+#include "QuaternionInterp.h"
+#include "transform_hierarchy.hpp"
+#include "frustum_culler.hpp"
+#include "bvh.hpp"
+#include "occlusion_culler.hpp"
+#include "thread_pool.hpp"
+#include "render_queue.hpp"
+#include "instance_batcher.hpp"
+#include "command_stream.hpp"
+#include "static_batcher.hpp"
+#include "tlsf_allocator.hpp"
+#include "vertex_codec.hpp"
+#include "AnimationLibrary.h"
+#include "gltf_utils.hpp"
+
+#include <cstdio>
+#include <algorithm>
+#include <random>
+#include <map>
+#include <cmath>
+
+using namespace DirectX;
+
+namespace
+{
+    std::vector<std::string> sReport;
+
+    // Sink for benchmark results, so the optimiser can't drop the evaluated values
+    volatile float sSink = 0.0f;
+
+    // Keeps the vertex buffer and object constants each draw was issued with, to compare
+    // the draw order of command streams
+    class DrawOrderExecutor : public NullCommandExecutor
+    {
+    public:
+        std::vector<std::pair<ID3D11Buffer*, uint32_t>> draws;
+
+        virtual void SetVertexBuffer(uint32_t slot, ID3D11Buffer *buffer, uint32_t stride) override
+        {
+            NullCommandExecutor::SetVertexBuffer(slot, buffer, stride);
+            if (slot == 0)
+                mVertexBuffer = buffer;
+        }
+        virtual void SetVSConstants(uint32_t slot, ID3D11Buffer *buffer, uint32_t firstConstant, uint32_t numConstants) override
+        {
+            NullCommandExecutor::SetVSConstants(slot, buffer, firstConstant, numConstants);
+            if (slot == 0)
+                mObjectConstant = firstConstant;
+        }
+        virtual void DrawIndexed(uint32_t indexCount, uint32_t startIndex, int32_t baseVertex, uint32_t materialIndex) override
+        {
+            NullCommandExecutor::DrawIndexed(indexCount, startIndex, baseVertex, materialIndex);
+            draws.emplace_back(mVertexBuffer, mObjectConstant);
+        }
+
+    private:
+        ID3D11Buffer*   mVertexBuffer = nullptr;
+        uint32_t        mObjectConstant = 0;
+    };
+
+    // The evaluator used before the specialised kernels: branches on the path for every
+    // sample and treats every sampler as LINEAR. Kept here as the benchmark baseline.
+    void SampleChannelGeneric(const Animation &anim, const AnimationChannel &channel, float time,
+                              XMVECTOR &outScale, XMVECTOR &outRot, XMVECTOR &outTrans)
+    {
+        const AnimationSampler &sampler = anim.m_samplers[channel.samplerIndex];
+
+        size_t prevFrame = 0;
+        auto it = std::upper_bound(sampler.timestamps.begin(), sampler.timestamps.end(), time);
+        if (it != sampler.timestamps.begin())
+            prevFrame = std::distance(sampler.timestamps.begin(), it) - 1;
+        size_t nextFrame = (std::min)(prevFrame + 1, sampler.timestamps.size() - 1);
+
+        float frameDuration = sampler.timestamps[nextFrame] - sampler.timestamps[prevFrame];
+        float t = (frameDuration > 0.0f) ? ((time - sampler.timestamps[prevFrame]) / frameDuration) : 0.0f;
+
+        if (channel.path == AnimationChannel::TRANSLATION) {
+            outTrans = XMVectorLerp(XMLoadFloat3(&sampler.vec3_values[prevFrame]), XMLoadFloat3(&sampler.vec3_values[nextFrame]), t);
+        }
+        else if (channel.path == AnimationChannel::ROTATION) {
+            XMVECTOR q1 = XMLoadFloat4(&sampler.vec4_values[prevFrame]);
+            XMVECTOR q2 = XMLoadFloat4(&sampler.vec4_values[nextFrame]);
+            if (XMVectorGetX(XMVector4Dot(q1, q2)) < 0.0f)
+                q2 = XMVectorNegate(q2);
+            outRot = XMQuaternionSlerp(q1, q2, t);
+        }
+        else if (channel.path == AnimationChannel::SCALE) {
+            outScale = XMVectorLerp(XMLoadFloat3(&sampler.vec3_values[prevFrame]), XMLoadFloat3(&sampler.vec3_values[nextFrame]), t);
+        }
+    }
+    // Free list ordered by offset, searched first-fit, as the baseline for TlsfAllocator
+    class FirstFitAllocator
+    {
+    public:
+        void Reset(uint32_t capacity)
+        {
+            mFree.clear();
+            mFree[0] = capacity;
+        }
+
+        bool Allocate(uint32_t size, uint32_t &offset)
+        {
+            for (auto it = mFree.begin(); it != mFree.end(); ++it)
+            {
+                if (it->second < size)
+                    continue;
+                offset = it->first;
+                if (it->second > size)
+                    mFree[it->first + size] = it->second - size;
+                mFree.erase(it);
+                return true;
+            }
+            return false;
+        }
+
+        void Free(uint32_t offset, uint32_t size)
+        {
+            auto it = mFree.emplace(offset, size).first;
+            auto next = std::next(it);
+            if ((next != mFree.end()) && (it->first + it->second == next->first))
+            {
+                it->second += next->second;
+                mFree.erase(next);
+            }
+            if (it != mFree.begin())
+            {
+                auto prev = std::prev(it);
+                if (prev->first + prev->second == it->first)
+                {
+                    prev->second += it->second;
+                    mFree.erase(it);
+                }
+            }
+        }
+
+        size_t GetFreeBlocks() const { return mFree.size(); }
+
+    private:
+        std::map<uint32_t, uint32_t> mFree;    // offset -> size
+    };
+
+    // Layout of the scene graph before the transforms were flattened
+    struct TreeNode
+    {
+        XMFLOAT4X4              local;
+        XMFLOAT4X4              world;
+        std::vector<TreeNode>   children;
+    };
+
+    void BuildTree(TreeNode &node, int idx, const std::vector<std::vector<int>> &children, const std::vector<XMFLOAT4X4> &locals)
+    {
+        node.local = locals[idx];
+        node.children.resize(children[idx].size());
+        for (size_t i = 0; i < children[idx].size(); ++i)
+            BuildTree(node.children[i], children[idx][i], children, locals);
+    }
+
+    void PropagateTree(TreeNode &node, FXMMATRIX parentWorld)
+    {
+        const XMMATRIX world = XMLoadFloat4x4(&node.local) * parentWorld;
+        XMStoreFloat4x4(&node.world, world);
+        for (auto &child : node.children)
+            PropagateTree(child, world);
+    }
+}
+
+void Benchmark::Report(const std::string &line)
+{
+    Log::Info(L"[Benchmark] %s", Utils::StringToWstring(line).c_str());
+    sReport.push_back(line);
+}
+
+void Benchmark::Report(const Result &result)
+{
+    char line[256];
+    snprintf(line, sizeof(line), "%-40s %9.2f ns/op  (%zu ops, %.2f ms)",
+             result.name.c_str(), result.NsPerOp(),
+             result.iterations * result.opsPerIteration, result.totalMs);
+    Report(std::string(line));
+}
+
+const std::vector<std::string>& Benchmark::GetReport()
+{
+    return sReport;
+}
+
+void Benchmark::ClearReport()
+{
+    sReport.clear();
+}
+
+void Benchmark::RunTrackEvaluation(const std::vector<ClipHandle> &clips)
+{
+    const size_t samplesPerClip = 256;
+    const size_t iterations = 200;
+
+    Report(std::string("Track evaluation"));
+
+    for (const auto &handle : clips)
+    {
+        const Animation &clip = *handle;
+
+        // Only the channels both evaluators understand
+        std::vector<const AnimationChannel*> channels;
+        for (const auto &channel : clip.m_channels)
+            if ((channel.path != AnimationChannel::WEIGHTS) &&
+                !clip.m_samplers[channel.samplerIndex].timestamps.empty())
+                channels.push_back(&channel);
+        if (channels.empty())
+            continue;
+
+        const float endTime = clip.GetEndTime();
+        const size_t ops = channels.size() * samplesPerClip;
+
+        auto Evaluate = [&](auto &&sampleFunc)
+        {
+            XMVECTOR acc = XMVectorZero();
+            for (size_t i = 0; i < samplesPerClip; ++i)
+            {
+                const float time = endTime * (float)i / (float)samplesPerClip;
+                for (const auto *channel : channels)
+                {
+                    XMVECTOR s = XMVectorZero(), r = XMVectorZero(), t = XMVectorZero();
+                    sampleFunc(*channel, time, s, r, t);
+                    acc = XMVectorAdd(acc, XMVectorAdd(s, XMVectorAdd(r, t)));
+                }
+            }
+            sSink = sSink + XMVectorGetX(acc);
+        };
+
+        Report(Run("  " + clip.m_name + " generic", iterations, ops, [&]()
+        {
+            Evaluate([&](const AnimationChannel &c, float time, XMVECTOR &s, XMVECTOR &r, XMVECTOR &t)
+                     { SampleChannelGeneric(clip, c, time, s, r, t); });
+        }));
+        Report(Run("  " + clip.m_name + " specialised", iterations, ops, [&]()
+        {
+            Evaluate([&](const AnimationChannel &c, float time, XMVECTOR &s, XMVECTOR &r, XMVECTOR &t)
+                     { clip.SampleChannel(c, time, s, r, t); });
+        }));
+    }
+}
+
+void Benchmark::RunRotationInterpolation(const std::vector<ClipHandle> &clips)
+{
+    const RotationPrecision tiers[] = { RotationPrecision::Slerp,
+                                        RotationPrecision::CorrectedNlerp,
+                                        RotationPrecision::Nlerp };
+
+    // Consecutive rotation keys of every clip (what the track kernels interpolate)
+    std::vector<XMFLOAT4> keyA, keyB;
+    for (const auto &clip : clips)
+        for (const auto &channel : clip->m_channels)
+        {
+            const AnimationSampler &sampler = clip->m_samplers[channel.samplerIndex];
+            if ((channel.path != AnimationChannel::ROTATION) || (sampler.interpolation != AnimationSampler::LINEAR))
+                continue;
+            for (size_t k = 0; k + 1 < sampler.vec4_values.size(); ++k)
+            {
+                keyA.push_back(sampler.vec4_values[k]);
+                keyB.push_back(sampler.vec4_values[k + 1]);
+            }
+        }
+
+    Report(std::string("Rotation interpolation"));
+    if (keyA.empty())
+    {
+        Report(std::string("  no LINEAR rotation tracks"));
+        return;
+    }
+
+    std::vector<XMFLOAT4> out(keyA.size());
+    for (RotationPrecision tier : tiers)
+    {
+        Report(Run(std::string("  batched ") + QuatInterp::PrecisionToString(tier), 200, keyA.size(), [&]()
+        {
+            QuatInterp::InterpolateN(keyA.data(), keyB.data(), 0.37f, out.data(), out.size(), tier);
+            sSink = sSink + out[0].w;
+        }));
+    }
+}
+
+void Benchmark::RunTransformHierarchy()
+{
+    const size_t sizes[] = { 10000, 50000, 100000 };
+
+    Report(std::string("Transform hierarchy"));
+
+    for (size_t nodeCount : sizes)
+    {
+        // Parent-ordered 4-ary tree with a few small transforms per level
+        std::vector<int> parents(nodeCount);
+        std::vector<std::vector<int>> children(nodeCount);
+        std::vector<XMFLOAT4X4> locals(nodeCount);
+        for (size_t i = 0; i < nodeCount; ++i)
+        {
+            parents[i] = (i == 0) ? -1 : (int)((i - 1) / 4);
+            if (parents[i] >= 0)
+                children[parents[i]].push_back((int)i);
+            XMStoreFloat4x4(&locals[i], XMMatrixRotationY(0.01f * (float)(i % 17)) *
+                                        XMMatrixTranslation(0.1f, 0.2f * (float)(i % 3), 0.0f));
+        }
+
+        TreeNode root;
+        BuildTree(root, 0, children, locals);
+
+        TransformHierarchy hierarchy;
+        hierarchy.Reserve(nodeCount);
+        for (size_t i = 0; i < nodeCount; ++i)
+            hierarchy.Add(parents[i] < 0 ? TransformHierarchy::InvalidIndex : (TransformHierarchy::Index)parents[i],
+                          XMLoadFloat4x4(&locals[i]));
+
+        const size_t iterations = (std::max)((size_t)10, (size_t)2000000 / nodeCount);
+        const std::string suffix = " " + std::to_string(nodeCount / 1000) + "k nodes";
+
+        Report(Run("  recursive" + suffix, iterations, nodeCount, [&]()
+        {
+            PropagateTree(root, XMMatrixIdentity());
+            sSink = sSink + root.children.back().world._41;
+        }));
+        Report(Run("  linear" + suffix, iterations, nodeCount, [&]()
+        {
+            // Moving the root dirties the whole tree, like the recursive walk
+            hierarchy.SetLocal(0, XMLoadFloat4x4(&locals[0]));
+            hierarchy.UpdateWorld();
+            sSink = sSink + XMVectorGetX(hierarchy.GetWorld((TransformHierarchy::Index)nodeCount - 1).r[3]);
+        }));
+        Report(Run("  linear, one leaf moved" + suffix, iterations, nodeCount, [&]()
+        {
+            hierarchy.SetLocal((TransformHierarchy::Index)nodeCount - 1, XMLoadFloat4x4(&locals[nodeCount - 1]));
+            hierarchy.UpdateWorld();
+            sSink = sSink + XMVectorGetX(hierarchy.GetWorld((TransformHierarchy::Index)nodeCount - 1).r[3]);
+        }));
+    }
+}
+
+void Benchmark::RunFrustumCulling()
+{
+    const size_t boxCount = 100000;
+
+    Report(std::string("Frustum culling"));
+
+    // Boxes scattered around the origin, the cameras look at it from a few directions
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<float> position(-100.0f, 100.0f);
+    std::uniform_real_distribution<float> size(0.1f, 2.0f);
+
+    BoundsSoA bounds;
+    bounds.Resize(boxCount);
+    for (size_t i = 0; i < boxCount; ++i)
+        bounds.Set(i, XMVectorSet(position(rng), position(rng) * 0.1f, position(rng), 0.0f),
+                      XMVectorSet(size(rng), size(rng), size(rng), 0.0f));
+
+    const XMMATRIX proj = XMMatrixPerspectiveFovLH(XM_PIDIV4, 16.0f / 9.0f, 0.1f, 150.0f);
+    const Frustum views[3] =
+    {
+        Frustum::FromViewProjection(XMMatrixLookAtLH(XMVectorSet(0.0f, 10.0f, -60.0f, 1.0f), XMVectorZero(), XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f)) * proj),
+        Frustum::FromViewProjection(XMMatrixLookAtLH(XMVectorSet(60.0f, 10.0f, 0.0f, 1.0f), XMVectorZero(), XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f)) * proj),
+        Frustum::FromViewProjection(XMMatrixLookAtLH(XMVectorSet(0.0f, 80.0f, 0.0f, 1.0f), XMVectorZero(), XMVectorSet(0.0f, 0.0f, 1.0f, 0.0f)) * proj),
+    };
+
+    std::vector<FrustumCuller::ViewMask> masks(boxCount);
+    std::vector<FrustumCuller::ViewMask> reference(boxCount);
+    const size_t iterations = 50;
+
+    for (size_t viewCount : { (size_t)1, (size_t)3 })
+    {
+        const std::string suffix = " 100k boxes, " + std::to_string(viewCount) + " view(s)";
+
+        FrustumCuller::Stats stats;
+        Report(Run("  scalar" + suffix, iterations, boxCount, [&]()
+        {
+            stats = FrustumCuller::CullScalar(bounds, views, viewCount, reference.data());
+        }));
+        Report(Run("  simd" + suffix, iterations, boxCount, [&]()
+        {
+            stats = FrustumCuller::Cull(bounds, views, viewCount, masks.data());
+        }));
+
+        char line[256];
+        snprintf(line, sizeof(line), "    visible in view 0: %zu, culled from all: %zu, results %s",
+                 stats.visible[0], stats.culled, (masks == reference) ? "match" : "DIFFER");
+        Report(std::string(line));
+    }
+}
+
+void Benchmark::RunBvh()
+{
+    const size_t instanceCount = 100000;
+
+    Report(std::string("BVH"));
+
+    std::mt19937 rng(11);
+    std::uniform_real_distribution<float> position(-500.0f, 500.0f);
+    std::uniform_real_distribution<float> size(0.2f, 3.0f);
+    std::uniform_real_distribution<float> step(-0.5f, 0.5f);
+
+    std::vector<Aabb> boxes(instanceCount);
+    for (auto &box : boxes)
+    {
+        const float x = position(rng), y = position(rng) * 0.05f, z = position(rng), s = size(rng);
+        box.min = XMFLOAT3(x - s, y - s, z - s);
+        box.max = XMFLOAT3(x + s, y + s, z + s);
+    }
+    auto Move = [&](Aabb &box)
+    {
+        const float dx = step(rng), dz = step(rng);
+        box.min.x += dx; box.max.x += dx;
+        box.min.z += dz; box.max.z += dz;
+    };
+
+    InstanceBvh bvh;
+    Report(Run("  build 100k", 5, instanceCount, [&]() { bvh.Build(boxes.data(), boxes.size()); }));
+    const float buildCost = bvh.GetSahCost();
+
+    const size_t movedCount = instanceCount / 10;
+    Report(Run("  refit, 10% moved", 20, movedCount, [&]()
+    {
+        for (size_t i = 0; i < movedCount; ++i)
+        {
+            const uint32_t instance = (uint32_t)(rng() % instanceCount);
+            Move(boxes[instance]);
+            bvh.UpdateInstance(instance, boxes[instance]);
+        }
+        bvh.Refit();
+    }));
+    Report(Run("  refit, all moved", 20, instanceCount, [&]()
+    {
+        for (uint32_t i = 0; i < (uint32_t)instanceCount; ++i)
+        {
+            Move(boxes[i]);
+            bvh.UpdateInstance(i, boxes[i]);
+        }
+        bvh.Refit();
+    }));
+
+    char line[256];
+    snprintf(line, sizeof(line), "    SAH cost %.1f after build, %.1f after refits (rebuild %s)",
+             buildCost, bvh.GetSahCost(), bvh.NeedsRebuild() ? "due" : "not needed");
+    Report(std::string(line));
+    bvh.Build(boxes.data(), boxes.size());
+
+    // Frustum: tree query vs. testing every box
+    const Frustum frustum = Frustum::FromViewProjection(
+        XMMatrixLookAtLH(XMVectorSet(0.0f, 20.0f, -100.0f, 1.0f), XMVectorZero(), XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f)) *
+        XMMatrixPerspectiveFovLH(XM_PIDIV4, 16.0f / 9.0f, 0.1f, 300.0f));
+    BoundsSoA soa;
+    soa.Resize(instanceCount);
+    for (size_t i = 0; i < instanceCount; ++i)
+        soa.SetMinMax(i, boxes[i].min, boxes[i].max);
+    std::vector<FrustumCuller::ViewMask> masks(instanceCount);
+    std::vector<uint32_t> hits;
+    FrustumCuller::Stats flatStats;
+
+    Report(Run("  frustum, flat simd", 50, instanceCount, [&]()
+    {
+        flatStats = FrustumCuller::Cull(soa, &frustum, 1, masks.data());
+    }));
+    Report(Run("  frustum, bvh", 50, instanceCount, [&]()
+    {
+        hits.clear();
+        bvh.QueryFrustum(frustum, hits);
+    }));
+    snprintf(line, sizeof(line), "    visible: flat %zu, bvh %zu", flatStats.visible[0], hits.size());
+    Report(std::string(line));
+
+    // Overlap and rays
+    const size_t queryCount = 1000;
+    std::vector<Aabb> queryBoxes(queryCount);
+    std::vector<XMFLOAT3> rayOrigins(queryCount), rayDirs(queryCount);
+    for (size_t i = 0; i < queryCount; ++i)
+    {
+        const float x = position(rng), z = position(rng);
+        queryBoxes[i].min = XMFLOAT3(x - 5.0f, -5.0f, z - 5.0f);
+        queryBoxes[i].max = XMFLOAT3(x + 5.0f, 5.0f, z + 5.0f);
+        rayOrigins[i] = XMFLOAT3(position(rng), 0.0f, -600.0f);
+        XMStoreFloat3(&rayDirs[i], XMVector3Normalize(XMVectorSet(step(rng), step(rng) * 0.01f, 1.0f, 0.0f)));
+    }
+
+    size_t overlapHits = 0;
+    Report(Run("  overlap queries", 10, queryCount, [&]()
+    {
+        overlapHits = 0;
+        for (const auto &box : queryBoxes)
+        {
+            hits.clear();
+            bvh.QueryOverlap(box, hits);
+            overlapHits += hits.size();
+        }
+    }));
+
+    size_t rayHits = 0;
+    Report(Run("  ray casts, closest", 10, queryCount, [&]()
+    {
+        rayHits = 0;
+        for (size_t i = 0; i < queryCount; ++i)
+        {
+            float t;
+            if (bvh.RayCastClosest(XMLoadFloat3(&rayOrigins[i]), XMLoadFloat3(&rayDirs[i]), 2000.0f, t) >= 0)
+                rayHits++;
+        }
+    }));
+    snprintf(line, sizeof(line), "    %zu overlaps, %zu/%zu rays hit", overlapHits, rayHits, queryCount);
+    Report(std::string(line));
+}
+
+void Benchmark::RunOcclusionCulling()
+{
+    const size_t boxCount = 100000;
+    const int blocksPerSide = 24;
+
+    Report(std::string("Occlusion Culling"));
+
+    // Occluders: a grid of building blocks, each a closed box of 12 triangles
+    const XMFLOAT3 cubePositions[8] =
+    {
+        { -1.0f, 0.0f, -1.0f }, { 1.0f, 0.0f, -1.0f }, { 1.0f, 2.0f, -1.0f }, { -1.0f, 2.0f, -1.0f },
+        { -1.0f, 0.0f,  1.0f }, { 1.0f, 0.0f,  1.0f }, { 1.0f, 2.0f,  1.0f }, { -1.0f, 2.0f,  1.0f },
+    };
+    const uint32_t cubeIndices[36] =
+    {
+        0, 2, 1, 0, 3, 2,   4, 5, 6, 4, 6, 7,   0, 1, 5, 0, 5, 4,
+        3, 6, 2, 3, 7, 6,   0, 4, 7, 0, 7, 3,   1, 2, 6, 1, 6, 5,
+    };
+
+    std::mt19937 rng(5);
+    std::uniform_real_distribution<float> height(2.0f, 12.0f);
+    std::vector<XMFLOAT4X4> blocks;
+    for (int z = 0; z < blocksPerSide; ++z)
+        for (int x = 0; x < blocksPerSide; ++x)
+        {
+            XMFLOAT4X4 world;
+            XMStoreFloat4x4(&world, XMMatrixScaling(3.0f, height(rng), 3.0f) *
+                                    XMMatrixTranslation((x - blocksPerSide / 2) * 10.0f, 0.0f, z * 10.0f + 10.0f));
+            blocks.push_back(world);
+        }
+
+    // Candidates: small boxes scattered between the blocks
+    std::uniform_real_distribution<float> position(-120.0f, 120.0f);
+    std::uniform_real_distribution<float> depth(5.0f, 250.0f);
+    std::uniform_real_distribution<float> size(0.2f, 1.5f);
+    BoundsSoA bounds;
+    bounds.Resize(boxCount);
+    for (size_t i = 0; i < boxCount; ++i)
+    {
+        const float s = size(rng);
+        bounds.Set(i, XMVectorSet(position(rng), s, depth(rng), 0.0f), XMVectorReplicate(s));
+    }
+
+    const XMMATRIX viewProj =
+        XMMatrixLookAtLH(XMVectorSet(0.0f, 3.0f, -5.0f, 1.0f), XMVectorSet(0.0f, 3.0f, 10.0f, 1.0f), XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f)) *
+        XMMatrixPerspectiveFovLH(XM_PIDIV4, 16.0f / 9.0f, 0.1f, 300.0f);
+
+    OcclusionCuller culler;
+    culler.SetResolution(320, 176);
+    auto RenderFrame = [&](ThreadPool *pool)
+    {
+        culler.BeginFrame(viewProj);
+        for (const auto &world : blocks)
+            culler.AddOccluder(cubePositions, sizeof(XMFLOAT3), 8, cubeIndices, 36, XMLoadFloat4x4(&world));
+        culler.Render(pool);
+    };
+
+    ThreadPool pool;
+    char name[64];
+    Report(Run("  rasterise, 1 thread", 50, 1, [&]() { RenderFrame(nullptr); }));
+    snprintf(name, sizeof(name), "  rasterise, %u threads", pool.GetThreadCount());
+    Report(Run(name, 50, 1, [&]() { RenderFrame(&pool); }));
+
+    std::vector<FrustumCuller::ViewMask> masks(boxCount);
+    size_t occluded = 0;
+    Report(Run("  test boxes", 10, boxCount, [&]()
+    {
+        std::fill(masks.begin(), masks.end(), (FrustumCuller::ViewMask)1);
+        occluded = culler.CullOccluded(bounds, masks.data());
+    }));
+
+    char line[256];
+    snprintf(line, sizeof(line), "    %zu occluders, %zu triangles on screen (%zu tile bins), %zu/%zu boxes occluded",
+             culler.GetStats().occluders, culler.GetStats().triangles, culler.GetStats().binnedTriangles,
+             occluded, boxCount);
+    Report(std::string(line));
+}
+
+void Benchmark::RunRenderQueue()
+{
+    const size_t drawCount = 100000;
+    const uint32_t shaderCount = 4, materialCount = 64, vertexBufferCount = 512;
+
+    Report(std::string("Render Queue"));
+
+    // Only the identities of the device objects matter here, they are never dereferenced
+    auto FakeObject = [](uintptr_t kind, uint32_t idx) { return (kind << 24) + ((uintptr_t)idx + 1) * 16; };
+
+    std::mt19937 rng(13);
+    RenderQueue queue;
+    std::vector<std::pair<uint64_t, uint32_t>> keys;
+    for (size_t i = 0; i < drawCount; ++i)
+    {
+        const uint32_t shader = rng() % shaderCount;
+        const uint32_t material = rng() % materialCount;
+        const uint32_t mesh = rng() % vertexBufferCount;
+
+        DrawPacket packet;
+        packet.vertexShader = reinterpret_cast<ID3D11VertexShader*>(FakeObject(1, shader));
+        packet.inputLayout = reinterpret_cast<ID3D11InputLayout*>(FakeObject(2, shader));
+        packet.vertexBuffer = reinterpret_cast<ID3D11Buffer*>(FakeObject(3, mesh));
+        packet.vertexStride = 80;
+        packet.indexBuffer = reinterpret_cast<ID3D11Buffer*>(FakeObject(4, mesh));
+        packet.topology = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
+        packet.objectConstants.buffer = reinterpret_cast<ID3D11Buffer*>(FakeObject(5, (uint32_t)i));
+        packet.indexCount = 36;
+
+        const uint64_t key = RenderQueue::MakeKey(RenderQueue::eOpaquePass,
+                                                  queue.GetObjectId(packet.vertexShader), material + 1, 0,
+                                                  queue.GetObjectId(packet.vertexBuffer),
+                                                  (float)(rng() % 10000) / 10000.0f);
+        queue.Add(key, packet);
+        keys.push_back(std::make_pair(key, (uint32_t)i));
+    }
+
+    // Both sort a fresh copy of the keys in the order they were added
+    std::vector<std::pair<uint64_t, uint32_t>> pairs;
+    Report(Run("  std::sort of (key, index)", 20, drawCount, [&]()
+    {
+        pairs = keys;
+        std::sort(pairs.begin(), pairs.end());
+    }));
+    Report(Run("  radix sort", 20, drawCount, [&]() { queue.Sort(); }));
+
+    bool isSorted = true;
+    for (size_t i = 1; i < queue.Size(); ++i)
+        isSorted &= queue.GetSortedKey(i - 1) <= queue.GetSortedKey(i);
+
+    const RenderQueue::Stats stats = queue.Submit(nullptr);
+    char line[256];
+    snprintf(line, sizeof(line), "    bindings: %zu every draw, %zu filtered in draw order, %zu filtered in key order (%s)",
+             stats.stateChangesNaive, stats.stateChangesUnsorted, stats.stateChanges, isSorted ? "sorted" : "NOT SORTED");
+    Report(std::string(line));
+}
+
+void Benchmark::RunInstancing()
+{
+    const size_t instanceCount = 1000;
+    const size_t primitiveCount = 8;
+    const size_t boneCount = 24;
+
+    Report(std::string("Instancing"));
+
+    // A model like the fox: a few primitives over two materials, skinned by one skeleton
+    // whose palette every instance shares. The device objects are never dereferenced.
+    std::vector<DrawPacket> packets(primitiveCount);
+    for (size_t p = 0; p < primitiveCount; ++p)
+    {
+        packets[p].vertexBuffer = reinterpret_cast<ID3D11Buffer*>((p + 1) * 16);
+        packets[p].vertexStride = 80;
+        packets[p].indexBuffer = reinterpret_cast<ID3D11Buffer*>((p + 1) * 16 + 8);
+        packets[p].topology = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
+        packets[p].indexCount = 300;
+    }
+    std::vector<XMMATRIX> palette(boneCount, XMMatrixIdentity());
+    const int skeleton = 0;
+
+    InstanceBatcher batcher;
+    RecordingInstanceBackend backend;
+    InstanceBatcher::Stats stats;
+    Report(Run("  batch and flush", 100, instanceCount * primitiveCount, [&]()
+    {
+        backend.Clear();
+        batcher.Begin();
+        for (size_t i = 0; i < instanceCount; ++i)
+        {
+            const XMMATRIX world = XMMatrixTranslation((float)i, 0.0f, 0.0f);
+            uint32_t paletteOffset = batcher.FindPalette(&skeleton, 1);
+            if (paletteOffset == InstanceBatcher::InvalidPalette)
+                paletteOffset = batcher.AddPalette(&skeleton, 1, palette.data(), palette.size());
+            for (size_t p = 0; p < primitiveCount; ++p)
+                batcher.Add(packets[p], &packets[p], (int)(p % 2), world, paletteOffset);
+        }
+        stats = batcher.Flush(backend);
+    }));
+
+    // Every primitive is one draw over all instances, in the order they were added
+    bool isValid = (backend.draws.size() == primitiveCount) && (backend.instances.size() == instanceCount * primitiveCount);
+    for (size_t d = 0; isValid && (d < backend.draws.size()); ++d)
+    {
+        const RecordingInstanceBackend::DrawCall &draw = backend.draws[d];
+        isValid &= (draw.packet.vertexBuffer == packets[d].vertexBuffer) &&
+                   (draw.firstInstance == d * instanceCount) && (draw.instanceCount == instanceCount);
+        for (uint32_t i = 0; isValid && (i < draw.instanceCount); ++i)
+            isValid &= (backend.instances[draw.firstInstance + i].world._41 == (float)i);
+    }
+
+    char line[256];
+    snprintf(line, sizeof(line), "    %zu draws -> %zu instanced draws, %zu palette matrices, %zu KB instance data (%s)",
+             instanceCount * primitiveCount, stats.batches, stats.paletteMatrices,
+             stats.instances * sizeof(InstanceData) / 1024, isValid ? "valid" : "INVALID");
+    Report(std::string(line));
+}
+
+void Benchmark::RunCommandStream()
+{
+    const size_t drawCount = 100000;
+    const uint32_t materialCount = 64, vertexBufferCount = 512;
+
+    Report(std::string("Command Stream"));
+
+    // Same kind of scene as RunRenderQueue(), one shader
+    auto FakeObject = [](uintptr_t kind, uint32_t idx) { return (kind << 24) + ((uintptr_t)idx + 1) * 16; };
+
+    std::mt19937 rng(17);
+    RenderQueue queue;
+    for (size_t i = 0; i < drawCount; ++i)
+    {
+        const uint32_t mesh = rng() % vertexBufferCount;
+
+        DrawPacket packet;
+        packet.vertexShader = reinterpret_cast<ID3D11VertexShader*>(FakeObject(1, 0));
+        packet.inputLayout = reinterpret_cast<ID3D11InputLayout*>(FakeObject(2, 0));
+        packet.vertexBuffer = reinterpret_cast<ID3D11Buffer*>(FakeObject(3, mesh));
+        packet.vertexStride = 80;
+        packet.indexBuffer = reinterpret_cast<ID3D11Buffer*>(FakeObject(4, mesh));
+        packet.topology = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
+        packet.objectConstants.buffer = reinterpret_cast<ID3D11Buffer*>(FakeObject(5, 0));
+        packet.objectConstants.firstConstant = (UINT)(i * 16);
+        packet.objectConstants.numConstants = 16;
+        packet.indexCount = 36;
+
+        const uint64_t key = RenderQueue::MakeKey(RenderQueue::eOpaquePass, 1, rng() % materialCount + 1, 0,
+                                                  queue.GetObjectId(packet.vertexBuffer),
+                                                  (float)(rng() % 10000) / 10000.0f);
+        queue.Add(key, packet);
+    }
+    queue.Sort();
+
+    CommandStream stream;
+    Report(Run("  record", 20, drawCount, [&]()
+    {
+        stream.Clear();
+        queue.Submit(&stream);
+    }));
+
+    NullCommandExecutor executor;
+    Report(Run("  replay, null executor", 20, drawCount, [&]()
+    {
+        executor.Reset();
+        stream.Execute(executor);
+    }));
+    const NullCommandExecutor::Stats stats = executor.GetStats();
+
+    // A captured stream replays to the same calls
+    const std::wstring path = L"command_stream_benchmark.bin";
+    CommandStream loaded;
+    NullCommandExecutor loadedExecutor;
+    bool isSame = stream.Save(path) && loaded.Load(path);
+    if (isSame)
+    {
+        loaded.Execute(loadedExecutor);
+        const NullCommandExecutor::Stats &loadedStats = loadedExecutor.GetStats();
+        isSame = (loaded.GetCommandCount() == stream.GetCommandCount()) &&
+                 (loadedStats.totalCalls == stats.totalCalls) && (loadedStats.draws == stats.draws);
+        for (int t = 0; t < CommandStream::eCommandTypeCount; ++t)
+            isSame &= (loadedStats.calls[t] == stats.calls[t]);
+    }
+
+    char line[256];
+    snprintf(line, sizeof(line), "    %zu commands, %.1f KB, %zu draws, %zu calls (%s after save / load)",
+             stream.GetCommandCount(), stream.GetSizeBytes() / 1024.0f, stats.draws, stats.totalCalls,
+             isSame ? "same" : "DIFFERENT");
+    Report(std::string(line));
+    for (int t = 0; t < CommandStream::eCommandTypeCount; ++t)
+    {
+        snprintf(line, sizeof(line), "      %-16s %zu",
+                 Utils::WstringToString(CommandStream::CommandTypeToString((CommandStream::CommandType)t)).c_str(),
+                 stats.calls[t]);
+        Report(std::string(line));
+    }
+}
+
+void Benchmark::RunParallelRecording()
+{
+    const size_t drawCount = 50000;
+    const uint32_t shaderCount = 4, materialCount = 64, vertexBufferCount = 512;
+
+    Report(std::string("Parallel Recording"));
+
+    auto FakeObject = [](uintptr_t kind, uint32_t idx) { return (kind << 24) + ((uintptr_t)idx + 1) * 16; };
+
+    std::mt19937 rng(19);
+    RenderQueue queue;
+    for (size_t i = 0; i < drawCount; ++i)
+    {
+        const uint32_t shader = rng() % shaderCount;
+        const uint32_t material = rng() % materialCount;
+        const uint32_t mesh = rng() % vertexBufferCount;
+
+        DrawPacket packet;
+        packet.vertexShader = reinterpret_cast<ID3D11VertexShader*>(FakeObject(1, shader));
+        packet.inputLayout = reinterpret_cast<ID3D11InputLayout*>(FakeObject(2, shader));
+        packet.vertexBuffer = reinterpret_cast<ID3D11Buffer*>(FakeObject(3, mesh));
+        packet.vertexStride = 80;
+        packet.indexBuffer = reinterpret_cast<ID3D11Buffer*>(FakeObject(4, mesh));
+        packet.topology = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
+        packet.textures = reinterpret_cast<ID3D11ShaderResourceView*>(FakeObject(6, material));
+        packet.objectConstants.buffer = reinterpret_cast<ID3D11Buffer*>(FakeObject(5, 0));
+        packet.objectConstants.firstConstant = (UINT)(i * 16);
+        packet.objectConstants.numConstants = 16;
+        packet.indexCount = 36;
+
+        const uint64_t key = RenderQueue::MakeKey(RenderQueue::eOpaquePass, shader + 1, material + 1, 0,
+                                                  queue.GetObjectId(packet.vertexBuffer),
+                                                  (float)(rng() % 10000) / 10000.0f);
+        queue.Add(key, packet);
+    }
+    queue.Sort();
+
+    CommandStream serial;
+    const RenderQueue::Stats serialStats = queue.Submit(&serial);
+    Report(Run("  record, serial", 20, drawCount, [&]()
+    {
+        serial.Clear();
+        queue.Submit(&serial);
+    }));
+    DrawOrderExecutor serialOrder;
+    serial.Execute(serialOrder);
+
+    // Thread counts include the recording thread, which always takes part
+    char name[64], line[256];
+    const unsigned int maxThreads = ThreadPool::DefaultWorkerCount() + 1;
+    for (unsigned int threadCount = 1; ; threadCount = (std::min)(threadCount * 2, maxThreads))
+    {
+        ThreadPool pool(threadCount - 1);
+        std::vector<CommandStream> streams;
+        RenderQueue::Stats stats;
+        snprintf(name, sizeof(name), "  record, %u thread%s", threadCount, threadCount > 1 ? "s" : "");
+        Report(Run(name, 20, drawCount, [&]() { stats = queue.SubmitParallel(&pool, streams); }));
+
+        // Merged in chunk order, the draws must come out exactly as the serial ones
+        DrawOrderExecutor parallelOrder;
+        size_t commandCount = 0;
+        for (const auto &stream : streams)
+        {
+            stream.Execute(parallelOrder);
+            commandCount += stream.GetCommandCount();
+        }
+        const bool isSameOrder = (parallelOrder.draws == serialOrder.draws) && (stats.draws == serialStats.draws);
+
+        snprintf(line, sizeof(line), "    %zu streams, %zu commands (%zu serial), %zu state changes (%zu serial), order %s",
+                 streams.size(), commandCount, serial.GetCommandCount(), stats.stateChanges,
+                 serialStats.stateChanges, isSameOrder ? "same" : "DIFFERENT");
+        Report(std::string(line));
+
+        if (threadCount == maxThreads)
+            break;
+    }
+}
+
+void Benchmark::RunStaticBatching()
+{
+    const size_t gridSize = 100;
+    const size_t primitiveCount = gridSize * gridSize;
+    const uint32_t materialCount = 8;
+
+    Report(std::string("Static batching"));
+
+    // A unit cube per primitive, laid out on a grid like the props of a level
+    std::vector<SceneVertex> vertices(8);
+    for (size_t v = 0; v < vertices.size(); ++v)
+    {
+        SceneVertex &vertex = vertices[v];
+        vertex = SceneVertex();
+        vertex.Pos = XMFLOAT3((v & 1) ? 0.5f : -0.5f, (v & 2) ? 0.5f : -0.5f, (v & 4) ? 0.5f : -0.5f);
+        XMStoreFloat3(&vertex.Normal, XMVector3Normalize(XMLoadFloat3(&vertex.Pos)));
+        vertex.Tangent = XMFLOAT4(1.0f, 0.0f, 0.0f, 1.0f);
+    }
+    const std::vector<uint32_t> indices =
+    {
+        0, 2, 1, 1, 2, 3,   4, 5, 6, 5, 7, 6,   0, 1, 4, 1, 5, 4,
+        2, 6, 3, 3, 6, 7,   0, 4, 2, 2, 4, 6,   1, 3, 5, 3, 7, 5,
+    };
+
+    std::mt19937 rng(11);
+    std::uniform_int_distribution<uint32_t> material(0, materialCount - 1);
+    std::vector<uint32_t> materials(primitiveCount);
+    for (auto &m : materials)
+        m = material(rng);
+
+    StaticBatcher batcher;
+    Report(Run("  build 10k primitives", 5, primitiveCount, [&]()
+    {
+        batcher.Destroy();
+        for (size_t i = 0; i < primitiveCount; ++i)
+        {
+            const XMMATRIX world = XMMatrixTranslation(((float)(i % gridSize) - gridSize * 0.5f) * 2.0f, 0.0f,
+                                                       ((float)(i / gridSize) - gridSize * 0.5f) * 2.0f);
+            batcher.Add(vertices.data(), vertices.size(), indices.data(), indices.size(),
+                        D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST, materials[i], world);
+        }
+        batcher.Finish();
+    }));
+
+    const XMMATRIX proj = XMMatrixPerspectiveFovLH(XM_PIDIV4, 16.0f / 9.0f, 0.1f, 150.0f);
+    const Frustum views[3] =
+    {
+        Frustum::FromViewProjection(XMMatrixLookAtLH(XMVectorSet(0.0f, 10.0f, -60.0f, 1.0f), XMVectorZero(), XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f)) * proj),
+        Frustum::FromViewProjection(XMMatrixLookAtLH(XMVectorSet(0.0f, 5.0f, 0.0f, 1.0f), XMVectorSet(30.0f, 0.0f, 30.0f, 1.0f), XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f)) * proj),
+        Frustum::FromViewProjection(XMMatrixLookAtLH(XMVectorSet(0.0f, 80.0f, 0.0f, 1.0f), XMVectorZero(), XMVectorSet(0.0f, 0.0f, 1.0f, 0.0f)) * proj),
+    };
+
+    std::vector<FrustumCuller::ViewMask> masks(batcher.GetSubrangeCount());
+    std::vector<StaticBatcher::DrawRange> ranges;
+    for (size_t v = 0; v < 3; ++v)
+    {
+        size_t visible = 0;
+        Report(Run("  cull and merge, view " + std::to_string(v), 50, primitiveCount, [&]()
+        {
+            visible = FrustumCuller::Cull(batcher.GetBounds(), &views[v], 1, masks.data()).visible[0];
+            batcher.GetDrawRanges(masks.data(), ranges);
+        }));
+
+        // The ranges have to cover exactly the indices of the visible primitives
+        size_t indexCount = 0;
+        for (const auto &range : ranges)
+            indexCount += range.indexCount;
+        const bool isValid = (indexCount == visible * indices.size());
+
+        char line[256];
+        snprintf(line, sizeof(line), "    %zu visible primitives: %zu draws unbatched -> %zu draws in %zu batches (%s)",
+                 visible, visible, ranges.size(), batcher.GetBatchCount(), isValid ? "valid" : "INVALID");
+        Report(std::string(line));
+    }
+}
+
+void Benchmark::RunGeometryAllocator()
+{
+    const uint32_t capacity = 1 << 22;
+    const size_t opCount = 100000;
+    const size_t targetLive = 1500;
+
+    Report(std::string("Geometry allocator"));
+
+    // Mesh-sized ranges, 24 to 8k elements, log-uniform; streaming keeps ~1500 of them alive
+    // and replaces a random one at a time
+    struct Op
+    {
+        uint32_t    size;
+        uint32_t    victim;     // live range to free first, by position
+    };
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<float> logSize(std::log(24.0f), std::log(8192.0f));
+    std::vector<Op> ops(opCount);
+    for (auto &op : ops)
+    {
+        op.size = (uint32_t)std::exp(logSize(rng));
+        op.victim = rng();
+    }
+
+    std::vector<TlsfAllocator::Allocation> tlsfLive;
+    std::vector<std::pair<uint32_t, uint32_t>> firstFitLive;    // offset, size
+    size_t tlsfFailed = 0, firstFitFailed = 0;
+
+    TlsfAllocator tlsf;
+    Report(Run("  TLSF allocate / free", 3, opCount, [&]()
+    {
+        tlsf.Reset(capacity);
+        tlsfLive.clear();
+        tlsfFailed = 0;
+        for (const auto &op : ops)
+        {
+            if (tlsfLive.size() >= targetLive)
+            {
+                const size_t victim = op.victim % tlsfLive.size();
+                tlsf.Free(tlsfLive[victim].block);
+                tlsfLive[victim] = tlsfLive.back();
+                tlsfLive.pop_back();
+            }
+            TlsfAllocator::Allocation allocation;
+            if (tlsf.Allocate(op.size, allocation))
+                tlsfLive.push_back(allocation);
+            else
+                tlsfFailed++;
+        }
+    }));
+
+    FirstFitAllocator firstFit;
+    Report(Run("  first-fit allocate / free", 3, opCount, [&]()
+    {
+        firstFit.Reset(capacity);
+        firstFitLive.clear();
+        firstFitFailed = 0;
+        for (const auto &op : ops)
+        {
+            if (firstFitLive.size() >= targetLive)
+            {
+                const size_t victim = op.victim % firstFitLive.size();
+                firstFit.Free(firstFitLive[victim].first, firstFitLive[victim].second);
+                firstFitLive[victim] = firstFitLive.back();
+                firstFitLive.pop_back();
+            }
+            uint32_t offset;
+            if (firstFit.Allocate(op.size, offset))
+                firstFitLive.emplace_back(offset, op.size);
+            else
+                firstFitFailed++;
+        }
+    }));
+
+    const TlsfAllocator::Stats before = tlsf.GetStats();
+    char line[256];
+    snprintf(line, sizeof(line), "    TLSF: %zu ranges, %.0f%% used, %zu free blocks, fragmentation %.1f%%, %zu failed",
+             before.allocations, 100.0 * before.used / before.capacity, before.freeBlocks,
+             before.Fragmentation() * 100.0f, tlsfFailed);
+    Report(std::string(line));
+    snprintf(line, sizeof(line), "    first-fit: %zu free blocks, %zu failed", firstFit.GetFreeBlocks(), firstFitFailed);
+    Report(std::string(line));
+
+    // Defragment() is only timed once, a second run would have nothing to move
+    std::vector<TlsfAllocator::Relocation> relocations;
+    TlsfAllocator packed;
+    Result defrag;
+    {
+        packed = tlsf;
+        Timer timer;
+        packed.Defragment(relocations);
+        defrag.totalMs = timer.ElapsedMs();
+    }
+    defrag.name = "  TLSF defragment";
+    defrag.iterations = 1;
+    defrag.opsPerIteration = before.allocations;
+    Report(defrag);
+
+    size_t movedUnits = 0;
+    for (const auto &relocation : relocations)
+        movedUnits += relocation.size;
+
+    const TlsfAllocator::Stats after = packed.GetStats();
+    snprintf(line, sizeof(line), "    %zu ranges moved (%zu units), %zu free blocks, fragmentation %.1f%%",
+             relocations.size(), movedUnits, after.freeBlocks, after.Fragmentation() * 100.0f);
+    Report(std::string(line));
+}
+
+void Benchmark::RunVertexCompression()
+{
+    const size_t vertexCount = 50000;
+
+    Report(std::string("Vertex compression"));
+
+    struct MeshSpec
+    {
+        const char* name;
+        float       extent;     // of the positions, in model units
+        uint32_t    firstJoint;
+        uint32_t    jointCount; // 0 for a static mesh
+    };
+    const MeshSpec specs[] =
+    {
+        { "static, 4 units",                    4.0f,      0,   0 },
+        { "skinned, 2 units",                   2.0f,      0,  64 },
+        { "static, 2000 units",                 2000.0f,   0,   0 },
+        { "skinned, joints 100-299",            2.0f,    100, 200 },
+        { "skinned, 300 joints, 2000 units",    2000.0f,   0, 300 },
+    };
+
+    std::mt19937 rng(5);
+    std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+    std::uniform_real_distribution<float> uv(0.0f, 4.0f);
+    std::vector<SceneVertex> vertices(vertexCount), decoded;
+    std::vector<uint8_t> encoded;
+    for (const auto &spec : specs)
+    {
+        for (auto &vertex : vertices)
+        {
+            vertex = SceneVertex();
+            vertex.Pos = XMFLOAT3(unit(rng) * spec.extent * 0.5f, unit(rng) * spec.extent * 0.5f, unit(rng) * spec.extent * 0.5f);
+
+            const XMVECTOR normal = XMVector3Normalize(XMVectorSet(unit(rng), unit(rng), unit(rng), 0.0f));
+            const XMVECTOR tangent = XMVector3Normalize(XMVector3Cross(normal, XMVector3Normalize(XMVectorSet(unit(rng), unit(rng), unit(rng), 0.0f))));
+            XMStoreFloat3(&vertex.Normal, normal);
+            XMStoreFloat4(&vertex.Tangent, XMVectorSetW(tangent, (rng() & 1) ? 1.0f : -1.0f));
+            vertex.Tex = XMFLOAT2(uv(rng), uv(rng));
+
+            if (spec.jointCount == 0)
+                continue;
+            // 1 to 4 influences, normalised
+            const uint32_t influences = 1 + rng() % 4;
+            float weights[4] = {}, sum = 0.0f;
+            uint32_t joints[4] = {};
+            for (uint32_t k = 0; k < influences; ++k)
+            {
+                weights[k] = 0.05f + (unit(rng) + 1.0f);
+                joints[k] = spec.firstJoint + rng() % spec.jointCount;
+                sum += weights[k];
+            }
+            vertex.Weights = XMFLOAT4(weights[0] / sum, weights[1] / sum, weights[2] / sum, weights[3] / sum);
+            vertex.Joints = XMUINT4(joints[0], joints[1], joints[2], joints[3]);
+        }
+
+        const VertexCodec::Encoding encoding = VertexCodec::Choose(vertices.data(), vertices.size());
+        Report(Run(std::string("  encode, ") + spec.name, 5, vertexCount, [&]()
+        {
+            VertexCodec::Encode(vertices.data(), vertices.size(), encoding, encoded);
+        }));
+        Report(Run(std::string("  decode, ") + spec.name, 5, vertexCount, [&]()
+        {
+            VertexCodec::Decode(encoded.data(), vertices.size(), encoding, decoded);
+        }));
+
+        const VertexCodec::Error error = VertexCodec::Measure(vertices.data(), decoded.data(), vertices.size());
+
+        char line[256];
+        snprintf(line, sizeof(line), "    %zu -> %u bytes/vertex (%s positions%s)",
+                 sizeof(SceneVertex), encoding.stride, encoding.isQuantised ? "unorm16" : "float",
+                 !encoding.isSkinned ? ", no skin" : (encoding.hasWideJoints ? ", uint16 joints" :
+                 (encoding.jointPalette.empty() ? ", uint8 joints" : ", uint8 joints through a palette")));
+        Report(std::string(line));
+        snprintf(line, sizeof(line), "    max error: position %.2e, normal %.4f deg, tangent %.4f deg (%zu flips), uv %.2e, weight %.4f, joints %zu",
+                 error.position, error.normalDegrees, error.tangentDegrees, error.handednessFlips, error.uv,
+                 error.weight, error.jointMismatches);
+        Report(std::string(line));
+    }
+}
+
+bool Benchmark::RunStreamReplay(const std::wstring &path)
+{
+    Report("Stream Replay: " + Utils::WstringToString(path));
+
+    CommandStream stream;
+    if (!stream.Load(path))
+    {
+        Report(std::string("    failed to load"));
+        return false;
+    }
+
+    NullCommandExecutor executor;
+    Report(Run("  replay, null executor", 100, stream.GetCommandCount(), [&]()
+    {
+        executor.Reset();
+        stream.Execute(executor);
+    }));
+    const NullCommandExecutor::Stats &stats = executor.GetStats();
+
+    char line[256];
+    snprintf(line, sizeof(line), "    %zu commands, %.1f KB, %zu draws, %zu indices, %.1f KB updated",
+             stream.GetCommandCount(), stream.GetSizeBytes() / 1024.0f, stats.draws, stats.indices,
+             stats.updateBytes / 1024.0f);
+    Report(std::string(line));
+    for (int t = 0; t < CommandStream::eCommandTypeCount; ++t)
+    {
+        snprintf(line, sizeof(line), "      %-16s %zu",
+                 Utils::WstringToString(CommandStream::CommandTypeToString((CommandStream::CommandType)t)).c_str(),
+                 stats.calls[t]);
+        Report(std::string(line));
+    }
+    return true;
+}
+
+bool Benchmark::RunHeadless(const std::wstring &clipsPath, const std::vector<std::wstring> &streamPaths)
+{
+    bool ok = true;
+
+    // The clips need the glTF file only, no device
+    std::vector<ClipHandle> clips;
+    tinygltf::Model model;
+    if (GltfUtils::LoadModel(model, clipsPath))
+        clips = AnimationLibrary::Get().LoadFromGltf(model, clipsPath);
+    if (clips.empty())
+    {
+        Report("No clips in " + Utils::WstringToString(clipsPath) + ", skipping the animation suites");
+        ok = false;
+    }
+    else
+    {
+        RunTrackEvaluation(clips);
+        RunRotationInterpolation(clips);
+    }
+
+    RunTransformHierarchy();
+    RunFrustumCulling();
+    RunBvh();
+    RunOcclusionCulling();
+    RunRenderQueue();
+    RunInstancing();
+    RunCommandStream();
+    RunParallelRecording();
+    RunStaticBatching();
+    RunGeometryAllocator();
+    RunVertexCompression();
+
+    for (const auto &path : streamPaths)
+        ok &= RunStreamReplay(path);
+
+    return ok;
+}
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <chrono>
+
+class Animation;
+using ClipHandle = std::shared_ptr<const Animation>;
+
+namespace Benchmark
+{
+    // Monotonic stopwatch, needs nothing from the platform
+    class Timer
+    {
+    public:
+        Timer() { Reset(); }
+
+        void Reset() { mStart = std::chrono::steady_clock::now(); }
+
+        double ElapsedMs() const
+        {
+            return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - mStart).count();
+        }
+
+    private:
+        std::chrono::steady_clock::time_point mStart;
+    };
+
+    struct Result
+    {
+        std::string name;
+        size_t      iterations = 0;
+        size_t      opsPerIteration = 1;
+        double      totalMs = 0.0;
+
+        double NsPerOp() const
+        {
+            const double ops = (double)iterations * (double)opsPerIteration;
+            return ops > 0.0 ? totalMs * 1e6 / ops : 0.0;
+        }
+    };
+
+    // Runs func once to warm up, then 'iterations' times under the timer
+    template <typename Func>
+    Result Run(const std::string &name, size_t iterations, size_t opsPerIteration, Func &&func)
+    {
+        func();
+
+        Timer timer;
+        for (size_t i = 0; i < iterations; ++i)
+            func();
+
+        Result result;
+        result.name = name;
+        result.iterations = iterations;
+        result.opsPerIteration = opsPerIteration;
+        result.totalMs = timer.ElapsedMs();
+        return result;
+    }
+
+    // Logs the result (Log::Info) and keeps it for display in the UI
+    void Report(const Result &result);
+    void Report(const std::string &line);
+
+    const std::vector<std::string>& GetReport();
+    void ClearReport();
+
+    // Suites
+
+    // Specialised per-(path, interpolation) track kernels vs. the former generic branching evaluator
+    void RunTrackEvaluation(const std::vector<ClipHandle> &clips);
+
+    // Throughput of the batched rotation evaluator per precision tier on the clips' key pairs
+    void RunRotationInterpolation(const std::vector<ClipHandle> &clips);
+
+    // World matrix propagation over synthetic 10k-100k node scenes: the former recursive
+    // tree of nodes holding their children by value vs. the flat TransformHierarchy pass,
+    // with everything moving and with a single moving leaf
+    void RunTransformHierarchy();
+
+    // Scalar vs. 4-wide frustum culling of 100k random boxes against one and three views
+    void RunFrustumCulling();
+
+    // InstanceBvh on a synthetic 100k-instance scene: SAH build, refit after 10% / all instances
+    // moved, and frustum, overlap and ray queries against brute force
+    void RunBvh();
+
+    // Software occlusion culling of 100k boxes behind a city-like block of occluders: depth
+    // rasterisation on one thread and on the thread pool, then the Hi-Z box tests
+    void RunOcclusionCulling();
+
+    // Render queue on 100k synthetic draws: radix sort of the 64-bit keys vs. std::sort, and
+    // the bindings submission issues in the order the draws were added and in key order
+    void RunRenderQueue();
+
+    // InstanceBatcher on 1000 instances of an 8-primitive model, into the recording backend:
+    // batching and the one-pass instance fill, draws before and after, and a check of the ranges
+    void RunInstancing();
+
+    // Command streams on 100k synthetic draws: recording the sorted render queue, replaying it
+    // through the null executor, and the same replay after a save / load round trip
+    void RunCommandStream();
+
+    // Parallel recording of 50k sorted draws into per-thread command streams, timed for
+    // 1, 2, 4, ... threads, with a check that the merged streams draw in the serial order
+    void RunParallelRecording();
+
+    // StaticBatcher on a 10k-primitive static scene over 8 materials: building the batches, then
+    // culling the subranges and merging the visible ones, with the draws before and after per view
+    void RunStaticBatching();
+
+    // TlsfAllocator against a first-fit free list on 100k allocations and frees of mesh-sized
+    // ranges: time per operation, failed allocations and fragmentation, then Defragment()
+    // with the fragmentation after it
+    void RunGeometryAllocator();
+
+    // VertexCodec round trip on synthetic static, skinned, large, palette and many-joint meshes: the
+    // encoding chosen, bytes per vertex, encode / decode time and the largest error of each attribute
+    void RunVertexCompression();
+
+    // Loads a captured command stream (see CommandStream::Save) and times its replay through
+    // the null executor, with the calls per command type. False if the file is not a valid stream.
+    bool RunStreamReplay(const std::wstring &path);
+
+    // Everything above that needs no device: the suites, with the clips of the glTF file
+    // 'clipsPath', then a replay of each stream. False if the clips or a stream failed to load.
+    bool RunHeadless(const std::wstring &clipsPath, const std::vector<std::wstring> &streamPaths);
+}
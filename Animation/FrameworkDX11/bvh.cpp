@@ -0,0 +1,498 @@
+#include "bvh.hpp"
+
+#include <algorithm>
+#include <functional>
+#include <cmath>
+#include <cfloat>
+
+namespace
+{
+    const int BinCount = 12;
+
+    inline XMVECTOR LoadMin(const Aabb &box) { return XMLoadFloat3(&box.min); }
+    inline XMVECTOR LoadMax(const Aabb &box) { return XMLoadFloat3(&box.max); }
+
+    inline float HalfArea(FXMVECTOR boxMin, FXMVECTOR boxMax)
+    {
+        XMFLOAT3 e;
+        XMStoreFloat3(&e, XMVectorMax(boxMax - boxMin, XMVectorZero()));
+        return e.x * e.y + e.y * e.z + e.z * e.x;
+    }
+
+    // -1 outside, 0 intersecting, 1 fully inside
+    int ClassifyBox(const Frustum &frustum, const XMFLOAT3 &boxMin, const XMFLOAT3 &boxMax)
+    {
+        const float cx = (boxMin.x + boxMax.x) * 0.5f, ex = (boxMax.x - boxMin.x) * 0.5f;
+        const float cy = (boxMin.y + boxMax.y) * 0.5f, ey = (boxMax.y - boxMin.y) * 0.5f;
+        const float cz = (boxMin.z + boxMax.z) * 0.5f, ez = (boxMax.z - boxMin.z) * 0.5f;
+
+        int result = 1;
+        for (const auto &p : frustum.planes)
+        {
+            const float dist = p.x * cx + p.y * cy + p.z * cz + p.w;
+            const float radius = std::fabs(p.x) * ex + std::fabs(p.y) * ey + std::fabs(p.z) * ez;
+            if (dist + radius < 0.0f)
+                return -1;
+            if (dist - radius < 0.0f)
+                result = 0;
+        }
+        return result;
+    }
+
+    inline bool Overlaps(const XMFLOAT3 &aMin, const XMFLOAT3 &aMax, const Aabb &b)
+    {
+        return (aMin.x <= b.max.x) && (aMax.x >= b.min.x) &&
+               (aMin.y <= b.max.y) && (aMax.y >= b.min.y) &&
+               (aMin.z <= b.max.z) && (aMax.z >= b.min.z);
+    }
+
+    struct Ray
+    {
+        XMFLOAT3 origin;
+        XMFLOAT3 invDir;
+        float    maxT;
+
+        Ray(FXMVECTOR o, FXMVECTOR d, float t) : maxT(t)
+        {
+            XMFLOAT3 dir;
+            XMStoreFloat3(&origin, o);
+            XMStoreFloat3(&dir, d);
+            // Axis-parallel rays get a huge inverse instead of a division by zero
+            invDir.x = (dir.x != 0.0f) ? 1.0f / dir.x : FLT_MAX;
+            invDir.y = (dir.y != 0.0f) ? 1.0f / dir.y : FLT_MAX;
+            invDir.z = (dir.z != 0.0f) ? 1.0f / dir.z : FLT_MAX;
+        }
+
+        // Entry distance, or FLT_MAX if the ray misses the box within [0, maxT]
+        float Intersect(const XMFLOAT3 &boxMin, const XMFLOAT3 &boxMax) const
+        {
+            const float tx1 = (boxMin.x - origin.x) * invDir.x, tx2 = (boxMax.x - origin.x) * invDir.x;
+            const float ty1 = (boxMin.y - origin.y) * invDir.y, ty2 = (boxMax.y - origin.y) * invDir.y;
+            const float tz1 = (boxMin.z - origin.z) * invDir.z, tz2 = (boxMax.z - origin.z) * invDir.z;
+            const float tmin = (std::max)((std::max)((std::min)(tx1, tx2), (std::min)(ty1, ty2)), (std::max)((std::min)(tz1, tz2), 0.0f));
+            const float tmax = (std::min)((std::min)((std::max)(tx1, tx2), (std::max)(ty1, ty2)), (std::min)((std::max)(tz1, tz2), maxT));
+            return (tmin <= tmax) ? tmin : FLT_MAX;
+        }
+    };
+}
+
+void InstanceBvh::Clear()
+{
+    mNodes.clear();
+    mParents.clear();
+    mIndices.clear();
+    mLeafOfInstance.clear();
+    mInstanceBounds.clear();
+    mDirtyNodes.clear();
+    mIsDirty.clear();
+    mBuildCost = 0.0f;
+}
+
+void InstanceBvh::Build(const Aabb *bounds, size_t count)
+{
+    Clear();
+    if (count == 0)
+        return;
+
+    mInstanceBounds.assign(bounds, bounds + count);
+    mIndices.resize(count);
+    std::vector<XMFLOAT3> centroids(count);
+    for (size_t i = 0; i < count; ++i)
+    {
+        mIndices[i] = (uint32_t)i;
+        XMStoreFloat3(&centroids[i], (LoadMin(bounds[i]) + LoadMax(bounds[i])) * 0.5f);
+    }
+
+    mNodes.reserve(2 * count);
+    mParents.reserve(2 * count);
+    mNodes.push_back({ XMFLOAT3(), 0, XMFLOAT3(), (uint32_t)count });
+    mParents.push_back(UINT32_MAX);
+    UpdateNodeBounds(0);
+    Subdivide(0, centroids);
+
+    mLeafOfInstance.resize(count);
+    for (uint32_t n = 0; n < (uint32_t)mNodes.size(); ++n)
+        for (uint32_t i = 0; i < mNodes[n].count; ++i)
+            mLeafOfInstance[mIndices[mNodes[n].first + i]] = n;
+
+    mIsDirty.assign(mNodes.size(), 0);
+    mBuildCost = GetSahCost();
+}
+
+void InstanceBvh::Subdivide(uint32_t rootIdx, std::vector<XMFLOAT3> &centroids)
+{
+    std::vector<uint32_t> stack(1, rootIdx);
+    while (!stack.empty())
+    {
+        const uint32_t nodeIdx = stack.back();
+        stack.pop_back();
+
+        const uint32_t first = mNodes[nodeIdx].first;
+        const uint32_t count = mNodes[nodeIdx].count;
+        if (count <= 1)
+            continue;
+
+        // Bin the centroids along each axis and sweep for the cheapest split
+        XMVECTOR cMin = XMLoadFloat3(&centroids[mIndices[first]]);
+        XMVECTOR cMax = cMin;
+        for (uint32_t i = 1; i < count; ++i)
+        {
+            const XMVECTOR c = XMLoadFloat3(&centroids[mIndices[first + i]]);
+            cMin = XMVectorMin(cMin, c);
+            cMax = XMVectorMax(cMax, c);
+        }
+        XMFLOAT3 lo, hi;
+        XMStoreFloat3(&lo, cMin);
+        XMStoreFloat3(&hi, cMax);
+        const float axisMin[3] = { lo.x, lo.y, lo.z };
+        const float axisExtent[3] = { hi.x - lo.x, hi.y - lo.y, hi.z - lo.z };
+
+        int bestAxis = -1, bestSplit = 0;
+        float bestCost = FLT_MAX;
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            if (axisExtent[axis] <= 0.0f)
+                continue;
+
+            struct Bin { XMVECTOR boxMin, boxMax; uint32_t count; };
+            Bin bins[BinCount];
+            for (auto &bin : bins)
+            {
+                bin.boxMin = XMVectorReplicate(FLT_MAX);
+                bin.boxMax = XMVectorReplicate(-FLT_MAX);
+                bin.count = 0;
+            }
+
+            const float scale = BinCount / axisExtent[axis];
+            for (uint32_t i = 0; i < count; ++i)
+            {
+                const uint32_t instance = mIndices[first + i];
+                const float c = (&centroids[instance].x)[axis];
+                Bin &bin = bins[(std::min)(BinCount - 1, (int)((c - axisMin[axis]) * scale))];
+                bin.boxMin = XMVectorMin(bin.boxMin, LoadMin(mInstanceBounds[instance]));
+                bin.boxMax = XMVectorMax(bin.boxMax, LoadMax(mInstanceBounds[instance]));
+                bin.count++;
+            }
+
+            // cost(split after bin b) = leftArea * leftCount + rightArea * rightCount
+            float leftCost[BinCount - 1];
+            XMVECTOR accMin = XMVectorReplicate(FLT_MAX), accMax = XMVectorReplicate(-FLT_MAX);
+            uint32_t accCount = 0;
+            for (int b = 0; b < BinCount - 1; ++b)
+            {
+                accMin = XMVectorMin(accMin, bins[b].boxMin);
+                accMax = XMVectorMax(accMax, bins[b].boxMax);
+                accCount += bins[b].count;
+                leftCost[b] = accCount ? HalfArea(accMin, accMax) * accCount : 0.0f;
+            }
+            accMin = XMVectorReplicate(FLT_MAX);
+            accMax = XMVectorReplicate(-FLT_MAX);
+            accCount = 0;
+            for (int b = BinCount - 1; b > 0; --b)
+            {
+                accMin = XMVectorMin(accMin, bins[b].boxMin);
+                accMax = XMVectorMax(accMax, bins[b].boxMax);
+                accCount += bins[b].count;
+                const float cost = leftCost[b - 1] + (accCount ? HalfArea(accMin, accMax) * accCount : 0.0f);
+                if ((accCount > 0) && (accCount < count) && (cost < bestCost))
+                {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestSplit = b;
+                }
+            }
+        }
+
+        const Node &node = mNodes[nodeIdx];
+        const float leafCost = HalfArea(XMLoadFloat3(&node.boundsMin), XMLoadFloat3(&node.boundsMax)) * count;
+        if ((count <= MaxLeafSize) && (bestCost >= leafCost))
+            continue;
+
+        uint32_t leftCount = 0;
+        if (bestAxis >= 0)
+        {
+            const float scale = BinCount / axisExtent[bestAxis];
+            auto begin = mIndices.begin() + first;
+            auto mid = std::partition(begin, begin + count, [&](uint32_t instance)
+            {
+                const float c = (&centroids[instance].x)[bestAxis];
+                return (std::min)(BinCount - 1, (int)((c - axisMin[bestAxis]) * scale)) < bestSplit;
+            });
+            leftCount = (uint32_t)(mid - begin);
+        }
+        else
+            leftCount = count / 2; // all centroids coincide, any split is as good
+
+        const uint32_t left = (uint32_t)mNodes.size();
+        mNodes.push_back({ XMFLOAT3(), first, XMFLOAT3(), leftCount });
+        mNodes.push_back({ XMFLOAT3(), first + leftCount, XMFLOAT3(), count - leftCount });
+        mParents.push_back(nodeIdx);
+        mParents.push_back(nodeIdx);
+        mNodes[nodeIdx].first = left;
+        mNodes[nodeIdx].count = 0;
+
+        UpdateNodeBounds(left);
+        UpdateNodeBounds(left + 1);
+        stack.push_back(left);
+        stack.push_back(left + 1);
+    }
+}
+
+void InstanceBvh::UpdateNodeBounds(uint32_t nodeIdx)
+{
+    Node &node = mNodes[nodeIdx];
+    XMVECTOR boxMin, boxMax;
+    if (node.count > 0)
+    {
+        boxMin = XMVectorReplicate(FLT_MAX);
+        boxMax = XMVectorReplicate(-FLT_MAX);
+        for (uint32_t i = 0; i < node.count; ++i)
+        {
+            const Aabb &box = mInstanceBounds[mIndices[node.first + i]];
+            boxMin = XMVectorMin(boxMin, LoadMin(box));
+            boxMax = XMVectorMax(boxMax, LoadMax(box));
+        }
+    }
+    else
+    {
+        const Node &l = mNodes[node.first];
+        const Node &r = mNodes[node.first + 1];
+        boxMin = XMVectorMin(XMLoadFloat3(&l.boundsMin), XMLoadFloat3(&r.boundsMin));
+        boxMax = XMVectorMax(XMLoadFloat3(&l.boundsMax), XMLoadFloat3(&r.boundsMax));
+    }
+    XMStoreFloat3(&node.boundsMin, boxMin);
+    XMStoreFloat3(&node.boundsMax, boxMax);
+}
+
+void InstanceBvh::UpdateInstance(uint32_t instance, const Aabb &bounds)
+{
+    if (instance >= mInstanceBounds.size())
+        return;
+
+    mInstanceBounds[instance] = bounds;
+    const uint32_t leaf = mLeafOfInstance[instance];
+    if (!mIsDirty[leaf])
+    {
+        mIsDirty[leaf] = 1;
+        mDirtyNodes.push_back(leaf);
+    }
+}
+
+void InstanceBvh::Refit()
+{
+    if (mDirtyNodes.empty())
+        return;
+
+    // Every ancestor of a changed leaf has to be refitted too, each one once
+    const size_t leafCount = mDirtyNodes.size();
+    for (size_t i = 0; i < leafCount; ++i)
+        for (uint32_t n = mParents[mDirtyNodes[i]]; (n != UINT32_MAX) && !mIsDirty[n]; n = mParents[n])
+        {
+            mIsDirty[n] = 1;
+            mDirtyNodes.push_back(n);
+        }
+
+    // Children always have larger indices than their parent
+    std::sort(mDirtyNodes.begin(), mDirtyNodes.end(), std::greater<uint32_t>());
+    for (uint32_t n : mDirtyNodes)
+    {
+        UpdateNodeBounds(n);
+        mIsDirty[n] = 0;
+    }
+    mDirtyNodes.clear();
+}
+
+float InstanceBvh::GetSahCost() const
+{
+    if (mNodes.empty())
+        return 0.0f;
+
+    const float rootArea = HalfArea(XMLoadFloat3(&mNodes[0].boundsMin), XMLoadFloat3(&mNodes[0].boundsMax));
+    if (rootArea <= 0.0f)
+        return (float)mInstanceBounds.size();
+
+    // Node visits plus box tests, each weighted by the chance a random query reaches it
+    float cost = 0.0f;
+    for (const auto &node : mNodes)
+    {
+        const float area = HalfArea(XMLoadFloat3(&node.boundsMin), XMLoadFloat3(&node.boundsMax));
+        cost += area * ((node.count > 0) ? (float)node.count : 1.0f);
+    }
+    return cost / rootArea;
+}
+
+void InstanceBvh::AppendSubtree(uint32_t nodeIdx, std::vector<uint32_t> &out) const
+{
+    // Internal nodes don't store the index range they cover, so walk down to the leaves
+    std::vector<uint32_t> stack(1, nodeIdx);
+    while (!stack.empty())
+    {
+        const Node &node = mNodes[stack.back()];
+        stack.pop_back();
+        if (node.count > 0)
+            out.insert(out.end(), mIndices.begin() + node.first, mIndices.begin() + node.first + node.count);
+        else
+        {
+            stack.push_back(node.first);
+            stack.push_back(node.first + 1);
+        }
+    }
+}
+
+void InstanceBvh::QueryFrustum(const Frustum &frustum, std::vector<uint32_t> &out) const
+{
+    if (mNodes.empty())
+        return;
+
+    uint32_t stack[64];
+    int top = 0;
+    stack[top++] = 0;
+    while (top > 0)
+    {
+        const uint32_t nodeIdx = stack[--top];
+        const Node &node = mNodes[nodeIdx];
+
+        const int side = ClassifyBox(frustum, node.boundsMin, node.boundsMax);
+        if (side < 0)
+            continue;
+        if (side > 0)
+        {
+            AppendSubtree(nodeIdx, out);
+            continue;
+        }
+
+        if (node.count > 0)
+        {
+            for (uint32_t i = 0; i < node.count; ++i)
+            {
+                const uint32_t instance = mIndices[node.first + i];
+                const Aabb &box = mInstanceBounds[instance];
+                if (ClassifyBox(frustum, box.min, box.max) >= 0)
+                    out.push_back(instance);
+            }
+        }
+        else if (top + 2 <= 64)
+        {
+            stack[top++] = node.first;
+            stack[top++] = node.first + 1;
+        }
+        else
+        {
+            AppendSubtree(nodeIdx, out); // too deep, stay conservative
+        }
+    }
+}
+
+void InstanceBvh::QueryOverlap(const Aabb &box, std::vector<uint32_t> &out) const
+{
+    if (mNodes.empty())
+        return;
+
+    std::vector<uint32_t> stack(1, 0);
+    while (!stack.empty())
+    {
+        const Node &node = mNodes[stack.back()];
+        stack.pop_back();
+        if (!Overlaps(node.boundsMin, node.boundsMax, box))
+            continue;
+
+        if (node.count > 0)
+        {
+            for (uint32_t i = 0; i < node.count; ++i)
+            {
+                const uint32_t instance = mIndices[node.first + i];
+                const Aabb &other = mInstanceBounds[instance];
+                if (Overlaps(other.min, other.max, box))
+                    out.push_back(instance);
+            }
+        }
+        else
+        {
+            stack.push_back(node.first);
+            stack.push_back(node.first + 1);
+        }
+    }
+}
+
+void InstanceBvh::QueryRay(FXMVECTOR origin, FXMVECTOR direction, float maxT, std::vector<uint32_t> &out) const
+{
+    if (mNodes.empty())
+        return;
+
+    const Ray ray(origin, direction, maxT);
+    std::vector<uint32_t> stack(1, 0);
+    while (!stack.empty())
+    {
+        const Node &node = mNodes[stack.back()];
+        stack.pop_back();
+        if (ray.Intersect(node.boundsMin, node.boundsMax) == FLT_MAX)
+            continue;
+
+        if (node.count > 0)
+        {
+            for (uint32_t i = 0; i < node.count; ++i)
+            {
+                const uint32_t instance = mIndices[node.first + i];
+                const Aabb &box = mInstanceBounds[instance];
+                if (ray.Intersect(box.min, box.max) != FLT_MAX)
+                    out.push_back(instance);
+            }
+        }
+        else
+        {
+            stack.push_back(node.first);
+            stack.push_back(node.first + 1);
+        }
+    }
+}
+
+int InstanceBvh::RayCastClosest(FXMVECTOR origin, FXMVECTOR direction, float maxT, float &outT) const
+{
+    int hit = -1;
+    outT = maxT;
+    if (mNodes.empty())
+        return hit;
+
+    Ray ray(origin, direction, maxT);
+    std::vector<uint32_t> stack(1, 0);
+    while (!stack.empty())
+    {
+        const Node &node = mNodes[stack.back()];
+        stack.pop_back();
+
+        if (node.count > 0)
+        {
+            for (uint32_t i = 0; i < node.count; ++i)
+            {
+                const uint32_t instance = mIndices[node.first + i];
+                const Aabb &box = mInstanceBounds[instance];
+                const float t = ray.Intersect(box.min, box.max);
+                if (t < ray.maxT)
+                {
+                    ray.maxT = t;
+                    hit = (int)instance;
+                }
+            }
+            continue;
+        }
+
+        // Visit the nearer child first, it is popped next
+        const uint32_t a = node.first, b = node.first + 1;
+        const float ta = ray.Intersect(mNodes[a].boundsMin, mNodes[a].boundsMax);
+        const float tb = ray.Intersect(mNodes[b].boundsMin, mNodes[b].boundsMax);
+        if (ta <= tb)
+        {
+            if (tb != FLT_MAX) stack.push_back(b);
+            if (ta != FLT_MAX) stack.push_back(a);
+        }
+        else
+        {
+            if (ta != FLT_MAX) stack.push_back(a);
+            stack.push_back(b);
+        }
+    }
+
+    if (hit >= 0)
+        outT = ray.maxT;
+    return hit;
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <DirectXMath.h>
+
+#include "frustum_culler.hpp"
+
+using namespace DirectX;
+
+struct Aabb
+{
+    XMFLOAT3 min;
+    XMFLOAT3 max;
+};
+
+// Bounding volume hierarchy over instance boxes. Built top-down with a binned surface area
+// heuristic; moving instances are refitted bottom-up from their leaves only. Refitting lets
+// the tree degrade, so owners check NeedsRebuild() now and then and build it again.
+class InstanceBvh
+{
+public:
+
+    static const uint32_t MaxLeafSize = 4;
+
+    void Build(const Aabb *bounds, size_t count);
+    void Clear();
+
+    // Stores the new box and marks its leaf; Refit() then updates the changed branches
+    void UpdateInstance(uint32_t instance, const Aabb &bounds);
+    void Refit();
+
+    // Expected cost of a query, relative to testing every instance once
+    float GetSahCost() const;
+    // True once refitting made the tree noticeably worse than right after the build
+    bool NeedsRebuild(float maxCostRatio = 1.5f) const { return GetSahCost() > mBuildCost * maxCostRatio; }
+
+    // Queries append instance indices to 'out'
+    void QueryFrustum(const Frustum &frustum, std::vector<uint32_t> &out) const;
+    void QueryOverlap(const Aabb &box, std::vector<uint32_t> &out) const;
+    void QueryRay(FXMVECTOR origin, FXMVECTOR direction, float maxT, std::vector<uint32_t> &out) const;
+    // Closest instance box the ray enters, -1 if none
+    int RayCastClosest(FXMVECTOR origin, FXMVECTOR direction, float maxT, float &outT) const;
+
+    size_t GetInstanceCount() const { return mInstanceBounds.size(); }
+    size_t GetNodeCount() const { return mNodes.size(); }
+    bool IsEmpty() const { return mNodes.empty(); }
+
+private:
+
+    // Leaf if count > 0: instances mIndices[first .. first + count).
+    // Otherwise the children are nodes 'first' and 'first + 1', always after their parent.
+    struct Node
+    {
+        XMFLOAT3 boundsMin;
+        uint32_t first;
+        XMFLOAT3 boundsMax;
+        uint32_t count;
+    };
+
+    void Subdivide(uint32_t nodeIdx, std::vector<XMFLOAT3> &centroids);
+    void UpdateNodeBounds(uint32_t nodeIdx);
+    void AppendSubtree(uint32_t nodeIdx, std::vector<uint32_t> &out) const;
+
+    std::vector<Node>       mNodes;
+    std::vector<uint32_t>   mParents;
+    std::vector<uint32_t>   mIndices;           // instance indices, grouped per leaf
+    std::vector<uint32_t>   mLeafOfInstance;
+    std::vector<Aabb>       mInstanceBounds;
+
+    std::vector<uint32_t>   mDirtyNodes;
+    std::vector<uint8_t>    mIsDirty;
+    float                   mBuildCost = 0.0f;
+};
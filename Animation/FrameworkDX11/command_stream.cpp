@@ -0,0 +1,408 @@
+#include "command_stream.hpp"
+#include "log.hpp"
+#include "utils.hpp"
+
+#include <cstring>
+#include <fstream>
+
+namespace
+{
+    // Payloads, copied in and out with memcpy so the stream needs no alignment
+    struct SetObjectCmd
+    {
+        const void* object;
+    };
+    struct SetVertexBufferCmd
+    {
+        ID3D11Buffer*   buffer;
+        uint32_t        slot;
+        uint32_t        stride;
+    };
+    struct SetValueCmd
+    {
+        uint32_t        value;
+    };
+    struct SetConstantsCmd
+    {
+        ID3D11Buffer*   buffer;
+        uint32_t        slot;
+        uint32_t        firstConstant;
+        uint32_t        numConstants;
+    };
+    struct SetResourceCmd
+    {
+        ID3D11ShaderResourceView*   view;
+        uint32_t                    slot;
+    };
+    struct UpdateBufferCmd
+    {
+        ID3D11Buffer*   buffer;
+        uint64_t        size;       // of the data following the command
+    };
+    struct DrawIndexedCmd
+    {
+        uint32_t        indexCount;
+        uint32_t        startIndex;
+        int32_t         baseVertex;
+        uint32_t        materialIndex;
+    };
+
+    const uint32_t FileMagic = 0x534D4443; // "CDMS"
+    const uint32_t FileVersion = 2;
+
+    template <typename T>
+    T Read(const uint8_t *src)
+    {
+        T value;
+        memcpy(&value, src, sizeof(T));
+        return value;
+    }
+
+    size_t GetPayloadSize(uint16_t type)
+    {
+        switch (type)
+        {
+        case CommandStream::eSetVertexShader:
+        case CommandStream::eSetPixelShader:
+        case CommandStream::eSetInputLayout:
+        case CommandStream::eSetIndexBuffer:    return sizeof(SetObjectCmd);
+        case CommandStream::eSetVertexBuffer:   return sizeof(SetVertexBufferCmd);
+        case CommandStream::eSetTopology:       return sizeof(SetValueCmd);
+        case CommandStream::eSetVSConstants:    return sizeof(SetConstantsCmd);
+        case CommandStream::eSetPSResource:     return sizeof(SetResourceCmd);
+        case CommandStream::eUpdateBuffer:      return sizeof(UpdateBufferCmd);
+        case CommandStream::eDrawIndexed:       return sizeof(DrawIndexedCmd);
+        default:                                return 0;
+        }
+    }
+}
+
+const wchar_t* CommandStream::CommandTypeToString(CommandType type)
+{
+    switch (type)
+    {
+    case eSetVertexShader:  return L"SetVertexShader";
+    case eSetInputLayout:   return L"SetInputLayout";
+    case eSetVertexBuffer:  return L"SetVertexBuffer";
+    case eSetIndexBuffer:   return L"SetIndexBuffer";
+    case eSetTopology:      return L"SetTopology";
+    case eSetVSConstants:   return L"SetVSConstants";
+    case eSetPSResource:    return L"SetPSResource";
+    case eUpdateBuffer:     return L"UpdateBuffer";
+    case eDrawIndexed:      return L"DrawIndexed";
+    case eSetPixelShader:   return L"SetPixelShader";
+    default:                return L"Unknown";
+    }
+}
+
+void CommandStream::Clear()
+{
+    mData.clear();
+    mCommandCount = 0;
+}
+
+template <typename T>
+void CommandStream::Write(CommandType type, const T &payload, const void *extra, size_t extraSize)
+{
+    const size_t payloadSize = (sizeof(T) + extraSize + 7) & ~(size_t)7;
+
+    CommandHeader header;
+    header.type = (uint16_t)type;
+    header.reserved = 0;
+    header.size = (uint32_t)payloadSize;
+
+    const size_t offset = mData.size();
+    mData.resize(offset + sizeof(header) + payloadSize, 0);
+    memcpy(&mData[offset], &header, sizeof(header));
+    memcpy(&mData[offset + sizeof(header)], &payload, sizeof(T));
+    if (extraSize > 0)
+        memcpy(&mData[offset + sizeof(header) + sizeof(T)], extra, extraSize);
+    mCommandCount++;
+}
+
+void CommandStream::SetVertexShader(ID3D11VertexShader *shader)
+{
+    Write(eSetVertexShader, SetObjectCmd{ shader });
+}
+
+void CommandStream::SetPixelShader(ID3D11PixelShader *shader)
+{
+    Write(eSetPixelShader, SetObjectCmd{ shader });
+}
+
+void CommandStream::SetInputLayout(ID3D11InputLayout *layout)
+{
+    Write(eSetInputLayout, SetObjectCmd{ layout });
+}
+
+void CommandStream::SetVertexBuffer(uint32_t slot, ID3D11Buffer *buffer, uint32_t stride)
+{
+    Write(eSetVertexBuffer, SetVertexBufferCmd{ buffer, slot, stride });
+}
+
+void CommandStream::SetIndexBuffer(ID3D11Buffer *buffer)
+{
+    Write(eSetIndexBuffer, SetObjectCmd{ buffer });
+}
+
+void CommandStream::SetTopology(uint32_t topology)
+{
+    Write(eSetTopology, SetValueCmd{ topology });
+}
+
+void CommandStream::SetVSConstants(uint32_t slot, ID3D11Buffer *buffer, uint32_t firstConstant, uint32_t numConstants)
+{
+    Write(eSetVSConstants, SetConstantsCmd{ buffer, slot, firstConstant, numConstants });
+}
+
+void CommandStream::SetPSResource(uint32_t slot, ID3D11ShaderResourceView *view)
+{
+    Write(eSetPSResource, SetResourceCmd{ view, slot });
+}
+
+void CommandStream::UpdateBuffer(ID3D11Buffer *buffer, const void *data, size_t size)
+{
+    Write(eUpdateBuffer, UpdateBufferCmd{ buffer, (uint64_t)size }, data, size);
+}
+
+void CommandStream::DrawIndexed(uint32_t indexCount, uint32_t startIndex, int32_t baseVertex, uint32_t materialIndex)
+{
+    Write(eDrawIndexed, DrawIndexedCmd{ indexCount, startIndex, baseVertex, materialIndex });
+}
+
+size_t CommandStream::GetCommandSize(const std::vector<uint8_t> &data, size_t offset)
+{
+    if ((offset > data.size()) || (data.size() - offset < sizeof(CommandHeader)))
+        return 0;
+
+    const CommandHeader header = Read<CommandHeader>(&data[offset]);
+    const size_t payloadSize = GetPayloadSize(header.type);
+    if ((payloadSize == 0) || (header.size < payloadSize) ||
+        (header.size > data.size() - offset - sizeof(CommandHeader)))
+        return 0;
+
+    // The update's data must be inside the payload too
+    if (header.type == eUpdateBuffer)
+    {
+        const auto cmd = Read<UpdateBufferCmd>(&data[offset + sizeof(CommandHeader)]);
+        if (cmd.size > header.size - sizeof(UpdateBufferCmd))
+            return 0;
+    }
+
+    return sizeof(CommandHeader) + header.size;
+}
+
+void CommandStream::Execute(ICommandExecutor &executor) const
+{
+    size_t offset = 0;
+    while (offset < mData.size())
+    {
+        const size_t commandSize = GetCommandSize(mData, offset);
+        if (commandSize == 0)
+        {
+            Log::Error(L"CommandStream: Invalid command at byte %d, execution stopped", offset);
+            return;
+        }
+
+        const CommandHeader header = Read<CommandHeader>(&mData[offset]);
+        const uint8_t *payload = &mData[offset + sizeof(CommandHeader)];
+        offset += commandSize;
+
+        switch (header.type)
+        {
+        case eSetVertexShader:
+            executor.SetVertexShader((ID3D11VertexShader*)Read<SetObjectCmd>(payload).object);
+            break;
+        case eSetPixelShader:
+            executor.SetPixelShader((ID3D11PixelShader*)Read<SetObjectCmd>(payload).object);
+            break;
+        case eSetInputLayout:
+            executor.SetInputLayout((ID3D11InputLayout*)Read<SetObjectCmd>(payload).object);
+            break;
+        case eSetVertexBuffer:
+        {
+            const auto cmd = Read<SetVertexBufferCmd>(payload);
+            executor.SetVertexBuffer(cmd.slot, cmd.buffer, cmd.stride);
+            break;
+        }
+        case eSetIndexBuffer:
+            executor.SetIndexBuffer((ID3D11Buffer*)Read<SetObjectCmd>(payload).object);
+            break;
+        case eSetTopology:
+            executor.SetTopology(Read<SetValueCmd>(payload).value);
+            break;
+        case eSetVSConstants:
+        {
+            const auto cmd = Read<SetConstantsCmd>(payload);
+            executor.SetVSConstants(cmd.slot, cmd.buffer, cmd.firstConstant, cmd.numConstants);
+            break;
+        }
+        case eSetPSResource:
+        {
+            const auto cmd = Read<SetResourceCmd>(payload);
+            executor.SetPSResource(cmd.slot, cmd.view);
+            break;
+        }
+        case eUpdateBuffer:
+        {
+            const auto cmd = Read<UpdateBufferCmd>(payload);
+            executor.UpdateBuffer(cmd.buffer, payload + sizeof(UpdateBufferCmd), (size_t)cmd.size);
+            break;
+        }
+        case eDrawIndexed:
+        {
+            const auto cmd = Read<DrawIndexedCmd>(payload);
+            executor.DrawIndexed(cmd.indexCount, cmd.startIndex, cmd.baseVertex, cmd.materialIndex);
+            break;
+        }
+        default:
+            // Rejected by GetCommandSize()
+            return;
+        }
+    }
+}
+
+bool CommandStream::Save(const std::wstring &path) const
+{
+    std::ofstream file(Utils::WstringToString(path), std::ios::binary);
+    if (!file)
+    {
+        Log::Error(L"CommandStream: Failed to open \"%s\" for writing", path.c_str());
+        return false;
+    }
+
+    const uint64_t commandCount = mCommandCount;
+    const uint64_t size = mData.size();
+    file.write((const char*)&FileMagic, sizeof(FileMagic));
+    file.write((const char*)&FileVersion, sizeof(FileVersion));
+    file.write((const char*)&commandCount, sizeof(commandCount));
+    file.write((const char*)&size, sizeof(size));
+    file.write((const char*)mData.data(), mData.size());
+    if (!file)
+    {
+        Log::Error(L"CommandStream: Failed to write \"%s\"", path.c_str());
+        return false;
+    }
+
+    Log::Info(L"CommandStream: %d commands (%d bytes) written to \"%s\"",
+              mCommandCount, mData.size(), path.c_str());
+    return true;
+}
+
+bool CommandStream::Load(const std::wstring &path)
+{
+    std::ifstream file(Utils::WstringToString(path), std::ios::binary);
+    if (!file)
+    {
+        Log::Error(L"CommandStream: Failed to open \"%s\"", path.c_str());
+        return false;
+    }
+
+    uint32_t magic = 0, version = 0;
+    uint64_t commandCount = 0, size = 0;
+    file.read((char*)&magic, sizeof(magic));
+    file.read((char*)&version, sizeof(version));
+    file.read((char*)&commandCount, sizeof(commandCount));
+    file.read((char*)&size, sizeof(size));
+    if (!file || (magic != FileMagic) || (version != FileVersion))
+    {
+        Log::Error(L"CommandStream: \"%s\" is not a command stream of version %d", path.c_str(), FileVersion);
+        return false;
+    }
+
+    // Don't trust the header's size before allocating
+    const std::streamoff dataStart = file.tellg();
+    file.seekg(0, std::ios::end);
+    const std::streamoff fileSize = file.tellg();
+    file.seekg(dataStart);
+    if (!file || ((uint64_t)(fileSize - dataStart) < size))
+    {
+        Log::Error(L"CommandStream: \"%s\" is truncated", path.c_str());
+        return false;
+    }
+
+    std::vector<uint8_t> data((size_t)size);
+    file.read((char*)data.data(), data.size());
+    if (!file)
+    {
+        Log::Error(L"CommandStream: \"%s\" is truncated", path.c_str());
+        return false;
+    }
+
+    // Every command and its payload has to fit, so Execute() never reads past the buffer
+    size_t offset = 0, count = 0;
+    while (offset < data.size())
+    {
+        const size_t commandSize = GetCommandSize(data, offset);
+        if (commandSize == 0)
+        {
+            Log::Error(L"CommandStream: \"%s\" has an invalid command at byte %d", path.c_str(), offset);
+            return false;
+        }
+        offset += commandSize;
+        count++;
+    }
+    if (count != commandCount)
+    {
+        Log::Error(L"CommandStream: \"%s\" holds %d commands, its header says %d",
+                   path.c_str(), count, (size_t)commandCount);
+        return false;
+    }
+
+    mData.swap(data);
+    mCommandCount = (size_t)commandCount;
+    return true;
+}
+
+void NullCommandExecutor::SetVertexShader(ID3D11VertexShader *)
+{
+    Count(CommandStream::eSetVertexShader);
+}
+
+void NullCommandExecutor::SetPixelShader(ID3D11PixelShader *)
+{
+    Count(CommandStream::eSetPixelShader);
+}
+
+void NullCommandExecutor::SetInputLayout(ID3D11InputLayout *)
+{
+    Count(CommandStream::eSetInputLayout);
+}
+
+void NullCommandExecutor::SetVertexBuffer(uint32_t, ID3D11Buffer *, uint32_t)
+{
+    Count(CommandStream::eSetVertexBuffer);
+}
+
+void NullCommandExecutor::SetIndexBuffer(ID3D11Buffer *)
+{
+    Count(CommandStream::eSetIndexBuffer);
+}
+
+void NullCommandExecutor::SetTopology(uint32_t)
+{
+    Count(CommandStream::eSetTopology);
+}
+
+void NullCommandExecutor::SetVSConstants(uint32_t, ID3D11Buffer *, uint32_t, uint32_t)
+{
+    Count(CommandStream::eSetVSConstants);
+}
+
+void NullCommandExecutor::SetPSResource(uint32_t, ID3D11ShaderResourceView *)
+{
+    Count(CommandStream::eSetPSResource);
+}
+
+void NullCommandExecutor::UpdateBuffer(ID3D11Buffer *, const void *, size_t size)
+{
+    Count(CommandStream::eUpdateBuffer);
+    mStats.updateBytes += size;
+}
+
+void NullCommandExecutor::DrawIndexed(uint32_t indexCount, uint32_t, int32_t, uint32_t)
+{
+    Count(CommandStream::eDrawIndexed);
+    mStats.draws++;
+    mStats.indices += indexCount;
+}
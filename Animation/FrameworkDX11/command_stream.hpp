@@ -0,0 +1,141 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+// Device objects are only passed through, so recording and replaying a stream needs no
+// D3D headers and no device
+struct ID3D11VertexShader;
+struct ID3D11PixelShader;
+struct ID3D11InputLayout;
+struct ID3D11Buffer;
+struct ID3D11ShaderResourceView;
+
+// Receives the commands of a CommandStream: D3D11CommandExecutor issues them, the null
+// executor only counts them
+class ICommandExecutor
+{
+public:
+    virtual ~ICommandExecutor() {}
+
+    virtual void SetVertexShader(ID3D11VertexShader *shader) = 0;
+    virtual void SetPixelShader(ID3D11PixelShader *shader) = 0;    // null for depth-only draws
+    virtual void SetInputLayout(ID3D11InputLayout *layout) = 0;
+    virtual void SetVertexBuffer(uint32_t slot, ID3D11Buffer *buffer, uint32_t stride) = 0;
+    virtual void SetIndexBuffer(ID3D11Buffer *buffer) = 0;      // 32-bit indices
+    virtual void SetTopology(uint32_t topology) = 0;            // D3D11_PRIMITIVE_TOPOLOGY
+    // A zero count binds the whole buffer without an offset
+    virtual void SetVSConstants(uint32_t slot, ID3D11Buffer *buffer, uint32_t firstConstant, uint32_t numConstants) = 0;
+    virtual void SetPSResource(uint32_t slot, ID3D11ShaderResourceView *view) = 0;
+    virtual void UpdateBuffer(ID3D11Buffer *buffer, const void *data, size_t size) = 0;
+    // The material index goes in as the start instance of a single-instance draw
+    virtual void DrawIndexed(uint32_t indexCount, uint32_t startIndex, int32_t baseVertex, uint32_t materialIndex) = 0;
+};
+
+// Bind, update and draw commands packed into one byte buffer, executed later in recording
+// order. Updates keep a copy of their data, so a stream can be replayed or saved after the
+// source is gone.
+class CommandStream
+{
+public:
+
+    enum CommandType : uint16_t
+    {
+        eSetVertexShader = 0,
+        eSetInputLayout,
+        eSetVertexBuffer,
+        eSetIndexBuffer,
+        eSetTopology,
+        eSetVSConstants,
+        eSetPSResource,
+        eUpdateBuffer,
+        eDrawIndexed,
+        eSetPixelShader,    // after the others, so saved streams keep their ids
+
+        eCommandTypeCount
+    };
+    static const wchar_t* CommandTypeToString(CommandType type);
+
+    void Clear();
+
+    void SetVertexShader(ID3D11VertexShader *shader);
+    void SetPixelShader(ID3D11PixelShader *shader);
+    void SetInputLayout(ID3D11InputLayout *layout);
+    void SetVertexBuffer(uint32_t slot, ID3D11Buffer *buffer, uint32_t stride);
+    void SetIndexBuffer(ID3D11Buffer *buffer);
+    void SetTopology(uint32_t topology);
+    void SetVSConstants(uint32_t slot, ID3D11Buffer *buffer, uint32_t firstConstant, uint32_t numConstants);
+    void SetPSResource(uint32_t slot, ID3D11ShaderResourceView *view);
+    void UpdateBuffer(ID3D11Buffer *buffer, const void *data, size_t size);
+    void DrawIndexed(uint32_t indexCount, uint32_t startIndex, int32_t baseVertex, uint32_t materialIndex);
+
+    void Execute(ICommandExecutor &executor) const;
+
+    size_t GetCommandCount() const { return mCommandCount; }
+    size_t GetSizeBytes() const { return mData.size(); }
+
+    // Binary capture for offline replay. The device objects are stored as they are: a loaded
+    // stream is only fit for executors that treat them as identities, like the null executor.
+    bool Save(const std::wstring &path) const;
+    bool Load(const std::wstring &path);
+
+private:
+
+    struct CommandHeader
+    {
+        uint16_t    type;
+        uint16_t    reserved;
+        uint32_t    size;       // of the payload, padded to 8 bytes
+    };
+
+    template <typename T>
+    void Write(CommandType type, const T &payload, const void *extra = nullptr, size_t extraSize = 0);
+
+    // Size of the command at 'offset' with its payload, 0 if it is unknown or does not fit in 'data'
+    static size_t GetCommandSize(const std::vector<uint8_t> &data, size_t offset);
+
+    std::vector<uint8_t>    mData;
+    size_t                  mCommandCount = 0;
+};
+
+// Issues nothing. Counts the calls per command type and the bytes that would have reached
+// the driver, for profiling submission without a GPU.
+class NullCommandExecutor : public ICommandExecutor
+{
+public:
+
+    struct Stats
+    {
+        size_t calls[CommandStream::eCommandTypeCount] = {};
+        size_t totalCalls = 0;
+        size_t draws = 0;
+        size_t indices = 0;
+        size_t updateBytes = 0;
+    };
+
+    void Reset() { mStats = Stats(); }
+    const Stats& GetStats() const { return mStats; }
+
+    virtual void SetVertexShader(ID3D11VertexShader *shader) override;
+    virtual void SetPixelShader(ID3D11PixelShader *shader) override;
+    virtual void SetInputLayout(ID3D11InputLayout *layout) override;
+    virtual void SetVertexBuffer(uint32_t slot, ID3D11Buffer *buffer, uint32_t stride) override;
+    virtual void SetIndexBuffer(ID3D11Buffer *buffer) override;
+    virtual void SetTopology(uint32_t topology) override;
+    virtual void SetVSConstants(uint32_t slot, ID3D11Buffer *buffer, uint32_t firstConstant, uint32_t numConstants) override;
+    virtual void SetPSResource(uint32_t slot, ID3D11ShaderResourceView *view) override;
+    virtual void UpdateBuffer(ID3D11Buffer *buffer, const void *data, size_t size) override;
+    virtual void DrawIndexed(uint32_t indexCount, uint32_t startIndex, int32_t baseVertex, uint32_t materialIndex) override;
+
+private:
+
+    void Count(CommandStream::CommandType type)
+    {
+        mStats.calls[type]++;
+        mStats.totalCalls++;
+    }
+
+    Stats mStats;
+};
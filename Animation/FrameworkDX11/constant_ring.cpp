@@ -0,0 +1,95 @@
+#include "constant_ring.hpp"
+#include "log.hpp"
+#include "utils.hpp"
+
+#include <cstring>
+
+bool ConstantRing::Init(ID3D11Device *device, ID3D11DeviceContext *context, size_t sizeBytes)
+{
+    Destroy();
+
+    if (!device || !context)
+        return false;
+
+    D3D11_FEATURE_DATA_D3D11_OPTIONS options = {};
+    if (FAILED(device->CheckFeatureSupport(D3D11_FEATURE_D3D11_OPTIONS, &options, sizeof(options))) ||
+        !options.ConstantBufferOffsetting || !options.MapNoOverwriteOnDynamicConstantBuffer)
+    {
+        Log::Warning(L"ConstantRing: Constant buffer offsets are not supported, per-object constants use their own buffers");
+        return false;
+    }
+
+    if (FAILED(context->QueryInterface(__uuidof(ID3D11DeviceContext1), (void**)&mContext)))
+    {
+        Log::Warning(L"ConstantRing: No ID3D11DeviceContext1, per-object constants use their own buffers");
+        return false;
+    }
+
+    sizeBytes = (sizeBytes + Alignment - 1) & ~(Alignment - 1);
+
+    D3D11_BUFFER_DESC bd;
+    ZeroMemory(&bd, sizeof(bd));
+    bd.Usage = D3D11_USAGE_DYNAMIC;
+    bd.ByteWidth = (UINT)sizeBytes;
+    bd.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+    bd.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+    if (FAILED(device->CreateBuffer(&bd, nullptr, &mBuffer)))
+    {
+        Log::Error(L"ConstantRing: Failed to create the %d byte buffer", sizeBytes);
+        Utils::ReleaseAndMakeNull(mContext);
+        return false;
+    }
+
+    mSize = sizeBytes;
+    BeginFrame();
+    return true;
+}
+
+void ConstantRing::Destroy()
+{
+    Utils::ReleaseAndMakeNull(mBuffer);
+    Utils::ReleaseAndMakeNull(mContext);
+    mSize = 0;
+    mHead = 0;
+}
+
+void ConstantRing::BeginFrame()
+{
+    mHead = 0;
+    mNeedsDiscard = true;
+    mFrame++;
+    mStats = Stats();
+}
+
+bool ConstantRing::Allocate(const void *data, size_t size, ConstantRange &range)
+{
+    // A single binding sees at most 4096 constants
+    const size_t alignedSize = (size + Alignment - 1) & ~(Alignment - 1);
+    if (!mBuffer || (size == 0) || (alignedSize > 4096 * 16) || (mHead + alignedSize > mSize))
+    {
+        mStats.failed++;
+        return false;
+    }
+
+    D3D11_MAPPED_SUBRESOURCE mapped;
+    const D3D11_MAP mapType = mNeedsDiscard ? D3D11_MAP_WRITE_DISCARD : D3D11_MAP_WRITE_NO_OVERWRITE;
+    if (FAILED(mContext->Map(mBuffer, 0, mapType, 0, &mapped)))
+    {
+        Log::Error(L"ConstantRing: Failed to map the buffer");
+        mStats.failed++;
+        return false;
+    }
+    memcpy((uint8_t*)mapped.pData + mHead, data, size);
+    mContext->Unmap(mBuffer, 0);
+    mNeedsDiscard = false;
+
+    range.buffer = mBuffer;
+    range.firstConstant = (UINT)(mHead / 16);
+    range.numConstants = (UINT)(alignedSize / 16);
+
+    mHead += alignedSize;
+    mStats.allocations++;
+    mStats.bytesWritten += size;
+    mStats.bytesUsed += alignedSize;
+    return true;
+}
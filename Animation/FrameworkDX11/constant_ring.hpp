@@ -0,0 +1,76 @@
+#pragma once
+
+// We are using an older version of DirectX headers which causes
+// "warning C4005: '...' : macro redefinition"
+#pragma warning(push)
+#pragma warning(disable: 4005)
+#include <d3d11_1.h>
+#pragma warning(pop)
+
+#include <cstddef>
+#include <cstdint>
+
+// Part of a constant buffer, in 16-byte constants. A zero count means the whole buffer,
+// bound without an offset.
+struct ConstantRange
+{
+    ID3D11Buffer*   buffer = nullptr;
+    UINT            firstConstant = 0;
+    UINT            numConstants = 0;
+
+    bool operator == (const ConstantRange &other) const
+    {
+        return buffer == other.buffer && firstConstant == other.firstConstant &&
+               numConstants == other.numConstants;
+    }
+    bool operator != (const ConstantRange &other) const { return !(*this == other); }
+};
+
+// Per-frame suballocator for constants written every draw: one large dynamic buffer, mapped
+// with DISCARD by the first allocation of a frame and with NO_OVERWRITE after that. Each
+// allocation is bound with its own offset (D3D 11.1) and stays valid until the next
+// BeginFrame(). A frame that runs out of space gets failed allocations, not a wrap, since a
+// DISCARD would drop allocations that are queued but not drawn yet.
+class ConstantRing
+{
+public:
+
+    // Offsets and sizes of bound ranges are multiples of 16 constants
+    static const size_t Alignment = 256;
+
+    struct Stats
+    {
+        size_t allocations = 0;
+        size_t bytesWritten = 0;    // copied into the buffer
+        size_t bytesUsed = 0;       // including the alignment
+        size_t failed = 0;          // allocations that did not fit
+    };
+
+    ~ConstantRing() { Destroy(); }
+
+    // Fails, leaving the ring unusable, if the device can't bind constant buffers with offsets
+    bool Init(ID3D11Device *device, ID3D11DeviceContext *context, size_t sizeBytes);
+    void Destroy();
+    bool IsValid() const { return mBuffer != nullptr; }
+
+    // Starts a new frame and its stats
+    void BeginFrame();
+    // Counts BeginFrame() calls, ranges from an older frame are stale
+    uint64_t GetFrame() const { return mFrame; }
+
+    bool Allocate(const void *data, size_t size, ConstantRange &range);
+
+    ID3D11DeviceContext1* GetContext1() const { return mContext; }
+    const Stats& GetStats() const { return mStats; }
+    size_t GetSize() const { return mSize; }
+
+private:
+
+    ID3D11DeviceContext1*   mContext = nullptr;
+    ID3D11Buffer*           mBuffer = nullptr;
+    size_t                  mSize = 0;
+    size_t                  mHead = 0;          // first free byte of the frame
+    bool                    mNeedsDiscard = true;
+    uint64_t                mFrame = 0;
+    Stats                   mStats;
+};
@@ -0,0 +1,215 @@
+#include "d3d11_command_executor.hpp"
+#include "log.hpp"
+#include "utils.hpp"
+#include "thread_pool.hpp"
+
+bool D3D11CommandExecutor::Init(StateCache *stateCache)
+{
+    Destroy();
+
+    if (!stateCache || !stateCache->IsValid())
+    {
+        Log::Error(L"D3D11CommandExecutor: No state cache");
+        return false;
+    }
+
+    mState = stateCache;
+    return true;
+}
+
+void D3D11CommandExecutor::Destroy()
+{
+    mState = nullptr;
+}
+
+void D3D11CommandExecutor::SetVertexShader(ID3D11VertexShader *shader)
+{
+    mState->VSSetShader(shader);
+}
+
+void D3D11CommandExecutor::SetPixelShader(ID3D11PixelShader *shader)
+{
+    mState->PSSetShader(shader);
+}
+
+void D3D11CommandExecutor::SetInputLayout(ID3D11InputLayout *layout)
+{
+    mState->IASetInputLayout(layout);
+}
+
+void D3D11CommandExecutor::SetVertexBuffer(uint32_t slot, ID3D11Buffer *buffer, uint32_t stride)
+{
+    mState->IASetVertexBuffer(slot, buffer, stride);
+}
+
+void D3D11CommandExecutor::SetIndexBuffer(ID3D11Buffer *buffer)
+{
+    mState->IASetIndexBuffer(buffer, DXGI_FORMAT_R32_UINT);
+}
+
+void D3D11CommandExecutor::SetTopology(uint32_t topology)
+{
+    mState->IASetPrimitiveTopology((D3D11_PRIMITIVE_TOPOLOGY)topology);
+}
+
+void D3D11CommandExecutor::SetVSConstants(uint32_t slot, ID3D11Buffer *buffer, uint32_t firstConstant, uint32_t numConstants)
+{
+    ConstantRange range;
+    range.buffer = buffer;
+    range.firstConstant = firstConstant;
+    range.numConstants = numConstants;
+    mState->VSSetConstantRange(slot, range);
+}
+
+void D3D11CommandExecutor::SetPSResource(uint32_t slot, ID3D11ShaderResourceView *view)
+{
+    mState->PSSetShaderResource(slot, view);
+}
+
+void D3D11CommandExecutor::UpdateBuffer(ID3D11Buffer *buffer, const void *data, size_t)
+{
+    // Whole-buffer updates, the size is only recorded for the stats
+    mState->GetContext()->UpdateSubresource(buffer, 0, nullptr, data, 0, 0);
+}
+
+void D3D11CommandExecutor::DrawIndexed(uint32_t indexCount, uint32_t startIndex, int32_t baseVertex, uint32_t materialIndex)
+{
+    mState->GetContext()->DrawIndexedInstanced(indexCount, 1, startIndex, baseVertex, materialIndex);
+}
+
+bool D3D11DeferredExecutor::Init(ID3D11Device *device, ID3D11DeviceContext *immediate, unsigned int contextCount)
+{
+    Destroy();
+
+    if (!device || !immediate || (contextCount == 0))
+    {
+        Log::Error(L"D3D11DeferredExecutor: Missing device, context, or contexts to create");
+        return false;
+    }
+
+    mImmediate = immediate;
+    for (unsigned int i = 0; i < contextCount; ++i)
+    {
+        ID3D11DeviceContext *context = nullptr;
+        if (FAILED(device->CreateDeferredContext(0, &context)))
+        {
+            Log::Error(L"D3D11DeferredExecutor: Failed to create deferred context %d", i);
+            Destroy();
+            return false;
+        }
+        mContexts.push_back(context);
+
+        mStateCaches.push_back(std::make_unique<StateCache>());
+        mStateCaches.back()->Init(context);
+        mExecutors.push_back(std::make_unique<D3D11CommandExecutor>());
+        mExecutors.back()->Init(mStateCaches.back().get());
+    }
+    mLists.resize(contextCount, nullptr);
+    return true;
+}
+
+void D3D11DeferredExecutor::Destroy()
+{
+    mExecutors.clear();
+    mStateCaches.clear();
+    for (auto &list : mLists)
+        Utils::ReleaseAndMakeNull(list);
+    mLists.clear();
+    for (auto &context : mContexts)
+        Utils::ReleaseAndMakeNull(context);
+    mContexts.clear();
+    ReleaseState();
+    mImmediate = nullptr;
+}
+
+bool D3D11DeferredExecutor::Execute(ThreadPool *pool, const std::vector<CommandStream> &streams)
+{
+    if (!IsValid() || (streams.size() > mContexts.size()))
+        return false;
+
+    CaptureState();
+
+    auto recordStream = [&](size_t i, unsigned int)
+    {
+        ApplyState(mContexts[i]);
+        mStateCaches[i]->Invalidate();
+        streams[i].Execute(*mExecutors[i]);
+        if (FAILED(mContexts[i]->FinishCommandList(FALSE, &mLists[i])))
+            mLists[i] = nullptr;
+    };
+    if (pool)
+        pool->ParallelFor(streams.size(), recordStream);
+    else
+        for (size_t i = 0; i < streams.size(); ++i)
+            recordStream(i, 0);
+
+    // In stream order, so the draws stay sorted. The immediate context keeps its own state.
+    bool isComplete = true;
+    for (size_t i = 0; i < streams.size(); ++i)
+    {
+        if (mLists[i])
+            mImmediate->ExecuteCommandList(mLists[i], TRUE);
+        else
+            isComplete = false;
+        Utils::ReleaseAndMakeNull(mLists[i]);
+    }
+    if (!isComplete)
+        Log::Error(L"D3D11DeferredExecutor: Failed to finish a command list, its draws are missing");
+
+    ReleaseState();
+    return true;
+}
+
+void D3D11DeferredExecutor::CaptureState()
+{
+    ReleaseState();
+
+    mImmediate->OMGetRenderTargets(1, &mState.renderTarget, &mState.depthStencil);
+    mImmediate->OMGetDepthStencilState(&mState.depthStencilState, &mState.stencilRef);
+    mImmediate->OMGetBlendState(&mState.blendState, mState.blendFactor, &mState.sampleMask);
+    mImmediate->RSGetState(&mState.rasterizerState);
+    mState.viewportCount = D3D11_VIEWPORT_AND_SCISSORRECT_OBJECT_COUNT_PER_PIPELINE;
+    mImmediate->RSGetViewports(&mState.viewportCount, mState.viewports);
+    mImmediate->PSGetShader(&mState.pixelShader, nullptr, nullptr);
+    mImmediate->PSGetConstantBuffers(0, InheritedCbs, mState.psCbs);
+    mImmediate->PSGetShaderResources(0, InheritedResources, mState.psResources);
+    mImmediate->PSGetSamplers(0, InheritedSamplers, mState.psSamplers);
+    mImmediate->VSGetConstantBuffers(0, InheritedCbs, mState.vsCbs);
+    mImmediate->IAGetVertexBuffers(1, InheritedVertexBuffers - 1, &mState.vertexBuffers[1], &mState.strides[1], &mState.offsets[1]);
+}
+
+void D3D11DeferredExecutor::ApplyState(ID3D11DeviceContext *context) const
+{
+    context->OMSetRenderTargets(1, &mState.renderTarget, mState.depthStencil);
+    context->OMSetDepthStencilState(mState.depthStencilState, mState.stencilRef);
+    context->OMSetBlendState(mState.blendState, mState.blendFactor, mState.sampleMask);
+    context->RSSetState(mState.rasterizerState);
+    context->RSSetViewports(mState.viewportCount, mState.viewports);
+    context->PSSetShader(mState.pixelShader, nullptr, 0);
+    context->PSSetConstantBuffers(0, InheritedCbs, mState.psCbs);
+    context->PSSetShaderResources(0, InheritedResources, mState.psResources);
+    context->PSSetSamplers(0, InheritedSamplers, mState.psSamplers);
+    context->VSSetConstantBuffers(0, InheritedCbs, mState.vsCbs);
+    context->IASetVertexBuffers(1, InheritedVertexBuffers - 1, &mState.vertexBuffers[1], &mState.strides[1], &mState.offsets[1]);
+}
+
+void D3D11DeferredExecutor::ReleaseState()
+{
+    Utils::ReleaseAndMakeNull(mState.renderTarget);
+    Utils::ReleaseAndMakeNull(mState.depthStencil);
+    Utils::ReleaseAndMakeNull(mState.depthStencilState);
+    Utils::ReleaseAndMakeNull(mState.blendState);
+    Utils::ReleaseAndMakeNull(mState.rasterizerState);
+    Utils::ReleaseAndMakeNull(mState.pixelShader);
+    for (auto &cb : mState.psCbs)
+        Utils::ReleaseAndMakeNull(cb);
+    for (auto &resource : mState.psResources)
+        Utils::ReleaseAndMakeNull(resource);
+    for (auto &sampler : mState.psSamplers)
+        Utils::ReleaseAndMakeNull(sampler);
+    for (auto &cb : mState.vsCbs)
+        Utils::ReleaseAndMakeNull(cb);
+    for (auto &buffer : mState.vertexBuffers)
+        Utils::ReleaseAndMakeNull(buffer);
+    mState = InheritedState();
+}
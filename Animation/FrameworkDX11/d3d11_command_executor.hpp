@@ -0,0 +1,105 @@
+#pragma once
+
+#include "command_stream.hpp"
+#include "state_cache.hpp"
+
+// We are using an older version of DirectX headers which causes
+// "warning C4005: '...' : macro redefinition"
+#pragma warning(push)
+#pragma warning(disable: 4005)
+#include <d3d11_1.h>
+#pragma warning(pop)
+
+#include <vector>
+#include <memory>
+
+class ThreadPool;
+
+// Issues the commands of a stream on the context of a state cache, which drops the bindings
+// that are already in place. Ranges of constant buffers need ID3D11DeviceContext1; without it
+// they are dropped with an error.
+class D3D11CommandExecutor : public ICommandExecutor
+{
+public:
+
+    ~D3D11CommandExecutor() { Destroy(); }
+
+    bool Init(StateCache *stateCache);
+    void Destroy();
+    bool IsValid() const { return mState != nullptr; }
+
+    virtual void SetVertexShader(ID3D11VertexShader *shader) override;
+    virtual void SetPixelShader(ID3D11PixelShader *shader) override;
+    virtual void SetInputLayout(ID3D11InputLayout *layout) override;
+    virtual void SetVertexBuffer(uint32_t slot, ID3D11Buffer *buffer, uint32_t stride) override;
+    virtual void SetIndexBuffer(ID3D11Buffer *buffer) override;
+    virtual void SetTopology(uint32_t topology) override;
+    virtual void SetVSConstants(uint32_t slot, ID3D11Buffer *buffer, uint32_t firstConstant, uint32_t numConstants) override;
+    virtual void SetPSResource(uint32_t slot, ID3D11ShaderResourceView *view) override;
+    virtual void UpdateBuffer(ID3D11Buffer *buffer, const void *data, size_t size) override;
+    virtual void DrawIndexed(uint32_t indexCount, uint32_t startIndex, int32_t baseVertex, uint32_t materialIndex) override;
+
+private:
+
+    StateCache*             mState = nullptr;       // borrowed
+};
+
+// Runs streams on deferred contexts in parallel, one context per stream, then plays the
+// command lists on the immediate context in stream order. Deferred contexts start from the
+// default state, so what the streams don't bind themselves (targets, viewport, pixel shader
+// and its resources, the frame and view constants, the material index stream) is copied from
+// the immediate context.
+class D3D11DeferredExecutor
+{
+public:
+
+    ~D3D11DeferredExecutor() { Destroy(); }
+
+    bool Init(ID3D11Device *device, ID3D11DeviceContext *immediate, unsigned int contextCount);
+    void Destroy();
+    bool IsValid() const { return !mContexts.empty(); }
+    unsigned int GetContextCount() const { return (unsigned int)mContexts.size(); }
+
+    // Fails without running anything if there are more streams than contexts
+    bool Execute(ThreadPool *pool, const std::vector<CommandStream> &streams);
+
+private:
+
+    static const UINT InheritedCbs = 6;
+    static const UINT InheritedResources = 8;
+    static const UINT InheritedSamplers = 4;
+    static const UINT InheritedVertexBuffers = 3;  // the streams bind the geometry slots themselves
+
+    // Pipeline state of the immediate context, with a reference on every object
+    struct InheritedState
+    {
+        ID3D11RenderTargetView*     renderTarget = nullptr;
+        ID3D11DepthStencilView*     depthStencil = nullptr;
+        ID3D11DepthStencilState*    depthStencilState = nullptr;
+        UINT                        stencilRef = 0;
+        ID3D11BlendState*           blendState = nullptr;
+        FLOAT                       blendFactor[4] = {};
+        UINT                        sampleMask = 0xFFFFFFFF;
+        ID3D11RasterizerState*      rasterizerState = nullptr;
+        D3D11_VIEWPORT              viewports[D3D11_VIEWPORT_AND_SCISSORRECT_OBJECT_COUNT_PER_PIPELINE];
+        UINT                        viewportCount = 0;
+        ID3D11PixelShader*          pixelShader = nullptr;
+        ID3D11Buffer*               psCbs[InheritedCbs] = {};
+        ID3D11ShaderResourceView*   psResources[InheritedResources] = {};
+        ID3D11SamplerState*         psSamplers[InheritedSamplers] = {};
+        ID3D11Buffer*               vsCbs[InheritedCbs] = {};
+        ID3D11Buffer*               vertexBuffers[InheritedVertexBuffers] = {};
+        UINT                        strides[InheritedVertexBuffers] = {};
+        UINT                        offsets[InheritedVertexBuffers] = {};
+    };
+    void CaptureState();
+    void ApplyState(ID3D11DeviceContext *context) const;
+    void ReleaseState();
+
+    ID3D11DeviceContext*                                mImmediate = nullptr;   // borrowed
+    std::vector<ID3D11DeviceContext*>                   mContexts;
+    std::vector<std::unique_ptr<StateCache>>            mStateCaches;
+    std::vector<std::unique_ptr<D3D11CommandExecutor>>  mExecutors;
+    std::vector<ID3D11CommandList*>                     mLists;
+    InheritedState                                      mState;
+};
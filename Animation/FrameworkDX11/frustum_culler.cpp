@@ -0,0 +1,170 @@
+#include "frustum_culler.hpp"
+
+#include <cmath>
+
+namespace
+{
+    const float UnboundedExtent = 1e30f;
+
+    void CountMasks(const FrustumCuller::ViewMask *masks, size_t count, size_t viewCount, FrustumCuller::Stats &stats)
+    {
+        stats.tested = count;
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (!masks[i])
+                stats.culled++;
+            for (size_t v = 0; v < viewCount; ++v)
+                stats.visible[v] += (masks[i] >> v) & 1;
+        }
+    }
+}
+
+void BoundsSoA::Resize(size_t count)
+{
+    mCount = count;
+
+    // Padding boxes are empty and never read back
+    const size_t padded = (count + 3) & ~(size_t)3;
+    centerX.resize(padded, 0.0f);
+    centerY.resize(padded, 0.0f);
+    centerZ.resize(padded, 0.0f);
+    extentX.resize(padded, 0.0f);
+    extentY.resize(padded, 0.0f);
+    extentZ.resize(padded, 0.0f);
+}
+
+void BoundsSoA::Set(size_t i, FXMVECTOR center, FXMVECTOR extents)
+{
+    XMFLOAT3 c, e;
+    XMStoreFloat3(&c, center);
+    XMStoreFloat3(&e, extents);
+    centerX[i] = c.x; centerY[i] = c.y; centerZ[i] = c.z;
+    extentX[i] = e.x; extentY[i] = e.y; extentZ[i] = e.z;
+}
+
+void BoundsSoA::SetMinMax(size_t i, const XMFLOAT3 &boxMin, const XMFLOAT3 &boxMax)
+{
+    const XMVECTOR lo = XMLoadFloat3(&boxMin);
+    const XMVECTOR hi = XMLoadFloat3(&boxMax);
+    Set(i, (lo + hi) * 0.5f, (hi - lo) * 0.5f);
+}
+
+void BoundsSoA::SetUnbounded(size_t i)
+{
+    Set(i, XMVectorZero(), XMVectorReplicate(UnboundedExtent));
+}
+
+void BoundsSoA::Transform(FXMVECTOR center, FXMVECTOR extents, CXMMATRIX world,
+                          XMVECTOR &outCenter, XMVECTOR &outExtents)
+{
+    // Row-vector convention: the new extent along j is sum_i |world[i][j]| * extents[i]
+    outCenter = XMVector3Transform(center, world);
+    outExtents = XMVectorAbs(world.r[0]) * XMVectorSplatX(extents) +
+                 XMVectorAbs(world.r[1]) * XMVectorSplatY(extents) +
+                 XMVectorAbs(world.r[2]) * XMVectorSplatZ(extents);
+}
+
+Frustum Frustum::FromViewProjection(FXMMATRIX viewProj)
+{
+    // Clip-space planes of the columns (D3D: 0 <= z <= w)
+    const XMMATRIX t = XMMatrixTranspose(viewProj);
+    const XMVECTOR planes[6] =
+    {
+        t.r[3] + t.r[0],    // left
+        t.r[3] - t.r[0],    // right
+        t.r[3] + t.r[1],    // bottom
+        t.r[3] - t.r[1],    // top
+        t.r[2],             // near
+        t.r[3] - t.r[2],    // far
+    };
+
+    Frustum frustum;
+    for (int i = 0; i < 6; ++i)
+        XMStoreFloat4(&frustum.planes[i], XMPlaneNormalize(planes[i]));
+    return frustum;
+}
+
+FrustumCuller::Stats FrustumCuller::Cull(const BoundsSoA &bounds, const Frustum *views, size_t viewCount, ViewMask *outMasks)
+{
+    Stats stats;
+    const size_t count = bounds.Size();
+    if (viewCount > MaxViews)
+        viewCount = MaxViews;
+
+    for (size_t i = 0; i < count; i += 4)
+    {
+        const XMVECTOR cx = XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(&bounds.centerX[i]));
+        const XMVECTOR cy = XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(&bounds.centerY[i]));
+        const XMVECTOR cz = XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(&bounds.centerZ[i]));
+        const XMVECTOR ex = XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(&bounds.extentX[i]));
+        const XMVECTOR ey = XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(&bounds.extentY[i]));
+        const XMVECTOR ez = XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(&bounds.extentZ[i]));
+
+        uint32_t masks[4] = {};
+        for (size_t v = 0; v < viewCount; ++v)
+        {
+            // A box is outside if it lies fully behind any plane: n.c + d < -(|n|.e)
+            XMVECTOR outside = XMVectorFalseInt();
+            for (const auto &plane : views[v].planes)
+            {
+                const XMVECTOR dist = XMVectorMultiplyAdd(cx, XMVectorReplicate(plane.x),
+                                      XMVectorMultiplyAdd(cy, XMVectorReplicate(plane.y),
+                                      XMVectorMultiplyAdd(cz, XMVectorReplicate(plane.z),
+                                                          XMVectorReplicate(plane.w))));
+                const XMVECTOR radius = XMVectorMultiplyAdd(ex, XMVectorReplicate(std::fabs(plane.x)),
+                                        XMVectorMultiplyAdd(ey, XMVectorReplicate(std::fabs(plane.y)),
+                                                            ez * XMVectorReplicate(std::fabs(plane.z))));
+                outside = XMVectorOrInt(outside, XMVectorLess(dist + radius, XMVectorZero()));
+            }
+
+            XMUINT4 lanes;
+            XMStoreUInt4(&lanes, outside);
+            masks[0] |= (lanes.x ? 0u : 1u) << v;
+            masks[1] |= (lanes.y ? 0u : 1u) << v;
+            masks[2] |= (lanes.z ? 0u : 1u) << v;
+            masks[3] |= (lanes.w ? 0u : 1u) << v;
+        }
+
+        const size_t lanesUsed = (count - i < 4) ? count - i : 4;
+        for (size_t lane = 0; lane < lanesUsed; ++lane)
+            outMasks[i + lane] = (ViewMask)masks[lane];
+    }
+
+    CountMasks(outMasks, count, viewCount, stats);
+    return stats;
+}
+
+FrustumCuller::Stats FrustumCuller::CullScalar(const BoundsSoA &bounds, const Frustum *views, size_t viewCount, ViewMask *outMasks)
+{
+    Stats stats;
+    const size_t count = bounds.Size();
+    if (viewCount > MaxViews)
+        viewCount = MaxViews;
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        ViewMask mask = 0;
+        for (size_t v = 0; v < viewCount; ++v)
+        {
+            bool outside = false;
+            for (const auto &p : views[v].planes)
+            {
+                const float dist = p.x * bounds.centerX[i] + p.y * bounds.centerY[i] + p.z * bounds.centerZ[i] + p.w;
+                const float radius = std::fabs(p.x) * bounds.extentX[i] +
+                                     std::fabs(p.y) * bounds.extentY[i] +
+                                     std::fabs(p.z) * bounds.extentZ[i];
+                if (dist + radius < 0.0f)
+                {
+                    outside = true;
+                    break;
+                }
+            }
+            if (!outside)
+                mask |= (ViewMask)(1u << v);
+        }
+        outMasks[i] = mask;
+    }
+
+    CountMasks(outMasks, count, viewCount, stats);
+    return stats;
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <DirectXMath.h>
+
+using namespace DirectX;
+
+// Axis-aligned boxes as centre and half extents, one array per component so the culler can
+// load four boxes into one register. The arrays are padded to a multiple of four.
+struct BoundsSoA
+{
+    std::vector<float> centerX, centerY, centerZ;
+    std::vector<float> extentX, extentY, extentZ;
+
+    void Resize(size_t count);
+    size_t Size() const { return mCount; }
+
+    void Set(size_t i, FXMVECTOR center, FXMVECTOR extents);
+    void SetMinMax(size_t i, const XMFLOAT3 &boxMin, const XMFLOAT3 &boxMax);
+    // Large enough to pass every frustum test, for things that can't be bounded
+    void SetUnbounded(size_t i);
+
+    // Bounds of local box (centre, extents) under 'world', still axis-aligned
+    static void Transform(FXMVECTOR center, FXMVECTOR extents, CXMMATRIX world,
+                          XMVECTOR &outCenter, XMVECTOR &outExtents);
+
+private:
+    size_t mCount = 0;
+};
+
+// Six planes, normals pointing inside, built from a (row-vector) view-projection matrix
+struct Frustum
+{
+    XMFLOAT4 planes[6];
+
+    static Frustum FromViewProjection(FXMMATRIX viewProj);
+};
+
+// Tests boxes against several views at once (e.g. the main camera and shadow views).
+// Works on plain arrays, needs no device.
+class FrustumCuller
+{
+public:
+
+    typedef uint8_t ViewMask;                   // bit v set: visible in view v
+    static const size_t MaxViews = 8;
+
+    struct Stats
+    {
+        size_t tested = 0;
+        size_t visible[MaxViews] = {};          // per view
+        size_t culled = 0;                      // outside every view
+    };
+
+    // outMasks gets one entry per box. Four boxes are tested per plane with SIMD.
+    static Stats Cull(const BoundsSoA &bounds, const Frustum *views, size_t viewCount, ViewMask *outMasks);
+
+    // One box at a time, same result; the reference for the benchmark
+    static Stats CullScalar(const BoundsSoA &bounds, const Frustum *views, size_t viewCount, ViewMask *outMasks);
+};
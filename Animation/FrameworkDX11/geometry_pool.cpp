@@ -0,0 +1,430 @@
+#include "geometry_pool.hpp"
+#include "log.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+    // A range to copy from the old page buffer into the new one, in elements
+    struct RangeCopy
+    {
+        uint32_t    src;
+        uint32_t    dst;
+        uint32_t    size;
+    };
+
+    // Neighbouring ranges that stay neighbours are copied in one go
+    void CopyRanges(ID3D11DeviceContext *context, ID3D11Buffer *src, ID3D11Buffer *dst,
+                    std::vector<RangeCopy> &copies, UINT elementSize)
+    {
+        std::sort(copies.begin(), copies.end(),
+                  [](const RangeCopy &a, const RangeCopy &b) { return a.dst < b.dst; });
+
+        size_t i = 0;
+        while (i < copies.size())
+        {
+            RangeCopy run = copies[i++];
+            while ((i < copies.size()) && (copies[i].src == run.src + run.size) && (copies[i].dst == run.dst + run.size))
+                run.size += copies[i++].size;
+
+            D3D11_BOX box;
+            box.left = run.src * elementSize;
+            box.right = (run.src + run.size) * elementSize;
+            box.top = 0;
+            box.bottom = 1;
+            box.front = 0;
+            box.back = 1;
+            context->CopySubresourceRegion(dst, 0, run.dst * elementSize, 0, 0, src, 0, &box);
+        }
+    }
+
+#ifdef _DEBUG
+    // Whole buffer through a staging copy; stalls until the GPU is done with it
+    bool ReadBack(ID3D11Device *device, ID3D11DeviceContext *context, ID3D11Buffer *buffer, std::vector<uint8_t> &data)
+    {
+        D3D11_BUFFER_DESC bd;
+        buffer->GetDesc(&bd);
+        bd.Usage = D3D11_USAGE_STAGING;
+        bd.BindFlags = 0;
+        bd.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+        bd.MiscFlags = 0;
+
+        ID3D11Buffer *staging = nullptr;
+        if (FAILED(device->CreateBuffer(&bd, nullptr, &staging)))
+            return false;
+        context->CopyResource(staging, buffer);
+
+        D3D11_MAPPED_SUBRESOURCE mapped;
+        const bool isMapped = SUCCEEDED(context->Map(staging, 0, D3D11_MAP_READ, 0, &mapped));
+        if (isMapped)
+        {
+            const uint8_t *src = static_cast<const uint8_t*>(mapped.pData);
+            data.assign(src, src + bd.ByteWidth);
+            context->Unmap(staging, 0);
+        }
+        Utils::ReleaseAndMakeNull(staging);
+        return isMapped;
+    }
+
+    // Every range has to arrive at its new offset unchanged
+    bool VerifyCopies(ID3D11Device *device, ID3D11DeviceContext *context, ID3D11Buffer *src, ID3D11Buffer *dst,
+                      const std::vector<RangeCopy> &copies, UINT elementSize)
+    {
+        std::vector<uint8_t> before, after;
+        if (!ReadBack(device, context, src, before) || !ReadBack(device, context, dst, after))
+            return false;
+
+        for (const auto &copy : copies)
+        {
+            const size_t srcByte = (size_t)copy.src * elementSize;
+            const size_t dstByte = (size_t)copy.dst * elementSize;
+            const size_t size = (size_t)copy.size * elementSize;
+            if ((srcByte + size > before.size()) || (dstByte + size > after.size()) ||
+                (memcmp(&before[srcByte], &after[dstByte], size) != 0))
+                return false;
+        }
+        return true;
+    }
+#endif
+}
+
+bool GeometryPool::Init(ID3D11Device *device, ID3D11DeviceContext *context, const UINT *streamStrides, UINT streamCount,
+                        uint32_t pageVertices, uint32_t pageIndices)
+{
+    Destroy();
+
+    if (!device || !context || !streamStrides || (streamCount == 0) || (streamCount > MaxStreams) ||
+        (pageVertices == 0) || (pageIndices == 0))
+        return false;
+    for (UINT stream = 0; stream < streamCount; ++stream)
+        if (streamStrides[stream] == 0)
+            return false;
+
+    mDevice = device;
+    mContext = context;
+    std::copy(streamStrides, streamStrides + streamCount, mStreamStrides);
+    mStreamCount = streamCount;
+    mPageVertices = pageVertices;
+    mPageIndices = pageIndices;
+    return true;
+}
+
+void GeometryPool::Destroy()
+{
+    for (auto &page : mPages)
+        DestroyPageBuffers(page);
+    mPages.clear();
+    mEntries.clear();
+    mFreeEntries.clear();
+    mStats = Stats();
+
+    mDevice = nullptr;
+    mContext = nullptr;
+}
+
+GeometryPool::Handle GeometryPool::Allocate(const void * const *streams, uint32_t vertexCount,
+                                            const uint32_t *indices, uint32_t indexCount)
+{
+    if (!IsValid() || !streams || !indices || (vertexCount == 0) || (indexCount == 0))
+        return InvalidHandle;
+    for (UINT stream = 0; stream < mStreamCount; ++stream)
+        if (!streams[stream])
+            return InvalidHandle;
+
+    mStats.allocations++;
+
+    // First page with room for both ranges
+    TlsfAllocator::Allocation vertexRange, indexRange;
+    uint32_t pageIdx = 0;
+    for (; pageIdx < (uint32_t)mPages.size(); ++pageIdx)
+    {
+        Page &page = mPages[pageIdx];
+        if (!page.indexBuffer || !page.vertices.Allocate(vertexCount, vertexRange))
+            continue;
+        if (page.indices.Allocate(indexCount, indexRange))
+            break;
+        page.vertices.Free(vertexRange.block);
+    }
+
+    if (pageIdx == (uint32_t)mPages.size())
+    {
+        // A new page, in the slot of an emptied one if there is any
+        pageIdx = 0;
+        while ((pageIdx < (uint32_t)mPages.size()) && mPages[pageIdx].indexBuffer)
+            pageIdx++;
+        if (pageIdx == (uint32_t)mPages.size())
+            mPages.emplace_back();
+
+        Page &page = mPages[pageIdx];
+        const uint32_t pageVertices = (std::max)(mPageVertices, vertexCount);
+        const uint32_t pageIndices = (std::max)(mPageIndices, indexCount);
+        if (!CreatePageBuffers(page, pageVertices, pageIndices))
+        {
+            mStats.failed++;
+            Log::Error(L"GeometryPool: Failed to create a page of %d vertices and %d indices", pageVertices, pageIndices);
+            return InvalidHandle;
+        }
+        page.vertices.Allocate(vertexCount, vertexRange);
+        page.indices.Allocate(indexCount, indexRange);
+    }
+
+    Page &page = mPages[pageIdx];
+    page.ranges++;
+
+    D3D11_BOX box;
+    box.top = 0;
+    box.bottom = 1;
+    box.front = 0;
+    box.back = 1;
+    for (UINT stream = 0; stream < mStreamCount; ++stream)
+    {
+        box.left = vertexRange.offset * mStreamStrides[stream];
+        box.right = (vertexRange.offset + vertexCount) * mStreamStrides[stream];
+        mContext->UpdateSubresource(page.vertexBuffers[stream], 0, &box, streams[stream], 0, 0);
+    }
+
+    box.left = indexRange.offset * sizeof(uint32_t);
+    box.right = (indexRange.offset + indexCount) * sizeof(uint32_t);
+    mContext->UpdateSubresource(page.indexBuffer, 0, &box, indices, 0, 0);
+
+    Handle handle;
+    if (!mFreeEntries.empty())
+    {
+        handle = mFreeEntries.back();
+        mFreeEntries.pop_back();
+    }
+    else
+    {
+        handle = (Handle)mEntries.size();
+        mEntries.emplace_back();
+    }
+
+    Entry &entry = mEntries[handle];
+    entry.page = pageIdx;
+    entry.vertexBlock = vertexRange.block;
+    entry.indexBlock = indexRange.block;
+    entry.refCount = 1;
+    return handle;
+}
+
+void GeometryPool::AddRef(Handle handle)
+{
+    if ((handle < mEntries.size()) && (mEntries[handle].refCount > 0))
+        mEntries[handle].refCount++;
+}
+
+void GeometryPool::Release(Handle handle)
+{
+    if ((handle >= mEntries.size()) || (mEntries[handle].refCount == 0))
+        return;
+
+    Entry &entry = mEntries[handle];
+    if (--entry.refCount > 0)
+        return;
+
+    Page &page = mPages[entry.page];
+    page.vertices.Free(entry.vertexBlock);
+    page.indices.Free(entry.indexBlock);
+    page.ranges--;
+
+    // Emptied pages give their memory back, except the first one
+    if ((page.ranges == 0) && (entry.page != 0))
+    {
+        DestroyPageBuffers(page);
+        page.vertices.Reset(0);
+        page.indices.Reset(0);
+    }
+
+    entry = Entry();
+    mFreeEntries.push_back(handle);
+}
+
+bool GeometryPool::UpdateVertices(Handle handle, UINT stream, uint32_t firstVertex, const void *vertices, uint32_t vertexCount)
+{
+    if ((handle >= mEntries.size()) || (mEntries[handle].refCount == 0) || (stream >= mStreamCount) || !vertices)
+        return false;
+
+    const Entry &entry = mEntries[handle];
+    const Page &page = mPages[entry.page];
+    if (firstVertex + vertexCount > page.vertices.GetSize(entry.vertexBlock))
+        return false;
+
+    const uint32_t offset = page.vertices.GetOffset(entry.vertexBlock) + firstVertex;
+    D3D11_BOX box;
+    box.left = offset * mStreamStrides[stream];
+    box.right = (offset + vertexCount) * mStreamStrides[stream];
+    box.top = 0;
+    box.bottom = 1;
+    box.front = 0;
+    box.back = 1;
+    mContext->UpdateSubresource(page.vertexBuffers[stream], 0, &box, vertices, 0, 0);
+    return true;
+}
+
+INT GeometryPool::GetBaseVertex(Handle handle) const
+{
+    const Entry &entry = mEntries[handle];
+    return (INT)mPages[entry.page].vertices.GetOffset(entry.vertexBlock);
+}
+
+UINT GeometryPool::GetStartIndex(Handle handle) const
+{
+    const Entry &entry = mEntries[handle];
+    return mPages[entry.page].indices.GetOffset(entry.indexBlock);
+}
+
+UINT GeometryPool::GetVertexSize() const
+{
+    UINT size = 0;
+    for (UINT stream = 0; stream < mStreamCount; ++stream)
+        size += mStreamStrides[stream];
+    return size;
+}
+
+void GeometryPool::Defragment()
+{
+    if (!IsValid())
+        return;
+
+    for (uint32_t pageIdx = 0; pageIdx < (uint32_t)mPages.size(); ++pageIdx)
+        DefragmentPage(pageIdx);
+    mStats.defragmentations++;
+}
+
+void GeometryPool::DefragmentPage(uint32_t pageIdx)
+{
+    Page &page = mPages[pageIdx];
+    if (!page.indexBuffer ||
+        ((page.vertices.GetStats().Fragmentation() == 0.0f) && (page.indices.GetStats().Fragmentation() == 0.0f)))
+        return;
+
+    // A range can't be copied onto an overlapping part of the same buffer, so the packed
+    // ranges go into new buffers. If they can't be created the page stays as it is.
+    Page packed;
+    if (!CreatePageBuffers(packed, page.vertices.GetCapacity(), page.indices.GetCapacity()))
+    {
+        Log::Warning(L"GeometryPool: No memory to defragment page %d", pageIdx);
+        return;
+    }
+
+    std::vector<RangeCopy> vertexCopies, indexCopies;
+    for (const auto &entry : mEntries)
+    {
+        if ((entry.refCount == 0) || (entry.page != pageIdx))
+            continue;
+        vertexCopies.push_back({ page.vertices.GetOffset(entry.vertexBlock), 0, page.vertices.GetSize(entry.vertexBlock) });
+        indexCopies.push_back({ page.indices.GetOffset(entry.indexBlock), 0, page.indices.GetSize(entry.indexBlock) });
+    }
+
+    std::vector<TlsfAllocator::Relocation> relocations;
+    page.vertices.Defragment(relocations);
+    for (const auto &relocation : relocations)
+        mStats.movedVertices += relocation.size;
+    page.indices.Defragment(relocations);
+    for (const auto &relocation : relocations)
+        mStats.movedIndices += relocation.size;
+
+    size_t copyIdx = 0;
+    for (const auto &entry : mEntries)
+    {
+        if ((entry.refCount == 0) || (entry.page != pageIdx))
+            continue;
+        vertexCopies[copyIdx].dst = page.vertices.GetOffset(entry.vertexBlock);
+        indexCopies[copyIdx].dst = page.indices.GetOffset(entry.indexBlock);
+        copyIdx++;
+    }
+
+    for (UINT stream = 0; stream < mStreamCount; ++stream)
+        CopyRanges(mContext, page.vertexBuffers[stream], packed.vertexBuffers[stream], vertexCopies, mStreamStrides[stream]);
+    CopyRanges(mContext, page.indexBuffer, packed.indexBuffer, indexCopies, sizeof(uint32_t));
+
+#ifdef _DEBUG
+    // Debug builds read both pages back and compare the moved ranges, while the old one is still there
+    bool isCopied = VerifyCopies(mDevice, mContext, page.indexBuffer, packed.indexBuffer, indexCopies, sizeof(uint32_t));
+    for (UINT stream = 0; stream < mStreamCount; ++stream)
+        isCopied = isCopied && VerifyCopies(mDevice, mContext, page.vertexBuffers[stream], packed.vertexBuffers[stream],
+                                            vertexCopies, mStreamStrides[stream]);
+    if (isCopied)
+        Log::Debug(L"GeometryPool: Page %d defragmented, %d ranges verified", pageIdx, indexCopies.size());
+    else
+        Log::Error(L"GeometryPool: Page %d differs after defragmenting", pageIdx);
+#endif
+
+    DestroyPageBuffers(page);
+    for (UINT stream = 0; stream < mStreamCount; ++stream)
+        page.vertexBuffers[stream] = Utils::Exchange(packed.vertexBuffers[stream], nullptr);
+    page.indexBuffer = Utils::Exchange(packed.indexBuffer, nullptr);
+}
+
+bool GeometryPool::CreatePageBuffers(Page &page, uint32_t vertexCount, uint32_t indexCount)
+{
+    D3D11_BUFFER_DESC bd;
+    ZeroMemory(&bd, sizeof(bd));
+    bd.Usage = D3D11_USAGE_DEFAULT;
+    bd.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+    for (UINT stream = 0; stream < mStreamCount; ++stream)
+    {
+        bd.ByteWidth = vertexCount * mStreamStrides[stream];
+        if (FAILED(mDevice->CreateBuffer(&bd, nullptr, &page.vertexBuffers[stream])))
+        {
+            DestroyPageBuffers(page);
+            return false;
+        }
+    }
+
+    bd.ByteWidth = indexCount * sizeof(uint32_t);
+    bd.BindFlags = D3D11_BIND_INDEX_BUFFER;
+    if (FAILED(mDevice->CreateBuffer(&bd, nullptr, &page.indexBuffer)))
+    {
+        DestroyPageBuffers(page);
+        return false;
+    }
+
+    page.vertices.Reset(vertexCount);
+    page.indices.Reset(indexCount);
+    page.ranges = 0;
+    return true;
+}
+
+void GeometryPool::DestroyPageBuffers(Page &page)
+{
+    for (auto &vertexBuffer : page.vertexBuffers)
+        Utils::ReleaseAndMakeNull(vertexBuffer);
+    Utils::ReleaseAndMakeNull(page.indexBuffer);
+}
+
+GeometryPool::Stats GeometryPool::GetStats() const
+{
+    Stats stats = mStats;
+
+    size_t vertexFree = 0, vertexLargestFree = 0;
+    size_t indexFree = 0, indexLargestFree = 0;
+    for (const auto &page : mPages)
+    {
+        if (!page.indexBuffer)
+            continue;
+
+        const TlsfAllocator::Stats vertexStats = page.vertices.GetStats();
+        const TlsfAllocator::Stats indexStats = page.indices.GetStats();
+        stats.pages++;
+        stats.ranges += page.ranges;
+        stats.bufferBytes += (size_t)vertexStats.capacity * GetVertexSize() + (size_t)indexStats.capacity * sizeof(uint32_t);
+
+        stats.vertexCapacity += vertexStats.capacity;
+        stats.vertexUsed += vertexStats.used;
+        vertexFree += vertexStats.capacity - vertexStats.used;
+        vertexLargestFree += vertexStats.largestFree;
+
+        stats.indexCapacity += indexStats.capacity;
+        stats.indexUsed += indexStats.used;
+        indexFree += indexStats.capacity - indexStats.used;
+        indexLargestFree += indexStats.largestFree;
+    }
+
+    // Free space split across pages is expected, only the splits within a page count
+    stats.vertexFragmentation = vertexFree ? 1.0f - (float)vertexLargestFree / (float)vertexFree : 0.0f;
+    stats.indexFragmentation = indexFree ? 1.0f - (float)indexLargestFree / (float)indexFree : 0.0f;
+    return stats;
+}
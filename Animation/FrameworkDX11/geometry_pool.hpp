@@ -0,0 +1,126 @@
+#pragma once
+
+#include "tlsf_allocator.hpp"
+
+// We are using an older version of DirectX headers which causes
+// "warning C4005: '...' : macro redefinition"
+#pragma warning(push)
+#pragma warning(disable: 4005)
+#include <d3d11.h>
+#pragma warning(pop)
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+// Vertex and index data of many meshes suballocated from a few large buffers ("pages"), so
+// draws of different meshes share their vertex and index buffer bindings and only differ in
+// base vertex and start index. Vertices can be split into several streams of their own
+// stride (see VertexStreams): a page then has one vertex buffer per stream, all allocated
+// alike, so one base vertex serves every stream. Each page has a TLSF allocator for its
+// vertices and one for its indices. Meshes hold a refcounted handle rather than the ranges
+// themselves, which lets Defragment() move the ranges around.
+class GeometryPool
+{
+public:
+
+    typedef uint32_t Handle;
+    static const Handle InvalidHandle = UINT32_MAX;
+
+    static const UINT MaxStreams = 3;
+
+    // Page size; a mesh larger than that gets a page of its own
+    static const uint32_t DefaultPageVertices = 1 << 16;
+    static const uint32_t DefaultPageIndices = 1 << 18;
+
+    struct Stats
+    {
+        size_t  pages = 0;
+        size_t  ranges = 0;             // live handles
+        size_t  bufferBytes = 0;        // of every page
+
+        size_t  vertexCapacity = 0;
+        size_t  vertexUsed = 0;
+        float   vertexFragmentation = 0.0f;
+        size_t  indexCapacity = 0;
+        size_t  indexUsed = 0;
+        float   indexFragmentation = 0.0f;
+
+        size_t  allocations = 0;        // since Init()
+        size_t  failed = 0;
+        size_t  defragmentations = 0;
+        size_t  movedVertices = 0;
+        size_t  movedIndices = 0;
+    };
+
+    ~GeometryPool() { Destroy(); }
+
+    // Pages are created on demand, with one vertex buffer per entry of 'streamStrides'
+    bool Init(ID3D11Device *device, ID3D11DeviceContext *context, const UINT *streamStrides, UINT streamCount,
+              uint32_t pageVertices = DefaultPageVertices, uint32_t pageIndices = DefaultPageIndices);
+    // Releases every page. Handles still held by meshes become stale and releasing them does nothing.
+    void Destroy();
+
+    bool IsValid() const { return mDevice != nullptr; }
+
+    // Copies the mesh into a page, with one reference on the returned handle. 'streams' holds
+    // the vertices of every stream. Indices are relative to the mesh's first vertex, draws
+    // add GetBaseVertex().
+    Handle Allocate(const void * const *streams, uint32_t vertexCount, const uint32_t *indices, uint32_t indexCount);
+    void AddRef(Handle handle);
+    // The ranges are freed with the last reference
+    void Release(Handle handle);
+
+    // Overwrites 'vertexCount' vertices of one stream of the mesh, starting at 'firstVertex'
+    bool UpdateVertices(Handle handle, UINT stream, uint32_t firstVertex, const void *vertices, uint32_t vertexCount);
+
+    ID3D11Buffer* GetVertexBuffer(Handle handle, UINT stream) const { return mPages[mEntries[handle].page].vertexBuffers[stream]; }
+    ID3D11Buffer* GetIndexBuffer(Handle handle) const { return mPages[mEntries[handle].page].indexBuffer; }
+    INT GetBaseVertex(Handle handle) const;
+    UINT GetStartIndex(Handle handle) const;
+    UINT GetStreamCount() const { return mStreamCount; }
+    UINT GetVertexStride(UINT stream) const { return mStreamStrides[stream]; }
+    // Of all streams together
+    UINT GetVertexSize() const;
+
+    // Packs the ranges of every fragmented page to its front, copying them into new page
+    // buffers on the GPU. Handles stay valid; draws must be recorded again afterwards.
+    void Defragment();
+
+    Stats GetStats() const;
+
+private:
+
+    struct Page
+    {
+        ID3D11Buffer*   vertexBuffers[MaxStreams] = {};
+        ID3D11Buffer*   indexBuffer = nullptr;     // null for an emptied page
+        TlsfAllocator   vertices;
+        TlsfAllocator   indices;
+        size_t          ranges = 0;
+    };
+
+    struct Entry
+    {
+        uint32_t                page = 0;
+        TlsfAllocator::BlockId  vertexBlock = TlsfAllocator::InvalidBlock;
+        TlsfAllocator::BlockId  indexBlock = TlsfAllocator::InvalidBlock;
+        uint32_t                refCount = 0;   // 0 for unused entries
+    };
+
+    bool CreatePageBuffers(Page &page, uint32_t vertexCount, uint32_t indexCount);
+    void DestroyPageBuffers(Page &page);
+    void DefragmentPage(uint32_t pageIdx);
+
+    ID3D11Device*           mDevice = nullptr;
+    ID3D11DeviceContext*    mContext = nullptr;
+    UINT                    mStreamStrides[MaxStreams] = {};
+    UINT                    mStreamCount = 0;
+    uint32_t                mPageVertices = 0;
+    uint32_t                mPageIndices = 0;
+
+    std::vector<Page>       mPages;         // emptied pages past the first keep a slot without buffers
+    std::vector<Entry>      mEntries;
+    std::vector<Handle>     mFreeEntries;
+    Stats                   mStats;
+};
@@ -9,6 +9,7 @@
 
 
 #include <string>
+#include <cstring>
 #include "log.hpp"
 #include "utils.hpp"
 
@@ -268,3 +269,64 @@ bool GltfUtils::FloatArrayToColor(XMFLOAT4 &color, const std::vector<double> &ve
         return false;
     }
 }
+
+const unsigned char* GltfUtils::GetBufferViewData(const tinygltf::Model &model,
+                                                  int bufferViewIdx,
+                                                  size_t byteOffset,
+                                                  size_t count,
+                                                  size_t elementSize,
+                                                  size_t &stride,
+                                                  const wchar_t *logPrefix,
+                                                  const wchar_t *logDataName)
+{
+    if ((bufferViewIdx < 0) || (bufferViewIdx >= (int)model.bufferViews.size()))
+    {
+        Log::Error(L"%sInvalid %s view buffer index (%d/%d)!",
+                   logPrefix, logDataName, bufferViewIdx, model.bufferViews.size());
+        return nullptr;
+    }
+
+    const auto &bufferView = model.bufferViews[bufferViewIdx];
+    const auto bufferIdx = bufferView.buffer;
+    if ((bufferIdx < 0) || (bufferIdx >= (int)model.buffers.size()))
+    {
+        Log::Error(L"%sInvalid %s buffer index (%d/%d)!",
+                   logPrefix, logDataName, bufferIdx, model.buffers.size());
+        return nullptr;
+    }
+
+    const auto &buffer = model.buffers[bufferIdx];
+    stride = (bufferView.byteStride == 0) ? elementSize : bufferView.byteStride;
+    const size_t byteEnd = (count == 0) ? byteOffset : byteOffset + stride * (count - 1) + elementSize;
+    if ((bufferView.byteOffset + bufferView.byteLength > buffer.data.size()) ||
+        (byteEnd > bufferView.byteLength))
+    {
+        Log::Error(L"%sAccessing data chunk outside %s buffer %d!",
+                   logPrefix, logDataName, bufferIdx);
+        return nullptr;
+    }
+
+    return buffer.data.data() + bufferView.byteOffset + byteOffset;
+}
+
+size_t GltfUtils::SparseIndexSize(int componentType)
+{
+    switch (componentType)
+    {
+    case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:  return sizeof(uint8_t);
+    case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT: return sizeof(uint16_t);
+    case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT:   return sizeof(uint32_t);
+    default:                                     return 0;
+    }
+}
+
+size_t GltfUtils::ReadSparseIndex(int componentType, const unsigned char *ptr)
+{
+    switch (componentType)
+    {
+    case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:  return *ptr;
+    case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT: { uint16_t idx; memcpy(&idx, ptr, sizeof(idx)); return idx; }
+    case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT:   { uint32_t idx; memcpy(&idx, ptr, sizeof(idx)); return idx; }
+    default:                                     return SIZE_MAX;
+    }
+}
@@ -15,6 +15,8 @@
 #pragma warning(disable: 4838)
 #pragma warning(pop)
 
+#include "log.hpp"
+
 #include <string>
 
 using namespace DirectX;
@@ -47,6 +49,29 @@ namespace GltfUtils
 
     bool FloatArrayToColor(XMFLOAT4 &color, const std::vector<double> &vector);
 
+    // First of 'count' elements of 'elementSize' bytes at 'byteOffset' into the buffer view,
+    // 'stride' apart (the view's byteStride, or packed). Null, with an error logged, if the
+    // view or its buffer index is invalid or the elements don't fit in the view and buffer.
+    const unsigned char* GetBufferViewData(const tinygltf::Model &model,
+                                           int bufferViewIdx,
+                                           size_t byteOffset,
+                                           size_t count,
+                                           size_t elementSize,
+                                           size_t &stride,
+                                           const wchar_t *logPrefix,
+                                           const wchar_t *logDataName);
+
+    // Calls consumer(element, valuePtr) for every sparse substitution of the accessor, each
+    // value being 'elementSize' bytes. Elements past accessor.count are skipped. False, with
+    // an error logged, if the sparse indices or values are out of range.
+    template <typename TConsumer>
+    bool IterateSparseValues(const tinygltf::Model &model,
+                             const tinygltf::Accessor &accessor,
+                             size_t elementSize,
+                             TConsumer consumer,
+                             const wchar_t *logPrefix,
+                             const wchar_t *logDataName);
+
     template <int component>
     void FloatToColorComponent(XMFLOAT4 &color, double value)
     {
@@ -60,4 +85,45 @@ namespace GltfUtils
         case 3: color.w = (float)value; break;
         }
     }
-}
\ No newline at end of file
+
+    size_t SparseIndexSize(int componentType);
+    size_t ReadSparseIndex(int componentType, const unsigned char *ptr);
+
+    template <typename TConsumer>
+    bool IterateSparseValues(const tinygltf::Model &model,
+                             const tinygltf::Accessor &accessor,
+                             size_t elementSize,
+                             TConsumer consumer,
+                             const wchar_t *logPrefix,
+                             const wchar_t *logDataName)
+    {
+        if (!accessor.sparse.isSparse || (accessor.sparse.count <= 0))
+            return true;
+
+        const auto &sparse = accessor.sparse;
+        const size_t indexSize = SparseIndexSize(sparse.indices.componentType);
+        if (indexSize == 0)
+        {
+            Log::Error(L"%sUnsupported %s sparse index component type (%d)!",
+                       logPrefix, logDataName, sparse.indices.componentType);
+            return false;
+        }
+
+        size_t indexStride, valueStride;
+        const unsigned char *indices = GetBufferViewData(model, sparse.indices.bufferView, sparse.indices.byteOffset,
+                                                         sparse.count, indexSize, indexStride, logPrefix, logDataName);
+        const unsigned char *values = GetBufferViewData(model, sparse.values.bufferView, sparse.values.byteOffset,
+                                                        sparse.count, elementSize, valueStride, logPrefix, logDataName);
+        if (!indices || !values)
+            return false;
+
+        // Sparse views are tightly packed
+        for (int i = 0; i < sparse.count; ++i)
+        {
+            const size_t element = ReadSparseIndex(sparse.indices.componentType, indices + i * indexSize);
+            if (element < accessor.count)
+                consumer(element, values + i * elementSize);
+        }
+        return true;
+    }
+}
@@ -0,0 +1,301 @@
+#include "instance_batcher.hpp"
+#include "structures.h"
+#include "scene_vertex.hpp"
+#include "log.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+void InstanceBatcher::Begin()
+{
+    mBatches.clear();
+    mBatchIndices.clear();
+    mPending.clear();
+    mPalettes.clear();
+    mPaletteOffsets.clear();
+}
+
+uint32_t InstanceBatcher::FindPalette(const void *owner, uint64_t version) const
+{
+    auto it = mPaletteOffsets.find(owner);
+    if (it == mPaletteOffsets.end() || it->second.version != version)
+        return InvalidPalette;
+    return it->second.offset;
+}
+
+uint32_t InstanceBatcher::AddPalette(const void *owner, uint64_t version, const XMMATRIX *matrices, size_t count)
+{
+    const uint32_t existing = FindPalette(owner, version);
+    if (existing != InvalidPalette)
+        return existing;
+
+    const uint32_t offset = (uint32_t)mPalettes.size();
+    mPalettes.resize(mPalettes.size() + count);
+    for (size_t i = 0; i < count; ++i)
+        XMStoreFloat4x4(&mPalettes[offset + i], matrices[i]);
+
+    PaletteEntry entry;
+    entry.version = version;
+    entry.offset = offset;
+    mPaletteOffsets[owner] = entry;
+    return offset;
+}
+
+void InstanceBatcher::Add(const DrawPacket &packet, const void *primitive, int material,
+                          FXMMATRIX world, uint32_t paletteOffset)
+{
+    BatchKey key;
+    key.primitive = primitive;
+    key.material = material;
+
+    auto it = mBatchIndices.find(key);
+    if (it == mBatchIndices.end())
+    {
+        it = mBatchIndices.emplace(key, (uint32_t)mBatches.size()).first;
+        Batch batch;
+        batch.packet = packet;
+        mBatches.push_back(batch);
+    }
+
+    PendingInstance instance;
+    instance.batch = it->second;
+    instance.paletteOffset = (paletteOffset != InvalidPalette) ? paletteOffset : 0;
+    XMStoreFloat4x4(&instance.world, world);
+    mPending.push_back(instance);
+    mBatches[instance.batch].instanceCount++;
+}
+
+InstanceBatcher::Stats InstanceBatcher::Flush(IInstanceBackend &backend)
+{
+    Stats stats;
+    if (mPending.empty())
+        return stats;
+
+    // Counting sort of the instances by batch: offsets first, then one scatter pass
+    uint32_t offset = 0;
+    for (auto &batch : mBatches)
+    {
+        batch.firstInstance = offset;
+        offset += batch.instanceCount;
+    }
+
+    std::vector<uint32_t> cursors(mBatches.size());
+    for (size_t b = 0; b < mBatches.size(); ++b)
+        cursors[b] = mBatches[b].firstInstance;
+
+    mInstances.resize(mPending.size());
+    for (const auto &pending : mPending)
+    {
+        InstanceData &data = mInstances[cursors[pending.batch]++];
+        data.world = pending.world;
+        data.paletteOffset = pending.paletteOffset;
+        data.materialIndex = mBatches[pending.batch].packet.materialIndex;
+        data.padding[0] = data.padding[1] = 0;
+    }
+
+    backend.UploadPalettes(mPalettes.data(), mPalettes.size());
+    backend.UploadInstances(mInstances.data(), mInstances.size());
+    for (const auto &batch : mBatches)
+        backend.DrawInstanced(batch.packet, batch.firstInstance, batch.instanceCount);
+
+    stats.instances = mInstances.size();
+    stats.batches = mBatches.size();
+    stats.paletteMatrices = mPalettes.size();
+
+    mBatches.clear();
+    mBatchIndices.clear();
+    mPending.clear();
+    return stats;
+}
+
+void RecordingInstanceBackend::Clear()
+{
+    palettes.clear();
+    instances.clear();
+    draws.clear();
+    uploads = 0;
+}
+
+void RecordingInstanceBackend::UploadPalettes(const XMFLOAT4X4 *matrices, size_t count)
+{
+    palettes.assign(matrices, matrices + count);
+    uploads++;
+}
+
+void RecordingInstanceBackend::UploadInstances(const InstanceData *data, size_t count)
+{
+    instances.assign(data, data + count);
+    uploads++;
+}
+
+void RecordingInstanceBackend::DrawInstanced(const DrawPacket &packet, uint32_t firstInstance, uint32_t instanceCount)
+{
+    DrawCall call;
+    call.packet = packet;
+    call.firstInstance = firstInstance;
+    call.instanceCount = instanceCount;
+    draws.push_back(call);
+}
+
+bool D3D11InstanceBackend::Init(ID3D11Device *device, StateCache *stateCache,
+                                ID3D11VertexShader *vertexShader, ID3D11InputLayout *inputLayout,
+                                ID3D11VertexShader *staticVertexShader, ID3D11InputLayout *staticInputLayout)
+{
+    if (!device || !stateCache || !stateCache->IsValid() || !vertexShader || !inputLayout ||
+        !staticVertexShader || !staticInputLayout)
+    {
+        Log::Error(L"D3D11InstanceBackend: Missing device, state cache, or the instanced shaders");
+        return false;
+    }
+
+    mDevice = device;
+    mState = stateCache;
+    mContext = stateCache->GetContext();
+    mVertexShader = vertexShader;
+    mInputLayout = inputLayout;
+    mStaticVertexShader = staticVertexShader;
+    mStaticInputLayout = staticInputLayout;
+    return true;
+}
+
+void D3D11InstanceBackend::Destroy()
+{
+    Utils::ReleaseAndMakeNull(mInstanceBuffer);
+    Utils::ReleaseAndMakeNull(mPaletteView);
+    Utils::ReleaseAndMakeNull(mPaletteBuffer);
+    mInstanceCapacity = 0;
+    mPaletteCapacity = 0;
+    mIsValid = false;
+}
+
+bool D3D11InstanceBackend::ReserveInstances(size_t count)
+{
+    if (count <= mInstanceCapacity)
+        return true;
+
+    size_t capacity = (std::max)(mInstanceCapacity * 2, (size_t)64);
+    while (capacity < count)
+        capacity *= 2;
+
+    Utils::ReleaseAndMakeNull(mInstanceBuffer);
+    mInstanceCapacity = 0;
+
+    D3D11_BUFFER_DESC bd;
+    ZeroMemory(&bd, sizeof(bd));
+    bd.Usage = D3D11_USAGE_DYNAMIC;
+    bd.ByteWidth = (UINT)(capacity * sizeof(InstanceData));
+    bd.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+    bd.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+    if (FAILED(mDevice->CreateBuffer(&bd, nullptr, &mInstanceBuffer)))
+    {
+        Log::Error(L"D3D11InstanceBackend: Failed to create instance buffer for %d instances", capacity);
+        return false;
+    }
+
+    mInstanceCapacity = capacity;
+    return true;
+}
+
+bool D3D11InstanceBackend::ReservePalettes(size_t matrixCount)
+{
+    if (matrixCount <= mPaletteCapacity)
+        return true;
+
+    size_t capacity = (std::max)(mPaletteCapacity * 2, (size_t)128);
+    while (capacity < matrixCount)
+        capacity *= 2;
+
+    Utils::ReleaseAndMakeNull(mPaletteView);
+    Utils::ReleaseAndMakeNull(mPaletteBuffer);
+    mPaletteCapacity = 0;
+
+    // Typed float4 buffer, so the shader model 4 vertex shader can Load() from it
+    D3D11_BUFFER_DESC bd;
+    ZeroMemory(&bd, sizeof(bd));
+    bd.Usage = D3D11_USAGE_DYNAMIC;
+    bd.ByteWidth = (UINT)(capacity * sizeof(XMFLOAT4X4));
+    bd.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+    bd.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+    if (FAILED(mDevice->CreateBuffer(&bd, nullptr, &mPaletteBuffer)))
+    {
+        Log::Error(L"D3D11InstanceBackend: Failed to create palette buffer for %d matrices", capacity);
+        return false;
+    }
+
+    D3D11_SHADER_RESOURCE_VIEW_DESC srvd;
+    ZeroMemory(&srvd, sizeof(srvd));
+    srvd.Format = DXGI_FORMAT_R32G32B32A32_FLOAT;
+    srvd.ViewDimension = D3D11_SRV_DIMENSION_BUFFER;
+    srvd.Buffer.FirstElement = 0;
+    srvd.Buffer.NumElements = (UINT)(capacity * 4);
+    if (FAILED(mDevice->CreateShaderResourceView(mPaletteBuffer, &srvd, &mPaletteView)))
+    {
+        Log::Error(L"D3D11InstanceBackend: Failed to create palette buffer view");
+        Utils::ReleaseAndMakeNull(mPaletteBuffer);
+        return false;
+    }
+
+    mPaletteCapacity = capacity;
+    return true;
+}
+
+void D3D11InstanceBackend::UploadPalettes(const XMFLOAT4X4 *matrices, size_t count)
+{
+    mIsValid = false;
+    if (!ReservePalettes((std::max)(count, (size_t)1)))
+        return;
+
+    D3D11_MAPPED_SUBRESOURCE mapped;
+    if (FAILED(mContext->Map(mPaletteBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped)))
+    {
+        Log::Error(L"D3D11InstanceBackend: Failed to map palette buffer");
+        return;
+    }
+    if (count > 0)
+        memcpy(mapped.pData, matrices, count * sizeof(XMFLOAT4X4));
+    mContext->Unmap(mPaletteBuffer, 0);
+    mIsValid = true;
+}
+
+void D3D11InstanceBackend::UploadInstances(const InstanceData *instances, size_t count)
+{
+    if (!mIsValid)
+        return; // palettes failed, the draws would read garbage
+    mIsValid = false;
+    if (!ReserveInstances(count))
+        return;
+
+    D3D11_MAPPED_SUBRESOURCE mapped;
+    if (FAILED(mContext->Map(mInstanceBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped)))
+    {
+        Log::Error(L"D3D11InstanceBackend: Failed to map instance buffer");
+        return;
+    }
+    memcpy(mapped.pData, instances, count * sizeof(InstanceData));
+    mContext->Unmap(mInstanceBuffer, 0);
+    mIsValid = true;
+}
+
+void D3D11InstanceBackend::DrawInstanced(const DrawPacket &packet, uint32_t firstInstance, uint32_t instanceCount)
+{
+    if (!mIsValid)
+        return;
+
+    // Static meshes have no skin stream, and a layout without one
+    const bool isSkinned = packet.skinBuffer != nullptr;
+    mState->VSSetShader(isSkinned ? mVertexShader : mStaticVertexShader);
+    mState->VSSetShaderResource(1, mPaletteView);
+    mState->IASetInputLayout(isSkinned ? mInputLayout : mStaticInputLayout);
+    mState->IASetVertexBuffer(PositionStreamSlot, packet.vertexBuffer, packet.vertexStride);
+    mState->IASetVertexBuffer(AttributeStreamSlot, packet.attributeBuffer, sizeof(AttributeVertex));
+    if (isSkinned)
+        mState->IASetVertexBuffer(SkinStreamSlot, packet.skinBuffer, sizeof(SkinVertex));
+    mState->IASetVertexBuffer(1, mInstanceBuffer, sizeof(InstanceData));
+    mState->IASetIndexBuffer(packet.indexBuffer, DXGI_FORMAT_R32_UINT);
+    mState->IASetPrimitiveTopology(packet.topology);
+    if (packet.textures)
+        mState->PSSetShaderResource(0, packet.textures);
+
+    mContext->DrawIndexedInstanced(packet.indexCount, instanceCount, packet.startIndex, packet.baseVertex, firstInstance);
+}
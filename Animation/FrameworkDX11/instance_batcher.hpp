@@ -0,0 +1,183 @@
+#pragma once
+
+#include "render_queue.hpp"
+#include "state_cache.hpp"
+
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+#include <cstddef>
+#include <DirectXMath.h>
+
+using namespace DirectX;
+
+// Per-instance vertex stream of the instanced vertex shader (VS_Instanced)
+struct InstanceData
+{
+    XMFLOAT4X4  world;              // not transposed, read as four rows
+    uint32_t    paletteOffset;      // first matrix of the instance's skinning palette
+    uint32_t    materialIndex;      // of the batch, instanced draws can't pass it as the start instance
+    uint32_t    padding[2];
+};
+
+// Where the batched draws go. The D3D11 backend below renders them, the recording backend
+// only keeps them, so the batching can be checked and timed without a device.
+class IInstanceBackend
+{
+public:
+    virtual ~IInstanceBackend() {}
+
+    // Called once per flush, before the draws that index into the data
+    virtual void UploadPalettes(const XMFLOAT4X4 *matrices, size_t count) = 0;
+    virtual void UploadInstances(const InstanceData *instances, size_t count) = 0;
+
+    // Geometry from 'packet'; its shader and layout are replaced by the instanced ones, the
+    // object and skin constants by the instance data
+    virtual void DrawInstanced(const DrawPacket &packet, uint32_t firstInstance, uint32_t instanceCount) = 0;
+};
+
+// Collects instances of primitives and merges those that share a primitive and material into
+// one instanced draw. The instance data of all draws goes into one array, each draw's
+// instances contiguous, filled in a single pass at Flush().
+class InstanceBatcher
+{
+public:
+
+    static const uint32_t InvalidPalette = UINT32_MAX;
+
+    struct Stats
+    {
+        size_t instances = 0;
+        size_t batches = 0;         // instanced draws issued
+        size_t paletteMatrices = 0;
+    };
+
+    void Begin();
+
+    // Skinning palettes, stored the way the constant buffer holds them (transposed). One
+    // copy per owner and version, so instances posed by the same skeleton share it.
+    uint32_t FindPalette(const void *owner, uint64_t version) const;
+    uint32_t AddPalette(const void *owner, uint64_t version, const XMMATRIX *matrices, size_t count);
+
+    // 'primitive' and 'material' identify the batch; the first packet added for it is used
+    void Add(const DrawPacket &packet, const void *primitive, int material,
+             FXMMATRIX world, uint32_t paletteOffset);
+
+    // Uploads the palettes and the instance data, then issues one draw per batch, in the
+    // order the batches were first seen
+    Stats Flush(IInstanceBackend &backend);
+
+    size_t GetPendingInstanceCount() const { return mPending.size(); }
+
+private:
+
+    struct BatchKey
+    {
+        const void* primitive;
+        int         material;
+
+        bool operator == (const BatchKey &other) const
+        {
+            return primitive == other.primitive && material == other.material;
+        }
+    };
+    struct BatchKeyHash
+    {
+        size_t operator () (const BatchKey &key) const
+        {
+            return std::hash<const void*>()(key.primitive) ^ ((size_t)key.material * 0x9E3779B97F4A7C15ull);
+        }
+    };
+
+    struct Batch
+    {
+        DrawPacket  packet;
+        uint32_t    instanceCount = 0;
+        uint32_t    firstInstance = 0;
+    };
+
+    struct PendingInstance
+    {
+        uint32_t    batch;
+        uint32_t    paletteOffset;
+        XMFLOAT4X4  world;
+    };
+
+    struct PaletteEntry
+    {
+        uint64_t    version;
+        uint32_t    offset;
+    };
+
+    std::vector<Batch>                                      mBatches;
+    std::unordered_map<BatchKey, uint32_t, BatchKeyHash>    mBatchIndices;
+    std::vector<PendingInstance>                            mPending;
+    std::vector<InstanceData>                               mInstances;
+
+    std::vector<XMFLOAT4X4>                                 mPalettes;
+    std::unordered_map<const void*, PaletteEntry>           mPaletteOffsets;
+};
+
+// Keeps every call, for tests and benchmarks
+class RecordingInstanceBackend : public IInstanceBackend
+{
+public:
+
+    struct DrawCall
+    {
+        DrawPacket  packet;
+        uint32_t    firstInstance;
+        uint32_t    instanceCount;
+    };
+
+    void Clear();
+
+    virtual void UploadPalettes(const XMFLOAT4X4 *matrices, size_t count) override;
+    virtual void UploadInstances(const InstanceData *instances, size_t count) override;
+    virtual void DrawInstanced(const DrawPacket &packet, uint32_t firstInstance, uint32_t instanceCount) override;
+
+    std::vector<XMFLOAT4X4>     palettes;
+    std::vector<InstanceData>   instances;
+    std::vector<DrawCall>       draws;
+    size_t                      uploads = 0;
+};
+
+// Dynamic instance vertex buffer and palette buffer (bound to VS t1), grown as needed.
+// The shaders and layouts, one pair for skinned and one for static meshes, are borrowed
+// from the renderer.
+class D3D11InstanceBackend : public IInstanceBackend
+{
+public:
+
+    ~D3D11InstanceBackend() { Destroy(); }
+
+    // Binds through the state cache, and uploads on its context
+    bool Init(ID3D11Device *device, StateCache *stateCache,
+              ID3D11VertexShader *vertexShader, ID3D11InputLayout *inputLayout,
+              ID3D11VertexShader *staticVertexShader, ID3D11InputLayout *staticInputLayout);
+    void Destroy();
+
+    virtual void UploadPalettes(const XMFLOAT4X4 *matrices, size_t count) override;
+    virtual void UploadInstances(const InstanceData *instances, size_t count) override;
+    virtual void DrawInstanced(const DrawPacket &packet, uint32_t firstInstance, uint32_t instanceCount) override;
+
+private:
+
+    bool ReserveInstances(size_t count);
+    bool ReservePalettes(size_t matrixCount);
+
+    ID3D11Device*               mDevice = nullptr;
+    StateCache*                 mState = nullptr;
+    ID3D11DeviceContext*        mContext = nullptr;
+    ID3D11VertexShader*         mVertexShader = nullptr;
+    ID3D11InputLayout*          mInputLayout = nullptr;
+    ID3D11VertexShader*         mStaticVertexShader = nullptr;  // no skin stream
+    ID3D11InputLayout*          mStaticInputLayout = nullptr;
+
+    ID3D11Buffer*               mInstanceBuffer = nullptr;
+    size_t                      mInstanceCapacity = 0;
+    ID3D11Buffer*               mPaletteBuffer = nullptr;
+    ID3D11ShaderResourceView*   mPaletteView = nullptr;
+    size_t                      mPaletteCapacity = 0;     // in matrices
+    bool                        mIsValid = false;         // last upload succeeded
+};
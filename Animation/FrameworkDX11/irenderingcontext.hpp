@@ -13,6 +13,9 @@
 using namespace DirectX;
 
 class DX11Renderer;
+class ICommandExecutor;
+class D3D11DeferredExecutor;
+class ThreadPool;
 
 // Used by a scene to access necessary renderer internals
 class IRenderingContext // TODO - this should be renamed as it is no longer an interface
@@ -50,8 +53,35 @@ public:
         return m_renderer;
     }
 
+    // Runs the command streams the scene graphs record, nullptr drops them
+    void SetCommandExecutor(ICommandExecutor* executor) {
+        m_executor = executor;
+    }
+
+    ICommandExecutor* GetCommandExecutor() {
+        return m_executor;
+    }
+
+    // Lets the scene graphs record large frames on several threads. The recorded chunks go
+    // to the deferred executor if there is one, else to the command executor in order.
+    void SetParallelSubmit(ThreadPool* pool, D3D11DeferredExecutor* deferred) {
+        m_threadPool = pool;
+        m_deferredExecutor = deferred;
+    }
+
+    ThreadPool* GetThreadPool() {
+        return m_threadPool;
+    }
+
+    D3D11DeferredExecutor* GetDeferredExecutor() {
+        return m_deferredExecutor;
+    }
+
 private:
     ID3D11Device* m_device;
     ID3D11DeviceContext* m_context;
     DX11Renderer* m_renderer;
+    ICommandExecutor* m_executor = nullptr;
+    ThreadPool* m_threadPool = nullptr;
+    D3D11DeferredExecutor* m_deferredExecutor = nullptr;
 };
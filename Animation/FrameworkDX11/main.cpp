@@ -8,10 +8,43 @@
 #include "constants.h"
 #include "Camera.h"
 #include "DX11App.h"
+#include "benchmark.hpp"
+
+#include <shellapi.h>
+#include <cstdio>
 
 DX11App app;
 
 
+//--------------------------------------------------------------------------------------
+// "--bench [stream.bin ...]": runs the benchmark suites and replays the captured command
+// streams without creating a window or a device, then prints the report to the console.
+// Returns the process exit code.
+//--------------------------------------------------------------------------------------
+int RunBenchmarks()
+{
+    if (!AttachConsole(ATTACH_PARENT_PROCESS))
+        AllocConsole();
+    FILE *out = nullptr;
+    freopen_s(&out, "CONOUT$", "w", stdout);
+
+    int argc = 0;
+    LPWSTR *argv = CommandLineToArgvW(GetCommandLineW(), &argc);
+    std::vector<std::wstring> streamPaths;
+    for (int i = 1; i < argc; ++i)
+        if (wcscmp(argv[i], L"--bench") != 0)
+            streamPaths.push_back(argv[i]);
+    LocalFree(argv);
+
+    const bool ok = Benchmark::RunHeadless(L"Resources\\Fox.gltf", streamPaths);
+    for (const auto &line : Benchmark::GetReport())
+        printf("%s\n", line.c_str());
+    fflush(stdout);
+
+    return ok ? 0 : 1;
+}
+
+
 //--------------------------------------------------------------------------------------
 // Entry point to the program. Initializes everything and goes into a message processing 
 // loop. Idle time is used to render the scene.
@@ -19,7 +52,9 @@ DX11App app;
 int WINAPI wWinMain( _In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance, _In_ LPWSTR lpCmdLine, _In_ int nCmdShow )
 {
     UNREFERENCED_PARAMETER( hPrevInstance );
-    UNREFERENCED_PARAMETER( lpCmdLine );
+
+    if( wcsstr( lpCmdLine, L"--bench" ) )
+        return RunBenchmarks();
 
     if( FAILED(app.initWindow( hInstance, nCmdShow ) ) )
         return 0;
@@ -0,0 +1,152 @@
+#include "material_table.hpp"
+#include "log.hpp"
+#include "utils.hpp"
+
+#include <cstring>
+#include <algorithm>
+
+MaterialTable::MaterialTable()
+{
+    Add(MaterialData());
+    mStats = Stats();
+}
+
+uint32_t MaterialTable::Add(const MaterialData &material)
+{
+    mStats.requests++;
+
+    const uint64_t hash = Hash(material);
+    const auto range = mLookup.equal_range(hash);
+    for (auto it = range.first; it != range.second; ++it)
+        if (memcmp(&mMaterials[it->second], &material, sizeof(MaterialData)) == 0)
+            return it->second;
+
+    if (mMaterials.size() >= MaxMaterials)
+    {
+        if (mStats.overflows++ == 0)
+            Log::Warning(L"MaterialTable: More than %d materials, the rest use the default one", MaxMaterials);
+        return DefaultMaterial;
+    }
+
+    const uint32_t idx = (uint32_t)mMaterials.size();
+    mMaterials.push_back(material);
+    mLookup.emplace(hash, idx);
+    mIsDirty = true;
+    return idx;
+}
+
+MaterialData MaterialTable::FromGltf(const tinygltf::Material &material)
+{
+    MaterialData data;
+
+    const auto &pbr = material.pbrMetallicRoughness;
+    if (pbr.baseColorFactor.size() == 4)
+        data.baseColorFactor = XMFLOAT4((float)pbr.baseColorFactor[0], (float)pbr.baseColorFactor[1],
+                                        (float)pbr.baseColorFactor[2], (float)pbr.baseColorFactor[3]);
+    if (material.emissiveFactor.size() == 3)
+        data.emissiveFactor = XMFLOAT3((float)material.emissiveFactor[0], (float)material.emissiveFactor[1],
+                                       (float)material.emissiveFactor[2]);
+    data.metallicFactor = (float)pbr.metallicFactor;
+    data.roughnessFactor = (float)pbr.roughnessFactor;
+    data.normalScale = (float)material.normalTexture.scale;
+    data.occlusionStrength = (float)material.occlusionTexture.strength;
+
+    // The cutoff only means something for masked materials, don't let it split the others
+    if (material.alphaMode == "MASK")
+    {
+        data.flags |= MaterialAlphaMask;
+        data.alphaCutoff = (float)material.alphaCutoff;
+    }
+    else if (material.alphaMode == "BLEND")
+        data.flags |= MaterialAlphaBlend;
+    if (material.doubleSided)
+        data.flags |= MaterialDoubleSided;
+
+    if (pbr.baseColorTexture.index >= 0)
+        data.flags |= MaterialBaseColorTexture;
+    if (pbr.metallicRoughnessTexture.index >= 0)
+        data.flags |= MaterialMetallicRoughnessTexture;
+    if (material.normalTexture.index >= 0)
+        data.flags |= MaterialNormalTexture;
+    if (material.occlusionTexture.index >= 0)
+        data.flags |= MaterialOcclusionTexture;
+    if (material.emissiveTexture.index >= 0)
+        data.flags |= MaterialEmissiveTexture;
+
+    return data;
+}
+
+bool MaterialTable::Upload(ID3D11Device *device, ID3D11DeviceContext *context)
+{
+    if (!device || !context)
+        return false;
+
+    if (!mIndexStream)
+    {
+        std::vector<uint32_t> indices(MaxMaterials);
+        for (uint32_t i = 0; i < MaxMaterials; ++i)
+            indices[i] = i;
+
+        D3D11_BUFFER_DESC bd;
+        ZeroMemory(&bd, sizeof(bd));
+        bd.Usage = D3D11_USAGE_IMMUTABLE;
+        bd.ByteWidth = (UINT)(indices.size() * sizeof(uint32_t));
+        bd.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+        D3D11_SUBRESOURCE_DATA initData;
+        ZeroMemory(&initData, sizeof(initData));
+        initData.pSysMem = indices.data();
+        if (FAILED(device->CreateBuffer(&bd, &initData, &mIndexStream)))
+        {
+            Log::Error(L"MaterialTable: Failed to create the material index stream");
+            return false;
+        }
+    }
+
+    if (!mBuffer)
+    {
+        D3D11_BUFFER_DESC bd;
+        ZeroMemory(&bd, sizeof(bd));
+        bd.Usage = D3D11_USAGE_DEFAULT;
+        bd.ByteWidth = MaxMaterials * sizeof(MaterialData);
+        bd.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+        if (FAILED(device->CreateBuffer(&bd, nullptr, &mBuffer)))
+        {
+            Log::Error(L"MaterialTable: Failed to create the material buffer");
+            return false;
+        }
+        mIsDirty = true;
+    }
+
+    if (!mIsDirty)
+        return true;
+
+    // Constant buffers are updated whole
+    std::vector<MaterialData> staging(MaxMaterials);
+    std::copy(mMaterials.begin(), mMaterials.end(), staging.begin());
+    context->UpdateSubresource(mBuffer, 0, nullptr, staging.data(), 0, 0);
+
+    mIsDirty = false;
+    mStats.uploads++;
+    mStats.uploadBytes += staging.size() * sizeof(MaterialData);
+    return true;
+}
+
+void MaterialTable::Destroy()
+{
+    Utils::ReleaseAndMakeNull(mBuffer);
+    Utils::ReleaseAndMakeNull(mIndexStream);
+    mIsDirty = true;
+}
+
+uint64_t MaterialTable::Hash(const MaterialData &material)
+{
+    // FNV-1a over the bytes, the padding is zero
+    const uint8_t *bytes = reinterpret_cast<const uint8_t*>(&material);
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < sizeof(MaterialData); ++i)
+    {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
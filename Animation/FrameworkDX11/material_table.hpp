@@ -0,0 +1,68 @@
+#pragma once
+
+#include "structures.h"
+
+// We are using an older version of DirectX headers which causes
+// "warning C4005: '...' : macro redefinition"
+#pragma warning(push)
+#pragma warning(disable: 4005)
+#include <d3d11.h>
+#pragma warning(pop)
+
+#include "tiny_gltf.h" // just the interfaces (no implementation)
+
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+#include <cstddef>
+
+// Every material of every loaded scene in one packed array, deduplicated by content, so
+// primitives sharing a material (within a file or across files) share the entry. The array
+// lives in one constant buffer, uploaded when materials were added; draws only carry an index.
+class MaterialTable
+{
+public:
+
+    // The glTF default material, for primitives without one and for a full table
+    static const uint32_t DefaultMaterial = 0;
+
+    struct Stats
+    {
+        size_t requests = 0;        // materials added, including the duplicates
+        size_t overflows = 0;       // did not fit, got the default material
+        size_t uploads = 0;
+        size_t uploadBytes = 0;
+    };
+
+    MaterialTable();
+    ~MaterialTable() { Destroy(); }
+
+    // Index of the entry with the same contents, added if there is none
+    uint32_t Add(const MaterialData &material);
+
+    static MaterialData FromGltf(const tinygltf::Material &material);
+
+    // Creates the buffers on first use and uploads the table if it changed since the last call
+    bool Upload(ID3D11Device *device, ID3D11DeviceContext *context);
+    void Destroy();
+
+    // PS constants, and the vertex stream that turns a draw's start instance into its index
+    ID3D11Buffer* GetBuffer() const { return mBuffer; }
+    ID3D11Buffer* GetIndexStream() const { return mIndexStream; }
+
+    size_t GetCount() const { return mMaterials.size(); }
+    const MaterialData& Get(uint32_t idx) const { return mMaterials[idx]; }
+    const Stats& GetStats() const { return mStats; }
+
+private:
+
+    static uint64_t Hash(const MaterialData &material);
+
+    std::vector<MaterialData>                       mMaterials;
+    std::unordered_multimap<uint64_t, uint32_t>     mLookup;    // content hash -> index
+    bool                                            mIsDirty = true;
+    Stats                                           mStats;
+
+    ID3D11Buffer*   mBuffer = nullptr;
+    ID3D11Buffer*   mIndexStream = nullptr;
+};
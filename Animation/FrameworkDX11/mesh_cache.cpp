@@ -0,0 +1,210 @@
+#include "mesh_cache.hpp"
+#include "scenegraph.h"
+#include "utils.hpp"
+#include "log.hpp"
+
+#include <cstring>
+
+namespace
+{
+    double NowMs()
+    {
+        LARGE_INTEGER now, freq;
+        QueryPerformanceCounter(&now);
+        QueryPerformanceFrequency(&freq);
+        return (double)now.QuadPart * 1000.0 / (double)freq.QuadPart;
+    }
+
+    // FNV-1a, continued from 'hash'
+    uint64_t HashBytes(uint64_t hash, const void *data, size_t size)
+    {
+        const uint8_t *bytes = reinterpret_cast<const uint8_t*>(data);
+        for (size_t i = 0; i < size; ++i)
+        {
+            hash ^= bytes[i];
+            hash *= 1099511628211ull;
+        }
+        return hash;
+    }
+}
+
+MeshHandle MeshCache::LoadFromGltf(IRenderingContext &ctx,
+                                   const tinygltf::Model &model,
+                                   int meshIdx,
+                                   int primitiveIdx,
+                                   const std::wstring &source,
+                                   const std::wstring &logPrefix)
+{
+    const std::string key = source.empty() ? std::string() :
+        Utils::WstringToString(source) + "#" + std::to_string(meshIdx) + "/" + std::to_string(primitiveIdx);
+
+    return FindOrLoad(ctx, key, [&](ScenePrimitive &primitive)
+    {
+        if (!primitive.LoadDataFromGLTF(model, model.meshes[meshIdx], primitiveIdx, logPrefix))
+            return false;
+        primitive.AddMaterialToTable(ctx, model);
+        return true;
+    });
+}
+
+MeshHandle MeshCache::CreateCube(IRenderingContext &ctx)
+{
+    return FindOrLoad(ctx, "builtin:cube", [](ScenePrimitive &primitive)
+    {
+        if (!primitive.GenerateCubeGeometry())
+            return false;
+        primitive.CalculateBounds();
+        return true;
+    });
+}
+
+MeshHandle MeshCache::CreateSphere(IRenderingContext &ctx, const WORD vertSegmCount, const WORD stripCount)
+{
+    const std::string key = "builtin:sphere:" + std::to_string(vertSegmCount) + "x" + std::to_string(stripCount);
+    return FindOrLoad(ctx, key, [=](ScenePrimitive &primitive)
+    {
+        if (!primitive.GenerateSphereGeometry(vertSegmCount, stripCount))
+            return false;
+        primitive.CalculateBounds();
+        return true;
+    });
+}
+
+MeshHandle MeshCache::FindOrLoad(IRenderingContext &ctx, const std::string &key, const Loader &load)
+{
+    mRequests++;
+
+    if (!key.empty())
+    {
+        if (MeshHandle mesh = Lookup(key))
+        {
+            mKeyHits++;
+            mSharedBytes += GetGeometryBytes(*mesh);
+            mSavedMs += mByKey[key].loadMs;
+            return mesh;
+        }
+    }
+
+    const double start = NowMs();
+    MeshHandle mesh = std::make_shared<ScenePrimitive>();
+    if (!load(*mesh))
+        return nullptr;
+
+    // Morphing rewrites the vertex buffer per node, such a primitive stays with its node
+    if (mesh->HasMorphTargets())
+    {
+        if (!mesh->CreateDeviceBuffers(ctx))
+            return nullptr;
+        mLoadMs += NowMs() - start;
+        return mesh;
+    }
+
+    // The geometry was loaded anyway, but the device buffers are not created twice
+    const uint64_t hash = HashContent(*mesh);
+    if (MeshHandle existing = FindContent(hash, *mesh))
+    {
+        const double loadMs = NowMs() - start;
+        mContentHits++;
+        mSharedBytes += GetGeometryBytes(*existing);
+        mLoadMs += loadMs;
+        if (!key.empty())
+        {
+            Entry &entry = mByKey[key];
+            entry.mesh = existing;
+            entry.loadMs = loadMs;
+        }
+        return existing;
+    }
+
+    if (!mesh->CreateDeviceBuffers(ctx))
+        return nullptr;
+
+    const double loadMs = NowMs() - start;
+    mLoadMs += loadMs;
+    if (!key.empty())
+    {
+        Entry &entry = mByKey[key];
+        entry.mesh = mesh;
+        entry.loadMs = loadMs;
+    }
+    mByContent.emplace(hash, mesh);
+    return mesh;
+}
+
+MeshHandle MeshCache::Lookup(const std::string &key)
+{
+    auto it = mByKey.find(key);
+    if (it == mByKey.end())
+        return nullptr;
+
+    MeshHandle mesh = it->second.mesh.lock();
+    if (!mesh)
+        mByKey.erase(it); // every holder released it
+    return mesh;
+}
+
+MeshHandle MeshCache::FindContent(uint64_t hash, const ScenePrimitive &primitive)
+{
+    auto range = mByContent.equal_range(hash);
+    for (auto it = range.first; it != range.second;)
+    {
+        MeshHandle mesh = it->second.lock();
+        if (!mesh)
+        {
+            it = mByContent.erase(it);
+            continue;
+        }
+        if (IsSameContent(*mesh, primitive))
+            return mesh;
+        ++it;
+    }
+    return nullptr;
+}
+
+uint64_t MeshCache::HashContent(const ScenePrimitive &primitive)
+{
+    uint64_t hash = 14695981039346656037ull;
+    hash = HashBytes(hash, &primitive.mTopology, sizeof(primitive.mTopology));
+    hash = HashBytes(hash, &primitive.mMaterialTableIdx, sizeof(primitive.mMaterialTableIdx));
+    hash = HashBytes(hash, primitive.mVertices.data(), primitive.mVertices.size() * sizeof(SceneVertex));
+    hash = HashBytes(hash, primitive.mIndices.data(), primitive.mIndices.size() * sizeof(uint32_t));
+    return hash;
+}
+
+bool MeshCache::IsSameContent(const ScenePrimitive &a, const ScenePrimitive &b)
+{
+    return (a.mTopology == b.mTopology) &&
+           (a.mMaterialTableIdx == b.mMaterialTableIdx) &&
+           (a.mVertices.size() == b.mVertices.size()) &&
+           (a.mIndices.size() == b.mIndices.size()) &&
+           (memcmp(a.mVertices.data(), b.mVertices.data(), a.mVertices.size() * sizeof(SceneVertex)) == 0) &&
+           (memcmp(a.mIndices.data(), b.mIndices.data(), a.mIndices.size() * sizeof(uint32_t)) == 0);
+}
+
+size_t MeshCache::GetGeometryBytes(const ScenePrimitive &primitive)
+{
+    // The CPU copy stays interleaved, the device buffers hold the mesh's streams
+    const size_t indexBytes = primitive.mIndices.size() * sizeof(uint32_t);
+    const size_t deviceVertexSize = VertexStreams::GetVertexSize(primitive.GetSkinBuffer() != nullptr);
+    return primitive.mVertices.size() * (sizeof(SceneVertex) + deviceVertexSize) + 2 * indexBytes;
+}
+
+MeshCache::Stats MeshCache::GetStats() const
+{
+    Stats stats;
+    for (const auto &entry : mByContent)
+    {
+        MeshHandle mesh = entry.second.lock();
+        if (!mesh)
+            continue;
+        stats.liveMeshes++;
+        stats.geometryBytes += GetGeometryBytes(*mesh);
+    }
+    stats.requests = mRequests;
+    stats.keyHits = mKeyHits;
+    stats.contentHits = mContentHits;
+    stats.sharedBytes = mSharedBytes;
+    stats.loadMs = mLoadMs;
+    stats.savedMs = mSavedMs;
+    return stats;
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include "irenderingcontext.hpp"
+#include "tiny_gltf.h" // just the interfaces (no implementation)
+
+#include <string>
+#include <memory>
+#include <functional>
+#include <unordered_map>
+#include <cstdint>
+#include <cstddef>
+
+class ScenePrimitive;
+
+// Primitive shared by every node drawing the same mesh, vertex data and device buffers
+// included. Shared primitives are never modified; the last holder frees it.
+using MeshHandle = std::shared_ptr<ScenePrimitive>;
+
+// Finds the live primitives again instead of loading them once per node. Loads are keyed by
+// where the mesh comes from: (file, mesh, primitive) for glTF, the shape and its parameters
+// for generated ones. A miss is also compared with the geometry of the live primitives, so
+// equal meshes under different keys (other meshes of a file, other files) are shared too.
+// Primitives with morph targets carry per-node state and are never shared.
+class MeshCache
+{
+public:
+
+    struct Stats
+    {
+        size_t liveMeshes = 0;
+        size_t geometryBytes = 0;   // vertices and indices of the live meshes, CPU copy and device buffers
+        size_t requests = 0;        // meshes handed out since start
+        size_t keyHits = 0;         // ...found by key, nothing loaded
+        size_t contentHits = 0;     // ...loaded, then found equal to a live mesh
+        size_t sharedBytes = 0;     // CPU and GPU memory the hits would have duplicated
+        double loadMs = 0.0;        // spent loading
+        double savedMs = 0.0;       // the key hits' meshes took this long when they were loaded
+    };
+
+    // Primitive 'primitiveIdx' of mesh 'meshIdx'. 'source' identifies the file; an empty
+    // source only shares by content.
+    MeshHandle LoadFromGltf(IRenderingContext &ctx,
+                            const tinygltf::Model &model,
+                            int meshIdx,
+                            int primitiveIdx,
+                            const std::wstring &source,
+                            const std::wstring &logPrefix);
+    MeshHandle CreateCube(IRenderingContext &ctx);
+    MeshHandle CreateSphere(IRenderingContext &ctx, const WORD vertSegmCount = 40, const WORD stripCount = 80);
+
+    Stats GetStats() const;
+
+    static size_t GetGeometryBytes(const ScenePrimitive &primitive);
+
+private:
+
+    // Fills the empty primitive's geometry and material, no device buffers yet
+    typedef std::function<bool(ScenePrimitive &)> Loader;
+
+    MeshHandle FindOrLoad(IRenderingContext &ctx, const std::string &key, const Loader &load);
+    MeshHandle Lookup(const std::string &key);
+    MeshHandle FindContent(uint64_t hash, const ScenePrimitive &primitive);
+
+    static uint64_t HashContent(const ScenePrimitive &primitive);
+    static bool IsSameContent(const ScenePrimitive &a, const ScenePrimitive &b);
+
+    struct Entry
+    {
+        std::weak_ptr<ScenePrimitive>   mesh;
+        double                          loadMs = 0.0;
+    };
+
+    std::unordered_map<std::string, Entry>                              mByKey;
+    std::unordered_multimap<uint64_t, std::weak_ptr<ScenePrimitive>>    mByContent;   // content hash -> mesh
+
+    size_t mRequests = 0;
+    size_t mKeyHits = 0;
+    size_t mContentHits = 0;
+    size_t mSharedBytes = 0;
+    double mLoadMs = 0.0;
+    double mSavedMs = 0.0;
+};
@@ -0,0 +1,441 @@
+#include "occlusion_culler.hpp"
+#include "thread_pool.hpp"
+#include "log.hpp"
+#include "utils.hpp"
+#include "stb_image_write.h" // just the interface, implemented in tiny_gltf.cpp
+
+#include <algorithm>
+#include <cmath>
+#include <cfloat>
+
+namespace
+{
+    // Triangles per transform job; big occluders are split so the threads stay balanced
+    const uint32_t ChunkTriangles = 512;
+}
+
+OcclusionCuller::OcclusionCuller()
+{
+    XMStoreFloat4x4(&mViewProj, XMMatrixIdentity());
+    SetResolution(256, 128);
+}
+
+void OcclusionCuller::SetResolution(unsigned int width, unsigned int height)
+{
+    mTilesX = (std::max)(1u, (width + TileWidth - 1) / TileWidth);
+    mTilesY = (std::max)(1u, (height + TileHeight - 1) / TileHeight);
+    mWidth = mTilesX * TileWidth;
+    mHeight = mTilesY * TileHeight;
+
+    // Halve down to a single texel; odd sizes round up so every pixel has a parent
+    mLevels.clear();
+    Level level;
+    level.width = mWidth;
+    level.height = mHeight;
+    for (;;)
+    {
+        level.depth.assign((size_t)level.width * level.height, 1.0f);
+        mLevels.push_back(level);
+        if (level.width == 1 && level.height == 1)
+            break;
+        level.width = (level.width + 1) / 2;
+        level.height = (level.height + 1) / 2;
+    }
+
+    for (auto &bins : mThreadBins)
+        bins.tiles.resize((size_t)mTilesX * mTilesY);
+    mIsReady = false;
+}
+
+void OcclusionCuller::BeginFrame(FXMMATRIX viewProj)
+{
+    XMStoreFloat4x4(&mViewProj, viewProj);
+    mOccluders.clear();
+    std::fill(mLevels[0].depth.begin(), mLevels[0].depth.end(), 1.0f);
+    mIsReady = false;
+}
+
+void OcclusionCuller::AddOccluder(const XMFLOAT3 *positions, size_t stride, size_t vertexCount,
+                                  const uint32_t *indices, size_t indexCount, CXMMATRIX world)
+{
+    if (!positions || !indices || indexCount < 3)
+        return;
+
+    Occluder occluder;
+    occluder.positions = reinterpret_cast<const uint8_t*>(positions);
+    occluder.stride = stride;
+    occluder.vertexCount = vertexCount;
+    occluder.indices = indices;
+    occluder.indexCount = indexCount - indexCount % 3;
+    XMStoreFloat4x4(&occluder.worldViewProj, world * XMLoadFloat4x4(&mViewProj));
+    mOccluders.push_back(occluder);
+}
+
+void OcclusionCuller::Render(ThreadPool *pool)
+{
+    mStats = Stats();
+    mStats.occluders = mOccluders.size();
+
+    mChunks.clear();
+    for (uint32_t o = 0; o < (uint32_t)mOccluders.size(); ++o)
+    {
+        const uint32_t indexCount = (uint32_t)mOccluders[o].indexCount;
+        for (uint32_t first = 0; first < indexCount; first += ChunkTriangles * 3)
+        {
+            OccluderChunk chunk;
+            chunk.occluder = o;
+            chunk.firstIndex = first;
+            chunk.indexCount = (std::min)(ChunkTriangles * 3, indexCount - first);
+            mChunks.push_back(chunk);
+        }
+    }
+
+    const unsigned int threadCount = pool ? pool->GetThreadCount() : 1;
+    const size_t tileCount = (size_t)mTilesX * mTilesY;
+    if (mThreadBins.size() < threadCount)
+        mThreadBins.resize(threadCount);
+    for (auto &bins : mThreadBins)
+    {
+        bins.triangles.clear();
+        bins.tiles.resize(tileCount);
+        for (auto &tile : bins.tiles)
+            tile.clear();
+    }
+
+    // Transform and bin; every thread appends to its own bins, so nothing is shared
+    auto transformJob = [this](size_t chunk, unsigned int thread) { TransformChunk(mChunks[chunk], mThreadBins[thread]); };
+    auto rasterizeJob = [this](size_t tile, unsigned int) { RasterizeTile((unsigned int)tile); };
+    if (pool)
+    {
+        pool->ParallelFor(mChunks.size(), transformJob);
+        pool->ParallelFor(tileCount, rasterizeJob);
+    }
+    else
+    {
+        for (size_t i = 0; i < mChunks.size(); ++i)
+            transformJob(i, 0);
+        for (size_t i = 0; i < tileCount; ++i)
+            rasterizeJob(i, 0);
+    }
+
+    for (const auto &bins : mThreadBins)
+    {
+        mStats.triangles += bins.triangles.size();
+        for (const auto &tile : bins.tiles)
+            mStats.binnedTriangles += tile.size();
+    }
+
+    BuildPyramid();
+    mIsReady = true;
+}
+
+void OcclusionCuller::TransformChunk(const OccluderChunk &chunk, ThreadBins &bins) const
+{
+    const Occluder &occluder = mOccluders[chunk.occluder];
+    const XMMATRIX worldViewProj = XMLoadFloat4x4(&occluder.worldViewProj);
+    const uint32_t *indices = occluder.indices + chunk.firstIndex;
+
+    for (uint32_t i = 0; i + 2 < chunk.indexCount; i += 3)
+    {
+        XMVECTOR clip[3];
+        bool isValid = true;
+        for (int v = 0; v < 3; ++v)
+        {
+            const uint32_t idx = indices[i + v];
+            if (idx >= occluder.vertexCount)
+            {
+                isValid = false;
+                break;
+            }
+            const XMFLOAT3 *position = reinterpret_cast<const XMFLOAT3*>(occluder.positions + idx * occluder.stride);
+            clip[v] = XMVector3Transform(XMLoadFloat3(position), worldViewProj);
+        }
+        if (isValid)
+            ClipAndBin(clip, bins);
+    }
+}
+
+void OcclusionCuller::ClipAndBin(const XMVECTOR clip[3], ThreadBins &bins) const
+{
+    XMFLOAT4 v[3];
+    for (int i = 0; i < 3; ++i)
+        XMStoreFloat4(&v[i], clip[i]);
+
+    // Entirely outside one of the side or far planes
+    if ((v[0].x < -v[0].w && v[1].x < -v[1].w && v[2].x < -v[2].w) ||
+        (v[0].x >  v[0].w && v[1].x >  v[1].w && v[2].x >  v[2].w) ||
+        (v[0].y < -v[0].w && v[1].y < -v[1].w && v[2].y < -v[2].w) ||
+        (v[0].y >  v[0].w && v[1].y >  v[1].w && v[2].y >  v[2].w) ||
+        (v[0].z >  v[0].w && v[1].z >  v[1].w && v[2].z >  v[2].w))
+        return;
+
+    // Clip against the near plane (z >= 0); what remains has w > 0 and can be projected
+    XMVECTOR polygon[4];
+    int vertexCount = 0;
+    for (int i = 0; i < 3; ++i)
+    {
+        const int next = (i + 1) % 3;
+        const bool isInside = v[i].z >= 0.0f;
+        if (isInside)
+            polygon[vertexCount++] = clip[i];
+        if (isInside != (v[next].z >= 0.0f))
+            polygon[vertexCount++] = XMVectorLerp(clip[i], clip[next], v[i].z / (v[i].z - v[next].z));
+    }
+    if (vertexCount < 3)
+        return;
+
+    XMFLOAT3 screen[4];
+    for (int i = 0; i < vertexCount; ++i)
+    {
+        XMFLOAT4 p;
+        XMStoreFloat4(&p, polygon[i]);
+        const float invW = 1.0f / p.w;
+        screen[i].x = (p.x * invW * 0.5f + 0.5f) * (float)mWidth;
+        screen[i].y = (0.5f - p.y * invW * 0.5f) * (float)mHeight;
+        screen[i].z = p.z * invW;
+    }
+
+    BinTriangle(screen, bins);
+    if (vertexCount == 4)
+    {
+        const XMFLOAT3 second[3] = { screen[0], screen[2], screen[3] };
+        BinTriangle(second, bins);
+    }
+}
+
+void OcclusionCuller::BinTriangle(const XMFLOAT3 screen[3], ThreadBins &bins) const
+{
+    XMFLOAT3 p0 = screen[0], p1 = screen[1], p2 = screen[2];
+
+    // Counter-clockwise in screen space (y down), so all edge functions are positive inside
+    float area = (p1.x - p0.x) * (p2.y - p0.y) - (p2.x - p0.x) * (p1.y - p0.y);
+    if (std::fabs(area) < 1e-6f)
+        return;
+    if (area < 0.0f)
+    {
+        std::swap(p1, p2);
+        area = -area;
+    }
+
+    // Nothing behind the far plane can hide anything
+    if ((std::min)({ p0.z, p1.z, p2.z }) >= 1.0f)
+        return;
+
+    // Pixels whose centre may be inside
+    ScreenTriangle tri;
+    tri.minX = (std::max)(0, (int)std::ceil((std::min)({ p0.x, p1.x, p2.x }) - 0.5f));
+    tri.minY = (std::max)(0, (int)std::ceil((std::min)({ p0.y, p1.y, p2.y }) - 0.5f));
+    tri.maxX = (std::min)((int)mWidth - 1, (int)std::floor((std::max)({ p0.x, p1.x, p2.x }) - 0.5f));
+    tri.maxY = (std::min)((int)mHeight - 1, (int)std::floor((std::max)({ p0.y, p1.y, p2.y }) - 0.5f));
+    if (tri.minX > tri.maxX || tri.minY > tri.maxY)
+        return;
+
+    const XMFLOAT3 *corners[3] = { &p0, &p1, &p2 };
+    for (int e = 0; e < 3; ++e)
+    {
+        const XMFLOAT3 &a = *corners[e];
+        const XMFLOAT3 &b = *corners[(e + 1) % 3];
+        tri.edgeA[e] = a.y - b.y;
+        tri.edgeB[e] = b.x - a.x;
+        tri.edgeC[e] = -(tri.edgeA[e] * a.x + tri.edgeB[e] * a.y);
+    }
+
+    tri.dzdx = ((p1.z - p0.z) * (p2.y - p0.y) - (p2.z - p0.z) * (p1.y - p0.y)) / area;
+    tri.dzdy = ((p2.z - p0.z) * (p1.x - p0.x) - (p1.z - p0.z) * (p2.x - p0.x)) / area;
+    tri.z0 = p0.z - tri.dzdx * p0.x - tri.dzdy * p0.y;
+
+    const uint32_t triIdx = (uint32_t)bins.triangles.size();
+    bins.triangles.push_back(tri);
+
+    const unsigned int tileX0 = tri.minX / TileWidth, tileX1 = tri.maxX / TileWidth;
+    const unsigned int tileY0 = tri.minY / TileHeight, tileY1 = tri.maxY / TileHeight;
+    for (unsigned int ty = tileY0; ty <= tileY1; ++ty)
+        for (unsigned int tx = tileX0; tx <= tileX1; ++tx)
+            bins.tiles[ty * mTilesX + tx].push_back(triIdx);
+}
+
+void OcclusionCuller::RasterizeTile(unsigned int tile)
+{
+    const int tileX0 = (int)((tile % mTilesX) * TileWidth);
+    const int tileY0 = (int)((tile / mTilesX) * TileHeight);
+    const int tileX1 = tileX0 + (int)TileWidth - 1;
+    const int tileY1 = tileY0 + (int)TileHeight - 1;
+    float *depth = mLevels[0].depth.data();
+
+    const XMVECTOR laneCentres = XMVectorSet(0.5f, 1.5f, 2.5f, 3.5f);
+
+    // The threads' bins are walked in order; with a min depth test the order doesn't matter
+    // for the result anyway
+    for (const auto &bins : mThreadBins)
+    {
+        for (uint32_t triIdx : bins.tiles[tile])
+        {
+            const ScreenTriangle &tri = bins.triangles[triIdx];
+            const int x0 = (std::max)(tri.minX, tileX0) & ~3;   // tiles are 4-aligned
+            const int x1 = (std::min)(tri.maxX, tileX1);
+            const int y0 = (std::max)(tri.minY, tileY0);
+            const int y1 = (std::min)(tri.maxY, tileY1);
+
+            const XMVECTOR a0 = XMVectorReplicate(tri.edgeA[0]);
+            const XMVECTOR a1 = XMVectorReplicate(tri.edgeA[1]);
+            const XMVECTOR a2 = XMVectorReplicate(tri.edgeA[2]);
+            const XMVECTOR dzdx = XMVectorReplicate(tri.dzdx);
+
+            for (int y = y0; y <= y1; ++y)
+            {
+                const float py = (float)y + 0.5f;
+                const XMVECTOR row0 = XMVectorReplicate(tri.edgeB[0] * py + tri.edgeC[0]);
+                const XMVECTOR row1 = XMVectorReplicate(tri.edgeB[1] * py + tri.edgeC[1]);
+                const XMVECTOR row2 = XMVectorReplicate(tri.edgeB[2] * py + tri.edgeC[2]);
+                const XMVECTOR rowZ = XMVectorReplicate(tri.dzdy * py + tri.z0);
+                float *row = depth + (size_t)y * mWidth;
+
+                for (int x = x0; x <= x1; x += 4)
+                {
+                    const XMVECTOR px = XMVectorAdd(XMVectorReplicate((float)x), laneCentres);
+                    const XMVECTOR inside = XMVectorAndInt(
+                        XMVectorAndInt(XMVectorGreaterOrEqual(XMVectorMultiplyAdd(px, a0, row0), XMVectorZero()),
+                                       XMVectorGreaterOrEqual(XMVectorMultiplyAdd(px, a1, row1), XMVectorZero())),
+                        XMVectorGreaterOrEqual(XMVectorMultiplyAdd(px, a2, row2), XMVectorZero()));
+                    if (XMVector4EqualInt(inside, XMVectorFalseInt()))
+                        continue;
+
+                    XMFLOAT4 *dst = reinterpret_cast<XMFLOAT4*>(row + x);
+                    const XMVECTOR old = XMLoadFloat4(dst);
+                    const XMVECTOR z = XMVectorMultiplyAdd(px, dzdx, rowZ);
+                    XMStoreFloat4(dst, XMVectorSelect(old, XMVectorMin(old, z), inside));
+                }
+            }
+        }
+    }
+}
+
+void OcclusionCuller::BuildPyramid()
+{
+    // Each texel keeps the farthest depth of the (up to) 2x2 texels below it
+    for (size_t l = 1; l < mLevels.size(); ++l)
+    {
+        const Level &src = mLevels[l - 1];
+        Level &dst = mLevels[l];
+        for (unsigned int y = 0; y < dst.height; ++y)
+        {
+            const unsigned int sy0 = y * 2, sy1 = (std::min)(y * 2 + 1, src.height - 1);
+            for (unsigned int x = 0; x < dst.width; ++x)
+            {
+                const unsigned int sx0 = x * 2, sx1 = (std::min)(x * 2 + 1, src.width - 1);
+                dst.depth[y * dst.width + x] = (std::max)(
+                    (std::max)(src.depth[sy0 * src.width + sx0], src.depth[sy0 * src.width + sx1]),
+                    (std::max)(src.depth[sy1 * src.width + sx0], src.depth[sy1 * src.width + sx1]));
+            }
+        }
+    }
+}
+
+bool OcclusionCuller::IsOccluded(const XMFLOAT3 &boxMin, const XMFLOAT3 &boxMax) const
+{
+    if (!mIsReady)
+        return false;
+
+    const XMMATRIX viewProj = XMLoadFloat4x4(&mViewProj);
+    float minX = FLT_MAX, minY = FLT_MAX, maxX = -FLT_MAX, maxY = -FLT_MAX;
+    float nearestZ = FLT_MAX;
+    for (int c = 0; c < 8; ++c)
+    {
+        const XMVECTOR corner = XMVectorSet((c & 1) ? boxMax.x : boxMin.x,
+                                            (c & 2) ? boxMax.y : boxMin.y,
+                                            (c & 4) ? boxMax.z : boxMin.z, 1.0f);
+        XMFLOAT4 p;
+        XMStoreFloat4(&p, XMVector4Transform(corner, viewProj));
+        if (p.z < 0.0f || p.w <= 0.0f)
+            return false;
+
+        // The nearest depth of a box is at one of its corners
+        const float invW = 1.0f / p.w;
+        const float x = (p.x * invW * 0.5f + 0.5f) * (float)mWidth;
+        const float y = (0.5f - p.y * invW * 0.5f) * (float)mHeight;
+        minX = (std::min)(minX, x);
+        maxX = (std::max)(maxX, x);
+        minY = (std::min)(minY, y);
+        maxY = (std::max)(maxY, y);
+        nearestZ = (std::min)(nearestZ, p.z * invW);
+    }
+
+    // Every pixel the box touches, clamped to the screen
+    if (maxX < 0.0f || maxY < 0.0f || minX >= (float)mWidth || minY >= (float)mHeight)
+        return false;
+    const unsigned int x0 = (unsigned int)(std::max)(0.0f, minX);
+    const unsigned int y0 = (unsigned int)(std::max)(0.0f, minY);
+    const unsigned int x1 = (unsigned int)(std::min)((float)mWidth - 1.0f, maxX);
+    const unsigned int y1 = (unsigned int)(std::min)((float)mHeight - 1.0f, maxY);
+
+    // Coarsest level at which the rectangle spans at most 2x2 texels
+    unsigned int level = 0;
+    while (level + 1 < mLevels.size() && ((x1 >> level) - (x0 >> level) > 1 || (y1 >> level) - (y0 >> level) > 1))
+        level++;
+
+    const Level &hiZ = mLevels[level];
+    for (unsigned int y = y0 >> level; y <= (y1 >> level); ++y)
+        for (unsigned int x = x0 >> level; x <= (x1 >> level); ++x)
+            if (hiZ.depth[y * hiZ.width + x] >= nearestZ)
+                return false;
+    return true;
+}
+
+size_t OcclusionCuller::CullOccluded(const BoundsSoA &bounds, FrustumCuller::ViewMask *masks) const
+{
+    if (!mIsReady)
+        return 0;
+
+    size_t occluded = 0;
+    for (size_t i = 0; i < bounds.Size(); ++i)
+    {
+        if (!(masks[i] & 1))
+            continue;
+
+        const XMFLOAT3 boxMin(bounds.centerX[i] - bounds.extentX[i],
+                              bounds.centerY[i] - bounds.extentY[i],
+                              bounds.centerZ[i] - bounds.extentZ[i]);
+        const XMFLOAT3 boxMax(bounds.centerX[i] + bounds.extentX[i],
+                              bounds.centerY[i] + bounds.extentY[i],
+                              bounds.centerZ[i] + bounds.extentZ[i]);
+        if (IsOccluded(boxMin, boxMax))
+        {
+            masks[i] &= ~(FrustumCuller::ViewMask)1;
+            occluded++;
+        }
+    }
+    return occluded;
+}
+
+bool OcclusionCuller::DumpDepth(const std::wstring &path, unsigned int level) const
+{
+    if (level >= mLevels.size())
+    {
+        Log::Error(L"OcclusionCuller: Depth dump of level %d requested, only %d levels",
+                   level, (unsigned int)mLevels.size());
+        return false;
+    }
+
+    // Stretch the depth range that was actually written, the rest is far (white)
+    const Level &src = mLevels[level];
+    float nearest = 1.0f;
+    for (float z : src.depth)
+        nearest = (std::min)(nearest, z);
+    const float scale = (nearest < 1.0f) ? 255.0f / (1.0f - nearest) : 0.0f;
+
+    std::vector<uint8_t> pixels(src.depth.size(), 255);
+    for (size_t i = 0; i < src.depth.size(); ++i)
+        if (src.depth[i] < 1.0f)
+            pixels[i] = (uint8_t)((std::max)(0.0f, src.depth[i] - nearest) * scale);
+
+    const std::string pathA = Utils::WstringToString(path);
+    if (!stbi_write_png(pathA.c_str(), (int)src.width, (int)src.height, 1, pixels.data(), (int)src.width))
+    {
+        Log::Error(L"OcclusionCuller: Failed to write depth dump \"%s\"", path.c_str());
+        return false;
+    }
+
+    Log::Info(L"OcclusionCuller: Level %d depth (%dx%d) written to \"%s\"",
+              level, src.width, src.height, path.c_str());
+    return true;
+}
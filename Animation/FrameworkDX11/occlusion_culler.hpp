@@ -0,0 +1,134 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <cstddef>
+#include <DirectXMath.h>
+
+#include "frustum_culler.hpp"
+
+using namespace DirectX;
+
+class ThreadPool;
+
+// Software occlusion culling. Occluder triangles are rasterised on the CPU into a small depth
+// buffer (D3D depth, 0 = near), which is reduced into a max-depth pyramid; a box is occluded
+// if its nearest point lies behind the farthest occluder depth over its screen rectangle.
+// Needs no device, so it also runs headless.
+//
+// Per frame: BeginFrame(), AddOccluder() for each occluder, Render(), then any number of
+// IsOccluded() / CullOccluded() tests.
+class OcclusionCuller
+{
+public:
+
+    // The depth buffer is split into tiles that are rasterised independently, one per job
+    static const unsigned int TileWidth = 32;
+    static const unsigned int TileHeight = 16;
+
+    struct Stats
+    {
+        size_t occluders = 0;
+        size_t triangles = 0;           // on screen after clipping
+        size_t binnedTriangles = 0;     // summed over the tiles they overlap
+    };
+
+    OcclusionCuller();
+
+    // Rounded up to whole tiles
+    void SetResolution(unsigned int width, unsigned int height);
+    unsigned int GetWidth() const { return mWidth; }
+    unsigned int GetHeight() const { return mHeight; }
+
+    // Clears the depth buffer and the occluder list
+    void BeginFrame(FXMMATRIX viewProj);
+
+    // Indexed triangle list. Positions are read with the given stride in bytes, so they can
+    // stay inside a bigger vertex; the data has to stay alive until Render().
+    void AddOccluder(const XMFLOAT3 *positions, size_t stride, size_t vertexCount,
+                     const uint32_t *indices, size_t indexCount, CXMMATRIX world);
+
+    // Transforms and bins the occluder triangles, rasterises the tiles and builds the depth
+    // pyramid. Both the transform and the rasterisation are spread over the pool, if any.
+    void Render(ThreadPool *pool);
+    bool IsReady() const { return mIsReady; }
+    const Stats& GetStats() const { return mStats; }
+
+    // True only if the world space box is certainly hidden. Boxes that reach the near plane
+    // or lie off screen are left to the frustum test and never reported occluded.
+    bool IsOccluded(const XMFLOAT3 &boxMin, const XMFLOAT3 &boxMax) const;
+
+    // Clears bit 0 (the main view) of every mask that has it and whose box is occluded.
+    // Returns the number of boxes cleared.
+    size_t CullOccluded(const BoundsSoA &bounds, FrustumCuller::ViewMask *masks) const;
+
+    // Writes a pyramid level as a greyscale PNG, the depth range stretched to 0..255
+    bool DumpDepth(const std::wstring &path, unsigned int level = 0) const;
+    unsigned int GetLevelCount() const { return (unsigned int)mLevels.size(); }
+
+    // Read access for tests and tools
+    const float* GetDepth(unsigned int level = 0) const { return mLevels[level].depth.data(); }
+
+private:
+
+    struct Occluder
+    {
+        const uint8_t*      positions;
+        size_t              stride;
+        size_t              vertexCount;
+        const uint32_t*     indices;
+        size_t              indexCount;
+        XMFLOAT4X4          worldViewProj;
+    };
+
+    // A range of one occluder's triangles, the unit of work of the transform step
+    struct OccluderChunk
+    {
+        uint32_t            occluder;
+        uint32_t            firstIndex;
+        uint32_t            indexCount;
+    };
+
+    // Screen space triangle, set up for rasterisation. Edge i is positive inside the
+    // triangle: edgeA[i] * x + edgeB[i] * y + edgeC[i] >= 0, with x and y at pixel centres.
+    struct ScreenTriangle
+    {
+        float               edgeA[3], edgeB[3], edgeC[3];
+        float               dzdx, dzdy, z0;     // depth = dzdx * x + dzdy * y + z0
+        int                 minX, minY, maxX, maxY;
+    };
+
+    // What each thread produced in the transform step; tiles[t] lists its triangles in tile t
+    struct ThreadBins
+    {
+        std::vector<ScreenTriangle>         triangles;
+        std::vector<std::vector<uint32_t>>  tiles;
+    };
+
+    struct Level
+    {
+        unsigned int        width = 0;
+        unsigned int        height = 0;
+        std::vector<float>  depth;
+    };
+
+    void TransformChunk(const OccluderChunk &chunk, ThreadBins &bins) const;
+    void ClipAndBin(const XMVECTOR clip[3], ThreadBins &bins) const;
+    void BinTriangle(const XMFLOAT3 screen[3], ThreadBins &bins) const;
+    void RasterizeTile(unsigned int tile);
+    void BuildPyramid();
+
+    unsigned int                mWidth = 0;
+    unsigned int                mHeight = 0;
+    unsigned int                mTilesX = 0;
+    unsigned int                mTilesY = 0;
+
+    XMFLOAT4X4                  mViewProj;
+    std::vector<Occluder>       mOccluders;
+    std::vector<OccluderChunk>  mChunks;
+    std::vector<ThreadBins>     mThreadBins;
+    std::vector<Level>          mLevels;            // [0] is the rasterised depth buffer
+    Stats                       mStats;
+    bool                        mIsReady = false;
+};
@@ -0,0 +1,141 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <new>
+#include <utility>
+#include <cstdint>
+#include <cstddef>
+
+// Reference to an object in a PagedPool. The generation changes every time the slot is
+// freed, so a handle to a destroyed object resolves to nullptr instead of to its successor.
+struct PoolHandle
+{
+    uint32_t index = UINT32_MAX;
+    uint32_t generation = 0;
+
+    bool IsValid() const { return index != UINT32_MAX; }
+    bool operator == (const PoolHandle &other) const { return (index == other.index) && (generation == other.generation); }
+    bool operator != (const PoolHandle &other) const { return !(*this == other); }
+};
+
+// Fixed-size pages of slots that are never moved or freed, so pointers to live objects stay
+// valid however much the pool grows. Create and Destroy are O(1) through an intrusive free list.
+template <typename T, size_t PageSize = 256>
+class PagedPool
+{
+public:
+
+    PagedPool() = default;
+    ~PagedPool() { Clear(); }
+
+    PagedPool(const PagedPool &) = delete;
+    PagedPool& operator = (const PagedPool &) = delete;
+
+    template <typename... Args>
+    T* Create(Args&&... args)
+    {
+        if (mFreeHead == UINT32_MAX)
+            AddPage();
+
+        Slot &slot = GetSlot(mFreeHead);
+        T *object = new (slot.storage) T(std::forward<Args>(args)...);
+        mFreeHead = slot.nextFree;
+        slot.nextFree = UINT32_MAX;
+        slot.alive = true;
+        mLiveCount++;
+        return object;
+    }
+
+    // The object must come from this pool
+    void Destroy(T *object)
+    {
+        if (!object)
+            return;
+
+        Slot &slot = *reinterpret_cast<Slot*>(object);
+        object->~T();
+        slot.alive = false;
+        slot.generation++;
+        slot.nextFree = mFreeHead;
+        mFreeHead = slot.index;
+        mLiveCount--;
+    }
+
+    // Handle of a live object of this pool, O(1)
+    PoolHandle GetHandle(const T *object) const
+    {
+        if (!object)
+            return PoolHandle();
+        const Slot &slot = *reinterpret_cast<const Slot*>(object);
+        return { slot.index, slot.generation };
+    }
+
+    // nullptr if the handle is stale or invalid
+    T* Get(PoolHandle handle) const
+    {
+        if (handle.index >= mPages.size() * PageSize)
+            return nullptr;
+        Slot &slot = GetSlot(handle.index);
+        if (!slot.alive || (slot.generation != handle.generation))
+            return nullptr;
+        return reinterpret_cast<T*>(slot.storage);
+    }
+
+    // Destroys every live object; outstanding handles become stale, the pages are kept
+    void Clear()
+    {
+        mFreeHead = UINT32_MAX;
+        for (size_t i = mPages.size() * PageSize; i-- > 0;)
+        {
+            Slot &slot = GetSlot((uint32_t)i);
+            if (slot.alive)
+            {
+                reinterpret_cast<T*>(slot.storage)->~T();
+                slot.alive = false;
+                slot.generation++;
+            }
+            slot.nextFree = mFreeHead;
+            mFreeHead = (uint32_t)i;
+        }
+        mLiveCount = 0;
+    }
+
+    size_t Size() const { return mLiveCount; }
+    size_t Capacity() const { return mPages.size() * PageSize; }
+
+private:
+
+    // 'storage' must stay the first member, objects are mapped back to their slot by address
+    struct Slot
+    {
+        alignas(T) unsigned char storage[sizeof(T)];
+        uint32_t index;
+        uint32_t generation;
+        uint32_t nextFree;
+        bool     alive;
+    };
+
+    Slot& GetSlot(uint32_t index) const { return mPages[index / PageSize][index % PageSize]; }
+
+    void AddPage()
+    {
+        const uint32_t first = (uint32_t)(mPages.size() * PageSize);
+        mPages.emplace_back(new Slot[PageSize]);
+
+        // Thread the new slots onto the free list in ascending order
+        Slot *page = mPages.back().get();
+        for (uint32_t i = 0; i < PageSize; ++i)
+        {
+            page[i].index = first + i;
+            page[i].generation = 0;
+            page[i].nextFree = (i + 1 < PageSize) ? first + i + 1 : mFreeHead;
+            page[i].alive = false;
+        }
+        mFreeHead = first;
+    }
+
+    std::vector<std::unique_ptr<Slot[]>>    mPages;
+    uint32_t                                mFreeHead = UINT32_MAX;
+    size_t                                  mLiveCount = 0;
+};
@@ -1,18 +1,55 @@
 //--------------------------------------------------------------------------------------
 // Constant Buffer Variables
 //--------------------------------------------------------------------------------------
-cbuffer ConstantBuffer : register( b0 )
+// Split by update frequency, the slots match structures.h
+cbuffer ObjectConstants : register( b0 )
 {
 	matrix World;
+}
+
+cbuffer FrameConstants : register( b3 )
+{
+	float4 vOutputColor;
+}
+
+cbuffer ViewConstants : register( b4 )
+{
 	matrix View;
 	matrix Projection;
-	float4 vOutputColor;
-    float4x4 g_boneTransforms[100];
+}
+
+cbuffer SkinConstants : register( b5 )
+{
+    float4x4 g_boneTransforms[100]; // Must match max_bones on CPU
+}
+
+// glTF metallic-roughness materials, MaterialData and MaxMaterials in structures.h
+#define MATERIAL_ALPHA_MASK 1
+
+struct MaterialData
+{
+    float4 BaseColorFactor;
+    float3 EmissiveFactor;
+    float MetallicFactor;
+    float RoughnessFactor;
+    float NormalScale;
+    float OcclusionStrength;
+    float AlphaCutoff;
+    uint Flags;
+    uint3 Padding;
+};
+
+cbuffer MaterialTable : register( b2 )
+{
+    MaterialData Materials[256];
 }
 
 Texture2D albedoMap : register(t0);
 SamplerState samLinear : register(s0);
 
+// Skinning palettes of the instanced draws, four float4 per matrix, laid out like g_boneTransforms
+Buffer<float4> instancePalettes : register(t1);
+
 static const float PI = 3.14159265f;
 
 #define MAX_LIGHTS 1
@@ -51,6 +88,9 @@ cbuffer LightProperties : register(b1)
 
 
 //--------------------------------------------------------------------------------------
+// Vertex inputs, one per VertexStreams::Layout: positions, attributes and skin come from
+// separate streams, so each entry only declares the ones it reads
+
 struct VS_INPUT
 {
     float4 Pos : POSITION;
@@ -59,6 +99,61 @@ struct VS_INPUT
     float2 Tex : TEXCOORD0;
     uint4 Joints : BLENDINDICES0;
     float4 Weights : BLENDWEIGHT0;
+    uint MaterialIndex : MATERIALINDEX; // the draw's start instance, see structures.h
+};
+
+// Static meshes have no skin stream
+struct VS_STATIC_INPUT
+{
+    float4 Pos : POSITION;
+    float3 Norm : NORMAL;
+    float4 Tangent : TANGENT;
+    float2 Tex : TEXCOORD0;
+    uint MaterialIndex : MATERIALINDEX;
+};
+
+// Depth-only passes read the positions alone, plus the skin of skinned meshes
+struct VS_DEPTH_INPUT
+{
+    float4 Pos : POSITION;
+};
+
+struct VS_DEPTH_SKINNED_INPUT
+{
+    float4 Pos : POSITION;
+    uint4 Joints : BLENDINDICES0;
+    float4 Weights : BLENDWEIGHT0;
+};
+
+// Per-vertex data plus the per-instance stream (InstanceData on the CPU)
+struct VS_INSTANCED_INPUT
+{
+    float4 Pos : POSITION;
+    float3 Norm : NORMAL;
+    float4 Tangent : TANGENT;
+    float2 Tex : TEXCOORD0;
+    uint4 Joints : BLENDINDICES0;
+    float4 Weights : BLENDWEIGHT0;
+    float4 World0 : INSTANCEWORLD0;
+    float4 World1 : INSTANCEWORLD1;
+    float4 World2 : INSTANCEWORLD2;
+    float4 World3 : INSTANCEWORLD3;
+    uint PaletteOffset : INSTANCEPALETTE;
+    uint MaterialIndex : INSTANCEMATERIAL;
+};
+
+struct VS_INSTANCED_STATIC_INPUT
+{
+    float4 Pos : POSITION;
+    float3 Norm : NORMAL;
+    float4 Tangent : TANGENT;
+    float2 Tex : TEXCOORD0;
+    float4 World0 : INSTANCEWORLD0;
+    float4 World1 : INSTANCEWORLD1;
+    float4 World2 : INSTANCEWORLD2;
+    float4 World3 : INSTANCEWORLD3;
+    uint PaletteOffset : INSTANCEPALETTE;
+    uint MaterialIndex : INSTANCEMATERIAL;
 };
 
 struct PS_INPUT
@@ -67,6 +162,7 @@ struct PS_INPUT
 	float4 worldPos : POSITION;
 	float3 Norm : NORMAL;
 	float2 Tex : TEXCOORD0;
+	nointerpolation uint MaterialIndex : MATERIAL;
 };
 
 
@@ -141,69 +237,163 @@ LightingResult ComputeLighting(float4 pixelToLightVectorNormalised, float4 pixel
 //--------------------------------------------------------------------------------------
 // Vertex Shader (VS)
 //--------------------------------------------------------------------------------------
-PS_INPUT VS(VS_INPUT input)
-{
-    float4 skinnedPos = float4(0, 0, 0, 0);
-    float3 skinnedNorm = float3(0, 0, 0);
-
-    // --- FIX START: Check if the object is skinned ---
-    // We sum the weights. If they equal 0, this is a static object (like the sphere).
-    float weightSum = input.Weights.x + input.Weights.y + input.Weights.z + input.Weights.w;
 
+// Skins position and normal with the constant buffer palette
+void SkinVertex(float4 pos, float3 norm, uint4 joints, float4 weights, out float4 skinnedPos, out float3 skinnedNorm)
+{
+    // We sum the weights. If they equal 0, this vertex is not bound to any joint.
+    float weightSum = weights.x + weights.y + weights.z + weights.w;
     if (weightSum == 0.0f)
     {
-        // It's a static object (Sphere), just use the original position and normal
-        skinnedPos = input.Pos;
-        skinnedPos.w = 1.0f;
-        skinnedNorm = input.Norm;
+        skinnedPos = float4(pos.xyz, 1.0f);
+        skinnedNorm = norm;
+        return;
     }
-    else
+
+    skinnedPos = float4(0, 0, 0, 0);
+    skinnedNorm = float3(0, 0, 0);
+
+    [unroll]
+    for (int i = 0; i < 4; ++i)
     {
-        // It's a skinned object (Fox), use the bone transforms
-        int indexX = input.Joints.x;
-        float4x4 jointXMatrix = g_boneTransforms[indexX];
-        float jointXWeight = input.Weights.x;
-        skinnedPos += mul(input.Pos, jointXMatrix) * jointXWeight;
-        skinnedNorm += mul(input.Norm, (float3x3) jointXMatrix) * jointXWeight;
-
-        int indexY = input.Joints.y;
-        float4x4 jointYMatrix = g_boneTransforms[indexY];
-        float jointYWeight = input.Weights.y;
-        skinnedPos += mul(input.Pos, jointYMatrix) * jointYWeight;
-        skinnedNorm += mul(input.Norm, (float3x3) jointYMatrix) * jointYWeight;
-
-        int indexZ = input.Joints.z;
-        float4x4 jointZMatrix = g_boneTransforms[indexZ];
-        float jointZWeight = input.Weights.z;
-        skinnedPos += mul(input.Pos, jointZMatrix) * jointZWeight;
-        skinnedNorm += mul(input.Norm, (float3x3) jointZMatrix) * jointZWeight;
-
-        int indexW = input.Joints.w;
-        float4x4 jointWMatrix = g_boneTransforms[indexW];
-        float jointWWeight = input.Weights.w;
-        skinnedPos += mul(input.Pos, jointWMatrix) * jointWWeight;
-        skinnedNorm += mul(input.Norm, (float3x3) jointWMatrix) * jointWWeight;
-        
-        skinnedPos.w = 1.0f;
+        float4x4 joint = g_boneTransforms[joints[i]];
+        skinnedPos += mul(float4(pos.xyz, 1.0f), joint) * weights[i];
+        skinnedNorm += mul(norm, (float3x3) joint) * weights[i];
     }
-    // --- FIX END ---
-    
+
+    skinnedPos.w = 1.0f;
+}
+
+// Every pass transforms positions through here, so the depth prepass and the forward
+// pass produce the same depth and EQUAL tests pass
+float4 ModelToClip(float4 modelPos, float4x4 world, out float4 worldPos)
+{
+    worldPos = mul(modelPos, world);
+    precise float4 clipPos = mul(mul(worldPos, View), Projection);
+    return clipPos;
+}
+
+PS_INPUT VS(VS_INPUT input)
+{
+    float4 skinnedPos;
+    float3 skinnedNorm;
+    SkinVertex(input.Pos, input.Norm, input.Joints, input.Weights, skinnedPos, skinnedNorm);
+
     PS_INPUT output = (PS_INPUT) 0;
     
     // Transform by World, View, Projection
-    output.Pos = mul(skinnedPos, World);
-    output.worldPos = output.Pos;
-    output.Pos = mul(output.Pos, View);
-    output.Pos = mul(output.Pos, Projection);
+    output.Pos = ModelToClip(skinnedPos, World, output.worldPos);
 
     output.Norm = mul(float4(skinnedNorm, 0), World).xyz;
     output.Norm = normalize(output.Norm);
 
     output.Tex = input.Tex;
+    output.MaterialIndex = input.MaterialIndex;
     
     return output;
 }
 
+// Static meshes: no skin stream, nothing to blend
+PS_INPUT VS_Static(VS_STATIC_INPUT input)
+{
+    PS_INPUT output = (PS_INPUT) 0;
+
+    output.Pos = ModelToClip(float4(input.Pos.xyz, 1.0f), World, output.worldPos);
+
+    output.Norm = mul(float4(input.Norm, 0), World).xyz;
+    output.Norm = normalize(output.Norm);
+
+    output.Tex = input.Tex;
+    output.MaterialIndex = input.MaterialIndex;
+
+    return output;
+}
+
+// Depth prepass: positions only, drawn without a pixel shader
+float4 VS_Depth(VS_DEPTH_INPUT input) : SV_POSITION
+{
+    float4 worldPos;
+    return ModelToClip(float4(input.Pos.xyz, 1.0f), World, worldPos);
+}
+
+float4 VS_DepthSkinned(VS_DEPTH_SKINNED_INPUT input) : SV_POSITION
+{
+    float4 skinnedPos;
+    float3 skinnedNorm;
+    SkinVertex(input.Pos, float3(0, 0, 0), input.Joints, input.Weights, skinnedPos, skinnedNorm);
+
+    float4 worldPos;
+    return ModelToClip(skinnedPos, World, worldPos);
+}
+
+//--------------------------------------------------------------------------------------
+// Vertex Shader (VS) for instanced draws: world matrix and palette come per instance
+//--------------------------------------------------------------------------------------
+float4x4 LoadPaletteMatrix(uint idx)
+{
+    // Stored transposed, like the constant buffer palette
+    uint base = idx * 4;
+    return transpose(float4x4(instancePalettes.Load(base),
+                              instancePalettes.Load(base + 1),
+                              instancePalettes.Load(base + 2),
+                              instancePalettes.Load(base + 3)));
+}
+
+PS_INPUT VS_Instanced(VS_INSTANCED_INPUT input)
+{
+    float4x4 world = float4x4(input.World0, input.World1, input.World2, input.World3);
+
+    float4 skinnedPos = float4(input.Pos.xyz, 1.0f);
+    float3 skinnedNorm = input.Norm;
+
+    // Vertices bound to no joint have no weights, see SkinVertex
+    float weightSum = input.Weights.x + input.Weights.y + input.Weights.z + input.Weights.w;
+    if (weightSum != 0.0f)
+    {
+        skinnedPos = float4(0, 0, 0, 0);
+        skinnedNorm = float3(0, 0, 0);
+
+        [unroll]
+        for (int i = 0; i < 4; ++i)
+        {
+            float4x4 joint = LoadPaletteMatrix(input.PaletteOffset + input.Joints[i]);
+            skinnedPos += mul(float4(input.Pos.xyz, 1.0f), joint) * input.Weights[i];
+            skinnedNorm += mul(input.Norm, (float3x3) joint) * input.Weights[i];
+        }
+
+        skinnedPos.w = 1.0f;
+    }
+
+    PS_INPUT output = (PS_INPUT) 0;
+
+    output.Pos = ModelToClip(skinnedPos, world, output.worldPos);
+
+    output.Norm = mul(float4(skinnedNorm, 0), world).xyz;
+    output.Norm = normalize(output.Norm);
+
+    output.Tex = input.Tex;
+    output.MaterialIndex = input.MaterialIndex;
+
+    return output;
+}
+
+PS_INPUT VS_InstancedStatic(VS_INSTANCED_STATIC_INPUT input)
+{
+    float4x4 world = float4x4(input.World0, input.World1, input.World2, input.World3);
+
+    PS_INPUT output = (PS_INPUT) 0;
+
+    output.Pos = ModelToClip(float4(input.Pos.xyz, 1.0f), world, output.worldPos);
+
+    output.Norm = mul(float4(input.Norm, 0), world).xyz;
+    output.Norm = normalize(output.Norm);
+
+    output.Tex = input.Tex;
+    output.MaterialIndex = input.MaterialIndex;
+
+    return output;
+}
+
 //--------------------------------------------------------------------------------------
 // Pixel Shader
 //--------------------------------------------------------------------------------------
@@ -227,15 +417,19 @@ float4 PS_Normal(PS_INPUT IN) : SV_TARGET
 	
     LightingResult lit = ComputeLighting(pixelToLightVectorNormalised, pixelToEyeVectorNormalised, distanceFromPixelToLight, normalize(IN.Norm));
 
-	// NOTE we aren't using any material properties just yet. 
+	// Only base colour, alpha cutoff and emission of the material are used by this lighting model
     float4 ambient = GlobalAmbient;  
 	float4 diffuse = lit.Diffuse;
 	float4 specular = lit.Specular;
 
+    MaterialData material = Materials[IN.MaterialIndex];
+
     float4 texColor;
-	texColor = albedoMap.Sample(samLinear, IN.Tex);
+	texColor = albedoMap.Sample(samLinear, IN.Tex) * material.BaseColorFactor;
+    if (material.Flags & MATERIAL_ALPHA_MASK)
+        clip(texColor.a - material.AlphaCutoff);
 	
-    float4 diffuseColor = (ambient + diffuse + specular) * texColor;
+    float4 diffuseColor = (ambient + diffuse + specular) * texColor + float4(material.EmissiveFactor, 0);
 	
 	return diffuseColor;
 }
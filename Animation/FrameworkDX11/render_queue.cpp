@@ -0,0 +1,292 @@
+#include "render_queue.hpp"
+#include "structures.h"
+#include "scene_vertex.hpp"
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <numeric>
+
+namespace
+{
+    // VS and PS shaders, object constants, input layout, vertex buffer, index buffer, topology
+    const size_t BindingsPerDraw = 7;
+
+    // The bindings currently set, as far as the queue knows
+    struct BoundState
+    {
+        ID3D11VertexShader*         vertexShader = nullptr;
+        ID3D11PixelShader*          pixelShader = nullptr;
+        ID3D11InputLayout*          inputLayout = nullptr;
+        ID3D11Buffer*               vertexBuffer = nullptr;
+        UINT                        vertexStride = 0;
+        ID3D11Buffer*               attributeBuffer = nullptr;
+        ID3D11Buffer*               skinBuffer = nullptr;
+        ID3D11Buffer*               indexBuffer = nullptr;
+        D3D11_PRIMITIVE_TOPOLOGY    topology = D3D11_PRIMITIVE_TOPOLOGY_UNDEFINED;
+        ConstantRange               objectConstants;
+        ConstantRange               skinConstants;
+        ID3D11ShaderResourceView*   textures = nullptr;
+        bool                        isEmpty = true;     // nothing bound yet, everything differs
+    };
+
+    // Brings 'state' to what 'packet' needs; returns the number of bindings that took.
+    // With a null stream the bindings are only counted.
+    size_t Bind(CommandStream *stream, const DrawPacket &packet, BoundState &state)
+    {
+        size_t changes = 0;
+        const bool all = state.isEmpty;
+        state.isEmpty = false;
+
+        if (all || packet.vertexShader != state.vertexShader)
+        {
+            state.vertexShader = packet.vertexShader;
+            if (stream)
+                stream->SetVertexShader(packet.vertexShader);
+            changes++;
+        }
+        if (all || packet.pixelShader != state.pixelShader)
+        {
+            state.pixelShader = packet.pixelShader;
+            if (stream)
+                stream->SetPixelShader(packet.pixelShader);
+            changes++;
+        }
+        if (all || packet.objectConstants != state.objectConstants)
+        {
+            state.objectConstants = packet.objectConstants;
+            if (stream)
+                stream->SetVSConstants(ObjectConstantsSlot, packet.objectConstants.buffer,
+                                       packet.objectConstants.firstConstant, packet.objectConstants.numConstants);
+            changes++;
+        }
+        if (packet.skinConstants.buffer && packet.skinConstants != state.skinConstants)
+        {
+            state.skinConstants = packet.skinConstants;
+            if (stream)
+                stream->SetVSConstants(SkinConstantsSlot, packet.skinConstants.buffer,
+                                       packet.skinConstants.firstConstant, packet.skinConstants.numConstants);
+            changes++;
+        }
+        if (all || packet.inputLayout != state.inputLayout)
+        {
+            state.inputLayout = packet.inputLayout;
+            if (stream)
+                stream->SetInputLayout(packet.inputLayout);
+            changes++;
+        }
+        if (all || packet.vertexBuffer != state.vertexBuffer || packet.vertexStride != state.vertexStride)
+        {
+            state.vertexBuffer = packet.vertexBuffer;
+            state.vertexStride = packet.vertexStride;
+            if (stream)
+                stream->SetVertexBuffer(PositionStreamSlot, packet.vertexBuffer, packet.vertexStride);
+            changes++;
+        }
+        if (packet.attributeBuffer && packet.attributeBuffer != state.attributeBuffer)
+        {
+            state.attributeBuffer = packet.attributeBuffer;
+            if (stream)
+                stream->SetVertexBuffer(AttributeStreamSlot, packet.attributeBuffer, sizeof(AttributeVertex));
+            changes++;
+        }
+        if (packet.skinBuffer && packet.skinBuffer != state.skinBuffer)
+        {
+            state.skinBuffer = packet.skinBuffer;
+            if (stream)
+                stream->SetVertexBuffer(SkinStreamSlot, packet.skinBuffer, sizeof(SkinVertex));
+            changes++;
+        }
+        if (all || packet.indexBuffer != state.indexBuffer)
+        {
+            state.indexBuffer = packet.indexBuffer;
+            if (stream)
+                stream->SetIndexBuffer(packet.indexBuffer);
+            changes++;
+        }
+        if (all || packet.topology != state.topology)
+        {
+            state.topology = packet.topology;
+            if (stream)
+                stream->SetTopology((uint32_t)packet.topology);
+            changes++;
+        }
+        if (packet.textures && packet.textures != state.textures)
+        {
+            state.textures = packet.textures;
+            if (stream)
+                stream->SetPSResource(0, packet.textures);
+            changes++;
+        }
+        return changes;
+    }
+
+    // What binding everything the packet needs costs
+    size_t GetBindingCount(const DrawPacket &packet)
+    {
+        return BindingsPerDraw + (packet.attributeBuffer ? 1 : 0) + (packet.skinBuffer ? 1 : 0) +
+               (packet.textures ? 1 : 0) + (packet.skinConstants.buffer ? 1 : 0);
+    }
+}
+
+uint64_t RenderQueue::MakeKey(unsigned int pass, uint32_t shader, uint32_t material,
+                              uint32_t textureSet, uint32_t vertexBuffer, float depth)
+{
+    const float clampedDepth = (std::min)((std::max)(depth, 0.0f), 1.0f);
+    const uint64_t quantisedDepth = (uint64_t)(clampedDepth * 65535.0f);
+
+    return ((uint64_t)(pass & 0xF) << 60) |
+           ((uint64_t)(shader & 0xFF) << 52) |
+           ((uint64_t)(material & 0xFFF) << 40) |
+           ((uint64_t)(textureSet & 0xFFF) << 28) |
+           ((uint64_t)(vertexBuffer & 0xFFF) << 16) |
+           quantisedDepth;
+}
+
+uint32_t RenderQueue::GetObjectId(const void *object)
+{
+    if (!object)
+        return 0;
+
+    auto it = mObjectIds.find(object);
+    if (it != mObjectIds.end())
+        return it->second;
+
+    const uint32_t id = (uint32_t)mObjectIds.size() + 1;
+    mObjectIds.emplace(object, id);
+    return id;
+}
+
+void RenderQueue::Clear()
+{
+    mPackets.clear();
+    mKeys.clear();
+    mOrder.clear();
+}
+
+void RenderQueue::Add(uint64_t key, const DrawPacket &packet)
+{
+    mOrder.push_back((uint32_t)mPackets.size());
+    mPackets.push_back(packet);
+    mKeys.push_back(key);
+}
+
+void RenderQueue::Sort()
+{
+    const size_t count = mPackets.size();
+    mOrder.resize(count);
+    std::iota(mOrder.begin(), mOrder.end(), 0u);
+    if (count < 2)
+        return;
+
+    mSortKeys = mKeys;
+    mSortKeysScratch.resize(count);
+    mOrderScratch.resize(count);
+
+    // All eight histograms in one pass over the keys
+    size_t histograms[8][256] = {};
+    for (uint64_t key : mSortKeys)
+        for (int b = 0; b < 8; ++b)
+            histograms[b][(key >> (b * 8)) & 0xFF]++;
+
+    for (int b = 0; b < 8; ++b)
+    {
+        size_t *histogram = histograms[b];
+        const int shift = b * 8;
+        if (histogram[(mSortKeys[0] >> shift) & 0xFF] == count)
+            continue; // every key has the same byte here
+
+        size_t offset = 0;
+        for (int i = 0; i < 256; ++i)
+        {
+            const size_t bucketSize = histogram[i];
+            histogram[i] = offset;
+            offset += bucketSize;
+        }
+
+        for (size_t i = 0; i < count; ++i)
+        {
+            const size_t dst = histogram[(mSortKeys[i] >> shift) & 0xFF]++;
+            mSortKeysScratch[dst] = mSortKeys[i];
+            mOrderScratch[dst] = mOrder[i];
+        }
+        mSortKeys.swap(mSortKeysScratch);
+        mOrder.swap(mOrderScratch);
+    }
+}
+
+RenderQueue::Stats RenderQueue::Submit(CommandStream *stream) const
+{
+    Stats stats;
+    stats.draws = mPackets.size();
+
+    BoundState unsorted;
+    for (const auto &packet : mPackets)
+    {
+        stats.stateChangesUnsorted += Bind(nullptr, packet, unsorted);
+        stats.stateChangesNaive += GetBindingCount(packet);
+    }
+
+    BoundState state;
+    for (uint32_t idx : mOrder)
+    {
+        const DrawPacket &packet = mPackets[idx];
+        stats.stateChanges += Bind(stream, packet, state);
+        if (stream)
+            stream->DrawIndexed(packet.indexCount, packet.startIndex, packet.baseVertex, packet.materialIndex);
+    }
+    return stats;
+}
+
+RenderQueue::Stats RenderQueue::SubmitParallel(ThreadPool *pool, std::vector<CommandStream> &streams,
+                                               size_t minDrawsPerChunk) const
+{
+    const size_t count = mPackets.size();
+    const size_t threadCount = pool ? pool->GetThreadCount() : 1;
+    const size_t chunkCount = (std::max)((size_t)1, (std::min)(threadCount, count / (std::max)(minDrawsPerChunk, (size_t)1)));
+    const size_t chunkSize = (count + chunkCount - 1) / chunkCount;
+
+    streams.resize(chunkCount);
+    std::vector<Stats> chunkStats(chunkCount);
+
+    auto recordChunk = [&](size_t chunk, unsigned int)
+    {
+        const size_t first = chunk * chunkSize;
+        const size_t last = (std::min)(first + chunkSize, count);
+        Stats &stats = chunkStats[chunk];
+        CommandStream &stream = streams[chunk];
+        stream.Clear();
+
+        BoundState unsorted;
+        for (size_t i = first; i < last; ++i)
+        {
+            const DrawPacket &packet = mPackets[i];
+            stats.stateChangesUnsorted += Bind(nullptr, packet, unsorted);
+            stats.stateChangesNaive += GetBindingCount(packet);
+        }
+
+        BoundState state;
+        for (size_t i = first; i < last; ++i)
+        {
+            const DrawPacket &packet = mPackets[mOrder[i]];
+            stats.stateChanges += Bind(&stream, packet, state);
+            stream.DrawIndexed(packet.indexCount, packet.startIndex, packet.baseVertex, packet.materialIndex);
+        }
+        stats.draws = last - first;
+    };
+
+    if (pool && (chunkCount > 1))
+        pool->ParallelFor(chunkCount, recordChunk);
+    else
+        for (size_t chunk = 0; chunk < chunkCount; ++chunk)
+            recordChunk(chunk, 0);
+
+    Stats stats;
+    for (const Stats &chunk : chunkStats)
+    {
+        stats.draws += chunk.draws;
+        stats.stateChanges += chunk.stateChanges;
+        stats.stateChangesUnsorted += chunk.stateChangesUnsorted;
+        stats.stateChangesNaive += chunk.stateChangesNaive;
+    }
+    return stats;
+}
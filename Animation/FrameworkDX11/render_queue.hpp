@@ -0,0 +1,99 @@
+#pragma once
+
+#include "constant_ring.hpp"
+#include "command_stream.hpp"
+
+#include <vector>
+#include <unordered_map>
+
+class ThreadPool;
+#include <cstdint>
+#include <cstddef>
+
+// Everything one indexed draw binds. Null attribute and skin streams, textures and skin
+// constants leave the current binding alone: the draw's input layout doesn't read them.
+struct DrawPacket
+{
+    ID3D11VertexShader*         vertexShader = nullptr;
+    ID3D11PixelShader*          pixelShader = nullptr;      // null for depth-only draws
+    ID3D11InputLayout*          inputLayout = nullptr;
+    ID3D11Buffer*               vertexBuffer = nullptr;     // PositionStreamSlot, the positions of split streams
+    UINT                        vertexStride = 0;
+    ID3D11Buffer*               attributeBuffer = nullptr;  // AttributeStreamSlot
+    ID3D11Buffer*               skinBuffer = nullptr;       // SkinStreamSlot
+    ID3D11Buffer*               indexBuffer = nullptr;
+    D3D11_PRIMITIVE_TOPOLOGY    topology = D3D11_PRIMITIVE_TOPOLOGY_UNDEFINED;
+    ConstantRange               objectConstants;            // VS slot 0
+    ConstantRange               skinConstants;              // VS slot 5, a null buffer leaves it alone
+    ID3D11ShaderResourceView*   textures = nullptr;         // PS slot 0
+    UINT                        indexCount = 0;
+    UINT                        startIndex = 0;             // first index of the draw
+    INT                         baseVertex = 0;             // added to every index, for pooled geometry
+    uint32_t                    materialIndex = 0;          // into the renderer's MaterialTable
+};
+
+// Draws are collected during traversal, each with a 64-bit sort key, then sorted and
+// submitted in one go. Submission only records the bindings that differ from the previous
+// draw, so the key order decides how much state is shared between neighbours.
+class RenderQueue
+{
+public:
+
+    enum Pass
+    {
+        eDepthPass = 0,     // depth-only prepass, drawn before everything else
+        eOpaquePass,
+    };
+
+    // Key layout, most significant first:
+    //   pass 4 | shader 8 | material 12 | texture set 12 | vertex buffer 12 | depth 16
+    // Ids wider than their field wrap around, which only costs sorting quality.
+    // Depth is view depth mapped to [0, 1], so each state group is drawn front to back.
+    static uint64_t MakeKey(unsigned int pass, uint32_t shader, uint32_t material,
+                            uint32_t textureSet, uint32_t vertexBuffer, float depth);
+
+    // Small id per device object for the key fields, stable for the queue's lifetime; 0 is nullptr
+    uint32_t GetObjectId(const void *object);
+
+    void Clear();
+    void Add(uint64_t key, const DrawPacket &packet);
+    size_t Size() const { return mPackets.size(); }
+
+    // Stable LSD radix sort on the keys, 8 bits per pass; passes where all keys share the
+    // byte are skipped
+    void Sort();
+
+    // Bindings issued against what a draw-by-draw submission would have cost
+    struct Stats
+    {
+        size_t draws = 0;
+        size_t stateChanges = 0;            // bindings issued
+        size_t stateChangesUnsorted = 0;    // same filtering, in the order the draws were added
+        size_t stateChangesNaive = 0;       // every binding of every draw
+    };
+
+    // Records the draws in sorted order. Without a stream only the bindings are counted.
+    Stats Submit(CommandStream *stream) const;
+
+    // Submit() on the pool: the sorted draws are cut into one contiguous chunk per thread (of
+    // at least minDrawsPerChunk), each recorded into its own stream, which binds everything
+    // for its first draw. Running 'streams' in order draws in key order, whichever thread
+    // recorded which chunk. stateChangesUnsorted is counted per chunk of the added order.
+    Stats SubmitParallel(ThreadPool *pool, std::vector<CommandStream> &streams,
+                         size_t minDrawsPerChunk = 1024) const;
+
+    uint64_t GetSortedKey(size_t i) const { return mKeys[mOrder[i]]; }
+    const DrawPacket& GetSorted(size_t i) const { return mPackets[mOrder[i]]; }
+
+private:
+
+    std::vector<DrawPacket>     mPackets;
+    std::vector<uint64_t>       mKeys;          // per packet
+    std::vector<uint32_t>       mOrder;         // packet indices, sorted by Sort()
+
+    std::vector<uint64_t>       mSortKeys;
+    std::vector<uint64_t>       mSortKeysScratch;
+    std::vector<uint32_t>       mOrderScratch;
+
+    std::unordered_map<const void*, uint32_t> mObjectIds;
+};
@@ -18,8 +18,8 @@ bool SceneGraph::PostLoadSanityTest()
 {
 
     // Geometry using normal map must have tangent specified (for now)
-    for (auto &node : mRootNodes)
-        if (!NodeTangentSanityTest(node))
+    for (auto *node : mRootNodes)
+        if (!NodeTangentSanityTest(*node))
             return false;
 
     return true;
@@ -29,14 +29,14 @@ bool SceneGraph::PostLoadSanityTest()
 bool SceneGraph::NodeTangentSanityTest(const SceneNode &node)
 {
     // Test node
-    for (auto &primitive : node.mPrimitives)
+    for (auto *primitive : node.mPrimitives)
     {
 
     }
 
     // Children
-    for (auto &child : node.mChildren)
-        if (!NodeTangentSanityTest(child))
+    for (auto *child : node.mChildren)
+        if (!NodeTangentSanityTest(*child))
             return false;
 
     return true;
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <DirectXMath.h>
+
+using namespace DirectX;
+
+struct SceneVertex
+{
+    XMFLOAT3 Pos;
+    XMFLOAT3 Normal;
+    XMFLOAT4 Tangent; // w represents handedness of the tangent basis and is either 1 or -1
+    XMFLOAT2 Tex;
+    XMUINT4  Joints;
+    XMFLOAT4 Weights;
+};
+
+// SceneVertex as the device buffers hold it, one vertex buffer ("stream") per group of
+// attributes, see VertexStreams
+struct PositionVertex
+{
+    XMFLOAT3 Pos;
+};
+
+struct AttributeVertex
+{
+    XMFLOAT3 Normal;
+    XMFLOAT4 Tangent;
+    XMFLOAT2 Tex;
+};
+
+struct SkinVertex
+{
+    XMUINT4  Joints;
+    XMFLOAT4 Weights;
+};
+
+struct SkinnedSceneVertex
+{
+    XMFLOAT3 Pos;
+    XMFLOAT3 Normal;
+    XMFLOAT4 Tangent; // w represents handedness of the tangent basis and is either 1 or -1
+    XMFLOAT2 Tex;
+    XMUINT4  Joints;
+    XMFLOAT4 Weights;
+};
@@ -10,11 +10,13 @@
 
 #include "DX11Renderer.h"
 #include "structures.h"
+#include "QuaternionInterp.h"
 
 
 #include <cassert>
 #include <array>
 #include <vector>
+#include <algorithm>
 
 #define UNUSED_COLOR XMFLOAT4(1.f, 0.f, 1.f, 1.f)
 #define STRIP_BREAK static_cast<uint32_t>(-1)
@@ -108,10 +110,266 @@ SceneGraph::~SceneGraph()
 
 SceneNode* SceneGraph::CreateRootNode()
 {
-    // Add a new root node to our vector of root nodes
-    mRootNodes.emplace_back(true); // 'true' means this is a root node
-    // Return a pointer to the new node we just created
-    return &mRootNodes.back();
+    return CreateNode(nullptr);
+}
+
+SceneNode* SceneGraph::CreateNode(SceneNode *parent)
+{
+    SceneNode *node = mNodePool.Create(this, parent == nullptr);
+    node->mParent = parent;
+    auto &siblings = parent ? parent->mChildren : mRootNodes;
+    node->mSiblingIdx = (uint32_t)siblings.size();
+    siblings.push_back(node);
+
+    // Appended behind everything else, its parent is already in the hierarchy
+    if (mTransforms.NeedsRebuild() || (parent && !parent->IsAttached()))
+        mTransforms.RequestRebuild();
+    else
+        AttachNode(*node);
+    return node;
+}
+
+void SceneGraph::AttachNode(SceneNode &node)
+{
+    const TransformHierarchy::Index parent =
+        node.mParent ? node.mParent->mTransformIdx : TransformHierarchy::InvalidIndex;
+    node.mTransformIdx = mTransforms.Add(parent, node.GetLocalMtrx());
+    node.mTransforms = &mTransforms;
+    node.mFirstDrawable = (uint32_t)mDrawables.size();
+    node.mDrawableCount = 0;
+    mObjectCbs.emplace_back();
+}
+
+void SceneGraph::QueueDrawables(SceneNode &node)
+{
+    if (mTransforms.NeedsRebuild())
+        return;
+
+    // Primitives were replaced, not just added: the node's drawables describe the old ones
+    if (!node.IsAttached() || (node.mPrimitives.size() <= node.mDrawableCount))
+    {
+        mTransforms.RequestRebuild();
+        return;
+    }
+    if (node.mPendingIdx != UINT32_MAX)
+        return;
+
+    // Not added right away, the primitive has no geometry and bounds yet
+    node.mPendingIdx = (uint32_t)mPendingDrawableNodes.size();
+    mPendingDrawableNodes.push_back(&node);
+}
+
+void SceneGraph::AttachPendingDrawables()
+{
+    const size_t firstNew = mDrawables.size();
+    for (size_t i = 0; i < mPendingDrawableNodes.size(); ++i)
+    {
+        SceneNode &node = *mPendingDrawableNodes[i];
+
+        // A node's drawables have to stay contiguous. Those of a new node simply go at the
+        // end, a node that already has some can only grow if they are the last ones.
+        const bool isLast = (node.mFirstDrawable + node.mDrawableCount == mDrawables.size());
+        if ((node.mPrimitives.size() < node.mDrawableCount) || ((node.mDrawableCount > 0) && !isLast))
+        {
+            for (auto *pending : mPendingDrawableNodes)
+                pending->mPendingIdx = UINT32_MAX;
+            mPendingDrawableNodes.clear();
+            RebuildTransforms();
+            return;
+        }
+
+        if (node.mDrawableCount == 0)
+            node.mFirstDrawable = (uint32_t)mDrawables.size();
+        for (size_t p = node.mDrawableCount; p < node.mPrimitives.size(); ++p)
+            AddDrawable(node, *node.mPrimitives[p]);
+        node.mDrawableCount = (uint32_t)node.mPrimitives.size();
+        node.mPendingIdx = UINT32_MAX;
+
+        // Their world bounds are computed with the node's next world matrix
+        mTransforms.MarkDirty(node.mTransformIdx);
+    }
+    mPendingDrawableNodes.clear();
+
+    mWorldBounds.Resize(mDrawables.size());
+    mVisibility.resize(mDrawables.size(), 1);
+    Log::Debug(L"SceneGraph::AttachPendingDrawables: %d drawable(s) added", mDrawables.size() - firstNew);
+}
+
+void SceneGraph::DetachNode(SceneNode *node)
+{
+    // Swap with the last sibling, the order of siblings is not kept
+    auto &siblings = node->mParent ? node->mParent->mChildren : mRootNodes;
+    const uint32_t idx = node->mSiblingIdx;
+    if ((idx < siblings.size()) && (siblings[idx] == node))
+    {
+        siblings[idx] = siblings.back();
+        siblings[idx]->mSiblingIdx = idx;
+        siblings.pop_back();
+    }
+    node->mParent = nullptr;
+}
+
+void SceneGraph::FreeSubtree(SceneNode *node)
+{
+    for (auto *child : node->mChildren)
+        FreeSubtree(child);
+
+    // Node animation must not keep pointing at the node
+    const int idx = node->mGltfNodeIdx;
+    if ((idx >= 0) && (idx < (int)mNodesByIdx.size()) && (mNodesByIdx[idx] == node))
+        mNodesByIdx[idx] = nullptr;
+    if (node->mAnimatedIdx != UINT32_MAX)
+    {
+        const uint32_t animatedIdx = node->mAnimatedIdx;
+        mAnimatedNodes[animatedIdx] = mAnimatedNodes.back();
+        mAnimatedNodes[animatedIdx].node->mAnimatedIdx = animatedIdx;
+        mAnimatedNodes.pop_back();
+    }
+    if (node->mPendingIdx != UINT32_MAX)
+    {
+        const uint32_t pendingIdx = node->mPendingIdx;
+        mPendingDrawableNodes[pendingIdx] = mPendingDrawableNodes.back();
+        mPendingDrawableNodes[pendingIdx]->mPendingIdx = pendingIdx;
+        mPendingDrawableNodes.pop_back();
+    }
+
+    // Its hierarchy entry and drawables stay where they are, unused, until the next rebuild
+    if (node->IsAttached() && !mTransforms.NeedsRebuild())
+    {
+        for (uint32_t i = 0; i < node->mDrawableCount; ++i)
+        {
+            mDrawables[node->mFirstDrawable + i].transformIdx = TransformHierarchy::InvalidIndex;
+            mFreedDrawables.push_back(node->mFirstDrawable + i);
+        }
+        mFreedTransforms++;
+    }
+
+    // Its geometry is still in the batches
+    if (node->mBatchedIdx != UINT32_MAX)
+    {
+        mBatchedNodes[node->mBatchedIdx].node = nullptr;
+        mStaticBatchesDirty = true;
+    }
+
+    for (auto *primitive : node->mPrimitives)
+        node->ReleasePrimitive(primitive);
+    for (auto *primitive : node->mBatchedPrimitives)
+        node->ReleasePrimitive(primitive);
+    mNodePool.Destroy(node);
+}
+
+void SceneGraph::DestroyNode(SceneNode *node)
+{
+    if (!node)
+        return;
+
+    // Cut off from its parent, the freed entries no longer follow it
+    if (node->IsAttached() && !mTransforms.NeedsRebuild())
+        mTransforms.SetParent(node->mTransformIdx, TransformHierarchy::InvalidIndex);
+
+    DetachNode(node);
+    FreeSubtree(node);
+    CompactTransforms();
+}
+
+bool SceneGraph::Reparent(SceneNode *node, SceneNode *newParent)
+{
+    if (!node)
+        return false;
+
+    for (const SceneNode *ancestor = newParent; ancestor; ancestor = ancestor->mParent)
+        if (ancestor == node)
+            return false;
+
+    DetachNode(node);
+    node->mParent = newParent;
+    node->mIsRootNode = (newParent == nullptr);
+    auto &siblings = newParent ? newParent->mChildren : mRootNodes;
+    node->mSiblingIdx = (uint32_t)siblings.size();
+    siblings.push_back(node);
+
+    if (mTransforms.NeedsRebuild())
+        return true;
+    if (!node->IsAttached() || (newParent && !newParent->IsAttached()))
+    {
+        mTransforms.RequestRebuild();
+        return true;
+    }
+
+    // Under a parent that comes first the entry just points at it. Otherwise the subtree
+    // is appended again behind the new parent and its old entries are left unused.
+    const TransformHierarchy::Index parentIdx =
+        newParent ? newParent->mTransformIdx : TransformHierarchy::InvalidIndex;
+    if (!newParent || (parentIdx < node->mTransformIdx))
+    {
+        mTransforms.SetParent(node->mTransformIdx, parentIdx);
+        return true;
+    }
+
+    const TransformHierarchy::Index oldIdx = node->mTransformIdx;
+    ReattachSubtree(*node, parentIdx);
+    mTransforms.SetParent(oldIdx, TransformHierarchy::InvalidIndex);
+    CompactTransforms();
+    return true;
+}
+
+void SceneGraph::ReattachSubtree(SceneNode &node, TransformHierarchy::Index parent)
+{
+    const TransformHierarchy::Index idx = mTransforms.Add(parent, mTransforms.GetLocal(node.mTransformIdx));
+    node.mTransformIdx = idx;
+    mObjectCbs.emplace_back();
+    mFreedTransforms++;
+
+    for (uint32_t i = 0; i < node.mDrawableCount; ++i)
+    {
+        Drawable &drawable = mDrawables[node.mFirstDrawable + i];
+        drawable.transformIdx = idx;
+        drawable.worldVersion = UINT32_MAX;
+    }
+
+    for (auto *child : node.mChildren)
+        ReattachSubtree(*child, idx);
+}
+
+void SceneGraph::CompactTransforms()
+{
+    // Rebuilding once a fixed share of the entries is unused keeps the cost per destroyed
+    // or moved node constant
+    const size_t MinFreedTransforms = 64;
+    if (mFreedTransforms > (std::max)(MinFreedTransforms, mTransforms.Size() / 4))
+        mTransforms.RequestRebuild();
+}
+
+void SceneGraph::DestroyNodes()
+{
+    mAnimatedNodes.clear();
+    mAnimatedChannels.clear();
+    mNodesByIdx.clear();
+    mNodeRestPoses.clear();
+    mCurrentNodeAnimation = -1;
+    mHasMorphChannels = false;
+
+    mRootNodes.clear();
+    mNodePool.Clear();
+    mPrimitivePool.Clear();
+    mTransforms.Clear();
+    mDrawables.clear();
+    mPendingDrawableNodes.clear();
+    mFreedDrawables.clear();
+    mFreedTransforms = 0;
+    mWorldBounds.Resize(0);
+    mVisibility.clear();
+    mBvh.Clear();
+    mBvhDrawables.clear();
+    mUnboundedDrawables.clear();
+    mBvhChanged.clear();
+    mTransforms.RequestRebuild();
+
+    mStaticBatcher.Destroy();
+    mBatchedNodes.clear();
+    mStaticBatchesDirty = false;
+    mStaticVisibility.clear();
+    mStaticRanges.clear();
 }
 
 
@@ -372,37 +630,708 @@ void printAnimations(tinygltf::Model model)
             PrintDebug(ss.str());
             ss.str("");
 
-            const tinygltf::Accessor& input_accessor = model.accessors[sampler.input];
-            const tinygltf::Accessor& output_accessor = model.accessors[sampler.output];
+            const tinygltf::Accessor& input_accessor = model.accessors[sampler.input];
+            const tinygltf::Accessor& output_accessor = model.accessors[sampler.output];
+
+            ss << "    - Keyframes: " << input_accessor.count
+                << " | Interpolation: " << sampler.interpolation;
+            PrintDebug(ss.str());
+            ss.str("");
+        }
+    }
+}
+
+void SceneGraph::AnimateFrame(IRenderingContext& ctx)
+{
+    if (!ctx.IsValid())
+        return;
+
+    UpdateTransforms();
+}
+
+void SceneGraph::AttachTransforms(SceneNode &node,
+                                  TransformHierarchy &target,
+                                  TransformHierarchy::Index parent)
+{
+    // Attached nodes still read their local matrix from the old arrays in mTransforms
+    node.mTransformIdx = target.Add(parent, node.GetLocalMtrx());
+    node.mTransforms = &mTransforms;
+
+    node.mFirstDrawable = (uint32_t)mDrawables.size();
+    node.mDrawableCount = (uint32_t)node.mPrimitives.size();
+    for (const auto *primitive : node.mPrimitives)
+        AddDrawable(node, *primitive);
+
+    for (auto *child : node.mChildren)
+        AttachTransforms(*child, target, node.mTransformIdx);
+}
+
+void SceneGraph::AddDrawable(const SceneNode &node, const ScenePrimitive &primitive)
+{
+    const XMVECTOR lo = XMLoadFloat3(&primitive.GetBoundsMin());
+    const XMVECTOR hi = XMLoadFloat3(&primitive.GetBoundsMax());
+    Drawable drawable;
+    drawable.transformIdx = node.mTransformIdx;
+    drawable.worldVersion = UINT32_MAX;
+    drawable.bounded = (node.mGltfSkinIdx < 0);
+    drawable.bvhInstance = UINT32_MAX;
+    XMStoreFloat3(&drawable.center, (lo + hi) * 0.5f);
+    XMStoreFloat3(&drawable.extents, (hi - lo) * 0.5f);
+    if (drawable.bounded)
+    {
+        drawable.bvhInstance = (uint32_t)mBvhDrawables.size();
+        mBvhDrawables.push_back((uint32_t)mDrawables.size());
+    }
+    else
+        mUnboundedDrawables.push_back((uint32_t)mDrawables.size());
+    mDrawables.push_back(drawable);
+}
+
+void SceneGraph::RebuildTransforms()
+{
+    // Pre-order walk, so every parent lands before its children
+    TransformHierarchy rebuilt;
+    rebuilt.Reserve(mTransforms.Size() - mFreedTransforms);
+    for (auto *pending : mPendingDrawableNodes)
+        pending->mPendingIdx = UINT32_MAX;
+    mPendingDrawableNodes.clear();
+    mFreedDrawables.clear();
+    mFreedTransforms = 0;
+    mDrawables.clear();
+    mBvhDrawables.clear();
+    mUnboundedDrawables.clear();
+    for (auto *node : mRootNodes)
+        AttachTransforms(*node, rebuilt, TransformHierarchy::InvalidIndex);
+
+    mWorldBounds.Resize(mDrawables.size());
+    mVisibility.assign(mDrawables.size(), 1);
+    mBvh.Clear(); // rebuilt from the new bounds by the next update
+    mBvhChanged.clear();
+
+    mTransforms = std::move(rebuilt);
+    mTransforms.RebuildDone();
+
+    // Indices moved, so no buffer holds the right node's constants any more
+    for (size_t i = mTransforms.Size(); i < mObjectCbs.size(); ++i)
+        Utils::ReleaseAndMakeNull(mObjectCbs[i].buffer);
+    mObjectCbs.resize(mTransforms.Size());
+    for (auto &cb : mObjectCbs)
+    {
+        cb.bufferVersion = UINT32_MAX;
+        cb.worldVersion = UINT32_MAX;
+        cb.skeleton = nullptr;
+    }
+}
+
+void SceneGraph::UpdateTransforms()
+{
+    if (mTransforms.NeedsRebuild())
+        RebuildTransforms();
+    else if (!mPendingDrawableNodes.empty())
+        AttachPendingDrawables();
+
+    // Only the subtrees touched since the last update are recomputed
+    mTransforms.UpdateWorld();
+    mStats.transformsUpdated += mTransforms.GetLastUpdateCount();
+
+    UpdateWorldBounds();
+    CheckStaticBatches();
+}
+
+void SceneGraph::UpdateWorldBounds()
+{
+    if (mTransforms.GetLastUpdateCount() == 0)
+        return;
+
+    // Small graphs are culled box by box, their BVH would never be queried
+    const bool useBvh = (mDrawables.size() >= BvhCullThreshold);
+    const bool rebuildBvh = (mBvh.GetInstanceCount() != mBvhDrawables.size());
+    for (size_t i = 0; i < mDrawables.size(); ++i)
+    {
+        Drawable &drawable = mDrawables[i];
+        if (drawable.transformIdx == TransformHierarchy::InvalidIndex)
+            continue; // its node was destroyed
+        const uint32_t version = mTransforms.GetWorldVersion(drawable.transformIdx);
+        if (drawable.worldVersion == version)
+            continue;
+        drawable.worldVersion = version;
+        if (useBvh && drawable.bounded && !rebuildBvh)
+            mBvhChanged.push_back(drawable.bvhInstance);
+
+        if (!drawable.bounded)
+        {
+            mWorldBounds.SetUnbounded(i);
+            continue;
+        }
+
+        XMVECTOR center, extents;
+        BoundsSoA::Transform(XMLoadFloat3(&drawable.center), XMLoadFloat3(&drawable.extents),
+                             mTransforms.GetWorld(drawable.transformIdx), center, extents);
+        mWorldBounds.Set(i, center, extents);
+    }
+
+    if (useBvh)
+        UpdateBvh(rebuildBvh);
+}
+
+void SceneGraph::UpdateBvh(bool rebuild)
+{
+    auto BoxOf = [this](uint32_t instance)
+    {
+        const uint32_t i = mBvhDrawables[instance];
+        Aabb box;
+        box.min = XMFLOAT3(mWorldBounds.centerX[i] - mWorldBounds.extentX[i],
+                           mWorldBounds.centerY[i] - mWorldBounds.extentY[i],
+                           mWorldBounds.centerZ[i] - mWorldBounds.extentZ[i]);
+        box.max = XMFLOAT3(mWorldBounds.centerX[i] + mWorldBounds.extentX[i],
+                           mWorldBounds.centerY[i] + mWorldBounds.extentY[i],
+                           mWorldBounds.centerZ[i] + mWorldBounds.extentZ[i]);
+        return box;
+    };
+
+    // Refitting is cheap but lets the tree degrade as things move; check its quality now and then
+    const unsigned int QualityCheckInterval = 32;
+    if (!rebuild && !mBvhChanged.empty() && (++mBvhRefits % QualityCheckInterval == 0))
+        rebuild = mBvh.NeedsRebuild();
+
+    if (rebuild)
+    {
+        std::vector<Aabb> boxes(mBvhDrawables.size());
+        for (uint32_t i = 0; i < boxes.size(); ++i)
+            boxes[i] = BoxOf(i);
+        mBvh.Build(boxes.data(), boxes.size());
+    }
+    else
+    {
+        for (uint32_t i : mBvhChanged)
+            mBvh.UpdateInstance(i, BoxOf(i));
+        mBvh.Refit();
+    }
+    mBvhChanged.clear();
+}
+
+void SceneGraph::CullPrimitives(IRenderingContext &ctx)
+{
+    if (!mCullingEnabled)
+    {
+        std::fill(mVisibility.begin(), mVisibility.end(), (FrustumCuller::ViewMask)1);
+        for (uint32_t i : mFreedDrawables)
+            mVisibility[i] = 0;
+        mStats.primitivesVisible += mVisibility.size() - mFreedDrawables.size();
+        return;
+    }
+
+    const XMMATRIX viewProj = ctx.getDXRenderer()->m_pScene->m_pCamera->getViewMatrix() *
+                              XMLoadFloat4x4(&ctx.getDXRenderer()->m_matProjection);
+    const Frustum frustum = Frustum::FromViewProjection(viewProj);
+
+    size_t visible;
+    if (mVisibility.size() < BvhCullThreshold)
+    {
+        visible = FrustumCuller::Cull(mWorldBounds, &frustum, 1, mVisibility.data()).visible[0];
+    }
+    else
+    {
+        mBvhQueryScratch.clear();
+        mBvh.QueryFrustum(frustum, mBvhQueryScratch);
+        std::fill(mVisibility.begin(), mVisibility.end(), (FrustumCuller::ViewMask)0);
+        for (uint32_t instance : mBvhQueryScratch)
+            mVisibility[mBvhDrawables[instance]] = 1;
+        for (uint32_t i : mUnboundedDrawables)
+            mVisibility[i] = 1;
+        visible = mBvhQueryScratch.size() + mUnboundedDrawables.size();
+    }
+
+    // Drawables of destroyed nodes keep their last bounds until the next rebuild
+    for (uint32_t i : mFreedDrawables)
+    {
+        if (mVisibility[i])
+            visible--;
+        mVisibility[i] = 0;
+    }
+    mStats.primitivesCulled += (mVisibility.size() - mFreedDrawables.size()) - visible;
+
+    // Only what survived the frustum test is checked against the occluders
+    if (mOcclusionCuller && mOcclusionCuller->IsReady())
+    {
+        const size_t occluded = mOcclusionCuller->CullOccluded(mWorldBounds, mVisibility.data());
+        mStats.primitivesOccluded += occluded;
+        visible -= occluded;
+    }
+    mStats.primitivesVisible += visible;
+}
+
+bool SceneGraph::BuildStaticBatches(IRenderingContext &ctx)
+{
+    if (!ctx.IsValid())
+        return false;
+
+    // Batches are baked with the world matrices as they are now
+    UpdateTransforms();
+    mStaticBatcher.Destroy();
+    for (const auto &batched : mBatchedNodes)
+        if (batched.node)
+            batched.node->mBatchedIdx = UINT32_MAX;
+    mBatchedNodes.clear();
+    mStaticBatchesDirty = false;
+
+    // Nodes driven by the playing node animation, and everything below them, keep moving.
+    // Anything else that moves later is caught by CheckStaticBatches().
+    std::vector<bool> isAnimated;
+    for (const auto &animated : mAnimatedNodes)
+    {
+        if (animated.nodeIdx >= (int)isAnimated.size())
+            isAnimated.resize(animated.nodeIdx + 1, false);
+        isAnimated[animated.nodeIdx] = true;
+    }
+
+    std::vector<std::pair<SceneNode*, ScenePrimitive*>> batched;
+    for (auto *node : mRootNodes)
+        CollectStaticPrimitives(*node, isAnimated, false, batched);
+    mTransforms.RequestRebuild(); // the drawables change either way
+
+    mStaticBatcher.Finish();
+    if (!mStaticBatcher.CreateDeviceBuffers(ctx.GetDevice()))
+    {
+        Log::Error(L"SceneGraph::BuildStaticBatches: Failed to create the batch buffers");
+        mStaticBatcher.Destroy();
+        return false;
+    }
+
+    if (!mStaticObjectCb && !mStaticBatcher.IsEmpty())
+    {
+        ObjectConstants data;
+        data.mWorld = XMMatrixIdentity();
+
+        D3D11_BUFFER_DESC bd;
+        ZeroMemory(&bd, sizeof(bd));
+        bd.Usage = D3D11_USAGE_IMMUTABLE;
+        bd.ByteWidth = sizeof(ObjectConstants);
+        bd.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+        D3D11_SUBRESOURCE_DATA initData;
+        ZeroMemory(&initData, sizeof(initData));
+        initData.pSysMem = &data;
+        if (FAILED(ctx.GetDevice()->CreateBuffer(&bd, &initData, &mStaticObjectCb)))
+        {
+            Log::Error(L"SceneGraph::BuildStaticBatches: Failed to create the object constants");
+            mStaticBatcher.Destroy();
+            return false;
+        }
+    }
+
+    // Only now that the batches exist do the primitives leave their nodes
+    for (const auto &entry : batched)
+    {
+        SceneNode *node = entry.first;
+        auto &primitives = node->mPrimitives;
+        primitives.erase(std::find(primitives.begin(), primitives.end(), entry.second));
+        node->mBatchedPrimitives.push_back(entry.second);
+
+        if (node->mBatchedIdx == UINT32_MAX)
+        {
+            node->mBatchedIdx = (uint32_t)mBatchedNodes.size();
+            BatchedNode batchedNode;
+            batchedNode.node = node;
+            XMStoreFloat4x4(&batchedNode.world, mTransforms.GetWorld(node->mTransformIdx));
+            batchedNode.worldVersion = UINT32_MAX; // the transforms are rebuilt before the next check
+            mBatchedNodes.push_back(batchedNode);
+        }
+    }
+
+    const StaticBatcher::Stats &stats = mStaticBatcher.GetStats();
+    Log::Debug(L"SceneGraph::BuildStaticBatches: %d primitive(s) merged into %d batch(es), %d left unbatched",
+               stats.primitives, stats.batches, stats.rejected);
+    return true;
+}
+
+void SceneGraph::CollectStaticPrimitives(SceneNode &node,
+                                         const std::vector<bool> &isAnimated,
+                                         bool isMoving,
+                                         std::vector<std::pair<SceneNode*, ScenePrimitive*>> &batched)
+{
+    node.mPrimitives.insert(node.mPrimitives.end(), node.mBatchedPrimitives.begin(), node.mBatchedPrimitives.end());
+    node.mBatchedPrimitives.clear();
+
+    const int idx = node.mGltfNodeIdx;
+    isMoving = isMoving || node.mIsDynamic || ((idx >= 0) && (idx < (int)isAnimated.size()) && isAnimated[idx]);
+
+    // Skinned and morphed vertices are not where mVertices says
+    if (!isMoving && node.IsAttached() && (node.mGltfSkinIdx < 0) && node.mMorphWeights.empty())
+    {
+        const XMMATRIX world = mTransforms.GetWorld(node.mTransformIdx);
+        for (auto *primitive : node.mPrimitives)
+        {
+            if (primitive->HasMorphTargets())
+                continue;
+
+            if (mStaticBatcher.Add(primitive->mVertices.data(), primitive->mVertices.size(),
+                                   primitive->mIndices.data(), primitive->mIndices.size(),
+                                   primitive->mTopology, primitive->GetMaterialTableIdx(), world))
+                batched.emplace_back(&node, primitive);
+        }
+    }
+
+    for (auto *child : node.mChildren)
+        CollectStaticPrimitives(*child, isAnimated, isMoving, batched);
+}
+
+void SceneGraph::CheckStaticBatches()
+{
+    if (mBatchedNodes.empty() || mStaticBatchesDirty || (mTransforms.GetLastUpdateCount() == 0))
+        return;
+
+    const XMVECTOR epsilon = XMVectorReplicate(1e-5f);
+    for (auto &batched : mBatchedNodes)
+    {
+        SceneNode *node = batched.node;
+        if (!node || !node->IsAttached())
+            continue;
+        const uint32_t version = mTransforms.GetWorldVersion(node->mTransformIdx);
+        if (version == batched.worldVersion)
+            continue;
+        batched.worldVersion = version;
+
+        // Recomputed is not necessarily moved, e.g. after a rebuild of the transforms
+        const XMMATRIX baked = XMLoadFloat4x4(&batched.world);
+        const XMMATRIX world = mTransforms.GetWorld(node->mTransformIdx);
+        bool isMoved = false;
+        for (int r = 0; r < 4; ++r)
+            isMoved = isMoved || !XMVector4NearEqual(baked.r[r], world.r[r], epsilon);
+        if (isMoved)
+        {
+            node->mIsDynamic = true;
+            mStaticBatchesDirty = true;
+        }
+    }
+}
+
+void SceneGraph::CullStaticBatches(IRenderingContext &ctx)
+{
+    const BoundsSoA &bounds = mStaticBatcher.GetBounds();
+    mStaticVisibility.resize(bounds.Size());
+    if (mStaticVisibility.empty())
+        return;
+
+    size_t visible = mStaticVisibility.size();
+    if (!mCullingEnabled)
+    {
+        std::fill(mStaticVisibility.begin(), mStaticVisibility.end(), (FrustumCuller::ViewMask)1);
+    }
+    else
+    {
+        const XMMATRIX viewProj = ctx.getDXRenderer()->m_pScene->m_pCamera->getViewMatrix() *
+                                  XMLoadFloat4x4(&ctx.getDXRenderer()->m_matProjection);
+        const Frustum frustum = Frustum::FromViewProjection(viewProj);
+        visible = FrustumCuller::Cull(bounds, &frustum, 1, mStaticVisibility.data()).visible[0];
+        mStats.primitivesCulled += mStaticVisibility.size() - visible;
+
+        if (mOcclusionCuller && mOcclusionCuller->IsReady())
+        {
+            const size_t occluded = mOcclusionCuller->CullOccluded(bounds, mStaticVisibility.data());
+            mStats.primitivesOccluded += occluded;
+            visible -= occluded;
+        }
+    }
+    mStats.primitivesVisible += visible;
+    mStats.staticPrimitives += visible;
+}
+
+void SceneGraph::QueueStaticBatches(IRenderingContext &ctx)
+{
+    if (mStaticBatcher.IsEmpty())
+        return;
+
+    // Neighbouring visible subranges of a batch go out as one draw
+    mStaticBatcher.GetDrawRanges(mStaticVisibility.data(), mStaticRanges);
+    mStats.staticDraws += mStaticRanges.size();
+
+    ConstantRange objectCb;
+    objectCb.buffer = mStaticObjectCb;
+    const BoundsSoA &bounds = mStaticBatcher.GetBounds();
+
+    for (const auto &range : mStaticRanges)
+    {
+        DrawPacket packet;
+        packet.vertexBuffer = mStaticBatcher.GetVertexBuffer(range.batch);
+        packet.vertexStride = sizeof(PositionVertex);
+        packet.attributeBuffer = mStaticBatcher.GetAttributeBuffer(range.batch);
+        packet.indexBuffer = mStaticBatcher.GetIndexBuffer(range.batch);
+        packet.topology = mStaticBatcher.GetTopology(range.batch);
+        packet.objectConstants = objectCb;
+        packet.startIndex = range.startIndex;
+        packet.indexCount = range.indexCount;
+        packet.materialIndex = mStaticBatcher.GetMaterial(range.batch);
+
+        const size_t first = range.firstSubrange;
+        const XMVECTOR center = XMVectorSet(bounds.centerX[first], bounds.centerY[first], bounds.centerZ[first], 1.0f);
+        QueueDraw(ctx, packet, GetSortDepth(center));
+    }
+}
+
+void SceneGraph::AddOccluders(OcclusionCuller &culler)
+{
+    UpdateTransforms();
+
+    for (const auto *node : mRootNodes)
+        AddNodeOccluders(*node, culler);
+}
+
+void SceneGraph::AddNodeOccluders(const SceneNode &node, OcclusionCuller &culler)
+{
+    // Skinned and morphed vertices are not where mVertices says, so they can't occlude
+    if (node.mIsOccluder && node.IsAttached() && node.mGltfSkinIdx < 0)
+    {
+        // Batched primitives still occlude, from their original geometry
+        const XMMATRIX world = mTransforms.GetWorld(node.mTransformIdx);
+        for (const auto *primitives : { &node.mPrimitives, &node.mBatchedPrimitives })
+            for (const auto *primitive : *primitives)
+            {
+                if (primitive->mTopology != D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST ||
+                    primitive->mIndices.empty() || primitive->HasMorphTargets())
+                    continue;
+
+                culler.AddOccluder(&primitive->mVertices[0].Pos, sizeof(SceneVertex), primitive->mVertices.size(),
+                                   primitive->mIndices.data(), primitive->mIndices.size(), world);
+            }
+    }
+
+    for (const auto *child : node.mChildren)
+        AddNodeOccluders(*child, culler);
+}
+
+unsigned int SceneGraph::AddNodeAnimation(const ClipHandle& anim)
+{
+    if (!anim)
+        return (unsigned int)-1;
+
+    mNodeAnimations.push_back(anim);
+    return (unsigned int)mNodeAnimations.size() - 1;
+}
+
+void SceneGraph::CollectNodes(SceneNode &node)
+{
+    const int idx = node.mGltfNodeIdx;
+    if (idx >= 0)
+    {
+        if (idx >= (int)mNodesByIdx.size())
+        {
+            mNodesByIdx.resize(idx + 1, nullptr);
+            mNodeRestPoses.resize(idx + 1);
+        }
+        mNodesByIdx[idx] = &node;
+
+        XMVECTOR s, r, t;
+        XMMatrixDecompose(&s, &r, &t, node.GetLocalMtrx());
+        XMStoreFloat3(&mNodeRestPoses[idx].scale, s);
+        XMStoreFloat4(&mNodeRestPoses[idx].rotation, r);
+        XMStoreFloat3(&mNodeRestPoses[idx].translation, t);
+    }
+
+    for (auto *child : node.mChildren)
+        CollectNodes(*child);
+}
+
+bool SceneGraph::PlayNodeAnimation(unsigned int animation)
+{
+    if (animation >= mNodeAnimations.size())
+        return false;
+
+    if (mNodesByIdx.empty())
+        for (auto *node : mRootNodes)
+            CollectNodes(*node);
+
+    // Put the nodes of the previous clip back to rest
+    for (const auto &animated : mAnimatedNodes)
+    {
+        animated.node->mAnimatedIdx = UINT32_MAX;
+        const auto &rest = mNodeRestPoses[animated.nodeIdx];
+        animated.node->SetMatrix(XMMatrixScalingFromVector(XMLoadFloat3(&rest.scale)) *
+                                 XMMatrixRotationQuaternion(XMLoadFloat4(&rest.rotation)) *
+                                 XMMatrixTranslationFromVector(XMLoadFloat3(&rest.translation)));
+    }
+
+    mCurrentNodeAnimation = (int)animation;
+    mNodeAnimationTime = mNodeAnimations[animation]->GetStartTime();
+
+    mPrevNodeAnimationTime = mNodeAnimationTime;
+    mHasMorphChannels = false;
+    for (auto *node : mNodesByIdx)
+        if (node)
+            node->mMorphChannel = -1;
+
+    // Bind the TRS channels to their nodes once, grouped per node. Channels on nodes with
+    // nothing rigid below them (e.g. joints, which the skeleton already drives) are dropped.
+    // WEIGHTS channels go straight to the morphed node.
+    const auto &channels = mNodeAnimations[animation]->m_channels;
+    std::vector<std::vector<int>> channelsPerNode(mNodesByIdx.size());
+    for (size_t i = 0; i < channels.size(); ++i)
+    {
+        const auto &channel = channels[i];
+        if ((channel.nodeIndex < 0) || (channel.nodeIndex >= (int)mNodesByIdx.size()))
+            continue;
+        if (channel.path == AnimationChannel::WEIGHTS)
+        {
+            SceneNode *node = mNodesByIdx[channel.nodeIndex];
+            if (node && !node->mMorphWeights.empty())
+            {
+                node->mMorphChannel = (int)i;
+                mHasMorphChannels = true;
+            }
+            continue;
+        }
+        const SceneNode *node = mNodesByIdx[channel.nodeIndex];
+        if (!node || !node->HasRigidGeometry())
+            continue;
+        channelsPerNode[channel.nodeIndex].push_back((int)i);
+    }
+
+    mAnimatedNodes.clear();
+    mAnimatedChannels.clear();
+    for (size_t idx = 0; idx < channelsPerNode.size(); ++idx)
+    {
+        if (channelsPerNode[idx].empty())
+            continue;
+        const auto &rest = mNodeRestPoses[idx];
+        mNodesByIdx[idx]->mAnimatedIdx = (uint32_t)mAnimatedNodes.size();
+        mAnimatedNodes.push_back({ mNodesByIdx[idx], (int)idx, mAnimatedChannels.size(), channelsPerNode[idx].size(), { rest, rest } });
+        mAnimatedChannels.insert(mAnimatedChannels.end(), channelsPerNode[idx].begin(), channelsPerNode[idx].end());
+    }
+
+    Log::Debug(L"SceneGraph::PlayNodeAnimation: \"%s\" drives %d node(s)",
+               Utils::StringToWstring(mNodeAnimations[animation]->m_name).c_str(),
+               mAnimatedNodes.size());
+
+    return true;
+}
+
+void SceneGraph::TickNodeAnimation(float stepTime)
+{
+    if ((mCurrentNodeAnimation < 0) || (mAnimatedNodes.empty() && !mHasMorphChannels))
+        return;
+
+    const Animation &anim = *mNodeAnimations[mCurrentNodeAnimation];
+    const float start = anim.GetStartTime();
+    const float duration = anim.GetEndTime() - start;
+
+    mPrevNodeAnimationTime = mNodeAnimationTime;
+    mNodeAnimationTime += stepTime;
+    if (duration > 0.0f)
+        mNodeAnimationTime = start + fmod(mNodeAnimationTime - start, duration);
+
+    mCurrentNodePose ^= 1;
+    for (auto &animated : mAnimatedNodes)
+    {
+        const auto &rest = mNodeRestPoses[animated.nodeIdx];
+        XMVECTOR s = XMLoadFloat3(&rest.scale);
+        XMVECTOR r = XMLoadFloat4(&rest.rotation);
+        XMVECTOR t = XMLoadFloat3(&rest.translation);
+
+        for (size_t i = 0; i < animated.channelCount; ++i)
+            anim.SampleChannel(anim.m_channels[mAnimatedChannels[animated.firstChannel + i]],
+                               mNodeAnimationTime, s, r, t);
+
+        auto &pose = animated.poses[mCurrentNodePose];
+        XMStoreFloat3(&pose.scale, s);
+        XMStoreFloat4(&pose.rotation, r);
+        XMStoreFloat3(&pose.translation, t);
+    }
+}
+
+void SceneGraph::InterpolateNodeAnimation(float alpha)
+{
+    mNodeAnimationAlpha = alpha;
+    for (const auto &animated : mAnimatedNodes)
+    {
+        const auto &prev = animated.poses[mCurrentNodePose ^ 1];
+        const auto &curr = animated.poses[mCurrentNodePose];
+
+        const XMVECTOR s = XMVectorLerp(XMLoadFloat3(&prev.scale), XMLoadFloat3(&curr.scale), alpha);
+        const XMVECTOR r = QuatInterp::Interpolate(XMLoadFloat4(&prev.rotation), XMLoadFloat4(&curr.rotation),
+                                                   alpha, QuatInterp::GetPrecision());
+        const XMVECTOR t = XMVectorLerp(XMLoadFloat3(&prev.translation), XMLoadFloat3(&curr.translation), alpha);
+
+        // SetLocal() in the TransformHierarchy marks just this node dirty; UpdateWorld()
+        // recomputes it and its descendants and skips the untouched subtrees
+        animated.node->SetMatrix(XMMatrixScalingFromVector(s) *
+                                 XMMatrixRotationQuaternion(r) *
+                                 XMMatrixTranslationFromVector(t));
+    }
+}
+
+void SceneGraph::SampleMorphWeights(const SceneNode &node, const Skeleton *skeleton)
+{
+    mMorphWeightsScratch = node.mMorphWeights;
+    mMorphWeightsBlend = node.mMorphWeights;
+    float *weights = mMorphWeightsScratch.data();
+    float *blend = mMorphWeightsBlend.data();
+    const size_t count = mMorphWeightsScratch.size();
+
+    if (skeleton && skeleton->SampleMorphWeights(node.mGltfNodeIdx, weights, blend, count))
+        return;
+
+    if ((node.mMorphChannel < 0) || (mCurrentNodeAnimation < 0))
+        return;
+
+    // Between the same two ticks as the node poses
+    const Animation &anim = *mNodeAnimations[mCurrentNodeAnimation];
+    const auto &channel = anim.m_channels[node.mMorphChannel];
+    anim.SampleWeights(channel, mPrevNodeAnimationTime, weights, count);
+    anim.SampleWeights(channel, mNodeAnimationTime, blend, count);
+    for (size_t i = 0; i < count; ++i)
+        weights[i] += (blend[i] - weights[i]) * mNodeAnimationAlpha;
+}
+
+void SceneGraph::TickSkeletons(SceneNode &node, float stepTime)
+{
+    if (node.m_skeleton.IsLoaded())
+    {
+        if (node.m_skeleton.CurrentAnimation() == nullptr)
+            node.m_skeleton.PlayAnimation((unsigned int)0);
+        node.m_skeleton.Tick(stepTime);
+    }
+
+    for (auto *child : node.mChildren)
+        TickSkeletons(*child, stepTime);
+}
+
+void SceneGraph::BuildPalettes(SceneNode &node, float alpha)
+{
+    if (node.m_skeleton.IsLoaded())
+        node.m_skeleton.BuildPalette(alpha);
+
+    for (auto *child : node.mChildren)
+        BuildPalettes(*child, alpha);
+}
+
+void SceneGraph::TickAnimation(float stepTime)
+{
+    for (auto *node : mRootNodes)
+        TickSkeletons(*node, stepTime);
+    TickNodeAnimation(stepTime);
+}
 
-            ss << "    - Keyframes: " << input_accessor.count
-                << " | Interpolation: " << sampler.interpolation;
-            PrintDebug(ss.str());
-            ss.str("");
-        }
-    }
+void SceneGraph::InterpolateAnimation(float alpha)
+{
+    for (auto *node : mRootNodes)
+        BuildPalettes(*node, alpha);
+    InterpolateNodeAnimation(alpha);
 }
 
-void SceneGraph::AnimateFrame(IRenderingContext& ctx)
+void SceneGraph::LoadNodeAnimations(const tinygltf::Model &model, const std::wstring &logPrefix)
 {
-    if (!ctx.IsValid())
-        return;
+    // The same clips the skeletons of this file use - nothing is loaded twice
+    mNodeAnimations = AnimationLibrary::Get().LoadFromGltf(model, mFilePath);
 
-    // Scene geometry
-    for (auto& node : mRootNodes)
-        node.Animate(ctx);
+    if (!mNodeAnimations.empty())
+        Log::Debug(L"%s%d animation(s) available for node animation", logPrefix.c_str(), mNodeAnimations.size());
 }
 
 bool SceneGraph::LoadSphere(IRenderingContext& ctx)
 {
-    mRootNodes.clear();
-    mRootNodes.reserve(1);
-   
-    SceneNode sceneNode(true);
-    bool ok = sceneNode.LoadSphere(ctx);
-    mRootNodes.push_back(std::move(sceneNode));
+    DestroyNodes();
 
-    return ok;
+    SceneNode *sceneNode = CreateRootNode();
+    return sceneNode->LoadSphere(ctx);
 }
 
 bool SceneGraph::LoadGLTF(IRenderingContext &ctx,
@@ -417,6 +1346,7 @@ bool SceneGraph::LoadGLTF(IRenderingContext &ctx,
     if (!GltfUtils::LoadModel(model, filePath))
         return false;
 
+    mFilePath = filePath;
    if (!LoadSceneFromGltf(ctx, model, logPrefix))
         return false;
 
@@ -439,6 +1369,7 @@ bool SceneGraph::LoadGLTFWithSkeleton(IRenderingContext& ctx,
     if (!GltfUtils::LoadModel(model, filePath))
         return false;
 
+    mFilePath = filePath;
     if (!LoadSceneFromGltfWithSkeleton(ctx, model, logPrefix))
         return false;
 
@@ -469,16 +1400,17 @@ bool SceneGraph::LoadSceneFromGltf(IRenderingContext &ctx,
                scene.nodes.size());
 
     // Nodes hierarchy
-    mRootNodes.clear();
+    DestroyNodes();
     mRootNodes.reserve(scene.nodes.size());
     for (const auto nodeIdx : scene.nodes)
     {
-        SceneNode sceneNode(true);
-        if (!LoadSceneNodeFromGLTF(ctx, sceneNode, model, nodeIdx, logPrefix + L"   "))
+        SceneNode *sceneNode = CreateRootNode();
+        if (!LoadSceneNodeFromGLTF(ctx, *sceneNode, model, nodeIdx, logPrefix + L"   "))
             return false;
-        mRootNodes.push_back(std::move(sceneNode));
     }
 
+    LoadNodeAnimations(model, logPrefix);
+
     return true;
 }
 
@@ -502,29 +1434,51 @@ bool SceneGraph::LoadSceneFromGltfWithSkeleton(IRenderingContext& ctx,
         scene.nodes.size());
 
     // Nodes hierarchy
-    mRootNodes.clear();
+    DestroyNodes();
     mRootNodes.reserve(scene.nodes.size());
     for (const auto nodeIdx : scene.nodes)
     {
-        SceneNode sceneNode(true);
+        SceneNode &sceneNode = *CreateRootNode();
 
         printMeshNames(model);
         printSkinAndBones(model);
         printWeightsToBones(model);
         printAnimations(model);
 
-        sceneNode.m_skeleton.LoadFromGltf(model);
+        sceneNode.m_skeleton.LoadFromGltf(model, 0, mFilePath);
         sceneNode.m_skeleton.Update(0);
         
         if (!LoadSceneNodeFromGLTF(ctx, sceneNode, model, nodeIdx, logPrefix + L"   "))
             return false;
-        //mRootNodes.push_back(std::move(sceneNode));
-        mRootNodes.push_back(sceneNode);
+        LoadAdditionalSkins(sceneNode, model, logPrefix + L"   ");
     }
 
+    LoadNodeAnimations(model, logPrefix);
+
     return true;
 }
 
+void SceneGraph::LoadAdditionalSkins(SceneNode &sceneNode,
+                                     const tinygltf::Model &model,
+                                     const std::wstring &logPrefix)
+{
+    if (sceneNode.mGltfSkinIdx > 0 && !sceneNode.m_skeleton.IsLoaded())
+    {
+        if (sceneNode.m_skeleton.LoadFromGltf(model, sceneNode.mGltfSkinIdx, mFilePath))
+        {
+            sceneNode.m_skeleton.Update(0);
+            Log::Debug(L"%sNode %d: skeleton from skin %d (%d joints)",
+                       logPrefix.c_str(), sceneNode.mGltfNodeIdx, sceneNode.mGltfSkinIdx,
+                       sceneNode.m_skeleton.GetBoneCount());
+        }
+        else
+            Log::Warning(L"%sNode %d: failed to load skin %d!",
+                         logPrefix.c_str(), sceneNode.mGltfNodeIdx, sceneNode.mGltfSkinIdx);
+    }
+
+    for (auto *child : sceneNode.mChildren)
+        LoadAdditionalSkins(*child, model, logPrefix);
+}
 
 bool SceneGraph::LoadSceneNodeFromGLTF(IRenderingContext &ctx,
                                   SceneNode &sceneNode,
@@ -545,7 +1499,6 @@ bool SceneGraph::LoadSceneNodeFromGLTF(IRenderingContext &ctx,
         return false;
 
     // Children
-    sceneNode.mChildren.clear();
     sceneNode.mChildren.reserve(node.children.size());
     const std::wstring &childLogPrefix = logPrefix + L"   ";
     for (const auto childIdx : node.children)
@@ -556,10 +1509,9 @@ bool SceneGraph::LoadSceneNodeFromGLTF(IRenderingContext &ctx,
             return false;
         }
 
-        SceneNode childNode;
-        if (!LoadSceneNodeFromGLTF(ctx, childNode, model, childIdx, childLogPrefix))
+        SceneNode *childNode = CreateNode(&sceneNode);
+        if (!LoadSceneNodeFromGLTF(ctx, *childNode, model, childIdx, childLogPrefix))
             return false;
-        sceneNode.mChildren.push_back(std::move(childNode));
     }
 
     return true;
@@ -578,53 +1530,65 @@ void SceneGraph::Destroy()
 
     Utils::ReleaseAndMakeNull(mSamplerLinear);
 
-    mRootNodes.clear();
+    mNodeAnimations.clear();
+
+    for (auto &cb : mObjectCbs)
+        Utils::ReleaseAndMakeNull(cb.buffer);
+    mObjectCbs.clear();
+    for (auto &skin : mSkinCbs)
+        Utils::ReleaseAndMakeNull(skin.second.buffer);
+    mSkinCbs.clear();
+
+    mInstanceBackend.Destroy();
+    Utils::ReleaseAndMakeNull(mStaticObjectCb);
+
+    DestroyNodes();
 }
 
 void SceneGraph::AddScaleToRoots(double scale)
 {
-    for (auto &rootNode : mRootNodes)
-        rootNode.AddScale(scale);
+    for (auto *rootNode : mRootNodes)
+        rootNode->AddScale(scale);
 }
 
 
 void SceneGraph::AddScaleToRoots(const std::vector<double> &vec)
 {
-    for (auto &rootNode : mRootNodes)
-        rootNode.AddScale(vec);
+    for (auto *rootNode : mRootNodes)
+        rootNode->AddScale(vec);
 }
 
 
 void SceneGraph::AddRotationQuaternionToRoots(const std::vector<double> &vec)
 {
-    for (auto &rootNode : mRootNodes)
-        rootNode.AddRotationQuaternion(vec);
+    for (auto *rootNode : mRootNodes)
+        rootNode->AddRotationQuaternion(vec);
 }
 
 
 void SceneGraph::AddTranslationToRoots(const std::vector<double> &vec)
 {
-    for (auto &rootNode : mRootNodes)
-        rootNode.AddTranslation(vec);
+    for (auto *rootNode : mRootNodes)
+        rootNode->AddTranslation(vec);
 }
 
 
 void SceneGraph::AddMatrixToRoots(const std::vector<double> &vec)
 {
-    for (auto &rootNode : mRootNodes)
-        rootNode.AddMatrix(vec);
+    for (auto *rootNode : mRootNodes)
+        rootNode->AddMatrix(vec);
 }
 
 void SceneGraph::AddMatrixToRoots(const XMMATRIX& mat)
 {
-    for (auto& rootNode : mRootNodes)
-        rootNode.AddMatrix(mat);
+    for (auto *rootNode : mRootNodes)
+        rootNode->AddMatrix(mat);
 }
 
 void SceneGraph::SetMatrixToRoots(const XMMATRIX& mat)
 {
-    for (auto& rootNode : mRootNodes)
-        rootNode.SetMatrix(mat);
+    for (auto *rootNode : mRootNodes)
+        rootNode->SetMatrix(mat);
 }
 
 void SceneGraph::RenderFrame(IRenderingContext& ctx, const float deltaTime)
@@ -632,58 +1596,403 @@ void SceneGraph::RenderFrame(IRenderingContext& ctx, const float deltaTime)
     if (!ctx.IsValid())
         return;
 
-    ConstantBuffer* data = &ctx.getDXRenderer()->m_ConstantBufferData;
-    data->mView = XMMatrixTranspose(ctx.getDXRenderer()->m_pScene->m_pCamera->getViewMatrix());
-    data->mProjection = XMMatrixTranspose(XMLoadFloat4x4(&ctx.getDXRenderer()->m_matProjection));
+    // Batched nodes moved or were destroyed since the batches were baked
+    if (mStaticBatchesDirty)
+        BuildStaticBatches(ctx);
+
+    // New nodes have no world matrix, and new primitives no bounds, until the next update
+    if (mTransforms.NeedsRebuild() || !mPendingDrawableNodes.empty())
+        UpdateTransforms();
+
+    CullPrimitives(ctx);
+    CullStaticBatches(ctx);
+
+    // Draws are sorted by key (front to back within each state group), so keep the view
+    // and the depth range at hand for the traversal
+    const XMMATRIX projection = XMLoadFloat4x4(&ctx.getDXRenderer()->m_matProjection);
+    XMStoreFloat4x4(&mSortView, ctx.getDXRenderer()->m_pScene->m_pCamera->getViewMatrix());
+    const float farPlane = XMVectorGetZ(projection.r[3]) / (1.0f - XMVectorGetZ(projection.r[2]));
+    mSortDepthScale = (farPlane > 0.0f) ? 1.0f / farPlane : 0.0f;
+
+    // Scene geometry. Constant uploads are recorded during the traversal, ahead of the draws.
+    mCommands.Clear();
+    mRenderQueue.Clear();
+    for (auto *node : mRootNodes)
+        RenderNode(ctx, *node, deltaTime);
+    QueueStaticBatches(ctx);
+
+    mRenderQueue.Sort();
+    RenderQueue::Stats queueStats;
+    ICommandExecutor *executor = ctx.GetCommandExecutor();
+    ThreadPool *pool = ctx.GetThreadPool();
+    if (pool && (mRenderQueue.Size() >= ParallelSubmitThreshold))
+    {
+        // Chunks of the sorted draws, recorded and executed in order of the chunks
+        queueStats = mRenderQueue.SubmitParallel(pool, mChunkCommands);
+        mStats.parallelChunks += mChunkCommands.size();
+        if (executor)
+        {
+            mCommands.Execute(*executor);
+            D3D11DeferredExecutor *deferred = ctx.GetDeferredExecutor();
+            const bool isDeferred = deferred && (executor == &ctx.getDXRenderer()->m_commandExecutor) &&
+                                    deferred->Execute(pool, mChunkCommands);
+            if (!isDeferred)
+                for (const auto &chunk : mChunkCommands)
+                    chunk.Execute(*executor);
+        }
+    }
+    else
+    {
+        queueStats = mRenderQueue.Submit(&mCommands);
+        if (executor)
+            mCommands.Execute(*executor);
+    }
+    mStats.drawCalls += queueStats.draws;
+    mStats.stateChanges += queueStats.stateChanges;
+    mStats.stateChangesSaved += queueStats.stateChangesNaive - queueStats.stateChanges;
+}
+
+float SceneGraph::GetSortDepth(const SceneNode &node, size_t primitiveIdx) const
+{
+    // Skinned primitives have no real bounds, the node's origin has to do for them
+    XMVECTOR position;
+    const size_t drawable = node.mFirstDrawable + primitiveIdx;
+    if (node.IsAttached() && drawable < mDrawables.size() && mDrawables[drawable].bounded)
+        position = XMVectorSet(mWorldBounds.centerX[drawable], mWorldBounds.centerY[drawable],
+                               mWorldBounds.centerZ[drawable], 1.0f);
+    else
+        position = node.GetWorldMtrx().r[3];
 
-    // Scene geometry
-    for (auto& node : mRootNodes)
-        RenderNode(ctx, node, XMMatrixIdentity(), deltaTime);
+    return GetSortDepth(position);
+}
 
+float SceneGraph::GetSortDepth(FXMVECTOR worldPosition) const
+{
+    const float viewDepth = XMVectorGetZ(XMVector3Transform(worldPosition, XMLoadFloat4x4(&mSortView)));
+    return viewDepth * mSortDepthScale;
 }
 
 
 void SceneGraph::RenderNode(IRenderingContext &ctx,
                        SceneNode &node,
-                       const XMMATRIX &parentWorldMtrx,
-                        const float deltaTime)
+                        const float deltaTime,
+                        const Skeleton *skeleton)
 {
     if (!ctx.IsValid())
         return;
 
-    XMMATRIX matWorld = XMLoadFloat4x4(&node.mWorldMtrx);
-
-    XMMATRIX world = matWorld * parentWorldMtrx;
-    ConstantBuffer* data = &ctx.getDXRenderer()->m_ConstantBufferData;
+    // The palette was built by InterpolateAnimation()
     if (node.m_skeleton.IsLoaded())
+        skeleton = &node.m_skeleton;
+
+    // Morph targets
+    if (!node.mMorphWeights.empty())
     {
-        if (node.m_skeleton.CurrentAnimation() == nullptr)
-            node.m_skeleton.PlayAnimation((unsigned int)0);
-        node.m_skeleton.Update(deltaTime);
-        data->bone_count = node.m_skeleton.GetBoneCount();
-        node.m_skeleton.GetSkinningMatrices(data->boneTransforms, max_bones);
+        SampleMorphWeights(node, skeleton);
+        for (auto *primitive : node.mPrimitives)
+            primitive->ApplyMorphWeights(ctx, mMorphWeightsScratch.data(), mMorphWeightsScratch.size());
     }
 
-    // Draw current node
-    for (auto &primitive : node.mPrimitives)
+    // Queue the primitives of the current node that passed culling
+    const FrustumCuller::ViewMask *visibility = nullptr;
+    bool anyVisible = !node.mPrimitives.empty();
+    if (node.IsAttached() && (node.mFirstDrawable + node.mPrimitives.size() <= mVisibility.size()))
     {
-        // update the per-node constant buffer
-        auto immCtx = ctx.GetImmediateContext();
-        
-        // store world and the view / projection in a constant buffer for the vertex shader to use
-        data->mWorld = DirectX::XMMatrixTranspose(world);
-        ctx.GetImmediateContext()->UpdateSubresource(ctx.getDXRenderer()->m_pScene->m_pConstantBuffer.Get(), 0, nullptr, data, 0, 0);
+        visibility = &mVisibility[node.mFirstDrawable];
+        anyVisible = std::any_of(visibility, visibility + node.mPrimitives.size(),
+                                 [](FrustumCuller::ViewMask mask) { return mask != 0; });
+    }
 
-        // Render a cube
-        ctx.GetImmediateContext()->VSSetShader(ctx.getDXRenderer()->m_pVertexShader.Get(), nullptr, 0);
-        ctx.GetImmediateContext()->VSSetConstantBuffers(0, 1, ctx.getDXRenderer()->m_pScene->m_pConstantBuffer.GetAddressOf());
+    if (anyVisible)
+    {
+        ConstantRange objectCb = UpdateObjectConstants(ctx, node, skeleton);
+        if (!objectCb.buffer)
+            objectCb.buffer = ctx.getDXRenderer()->m_pScene->m_pConstantBuffer.Get();
+        const ConstantRange skinCb = skeleton ? UpdateSkinConstants(ctx, *skeleton) : ConstantRange();
 
-        primitive.DrawGeometry(ctx, ctx.getDXRenderer()->m_pVertexLayout.Get());
+        for (size_t i = 0; i < node.mPrimitives.size(); ++i)
+        {
+            if (visibility && !visibility[i])
+                continue;
+            const ScenePrimitive *primitive = node.mPrimitives[i];
+
+            DrawPacket packet;
+            primitive->FillDrawPacket(packet);
+            packet.objectConstants = objectCb;
+            packet.skinConstants = skinCb;
+            QueueDraw(ctx, packet, GetSortDepth(node, i));
+        }
     }
 
     // Children
-    for (auto &child : node.mChildren)
-        RenderNode(ctx, child, world, deltaTime);
+    for (auto *child : node.mChildren)
+        RenderNode(ctx, *child, deltaTime, skeleton);
+}
+
+void SceneGraph::QueueDraw(IRenderingContext &ctx, DrawPacket &packet, float sortDepth)
+{
+    DX11Renderer *renderer = ctx.getDXRenderer();
+    const bool isSkinned = packet.skinBuffer != nullptr;
+
+    const VertexStreams::Layout layout = VertexStreams::GetLayout(isSkinned, false);
+    packet.vertexShader = renderer->m_vertexShaders[layout].Get();
+    packet.inputLayout = renderer->m_vertexLayouts[layout].Get();
+    packet.pixelShader = renderer->m_pPixelShader.Get();
+
+    // No per-primitive textures yet, the texture set field stays 0
+    mRenderQueue.Add(RenderQueue::MakeKey(RenderQueue::eOpaquePass, mRenderQueue.GetObjectId(packet.vertexShader),
+                                          packet.materialIndex, 0, mRenderQueue.GetObjectId(packet.vertexBuffer),
+                                          sortDepth),
+                     packet);
+
+    // Alpha tested and blended materials need their shading to know the coverage, they
+    // are left to the forward pass
+    const VertexStreams::Layout depthLayout = VertexStreams::GetLayout(isSkinned, true);
+    if (!mDepthPrepass || !renderer->m_vertexShaders[depthLayout])
+        return;
+    const MaterialTable &materials = renderer->m_materialTable;
+    if ((packet.materialIndex < materials.GetCount()) &&
+        (materials.Get(packet.materialIndex).flags & (MaterialAlphaMask | MaterialAlphaBlend)))
+        return;
+
+    // Positions (and skin) only, no pixel shader; sorted by buffer, then front to back
+    DrawPacket depthPacket = packet;
+    depthPacket.vertexShader = renderer->m_vertexShaders[depthLayout].Get();
+    depthPacket.inputLayout = renderer->m_vertexLayouts[depthLayout].Get();
+    depthPacket.pixelShader = nullptr;
+    depthPacket.attributeBuffer = nullptr;
+    depthPacket.textures = nullptr;
+    mRenderQueue.Add(RenderQueue::MakeKey(RenderQueue::eDepthPass, mRenderQueue.GetObjectId(depthPacket.vertexShader),
+                                          0, 0, mRenderQueue.GetObjectId(depthPacket.vertexBuffer), sortDepth),
+                     depthPacket);
+    mStats.depthDraws++;
+}
+
+void SceneGraph::RenderInstances(IRenderingContext &ctx,
+                                 const XMMATRIX *rootMatrices,
+                                 size_t instanceCount,
+                                 const float deltaTime)
+{
+    if (!ctx.IsValid() || (instanceCount == 0))
+        return;
+
+    // View and projection come from the renderer's view constants
+    DX11Renderer *renderer = ctx.getDXRenderer();
+    const bool instanced = renderer->m_pInstancedVertexShader &&
+                           mInstanceBackend.Init(ctx.GetDevice(), &renderer->m_stateCache,
+                                                 renderer->m_pInstancedVertexShader.Get(),
+                                                 renderer->m_pInstancedVertexLayout.Get(),
+                                                 renderer->m_pStaticInstancedVertexShader.Get(),
+                                                 renderer->m_pStaticInstancedVertexLayout.Get());
+    if (!instanced)
+    {
+        for (size_t i = 0; i < instanceCount; ++i)
+        {
+            SetMatrixToRoots(rootMatrices[i]);
+            UpdateTransforms();
+            RenderFrame(ctx, deltaTime);
+        }
+        return;
+    }
+
+    // Every instance is posed, culled and collected on its own; the draws are merged at the end
+    mInstanceBatcher.Begin();
+    for (size_t i = 0; i < instanceCount; ++i)
+    {
+        SetMatrixToRoots(rootMatrices[i]);
+        UpdateTransforms();
+        CullPrimitives(ctx);
+
+        // The vertex buffers are shared, so morph weights can only be applied once
+        for (auto *node : mRootNodes)
+            BatchNode(ctx, *node, i == 0);
+    }
+
+    const InstanceBatcher::Stats batchStats = mInstanceBatcher.Flush(mInstanceBackend);
+    mStats.drawCalls += batchStats.batches;
+    mStats.instancedDraws += batchStats.batches;
+    mStats.instances += instanceCount;
+}
+
+void SceneGraph::BatchNode(IRenderingContext &ctx,
+                           SceneNode &node,
+                           bool applyMorphWeights,
+                           const Skeleton *skeleton)
+{
+    if (node.m_skeleton.IsLoaded())
+        skeleton = &node.m_skeleton;
+
+    if (applyMorphWeights && !node.mMorphWeights.empty())
+    {
+        SampleMorphWeights(node, skeleton);
+        for (auto *primitive : node.mPrimitives)
+            primitive->ApplyMorphWeights(ctx, mMorphWeightsScratch.data(), mMorphWeightsScratch.size());
+    }
+
+    const FrustumCuller::ViewMask *visibility = nullptr;
+    bool anyVisible = !node.mPrimitives.empty();
+    if (node.IsAttached() && (node.mFirstDrawable + node.mPrimitives.size() <= mVisibility.size()))
+    {
+        visibility = &mVisibility[node.mFirstDrawable];
+        anyVisible = std::any_of(visibility, visibility + node.mPrimitives.size(),
+                                 [](FrustumCuller::ViewMask mask) { return mask != 0; });
+    }
+
+    if (anyVisible)
+    {
+        // Instances posed by the same skeleton state share one palette
+        uint32_t paletteOffset = InstanceBatcher::InvalidPalette;
+        if (skeleton && (skeleton->GetBoneCount() > 0))
+        {
+            paletteOffset = mInstanceBatcher.FindPalette(skeleton, skeleton->GetPaletteVersion());
+            if (paletteOffset == InstanceBatcher::InvalidPalette)
+            {
+                mPaletteScratch.resize(skeleton->GetBoneCount());
+                skeleton->GetSkinningMatrices(mPaletteScratch.data(), (unsigned int)mPaletteScratch.size());
+                paletteOffset = mInstanceBatcher.AddPalette(skeleton, skeleton->GetPaletteVersion(),
+                                                            mPaletteScratch.data(), mPaletteScratch.size());
+            }
+        }
+
+        const XMMATRIX world = node.GetWorldMtrx();
+        for (size_t i = 0; i < node.mPrimitives.size(); ++i)
+        {
+            if (visibility && !visibility[i])
+                continue;
+            const ScenePrimitive *primitive = node.mPrimitives[i];
+
+            DrawPacket packet;
+            primitive->FillDrawPacket(packet);
+            mInstanceBatcher.Add(packet, primitive, (int)primitive->GetMaterialTableIdx(), world, paletteOffset);
+        }
+    }
+
+    for (auto *child : node.mChildren)
+        BatchNode(ctx, *child, applyMorphWeights, skeleton);
+}
+
+ConstantRange SceneGraph::UpdateObjectConstants(IRenderingContext &ctx,
+                                                const SceneNode &node,
+                                                const Skeleton *skeleton)
+{
+    if (!node.IsAttached() || (node.mTransformIdx >= mObjectCbs.size()))
+        return ConstantRange();
+
+    NodeConstants &cb = mObjectCbs[node.mTransformIdx];
+
+    // The all-in-one buffer held the palette too, so a new pose re-uploaded every node it skins
+    const uint32_t worldVersion = mTransforms.GetWorldVersion(node.mTransformIdx);
+    const uint64_t paletteVersion = skeleton ? skeleton->GetPaletteVersion() : 0;
+    const bool isChanged = (cb.worldVersion != worldVersion) ||
+                           (cb.skeleton != skeleton) ||
+                           (cb.paletteVersion != paletteVersion);
+    cb.skeleton = skeleton;
+    cb.paletteVersion = paletteVersion;
+    if (isChanged)
+        mStats.cbBytesMonolithic += MonolithicConstantsSize;
+
+    ObjectConstants data;
+    data.mWorld = XMMatrixTranspose(node.GetWorldMtrx());
+
+    // Ring allocations only live for a frame, so they are written every time
+    ConstantRing &ring = ctx.getDXRenderer()->m_constantRing;
+    ConstantRange range;
+    if (ring.IsValid() && ring.Allocate(&data, sizeof(data), range))
+    {
+        cb.worldVersion = worldVersion;
+        mStats.cbUploads++;
+        mStats.cbBytes += sizeof(data);
+        return range;
+    }
+
+    if (!cb.buffer)
+    {
+        auto device = ctx.GetDevice();
+        if (!device)
+            return ConstantRange();
+
+        D3D11_BUFFER_DESC bd;
+        ZeroMemory(&bd, sizeof(bd));
+        bd.Usage = D3D11_USAGE_DEFAULT;
+        bd.ByteWidth = sizeof(ObjectConstants);
+        bd.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+        bd.CPUAccessFlags = 0;
+        if (FAILED(device->CreateBuffer(&bd, nullptr, &cb.buffer)))
+            return ConstantRange();
+        cb.bufferVersion = UINT32_MAX;
+    }
+
+    // Frames that went through the ring did not touch the buffer, so it is checked on its own
+    range.buffer = cb.buffer;
+    if (cb.bufferVersion == worldVersion)
+    {
+        mStats.cbSkipped++;
+        return range;
+    }
+
+    mCommands.UpdateBuffer(cb.buffer, &data, sizeof(data));
+    cb.bufferVersion = worldVersion;
+    cb.worldVersion = worldVersion;
+    mStats.cbUploads++;
+    mStats.cbBytes += sizeof(data);
+
+    return range;
+}
+
+ConstantRange SceneGraph::UpdateSkinConstants(IRenderingContext &ctx, const Skeleton &skeleton)
+{
+    SkinConstantsCache &cache = mSkinCbs[&skeleton];
+    const uint64_t paletteVersion = skeleton.GetPaletteVersion();
+
+    ConstantRing &ring = ctx.getDXRenderer()->m_constantRing;
+    if (ring.IsValid())
+    {
+        if ((cache.ringFrame == ring.GetFrame()) && (cache.ringVersion == paletteVersion))
+            return cache.ringRange;
+
+        // Only the bones the skeleton has
+        mPaletteScratch.resize((std::max)((std::min)(skeleton.GetBoneCount(), max_bones), 1u));
+        skeleton.GetSkinningMatrices(mPaletteScratch.data(), (unsigned int)mPaletteScratch.size());
+        const size_t size = mPaletteScratch.size() * sizeof(XMMATRIX);
+        if (ring.Allocate(mPaletteScratch.data(), size, cache.ringRange))
+        {
+            cache.ringFrame = ring.GetFrame();
+            cache.ringVersion = paletteVersion;
+            mStats.cbBytes += size;
+            return cache.ringRange;
+        }
+    }
+
+    if (!cache.buffer)
+    {
+        auto device = ctx.GetDevice();
+        if (!device)
+            return ConstantRange();
+
+        D3D11_BUFFER_DESC bd;
+        ZeroMemory(&bd, sizeof(bd));
+        bd.Usage = D3D11_USAGE_DEFAULT;
+        bd.ByteWidth = sizeof(SkinConstants);
+        bd.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+        bd.CPUAccessFlags = 0;
+        if (FAILED(device->CreateBuffer(&bd, nullptr, &cache.buffer)))
+            return ConstantRange();
+        cache.bufferVersion = UINT64_MAX;
+    }
+
+    if (cache.bufferVersion != paletteVersion)
+    {
+        // The whole buffer, constant buffers are not partially updated before D3D 11.1
+        SkinConstants data;
+        skeleton.GetSkinningMatrices(data.boneTransforms, max_bones);
+        mCommands.UpdateBuffer(cache.buffer, &data, sizeof(data));
+        cache.bufferVersion = paletteVersion;
+        mStats.cbBytes += sizeof(data);
+    }
+
+    ConstantRange range;
+    range.buffer = cache.buffer;
+    return range;
 }
 
 ScenePrimitive::ScenePrimitive()
@@ -694,12 +2003,25 @@ ScenePrimitive::ScenePrimitive(const ScenePrimitive &src) :
     mIndices(src.mIndices),
     mTopology(src.mTopology),
     mIsTangentPresent(src.mIsTangentPresent),
+    mGeometryPool(src.mGeometryPool),
+    mGeometry(src.mGeometry),
     mVertexBuffer(src.mVertexBuffer),
+    mAttributeBuffer(src.mAttributeBuffer),
+    mSkinBuffer(src.mSkinBuffer),
     mIndexBuffer(src.mIndexBuffer),
-    mMaterialIdx(src.mMaterialIdx)
+    mMaterialIdx(src.mMaterialIdx),
+    mMaterialTableIdx(src.mMaterialTableIdx),
+    mMorphTargets(src.mMorphTargets),
+    mMorphedVertices(src.mMorphedVertices),
+    mAppliedMorphWeights(src.mAppliedMorphWeights),
+    mIsMorphed(src.mIsMorphed)
 {
     // We are creating new references of device resources
+    if (mGeometryPool)
+        mGeometryPool->AddRef(mGeometry);
     Utils::SafeAddRef(mVertexBuffer);
+    Utils::SafeAddRef(mAttributeBuffer);
+    Utils::SafeAddRef(mSkinBuffer);
     Utils::SafeAddRef(mIndexBuffer);
 }
 
@@ -708,9 +2030,18 @@ ScenePrimitive::ScenePrimitive(ScenePrimitive &&src) :
     mIndices(std::move(src.mIndices)),
     mIsTangentPresent(Utils::Exchange(src.mIsTangentPresent, false)),
     mTopology(Utils::Exchange(src.mTopology, D3D11_PRIMITIVE_TOPOLOGY_UNDEFINED)),
+    mGeometryPool(Utils::Exchange(src.mGeometryPool, nullptr)),
+    mGeometry(Utils::Exchange(src.mGeometry, GeometryPool::InvalidHandle)),
     mVertexBuffer(Utils::Exchange(src.mVertexBuffer, nullptr)),
+    mAttributeBuffer(Utils::Exchange(src.mAttributeBuffer, nullptr)),
+    mSkinBuffer(Utils::Exchange(src.mSkinBuffer, nullptr)),
     mIndexBuffer(Utils::Exchange(src.mIndexBuffer, nullptr)),
-    mMaterialIdx(Utils::Exchange(src.mMaterialIdx, -1))
+    mMaterialIdx(Utils::Exchange(src.mMaterialIdx, -1)),
+    mMaterialTableIdx(Utils::Exchange(src.mMaterialTableIdx, MaterialTable::DefaultMaterial)),
+    mMorphTargets(std::move(src.mMorphTargets)),
+    mMorphedVertices(std::move(src.mMorphedVertices)),
+    mAppliedMorphWeights(std::move(src.mAppliedMorphWeights)),
+    mIsMorphed(Utils::Exchange(src.mIsMorphed, false))
 {}
 
 ScenePrimitive& ScenePrimitive::operator =(const ScenePrimitive &src)
@@ -719,14 +2050,28 @@ ScenePrimitive& ScenePrimitive::operator =(const ScenePrimitive &src)
     mIndices = src.mIndices;
     mIsTangentPresent = src.mIsTangentPresent;
     mTopology = src.mTopology;
+    mGeometryPool = src.mGeometryPool;
+    mGeometry = src.mGeometry;
     mVertexBuffer = src.mVertexBuffer;
+    mAttributeBuffer = src.mAttributeBuffer;
+    mSkinBuffer = src.mSkinBuffer;
     mIndexBuffer = src.mIndexBuffer;
 
     // We are creating new references of device resources
+    if (mGeometryPool)
+        mGeometryPool->AddRef(mGeometry);
     Utils::SafeAddRef(mVertexBuffer);
+    Utils::SafeAddRef(mAttributeBuffer);
+    Utils::SafeAddRef(mSkinBuffer);
     Utils::SafeAddRef(mIndexBuffer);
 
     mMaterialIdx = src.mMaterialIdx;
+    mMaterialTableIdx = src.mMaterialTableIdx;
+
+    mMorphTargets = src.mMorphTargets;
+    mMorphedVertices = src.mMorphedVertices;
+    mAppliedMorphWeights = src.mAppliedMorphWeights;
+    mIsMorphed = src.mIsMorphed;
 
     return *this;
 }
@@ -737,10 +2082,20 @@ ScenePrimitive& ScenePrimitive::operator =(ScenePrimitive &&src)
     mIndices = std::move(src.mIndices);
     mIsTangentPresent = Utils::Exchange(src.mIsTangentPresent, false);
     mTopology = Utils::Exchange(src.mTopology, D3D11_PRIMITIVE_TOPOLOGY_UNDEFINED);
+    mGeometryPool = Utils::Exchange(src.mGeometryPool, nullptr);
+    mGeometry = Utils::Exchange(src.mGeometry, GeometryPool::InvalidHandle);
     mVertexBuffer = Utils::Exchange(src.mVertexBuffer, nullptr);
+    mAttributeBuffer = Utils::Exchange(src.mAttributeBuffer, nullptr);
+    mSkinBuffer = Utils::Exchange(src.mSkinBuffer, nullptr);
     mIndexBuffer = Utils::Exchange(src.mIndexBuffer, nullptr);
 
     mMaterialIdx = Utils::Exchange(src.mMaterialIdx, -1);
+    mMaterialTableIdx = Utils::Exchange(src.mMaterialTableIdx, MaterialTable::DefaultMaterial);
+
+    mMorphTargets = std::move(src.mMorphTargets);
+    mMorphedVertices = std::move(src.mMorphedVertices);
+    mAppliedMorphWeights = std::move(src.mAppliedMorphWeights);
+    mIsMorphed = Utils::Exchange(src.mIsMorphed, false);
 
     return *this;
 }
@@ -755,6 +2110,7 @@ bool ScenePrimitive::CreateQuad(IRenderingContext & ctx)
 {
     if (!GenerateQuadGeometry())
         return false;
+    CalculateBounds();
     if (!CreateDeviceBuffers(ctx))
         return false;
 
@@ -766,6 +2122,7 @@ bool ScenePrimitive::CreateCube(IRenderingContext & ctx)
 {
     if (!GenerateCubeGeometry())
         return false;
+    CalculateBounds();
     if (!CreateDeviceBuffers(ctx))
         return false;
 
@@ -777,6 +2134,7 @@ bool ScenePrimitive::CreateOctahedron(IRenderingContext & ctx)
 {
     if (!GenerateOctahedronGeometry())
         return false;
+    CalculateBounds();
     if (!CreateDeviceBuffers(ctx))
         return false;
 
@@ -790,6 +2148,7 @@ bool ScenePrimitive::CreateSphere(IRenderingContext & ctx,
 {
     if (!GenerateSphereGeometry(vertSegmCount, stripCount))
         return false;
+    CalculateBounds();
     if (!CreateDeviceBuffers(ctx))
         return false;
 
@@ -1034,11 +2393,20 @@ bool ScenePrimitive::LoadFromGLTF(IRenderingContext & ctx,
         return false;
     if (!CreateDeviceBuffers(ctx))
         return false;
+    AddMaterialToTable(ctx, model);
 
     return true;
 }
 
 
+void ScenePrimitive::AddMaterialToTable(IRenderingContext &ctx, const tinygltf::Model &model)
+{
+    // Equal materials, in this file or any other, end up in the same entry
+    if ((mMaterialIdx >= 0) && ctx.getDXRenderer())
+        mMaterialTableIdx = ctx.getDXRenderer()->m_materialTable.Add(MaterialTable::FromGltf(model.materials[mMaterialIdx]));
+}
+
+
 bool ScenePrimitive::LoadDataFromGLTF(const tinygltf::Model &model,
                                       const tinygltf::Mesh &mesh,
                                       const int primitiveIdx,
@@ -1492,12 +2860,61 @@ bool ScenePrimitive::LoadDataFromGLTF(const tinygltf::Model &model,
         mMaterialIdx = matIdx;
     }
 
+    // Morph targets
+    if (!mMorphTargets.LoadFromGltf(model, primitive, mVertices.size(), subItemsLogPrefix))
+        return false;
+
+    // Bounds: POSITION min/max are required by the spec, but not every exporter writes them
+    if ((posAccessor.minValues.size() == 3) && (posAccessor.maxValues.size() == 3))
+    {
+        mBoundsMin = XMFLOAT3((float)posAccessor.minValues[0], (float)posAccessor.minValues[1], (float)posAccessor.minValues[2]);
+        mBoundsMax = XMFLOAT3((float)posAccessor.maxValues[0], (float)posAccessor.maxValues[1], (float)posAccessor.maxValues[2]);
+        ExtendBoundsByMorphTargets();
+    }
+    else
+        CalculateBounds();
+
     CalculateTangentsIfNeeded(subItemsLogPrefix);
 
     return true;
 }
 
 
+void ScenePrimitive::CalculateBounds()
+{
+    if (mVertices.empty())
+    {
+        mBoundsMin = mBoundsMax = XMFLOAT3(0.0f, 0.0f, 0.0f);
+        return;
+    }
+
+    XMVECTOR lo = XMLoadFloat3(&mVertices[0].Pos);
+    XMVECTOR hi = lo;
+    for (const auto &vertex : mVertices)
+    {
+        const XMVECTOR pos = XMLoadFloat3(&vertex.Pos);
+        lo = XMVectorMin(lo, pos);
+        hi = XMVectorMax(hi, pos);
+    }
+    XMStoreFloat3(&mBoundsMin, lo);
+    XMStoreFloat3(&mBoundsMax, hi);
+
+    ExtendBoundsByMorphTargets();
+}
+
+
+void ScenePrimitive::ExtendBoundsByMorphTargets()
+{
+    if (mMorphTargets.IsEmpty())
+        return;
+
+    XMFLOAT3 deltaMin, deltaMax;
+    mMorphTargets.GetDeltaBounds(deltaMin, deltaMax);
+    XMStoreFloat3(&mBoundsMin, XMLoadFloat3(&mBoundsMin) + XMLoadFloat3(&deltaMin));
+    XMStoreFloat3(&mBoundsMax, XMLoadFloat3(&mBoundsMax) + XMLoadFloat3(&deltaMax));
+}
+
+
 bool ScenePrimitive::CalculateTangentsIfNeeded(const std::wstring &logPrefix)
 {
     if (!IsTangentPresent())
@@ -1762,6 +3179,34 @@ bool ScenePrimitive::CreateDeviceBuffers(IRenderingContext & ctx)
     if (!device)
         return false;
 
+    // One buffer per vertex stream; meshes without skin weights leave out the skin
+    const bool isSkinned = VertexStreams::HasSkin(mVertices.data(), mVertices.size());
+    const UINT streamCount = VertexStreams::GetStreamCount(isSkinned);
+    std::vector<uint8_t> streams[VertexStreams::eStreamCount];
+    const void *streamData[VertexStreams::eStreamCount] = {};
+    for (UINT stream = 0; stream < streamCount; ++stream)
+    {
+        VertexStreams::Extract(mVertices.data(), mVertices.size(), (VertexStreams::Stream)stream, streams[stream]);
+        streamData[stream] = streams[stream].data();
+    }
+
+    // Shared pool buffers if possible, so draws of different meshes keep their bindings
+    DX11Renderer *renderer = ctx.getDXRenderer();
+    GeometryPool *pool = nullptr;
+    if (renderer)
+        pool = isSkinned ? &renderer->m_skinnedGeometryPool : &renderer->m_geometryPool;
+    if (pool && pool->IsValid())
+    {
+        const GeometryPool::Handle handle = pool->Allocate(streamData, (uint32_t)mVertices.size(),
+                                                           mIndices.data(), (uint32_t)mIndices.size());
+        if (handle != GeometryPool::InvalidHandle)
+        {
+            mGeometryPool = pool;
+            mGeometry = handle;
+            return true;
+        }
+    }
+
     HRESULT hr = S_OK;
 
     D3D11_BUFFER_DESC bd;
@@ -1770,21 +3215,21 @@ bool ScenePrimitive::CreateDeviceBuffers(IRenderingContext & ctx)
     D3D11_SUBRESOURCE_DATA initData;
     ZeroMemory(&initData, sizeof(initData));
 
-    // Vertex buffer
-    bd.Usage = D3D11_USAGE_DEFAULT;
-    
-    int x = sizeof(SceneVertex);
-    bd.ByteWidth = (UINT)(sizeof(SceneVertex) * mVertices.size());
-
-
-    bd.BindFlags = D3D11_BIND_VERTEX_BUFFER;
-    bd.CPUAccessFlags = 0;
-    initData.pSysMem = mVertices.data();
-    hr = device->CreateBuffer(&bd, &initData, &mVertexBuffer);
-    if (FAILED(hr))
-    {
-        DestroyDeviceBuffers();
-        return false;
+    // Vertex buffers
+    ID3D11Buffer** vertexBuffers[VertexStreams::eStreamCount] = { &mVertexBuffer, &mAttributeBuffer, &mSkinBuffer };
+    for (UINT stream = 0; stream < streamCount; ++stream)
+    {
+        bd.Usage = D3D11_USAGE_DEFAULT;
+        bd.ByteWidth = (UINT)streams[stream].size();
+        bd.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+        bd.CPUAccessFlags = 0;
+        initData.pSysMem = streams[stream].data();
+        hr = device->CreateBuffer(&bd, &initData, vertexBuffers[stream]);
+        if (FAILED(hr))
+        {
+            DestroyDeviceBuffers();
+            return false;
+        }
     }
 
     // Index buffer
@@ -1815,56 +3260,213 @@ void ScenePrimitive::DestroyGeomData()
 {
     mVertices.clear();
     mIndices.clear();
+    mMorphTargets.Clear();
+    mMorphedVertices.clear();
+    mAppliedMorphWeights.clear();
+    mIsMorphed = false;
     mTopology = D3D11_PRIMITIVE_TOPOLOGY_UNDEFINED;
 }
 
 
 void ScenePrimitive::DestroyDeviceBuffers()
 {
+    if (mGeometryPool)
+        mGeometryPool->Release(mGeometry);
+    mGeometryPool = nullptr;
+    mGeometry = GeometryPool::InvalidHandle;
     Utils::ReleaseAndMakeNull(mVertexBuffer);
+    Utils::ReleaseAndMakeNull(mAttributeBuffer);
+    Utils::ReleaseAndMakeNull(mSkinBuffer);
     Utils::ReleaseAndMakeNull(mIndexBuffer);
 }
 
 
+ID3D11Buffer* ScenePrimitive::GetStreamBuffer(VertexStreams::Stream stream) const
+{
+    if (mGeometryPool)
+        return (stream < mGeometryPool->GetStreamCount()) ? mGeometryPool->GetVertexBuffer(mGeometry, stream) : nullptr;
+
+    switch (stream)
+    {
+    case VertexStreams::ePositionStream:    return mVertexBuffer;
+    case VertexStreams::eAttributeStream:   return mAttributeBuffer;
+    case VertexStreams::eSkinStream:        return mSkinBuffer;
+    default:                                return nullptr;
+    }
+}
+
+
+void ScenePrimitive::FillDrawPacket(DrawPacket &packet) const
+{
+    packet.vertexBuffer = GetVertexBuffer();
+    packet.vertexStride = sizeof(PositionVertex);
+    packet.attributeBuffer = GetAttributeBuffer();
+    packet.skinBuffer = GetSkinBuffer();
+    packet.indexBuffer = GetIndexBuffer();
+    packet.topology = mTopology;
+    packet.indexCount = (UINT)mIndices.size();
+    packet.startIndex = GetStartIndex();
+    packet.baseVertex = GetBaseVertex();
+    packet.materialIndex = mMaterialTableIdx;
+}
+
 void ScenePrimitive::DrawGeometry(IRenderingContext &ctx, ID3D11InputLayout* vertexLayout) const
 {
-    auto immCtx = ctx.GetImmediateContext();
+    StateCache &state = ctx.getDXRenderer()->m_stateCache;
+
+    state.IASetInputLayout(vertexLayout);
+    state.IASetVertexBuffer(PositionStreamSlot, GetVertexBuffer(), sizeof(PositionVertex));
+    state.IASetVertexBuffer(AttributeStreamSlot, GetAttributeBuffer(), sizeof(AttributeVertex));
+    if (ID3D11Buffer *skinBuffer = GetSkinBuffer())
+        state.IASetVertexBuffer(SkinStreamSlot, skinBuffer, sizeof(SkinVertex));
+    state.IASetIndexBuffer(GetIndexBuffer(), DXGI_FORMAT_R32_UINT);
+    state.IASetPrimitiveTopology(mTopology);
+
+    state.GetContext()->DrawIndexedInstanced((UINT)mIndices.size(), 1, GetStartIndex(), GetBaseVertex(), mMaterialTableIdx);
+}
+
+
+void ScenePrimitive::ApplyMorphWeights(IRenderingContext &ctx, const float *weights, size_t weightCount)
+{
+    if (mMorphTargets.IsEmpty() || !HasDeviceBuffers())
+        return;
+
+    // Most frames of most clips hold the weights still - don't touch the buffer then
+    if ((mAppliedMorphWeights.size() == weightCount) &&
+        std::equal(mAppliedMorphWeights.begin(), mAppliedMorphWeights.end(), weights))
+        return;
+    mAppliedMorphWeights.assign(weights, weights + weightCount);
+
+    const bool isActive = mMorphTargets.Evaluate(weights, weightCount);
+    if (!isActive && !mIsMorphed)
+        return; // device buffer already holds the base shape
+
+    // Only the [first, last] range of vertices touched by any target is re-uploaded
+    const auto &affected = mMorphTargets.GetAffectedVertices();
+    const uint32_t first = affected.front();
+    const uint32_t last = affected.back();
+    mMorphedVertices.assign(mVertices.begin() + first, mVertices.begin() + last + 1);
+
+    if (isActive)
+    {
+        const float *dx = mMorphTargets.GetPositionDeltaX();
+        const float *dy = mMorphTargets.GetPositionDeltaY();
+        const float *dz = mMorphTargets.GetPositionDeltaZ();
+        for (size_t i = 0; i < affected.size(); ++i)
+        {
+            auto &pos = mMorphedVertices[affected[i] - first].Pos;
+            pos.x += dx[i];
+            pos.y += dy[i];
+            pos.z += dz[i];
+        }
+
+        if (mMorphTargets.HasNormalDeltas())
+        {
+            const float *nx = mMorphTargets.GetNormalDeltaX();
+            const float *ny = mMorphTargets.GetNormalDeltaY();
+            const float *nz = mMorphTargets.GetNormalDeltaZ();
+            for (size_t i = 0; i < affected.size(); ++i)
+            {
+                auto &normal = mMorphedVertices[affected[i] - first].Normal;
+                const XMVECTOR n = XMVectorAdd(XMLoadFloat3(&normal), XMVectorSet(nx[i], ny[i], nz[i], 0.0f));
+                XMStoreFloat3(&normal, XMVector3Normalize(n));
+            }
+        }
+    }
 
-    immCtx->IASetInputLayout(vertexLayout);
-    UINT stride = sizeof(SceneVertex);
-    UINT offset = 0;
-    immCtx->IASetVertexBuffers(0, 1, &mVertexBuffer, &stride, &offset);
-    immCtx->IASetIndexBuffer(mIndexBuffer, DXGI_FORMAT_R32_UINT, 0);
-    immCtx->IASetPrimitiveTopology(mTopology);
+    // Positions always, the attribute stream only if the normals move too
+    for (const auto stream : { VertexStreams::ePositionStream, VertexStreams::eAttributeStream })
+    {
+        if ((stream == VertexStreams::eAttributeStream) && !mMorphTargets.HasNormalDeltas())
+            continue;
+
+        VertexStreams::Extract(mMorphedVertices.data(), mMorphedVertices.size(), stream, mMorphedStream);
+        if (mGeometryPool)
+            mGeometryPool->UpdateVertices(mGeometry, stream, first, mMorphedStream.data(), (uint32_t)mMorphedVertices.size());
+        else
+        {
+            const UINT stride = VertexStreams::GetStride(stream);
+            D3D11_BOX box;
+            box.left = (UINT)(first * stride);
+            box.right = (UINT)((last + 1) * stride);
+            box.top = 0;
+            box.bottom = 1;
+            box.front = 0;
+            box.back = 1;
+            ctx.GetImmediateContext()->UpdateSubresource(GetStreamBuffer(stream), 0, &box, mMorphedStream.data(), 0, 0);
+        }
+    }
 
-    immCtx->DrawIndexed((UINT)mIndices.size(), 0, 0);
+    mIsMorphed = isActive;
 }
 
 
-SceneNode::SceneNode(bool isRootNode) :
+SceneNode::SceneNode(SceneGraph *graph, bool isRootNode) :
+    mGraph(graph),
     mIsRootNode(isRootNode)
 {
     XMStoreFloat4x4(&mLocalMtrx, XMMatrixIdentity());
-    XMStoreFloat4x4(&mWorldMtrx, XMMatrixIdentity());
+}
+
+XMMATRIX SceneNode::GetLocalMtrx() const
+{
+    if (IsAttached())
+        return mTransforms->GetLocal(mTransformIdx);
+    return XMLoadFloat4x4(&mLocalMtrx);
+}
+
+XMMATRIX SceneNode::GetWorldMtrx() const
+{
+    if (IsAttached())
+        return mTransforms->GetWorld(mTransformIdx);
+    return XMLoadFloat4x4(&mLocalMtrx);
+}
+
+void SceneNode::StoreLocalMtrx(FXMMATRIX matrix)
+{
+    if (IsAttached())
+        mTransforms->SetLocal(mTransformIdx, matrix);
+    else
+        XMStoreFloat4x4(&mLocalMtrx, matrix);
 }
 
 SceneNode* SceneNode::CreateChildNode()
 {
-    // Add a new child node to this node's vector of children
-    mChildren.emplace_back(false); // 'false' means this is not a root node
-    // Return a pointer to the new child
-    return &mChildren.back();
+    return mGraph->CreateNode(this);
 }
 
+ScenePrimitive* SceneNode::AddPrimitive()
+{
+    ScenePrimitive *primitive = mGraph->CreatePrimitive();
+    mPrimitives.push_back(primitive);
+    mGraph->QueueDrawables(*this);
+    return primitive;
+}
+
+void SceneNode::AddSharedPrimitive(const MeshHandle &mesh)
+{
+    mPrimitives.push_back(mesh.get());
+    mSharedPrimitives.push_back(mesh);
+    mGraph->QueueDrawables(*this);
+}
+
+void SceneNode::ReleasePrimitive(ScenePrimitive *primitive)
+{
+    auto it = std::find_if(mSharedPrimitives.begin(), mSharedPrimitives.end(),
+                           [primitive](const MeshHandle &mesh) { return mesh.get() == primitive; });
+    if (it != mSharedPrimitives.end())
+        mSharedPrimitives.erase(it);
+    else
+        mGraph->DestroyPrimitive(primitive);
+}
 
 ScenePrimitive* SceneNode::CreateEmptyPrimitive()
 {
+    for (auto *primitive : mPrimitives)
+        ReleasePrimitive(primitive);
     mPrimitives.clear();
-    mPrimitives.resize(1);
-    if (mPrimitives.size() != 1)
-        return nullptr;
 
-    return &mPrimitives[0];
+    return AddPrimitive();
 }
 
 void SceneNode::SetIdentity()
@@ -1873,7 +3475,7 @@ void SceneNode::SetIdentity()
     XMMATRIX identity = XMMatrixIdentity();
 
     // 2. Store that aligned matrix into your unaligned class member
-    XMStoreFloat4x4(&mLocalMtrx, identity);
+    StoreLocalMtrx(identity);
 }
 
 void SceneNode::AddScale(double scale)
@@ -1894,7 +3496,7 @@ void SceneNode::AddScale(const std::vector<double>& vec)
 
     // --- Load ---
     // 1. Load the unaligned member variable into an aligned local XMMATRIX.
-    XMMATRIX localMtrx = XMLoadFloat4x4(&mLocalMtrx);
+    XMMATRIX localMtrx = GetLocalMtrx();
 
     // --- Compute ---
     // 2. Create the new scaling matrix (this is also an aligned local).
@@ -1905,24 +3507,25 @@ void SceneNode::AddScale(const std::vector<double>& vec)
 
     // --- Store ---
     // 4. Store the aligned result back into the unaligned member variable.
-    XMStoreFloat4x4(&mLocalMtrx, localMtrx);
+    StoreLocalMtrx(localMtrx);
 }
 
 void SceneNode::AddMatrix(const XMMATRIX& matrix)
-{   
+{
+   
     // 1. Load
-    XMMATRIX local = XMLoadFloat4x4(&mLocalMtrx);
+    XMMATRIX local = GetLocalMtrx();
 
     // 2. Compute
     local = XMMatrixMultiply(local, matrix);
 
     // 3. Store
-    XMStoreFloat4x4(&mLocalMtrx, local);
+    StoreLocalMtrx(local);
 }
 
 void SceneNode::SetMatrix(FXMMATRIX matrix)
 {
-    XMStoreFloat4x4(&mLocalMtrx, matrix);
+    StoreLocalMtrx(matrix);
 }
 
 
@@ -1939,7 +3542,7 @@ void SceneNode::AddRotationQuaternion(const std::vector<double>& vec)
 
     // --- Load ---
     // 1. Load the unaligned member variable into an aligned local XMMATRIX.
-    XMMATRIX localMtrx = XMLoadFloat4x4(&mLocalMtrx);
+    XMMATRIX localMtrx = GetLocalMtrx();
 
     // --- Compute ---
     // 2. Load and normalize the quaternion (using aligned XMVECTOR).
@@ -1955,7 +3558,7 @@ void SceneNode::AddRotationQuaternion(const std::vector<double>& vec)
 
     // --- Store ---
     // 5. Store the aligned result back into the unaligned member variable.
-    XMStoreFloat4x4(&mLocalMtrx, localMtrx);
+    StoreLocalMtrx(localMtrx);
 }
 
 void SceneNode::AddTranslation(const std::vector<double>& vec)
@@ -1971,7 +3574,7 @@ void SceneNode::AddTranslation(const std::vector<double>& vec)
 
     // --- Load ---
     // 1. Load the unaligned member variable into an aligned local XMMATRIX.
-    XMMATRIX localMtrx = XMLoadFloat4x4(&mLocalMtrx);
+    XMMATRIX localMtrx = GetLocalMtrx();
 
     // --- Compute ---
     // 2. Create the new translation matrix (this is also an aligned local).
@@ -1982,7 +3585,7 @@ void SceneNode::AddTranslation(const std::vector<double>& vec)
 
     // --- Store ---
     // 4. Store the aligned result back into the unaligned member variable.
-    XMStoreFloat4x4(&mLocalMtrx, localMtrx);
+    StoreLocalMtrx(localMtrx);
 }
 
 void SceneNode::AddMatrix(const std::vector<double>& vec)
@@ -2007,7 +3610,7 @@ void SceneNode::AddMatrix(const std::vector<double>& vec)
 
     // --- Load ---
     // 2. Load the unaligned member variable into an aligned local XMMATRIX.
-    XMMATRIX localMtrx = XMLoadFloat4x4(&mLocalMtrx);
+    XMMATRIX localMtrx = GetLocalMtrx();
 
     // --- Compute (Part 2: Combine) ---
     // 3. Perform the multiplication using only aligned local variables.
@@ -2015,27 +3618,33 @@ void SceneNode::AddMatrix(const std::vector<double>& vec)
 
     // --- Store ---
     // 4. Store the aligned result back into the unaligned member variable.
-    XMStoreFloat4x4(&mLocalMtrx, localMtrx);
+    StoreLocalMtrx(localMtrx);
 }
 
 bool SceneNode::LoadCube(IRenderingContext& ctx)
 {
-    ScenePrimitive cube;
-    bool ok = cube.CreateCube(ctx);
-
-    mPrimitives.push_back(std::move(cube));
-
-    return ok;
+    if (DX11Renderer *renderer = ctx.getDXRenderer())
+    {
+        MeshHandle mesh = renderer->m_meshCache.CreateCube(ctx);
+        if (!mesh)
+            return false;
+        AddSharedPrimitive(mesh);
+        return true;
+    }
+    return AddPrimitive()->CreateCube(ctx);
 }
 
 bool SceneNode::LoadSphere(IRenderingContext& ctx)
 {
-    ScenePrimitive sphere;
-    bool ok = sphere.CreateSphere(ctx);
-
-    mPrimitives.push_back(std::move(sphere));
-
-    return ok;
+    if (DX11Renderer *renderer = ctx.getDXRenderer())
+    {
+        MeshHandle mesh = renderer->m_meshCache.CreateSphere(ctx);
+        if (!mesh)
+            return false;
+        AddSharedPrimitive(mesh);
+        return true;
+    }
+    return AddPrimitive()->CreateSphere(ctx);
 }
 
 bool SceneNode::LoadFromGLTF(IRenderingContext & ctx,
@@ -2071,6 +3680,9 @@ bool SceneNode::LoadFromGLTF(IRenderingContext & ctx,
 
     const std::wstring &subItemsLogPrefix = logPrefix + L"   ";
 
+    mGltfNodeIdx = nodeIdx;
+    mGltfSkinIdx = node.skin;
+
     // Local transformation
     SetIdentity();
     if (node.matrix.size() == 16)
@@ -2125,12 +3737,32 @@ bool SceneNode::LoadFromGLTF(IRenderingContext & ctx,
         // Primitives
         const auto primitivesCount = mesh.primitives.size();
         mPrimitives.reserve(primitivesCount);
+        // Through the renderer's cache, so nodes and graphs drawing the same mesh share it
+        DX11Renderer *renderer = ctx.getDXRenderer();
         for (size_t i = 0; i < primitivesCount; ++i)
         {
-            ScenePrimitive primitive;
-            if (!primitive.LoadFromGLTF(ctx, model, mesh, (int)i, subItemsLogPrefix + L"   "))
+            if (renderer)
+            {
+                MeshHandle shared = renderer->m_meshCache.LoadFromGltf(ctx, model, meshIdx, (int)i, mGraph->GetFilePath(),
+                                                                       subItemsLogPrefix + L"   ");
+                if (!shared)
+                    return false;
+                AddSharedPrimitive(shared);
+            }
+            else if (!AddPrimitive()->LoadFromGLTF(ctx, model, mesh, (int)i, subItemsLogPrefix + L"   "))
                 return false;
-            mPrimitives.push_back(std::move(primitive));
+        }
+
+        // Default morph weights (node weights override the mesh ones)
+        size_t targetCount = 0;
+        for (const auto *primitive : mPrimitives)
+            targetCount = (std::max)(targetCount, primitive->GetMorphTargetCount());
+        if (targetCount > 0)
+        {
+            const auto &weights = !node.weights.empty() ? node.weights : mesh.weights;
+            mMorphWeights.assign(targetCount, 0.0f);
+            for (size_t i = 0; i < (std::min)(targetCount, weights.size()); ++i)
+                mMorphWeights[i] = (float)weights[i];
         }
     }
 
@@ -2138,24 +3770,14 @@ bool SceneNode::LoadFromGLTF(IRenderingContext & ctx,
 }
 
 
-void SceneNode::Animate(IRenderingContext &ctx)
+bool SceneNode::HasRigidGeometry() const
 {
-    //if (mIsRootNode)
-    //{
-    //    const float time = ctx.GetFrameAnimationTime();
-    //    const float period = 15.f; //seconds
-    //    const float totalAnimPos = time / period;
-    //    const float angle = totalAnimPos * XM_2PI;
-
-    //    const XMMATRIX rotMtrx = XMMatrixRotationY(angle);
-
-    //    mWorldMtrx = mLocalMtrx * rotMtrx;
-    //}
-    //else
-   //     mWorldMtrx = mLocalMtrx;
+    if (!mPrimitives.empty() && (mGltfSkinIdx < 0))
+        return true;
 
-    mWorldMtrx = mLocalMtrx;
+    for (const auto *child : mChildren)
+        if (child->HasRigidGeometry())
+            return true;
 
-    for (auto &child : mChildren)
-        child.Animate(ctx);
+    return false;
 }
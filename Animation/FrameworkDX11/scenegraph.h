@@ -17,34 +17,29 @@
 #include "tiny_gltf.h" // just the interfaces (no implementation)
 
 #include <string>
+#include <unordered_map>
 
 #include <DirectXMath.h>
 #include "Skeleton.h"
+#include "MorphTargets.h"
+#include "transform_hierarchy.hpp"
+#include "paged_pool.hpp"
+#include "frustum_culler.hpp"
+#include "bvh.hpp"
+#include "occlusion_culler.hpp"
+#include "render_queue.hpp"
+#include "command_stream.hpp"
+#include "instance_batcher.hpp"
+#include "material_table.hpp"
+#include "scene_vertex.hpp"
+#include "vertex_streams.hpp"
+#include "static_batcher.hpp"
+#include "geometry_pool.hpp"
+#include "mesh_cache.hpp"
 
 using namespace DirectX;
 
-struct SceneVertex
-{
-    XMFLOAT3 Pos;
-    XMFLOAT3 Normal;
-    XMFLOAT4 Tangent; // w represents handedness of the tangent basis and is either 1 or -1
-    XMFLOAT2 Tex;
-    XMUINT4  Joints;
-    XMFLOAT4 Weights;
-};
-
-struct SkinnedSceneVertex
-{
-    XMFLOAT3 Pos;
-    XMFLOAT3 Normal;
-    XMFLOAT4 Tangent; // w represents handedness of the tangent basis and is either 1 or -1
-    XMFLOAT2 Tex;
-    XMUINT4  Joints;
-    XMFLOAT4 Weights;
-};
-
-
-
+class SceneGraph;
 
 class ScenePrimitive
 {
@@ -87,10 +82,26 @@ public:
 
     bool IsTangentPresent() const { return mIsTangentPresent; }
 
+    // Local axis-aligned bounds, including the reach of the morph targets
+    const XMFLOAT3& GetBoundsMin() const { return mBoundsMin; }
+    const XMFLOAT3& GetBoundsMax() const { return mBoundsMax; }
+    void CalculateBounds();
+
     void DrawGeometry(IRenderingContext &ctx, ID3D11InputLayout *vertexLayout) const;
+    // Geometry part of a queued draw; shader, layout and constants are up to the caller
+    void FillDrawPacket(DrawPacket &packet) const;
+
+    // Blends the morph targets on the CPU and re-uploads the affected vertex range.
+    // Does nothing if the primitive has no targets or the weights did not change.
+    void ApplyMorphWeights(IRenderingContext &ctx, const float *weights, size_t weightCount);
+    bool HasMorphTargets() const { return !mMorphTargets.IsEmpty(); }
+    size_t GetMorphTargetCount() const { return mMorphTargets.GetTargetCount(); }
 
     void SetMaterialIdx(int idx) { mMaterialIdx = idx; };
     int GetMaterialIdx() const { return mMaterialIdx; };
+    // Entry of the renderer's material table, shared by every primitive with equal material data
+    void SetMaterialTableIdx(uint32_t idx) { mMaterialTableIdx = idx; };
+    uint32_t GetMaterialTableIdx() const { return mMaterialTableIdx; };
 
     void Destroy();
 
@@ -106,12 +117,29 @@ private:
                               const int primitiveIdx,
                               const std::wstring &logPrefix);
 
+    void ExtendBoundsByMorphTargets();
+
+    // Entry of the renderer's material table for the glTF material
+    void AddMaterialToTable(IRenderingContext &ctx, const tinygltf::Model &model);
+
     void FillFaceStripsCacheIfNeeded() const;
     bool CreateDeviceBuffers(IRenderingContext &ctx);
 
+    bool HasDeviceBuffers() const { return mGeometryPool || mVertexBuffer; }
+    ID3D11Buffer* GetVertexBuffer() const { return GetStreamBuffer(VertexStreams::ePositionStream); }
+    ID3D11Buffer* GetAttributeBuffer() const { return GetStreamBuffer(VertexStreams::eAttributeStream); }
+    ID3D11Buffer* GetSkinBuffer() const { return GetStreamBuffer(VertexStreams::eSkinStream); }
+    ID3D11Buffer* GetStreamBuffer(VertexStreams::Stream stream) const;
+    ID3D11Buffer* GetIndexBuffer() const { return mGeometryPool ? mGeometryPool->GetIndexBuffer(mGeometry) : mIndexBuffer; }
+    INT GetBaseVertex() const { return mGeometryPool ? mGeometryPool->GetBaseVertex(mGeometry) : 0; }
+    UINT GetStartIndex() const { return mGeometryPool ? mGeometryPool->GetStartIndex(mGeometry) : 0; }
+
     void DestroyGeomData();
     void DestroyDeviceBuffers();
 
+    // Loads shared primitives through the private loading steps
+    friend class MeshCache;
+
 public:
 
     // Geometry data
@@ -119,6 +147,8 @@ public:
     std::vector<uint32_t>       mIndices;
     D3D11_PRIMITIVE_TOPOLOGY    mTopology = D3D_PRIMITIVE_TOPOLOGY_UNDEFINED;
     bool                        mIsTangentPresent = false;
+    XMFLOAT3                    mBoundsMin = XMFLOAT3(0.0f, 0.0f, 0.0f);
+    XMFLOAT3                    mBoundsMax = XMFLOAT3(0.0f, 0.0f, 0.0f);
 
     // Cached geometry data
     struct FaceStrip
@@ -130,19 +160,37 @@ public:
     mutable std::vector<FaceStrip>  mFaceStrips;
     mutable size_t                  mFaceStripsTotalCount = 0;
 
-    // Device geometry data
-    ID3D11Buffer*               mVertexBuffer = nullptr;
+    // Device geometry data, split into VertexStreams (no skin stream for static meshes): a
+    // range of one of the renderer's geometry pools, or buffers of its own if the pool is
+    // not available
+    GeometryPool*               mGeometryPool = nullptr;
+    GeometryPool::Handle        mGeometry = GeometryPool::InvalidHandle;
+    ID3D11Buffer*               mVertexBuffer = nullptr;        // positions
+    ID3D11Buffer*               mAttributeBuffer = nullptr;
+    ID3D11Buffer*               mSkinBuffer = nullptr;
     ID3D11Buffer*               mIndexBuffer = nullptr;
 
     // Material
-    int                         mMaterialIdx = -1;
+    int                         mMaterialIdx = -1;          // glTF index, within the file
+    uint32_t                    mMaterialTableIdx = MaterialTable::DefaultMaterial;
+
+    // Morph targets
+    MorphTargetSet              mMorphTargets;
+    std::vector<SceneVertex>    mMorphedVertices;   // staging copy of the affected vertex range
+    std::vector<uint8_t>        mMorphedStream;     // one stream of it, as uploaded
+    std::vector<float>          mAppliedMorphWeights;
+    bool                        mIsMorphed = false; // device buffer differs from mVertices
 };
 
 
+// Nodes live in their SceneGraph's node pool and are created through it (CreateRootNode,
+// CreateChildNode), so pointers to them stay valid until the node is destroyed.
 class SceneNode
 {
 public:
-    SceneNode(bool useDebugAnimation = false);
+    SceneNode(SceneGraph *graph, bool isRootNode);
+    SceneNode(const SceneNode &) = delete;
+    SceneNode& operator = (const SceneNode &) = delete;
 
     ScenePrimitive* CreateEmptyPrimitive();
 
@@ -166,30 +214,72 @@ public:
                       int nodeIdx,
                       const std::wstring &logPrefix);
 
-    void Animate(IRenderingContext &ctx);
-
-    XMMATRIX GetWorldMtrx() const
-    {
-        // Load the unaligned member into an aligned local XMMATRIX
-        return XMLoadFloat4x4(&mWorldMtrx);
-    }
+    // Local matrix composed with the parents', as of the last SceneGraph::AnimateFrame()
+    XMMATRIX GetWorldMtrx() const;
     Skeleton* GetSkeleton() {
         return &m_skeleton;
     }
 
     SceneNode* CreateChildNode();
-    SceneNode* GetChildNode(const unsigned int i) { return &mChildren[i]; }
+    SceneNode* GetChildNode(const unsigned int i) { return mChildren[i]; }
+    unsigned int GetChildCount() const { return (unsigned int)mChildren.size(); }
+    SceneNode* GetParent() const { return mParent; }
+
+    // Index used to match animation channels (the glTF node index for loaded nodes)
+    void SetNodeIdx(int idx) { mGltfNodeIdx = idx; }
+    int GetNodeIdx() const { return mGltfNodeIdx; }
+
+    XMMATRIX GetLocalMtrx() const;
+
+    // Occluders are rasterised into the CPU depth buffer the other primitives are tested
+    // against (see SceneGraph::AddOccluders). Skinned and morphed geometry is never used.
+    void SetOccluder(bool isOccluder) { mIsOccluder = isOccluder; }
+    bool IsOccluder() const { return mIsOccluder; }
 
 private:
+    void StoreLocalMtrx(FXMMATRIX matrix);
+    bool IsAttached() const { return mTransforms != nullptr; }
+
+    // True if this subtree draws anything that isn't skinned (i.e. moves with the node transforms)
+    bool HasRigidGeometry() const;
+
+    // Takes a new primitive from the graph's pool and appends it
+    ScenePrimitive* AddPrimitive();
+    // Appends a primitive of the renderer's mesh cache, held until the node lets it go
+    void AddSharedPrimitive(const MeshHandle &mesh);
+    // Back to the graph's pool, or just dropped if it is shared
+    void ReleasePrimitive(ScenePrimitive *primitive);
+
     friend class SceneGraph;
-    std::vector<ScenePrimitive> mPrimitives;
-    std::vector<SceneNode>      mChildren;
-    Skeleton                    m_skeleton;
+    SceneGraph*                     mGraph;
+    SceneNode*                      mParent = nullptr;
+    std::vector<ScenePrimitive*>    mPrimitives;    // owned, from the graph's primitive pool, or shared
+    std::vector<ScenePrimitive*>    mBatchedPrimitives; // as above, drawn by the graph's static batches
+    uint32_t                        mBatchedIdx = UINT32_MAX;   // into the graph's mBatchedNodes
+    bool                            mIsDynamic = false; // moved while batched, kept out of later batches
+    std::vector<MeshHandle>         mSharedPrimitives;  // keeps the shared ones of the lists above alive
+    std::vector<SceneNode*>         mChildren;      // owned, from the graph's node pool
+    Skeleton                        m_skeleton;
+
+    int                         mGltfNodeIdx = -1;
+    int                         mGltfSkinIdx = -1;
+    std::vector<float>          mMorphWeights; // node.weights or mesh.weights, one per target
+    int                         mMorphChannel = -1; // WEIGHTS channel of the graph's playing node animation
 
 private:
     bool        mIsRootNode;
-    XMFLOAT4X4   mLocalMtrx; // <-- Changed from XMMATRIX
-    XMFLOAT4X4   mWorldMtrx; // <-- Changed from XMMATRIX
+    bool        mIsOccluder = false;
+
+    // Once the node is part of a SceneGraph its transform lives in the graph's hierarchy,
+    // until then (while it is being built) in mLocalMtrx.
+    TransformHierarchy*         mTransforms = nullptr;
+    TransformHierarchy::Index   mTransformIdx = TransformHierarchy::InvalidIndex;
+    uint32_t                    mFirstDrawable = 0; // of mPrimitives in the graph's bounds arrays
+    uint32_t                    mDrawableCount = 0; // primitives that have one, the first ones
+    uint32_t                    mPendingIdx = UINT32_MAX;   // into the graph's mPendingDrawableNodes
+    uint32_t                    mSiblingIdx = 0;    // in the parent's mChildren, or the graph's mRootNodes
+    uint32_t                    mAnimatedIdx = UINT32_MAX;  // into the graph's mAnimatedNodes
+    XMFLOAT4X4                  mLocalMtrx;
 };
 
 class SceneGraph : public IScene
@@ -211,9 +301,17 @@ public:
     virtual void Destroy() override;
     virtual void RenderFrame(IRenderingContext &ctx, const float deltaTime) override;
 
+    // Draws the graph once per root matrix. Primitives drawn by several instances with the same
+    // material go out as one instanced draw. Without the instanced shader every instance gets
+    // its own RenderFrame(). The instances share the graph's animation state.
+    void RenderInstances(IRenderingContext &ctx, const XMMATRIX *rootMatrices, size_t instanceCount,
+                         const float deltaTime);
+
     bool LoadSphere(IRenderingContext& ctx);
     bool LoadGLTF(IRenderingContext& ctx, const std::wstring& filePath);
     bool LoadGLTFWithSkeleton(IRenderingContext& ctx, const std::wstring& filePath);
+    // Of the last loaded glTF, empty for graphs built in code
+    const std::wstring& GetFilePath() const { return mFilePath; }
 
     // Transformations
     void AddScaleToRoots(double scale);
@@ -229,7 +327,95 @@ public:
 
     void AnimateFrame(IRenderingContext& ctx);
     SceneNode* CreateRootNode();
-    SceneNode* GetRootNode(unsigned int i) { return &mRootNodes[i]; }
+
+    // Node lifetime. Nodes are pooled: creating, destroying and reparenting never copies or
+    // moves a node, and pointers stay valid until the node itself is destroyed. Handles
+    // additionally detect that: GetNode() returns nullptr once the node is gone. All three
+    // patch the flattened transforms in place and take constant time (amortised: unused
+    // entries are compacted by a full rebuild now and then). Siblings are not kept in order.
+    typedef PoolHandle NodeHandle;
+    NodeHandle GetHandle(const SceneNode *node) const { return mNodePool.GetHandle(node); }
+    SceneNode* GetNode(NodeHandle handle) const { return mNodePool.Get(handle); }
+    SceneNode* CreateNode(SceneNode *parent); // nullptr parent creates a root
+    void DestroyNode(SceneNode *node);        // with its whole subtree
+    // Keeps the local matrix, so the node's world transform follows its new parent.
+    // Fails if newParent is the node or one of its descendants.
+    bool Reparent(SceneNode *node, SceneNode *newParent);
+    size_t GetNodeCount() const { return mNodePool.Size(); }
+    ScenePrimitive* CreatePrimitive() { return mPrimitivePool.Create(); }
+    void DestroyPrimitive(ScenePrimitive *primitive) { mPrimitivePool.Destroy(primitive); }
+
+    // Node (non-joint) animation. Channels are matched to nodes by SceneNode::GetNodeIdx().
+    // The rest pose of the animated nodes is captured the first time a clip is played.
+    unsigned int AddNodeAnimation(const ClipHandle& anim);
+    unsigned int GetNodeAnimationCount() const { return (unsigned int)mNodeAnimations.size(); }
+    bool PlayNodeAnimation(unsigned int animation);
+
+    // Fixed-step animation: TickAnimation() advances every skeleton and the node animation by
+    // one step, InterpolateAnimation() poses them between the last two ticks for rendering.
+    void TickAnimation(float stepTime);
+    void InterpolateAnimation(float alpha);
+    // Frustum culling of the primitives against the camera, on by default
+    void SetCullingEnabled(bool enabled) { mCullingEnabled = enabled; }
+
+    // Software occlusion culling. AddOccluders() draws the occluder nodes, as of the current
+    // transforms, into the culler; with SetOcclusionCuller() the frustum culled primitives are
+    // also tested against its depth buffer, whenever it holds a finished frame.
+    void AddOccluders(OcclusionCuller &culler);
+    void SetOcclusionCuller(const OcclusionCuller *culler) { mOcclusionCuller = culler; }
+
+    // Depth-only draws of the opaque primitives ahead of the forward pass, binding the
+    // position stream alone (and the skin of skinned meshes); off by default
+    void SetDepthPrepass(bool enabled) { mDepthPrepass = enabled; }
+
+    // Merges the primitives of every node that doesn't move (no skin, morph targets or
+    // playing node animation on it or above it) into static batches, pre-transformed with the
+    // current world matrices. Those primitives leave their nodes and are drawn by the batches,
+    // culled one by one but issued as merged index ranges. A batched node that is moved (or
+    // whose ancestor is), reparented or destroyed marks the batches dirty: the next
+    // RenderFrame() bakes them again, and moved nodes draw on their own from then on.
+    // RenderInstances() does not draw the batches. Calling it again rebuilds them.
+    bool BuildStaticBatches(IRenderingContext &ctx);
+    const StaticBatcher& GetStaticBatcher() const { return mStaticBatcher; }
+
+    // World bounds of every primitive, one per drawable, as of the last transform update
+    const BoundsSoA& GetWorldBounds() const { return mWorldBounds; }
+
+    // Hierarchy over the bounded drawables, for overlap and ray queries; instance i is
+    // drawable GetBvhDrawables()[i]. Skinned drawables have no bounds and are not in it. Only
+    // kept up to date in graphs with at least BvhCullThreshold drawables.
+    const InstanceBvh& GetBvh() const { return mBvh; }
+    const std::vector<uint32_t>& GetBvhDrawables() const { return mBvhDrawables; }
+
+    SceneNode* GetRootNode(unsigned int i) { return mRootNodes[i]; }
+    unsigned int GetRootNodeCount() const { return (unsigned int)mRootNodes.size(); }
+
+    // Per-frame counters, accumulated until ResetStats()
+    struct FrameStats
+    {
+        size_t transformsUpdated = 0;   // world matrices recomputed
+        size_t cbUploads = 0;           // per-node constants written
+        size_t cbSkipped = 0;           // nodes drawn with the constants they already had
+        size_t cbBytes = 0;             // object and skin constants uploaded
+        size_t cbBytesMonolithic = 0;   // the same uploads with the single, all-in-one buffer
+        size_t primitivesVisible = 0;
+        size_t primitivesCulled = 0;    // outside the view frustum
+        size_t primitivesOccluded = 0;  // inside, but hidden behind the occluders
+        size_t drawCalls = 0;
+        size_t stateChanges = 0;        // bindings issued by the render queue
+        size_t stateChangesSaved = 0;   // against binding everything for every draw
+        size_t instances = 0;           // graph instances drawn by RenderInstances()
+        size_t instancedDraws = 0;      // draw calls they took
+        size_t parallelChunks = 0;      // command streams recorded in parallel, 0 if serial
+        size_t staticDraws = 0;         // draw calls of the static batches
+        size_t staticPrimitives = 0;    // batched primitives they drew
+        size_t depthDraws = 0;          // of drawCalls, in the depth prepass
+    };
+    const FrameStats& GetStats() const { return mStats; }
+
+    // Commands of the last RenderFrame(), for capture and replay
+    const CommandStream& GetLastCommands() const { return mCommands; }
+    void ResetStats() { mStats = FrameStats(); }
 
 
 private:
@@ -253,6 +439,38 @@ private:
                            const tinygltf::Model &model,
                            const std::wstring &logPrefix);
 
+    // Gives every node skinned by skin 1..N its own skeleton (skin 0 lives on the roots)
+    void LoadAdditionalSkins(SceneNode &sceneNode,
+                             const tinygltf::Model &model,
+                             const std::wstring &logPrefix);
+
+    void LoadNodeAnimations(const tinygltf::Model &model, const std::wstring &logPrefix);
+    void CollectNodes(SceneNode &node);
+
+    void TickSkeletons(SceneNode &node, float stepTime);
+    void BuildPalettes(SceneNode &node, float alpha);
+    void TickNodeAnimation(float stepTime);
+    void InterpolateNodeAnimation(float alpha);
+    // Fills mMorphWeightsScratch with the node's weights, from its skeleton's clip or the node animation
+    void SampleMorphWeights(const SceneNode &node, const Skeleton *skeleton);
+
+    // Releases every node and primitive, and whatever refers to them
+    void DestroyNodes();
+    void FreeSubtree(SceneNode *node);
+    void DetachNode(SceneNode *node);
+    // Appends the node's transform behind its parent's, with no drawables yet
+    void AttachNode(SceneNode &node);
+    // Appends the subtree's transforms again, behind 'parent', leaving the old ones unused
+    void ReattachSubtree(SceneNode &node, TransformHierarchy::Index parent);
+    // Requests a rebuild once too many hierarchy entries are unused
+    void CompactTransforms();
+
+    // Called by the node when it gets a primitive: its drawable is added by the next update,
+    // once the primitive is loaded
+    friend class SceneNode;
+    void QueueDrawables(SceneNode &node);
+    void AttachPendingDrawables();
+
     bool LoadSceneNodeFromGLTF(IRenderingContext &ctx,
                                SceneNode &sceneNode,
                                const tinygltf::Model &model,
@@ -260,10 +478,48 @@ private:
                                const std::wstring &logPrefix);
 
 
+    // Queues the visible primitives of the subtree; RenderFrame() sorts and submits them
     void RenderNode(IRenderingContext &ctx,
                     SceneNode &node,
-                    const XMMATRIX &parentWorldMtrx,
-                    const float deltaTime);
+                    const float deltaTime,
+                    const Skeleton *skeleton = nullptr);
+    // View depth of the primitive mapped to [0, 1] for the sort key
+    float GetSortDepth(const SceneNode &node, size_t primitiveIdx) const;
+    float GetSortDepth(FXMVECTOR worldPosition) const;
+    // Queues the packet's forward draw with the vertex shader and layout of its mesh type,
+    // plus its depth-only draw if the depth prepass is on
+    void QueueDraw(IRenderingContext &ctx, DrawPacket &packet, float sortDepth);
+    // Adds the visible primitives of the subtree to mInstanceBatcher
+    void BatchNode(IRenderingContext &ctx,
+                   SceneNode &node,
+                   bool applyMorphWeights,
+                   const Skeleton *skeleton = nullptr);
+
+    // Moves the transforms of every node into mTransforms, parents first
+    void RebuildTransforms();
+    void AttachTransforms(SceneNode &node, TransformHierarchy &target, TransformHierarchy::Index parent);
+    void AddDrawable(const SceneNode &node, const ScenePrimitive &primitive);
+    void UpdateTransforms();
+    void UpdateWorldBounds();
+    void UpdateBvh(bool rebuild);
+    void CullPrimitives(IRenderingContext &ctx);
+
+    // Returns the subtree's batched primitives to their nodes, then adds those that can be
+    // batched to mStaticBatcher and lists them in 'batched'
+    void CollectStaticPrimitives(SceneNode &node, const std::vector<bool> &isAnimated, bool isMoving,
+                                 std::vector<std::pair<SceneNode*, ScenePrimitive*>> &batched);
+    // Culls the batches' subranges and queues the visible ones as merged draws
+    void CullStaticBatches(IRenderingContext &ctx);
+    // Marks the batches dirty if a batched node's world matrix is not the baked one
+    void CheckStaticBatches();
+    void QueueStaticBatches(IRenderingContext &ctx);
+    void AddNodeOccluders(const SceneNode &node, OcclusionCuller &culler);
+
+    // The node's world matrix, from the renderer's constant ring, or else written into the
+    // node's own buffer unless the node did not move. A null buffer on failure.
+    ConstantRange UpdateObjectConstants(IRenderingContext &ctx, const SceneNode &node, const Skeleton *skeleton);
+    // The skeleton's palette, written once per frame and palette version
+    ConstantRange UpdateSkinConstants(IRenderingContext &ctx, const Skeleton &skeleton);
 
     
 
@@ -272,9 +528,130 @@ private:
 
     
     SceneId               mSceneId;
+    std::wstring          mFilePath; // of the last loaded glTF, keys shared resources
 
     // Geometry
-    std::vector<SceneNode>      mRootNodes;
+    PagedPool<SceneNode, 64>        mNodePool;
+    PagedPool<ScenePrimitive, 256>  mPrimitivePool;
+    std::vector<SceneNode*>     mRootNodes;
+    TransformHierarchy          mTransforms;
+
+    // Per-node object constants, indexed like mTransforms. Each remembers the versions of
+    // the data it was last written with; without the constant ring the node's own buffer is
+    // only re-uploaded when the world matrix it holds is out of date.
+    struct NodeConstants
+    {
+        ID3D11Buffer*   buffer = nullptr;   // only without the ring
+        uint32_t        bufferVersion = UINT32_MAX;     // world version in 'buffer'
+        uint32_t        worldVersion = UINT32_MAX;      // last written, ring or buffer
+        const Skeleton* skeleton = nullptr;
+        uint64_t        paletteVersion = UINT64_MAX;
+    };
+    std::vector<NodeConstants>  mObjectCbs;
+
+    // Skin constants per skeleton, in the ring (valid for one ring frame) or in a buffer of their own
+    struct SkinConstantsCache
+    {
+        ConstantRange   ringRange;
+        uint64_t        ringFrame = UINT64_MAX;
+        uint64_t        ringVersion = UINT64_MAX;
+        ID3D11Buffer*   buffer = nullptr;
+        uint64_t        bufferVersion = UINT64_MAX;
+    };
+    std::unordered_map<const Skeleton*, SkinConstantsCache> mSkinCbs;
+
+    // Every primitive in transform order, with its bounds. Skinned primitives are unbounded:
+    // their bind pose box says nothing about where the skeleton moves the vertices.
+    struct Drawable
+    {
+        TransformHierarchy::Index   transformIdx;
+        uint32_t                    worldVersion;   // of the transform mWorldBounds was built from
+        bool                        bounded;
+        uint32_t                    bvhInstance;    // UINT32_MAX if unbounded
+        XMFLOAT3                    center;         // local
+        XMFLOAT3                    extents;
+    };
+    std::vector<Drawable>       mDrawables;
+    std::vector<SceneNode*>     mPendingDrawableNodes;  // attached, with primitives not in mDrawables yet
+    std::vector<uint32_t>       mFreedDrawables;    // of destroyed nodes, until the next rebuild
+    size_t                      mFreedTransforms = 0;   // hierarchy entries no node uses any more
+    BoundsSoA                   mWorldBounds;
+    std::vector<FrustumCuller::ViewMask> mVisibility;
+
+    // Scenes with many primitives are culled through the BVH instead of box by box. Its
+    // boxes would be infinite for unbounded drawables, those are always visible instead.
+    static const size_t         BvhCullThreshold = 256;
+    InstanceBvh                 mBvh;
+    std::vector<uint32_t>       mBvhDrawables;      // per BVH instance
+    std::vector<uint32_t>       mUnboundedDrawables;
+    std::vector<uint32_t>       mBvhChanged;        // BVH instances moved since the last refit
+    std::vector<uint32_t>       mBvhQueryScratch;
+    unsigned int                mBvhRefits = 0;
+    bool                        mCullingEnabled = true;
+
+    // Static geometry, drawn with an identity world matrix
+    StaticBatcher               mStaticBatcher;
+    // Nodes with primitives in the batches and the world matrix they were baked with; a
+    // null node was destroyed. Checked whenever their world version changes.
+    struct BatchedNode
+    {
+        SceneNode*                  node;
+        XMFLOAT4X4                  world;
+        uint32_t                    worldVersion;
+    };
+    std::vector<BatchedNode>    mBatchedNodes;
+    bool                        mStaticBatchesDirty = false;
+    std::vector<FrustumCuller::ViewMask> mStaticVisibility;  // per subrange
+    std::vector<StaticBatcher::DrawRange> mStaticRanges;
+    ID3D11Buffer*               mStaticObjectCb = nullptr;
+    const OcclusionCuller*      mOcclusionCuller = nullptr;
+    bool                        mDepthPrepass = false;
+    FrameStats                  mStats;
+
+    // Draws of the current RenderFrame(), recorded into mCommands and run by the context's
+    // command executor
+    RenderQueue                 mRenderQueue;
+    CommandStream               mCommands;
+    // Frames with at least ParallelSubmitThreshold draws record them in chunks on the
+    // context's thread pool, mCommands then only holds the constant uploads
+    static const size_t         ParallelSubmitThreshold = 2048;
+    std::vector<CommandStream>  mChunkCommands;
+    XMFLOAT4X4                  mSortView = {};
+    float                       mSortDepthScale = 0.0f;
+    std::vector<float>          mMorphWeightsScratch;
+    std::vector<float>          mMorphWeightsBlend; // second sample the scratch weights are blended with
+
+    // RenderInstances(), the world matrices and palettes travel in the instance data
+    InstanceBatcher             mInstanceBatcher;
+    D3D11InstanceBackend        mInstanceBackend;
+    std::vector<XMMATRIX>       mPaletteScratch;
+
+    // Node animation
+    struct NodePose
+    {
+        XMFLOAT3 scale;
+        XMFLOAT4 rotation;
+        XMFLOAT3 translation;
+    };
+    struct AnimatedNode
+    {
+        SceneNode*  node;
+        int         nodeIdx;
+        size_t      firstChannel;   // into mAnimatedChannels
+        size_t      channelCount;
+        NodePose    poses[2];       // last two ticks, poses[mCurrentNodePose] is the latest
+    };
+    std::vector<ClipHandle>     mNodeAnimations;
+    int                         mCurrentNodeAnimation = -1;
+    float                       mNodeAnimationTime = 0.0f;
+    float                       mPrevNodeAnimationTime = 0.0f;  // the tick before, for the morph weights
+    float                       mNodeAnimationAlpha = 1.0f;
+    bool                        mHasMorphChannels = false;      // the clip animates morph weights
+    int                         mCurrentNodePose = 0;
+    std::vector<SceneNode*>     mNodesByIdx;        // filled on first play
+    std::vector<NodePose>       mNodeRestPoses;
+    std::vector<AnimatedNode>   mAnimatedNodes;     // only nodes the current clip touches
+    std::vector<int>            mAnimatedChannels;  // channel indices, grouped per node
 
     // Shaders
     ID3D11VertexShader*         mVertexShader = nullptr;
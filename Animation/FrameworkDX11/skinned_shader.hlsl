@@ -1,14 +1,26 @@
 //--------------------------------------------------------------------------------------
 // Constant Buffer Variables
 //--------------------------------------------------------------------------------------
-cbuffer ConstantBuffer : register( b0 )
+// Split by update frequency, the slots match structures.h
+cbuffer ObjectConstants : register( b0 )
 {
 	matrix World;
+}
+
+cbuffer FrameConstants : register( b3 )
+{
+	float4 vOutputColor;
+}
+
+cbuffer ViewConstants : register( b4 )
+{
 	matrix View;
 	matrix Projection;
-	float4 vOutputColor;
+}
+
+cbuffer SkinConstants : register( b5 )
+{
     float4x4 g_boneTransforms[100]; // Must match max_bones on CPU
-    unsigned int bone_count;
 }
 
 Texture2D albedoMap : register(t0);
@@ -89,6 +101,15 @@ struct VS_INPUT
     float4 Weights : BLENDWEIGHT0;
 };
 
+// Static meshes have no skin stream
+struct VS_STATIC_INPUT
+{
+    float4 Pos : POSITION;
+    float3 Norm : NORMAL;
+    float4 Tangent : TANGENT;
+    float2 Tex : TEXCOORD0;
+};
+
 struct PS_INPUT
 {
     float4 Pos : SV_POSITION;
@@ -186,6 +207,23 @@ PS_INPUT VS( VS_INPUT input )
     return output;
 }
 
+PS_INPUT VS_Static( VS_STATIC_INPUT input )
+{
+    PS_INPUT output = (PS_INPUT) 0;
+
+    output.Pos = mul(float4(input.Pos.xyz, 1.0f), World);
+    output.worldPos = output.Pos;
+    output.Pos = mul(output.Pos, View);
+    output.Pos = mul(output.Pos, Projection);
+
+    output.Norm = mul(input.Norm, (float3x3) World);
+    output.Norm = normalize(output.Norm);
+
+    output.Tex = input.Tex;
+
+    return output;
+}
+
 //--------------------------------------------------------------------------------------
 // Pixel Shader
 //--------------------------------------------------------------------------------------
@@ -0,0 +1,219 @@
+#include "state_cache.hpp"
+#include "log.hpp"
+#include "utils.hpp"
+
+#include <fstream>
+
+const char* StateCache::BindingToString(Binding binding)
+{
+    switch (binding)
+    {
+    case eVertexShader: return "VertexShader";
+    case ePixelShader:  return "PixelShader";
+    case eInputLayout:  return "InputLayout";
+    case eTopology:     return "Topology";
+    case eVertexBuffer: return "VertexBuffer";
+    case eIndexBuffer:  return "IndexBuffer";
+    case eVSConstants:  return "VSConstants";
+    case ePSConstants:  return "PSConstants";
+    case eVSResource:   return "VSResource";
+    case ePSResource:   return "PSResource";
+    case ePSSampler:    return "PSSampler";
+    default:            return "Unknown";
+    }
+}
+
+bool StateCache::Init(ID3D11DeviceContext *context)
+{
+    Destroy();
+
+    if (!context)
+    {
+        Log::Error(L"StateCache: No device context");
+        return false;
+    }
+
+    mContext = context;
+    if (FAILED(context->QueryInterface(__uuidof(ID3D11DeviceContext1), (void**)&mContext1)))
+        mContext1 = nullptr;
+    return true;
+}
+
+void StateCache::Destroy()
+{
+    Utils::ReleaseAndMakeNull(mContext1);
+    mContext = nullptr;
+    mRangeErrorLogged = false;
+    Invalidate();
+}
+
+void StateCache::Invalidate()
+{
+    mVertexShader.isKnown = false;
+    mPixelShader.isKnown = false;
+    mInputLayout.isKnown = false;
+    mTopology.isKnown = false;
+    mIndexBuffer.isKnown = false;
+    for (auto &shadow : mVertexBuffers)
+        shadow.isKnown = false;
+    for (auto &shadow : mVSConstants)
+        shadow.isKnown = false;
+    for (auto &shadow : mPSConstants)
+        shadow.isKnown = false;
+    for (auto &shadow : mVSResources)
+        shadow.isKnown = false;
+    for (auto &shadow : mPSResources)
+        shadow.isKnown = false;
+    for (auto &shadow : mPSSamplers)
+        shadow.isKnown = false;
+}
+
+void StateCache::BeginFrame()
+{
+    mLastFrameStats = mStats;
+    mStats = Stats();
+    Invalidate();
+}
+
+template <typename T>
+bool StateCache::IsBound(Shadow<T> &shadow, const T &value, Binding binding)
+{
+    if (shadow.isKnown && (shadow.value == value))
+    {
+        mStats.filtered[binding]++;
+        mStats.totalFiltered++;
+        return true;
+    }
+
+    shadow.value = value;
+    shadow.isKnown = true;
+    mStats.issued[binding]++;
+    mStats.totalIssued++;
+    return false;
+}
+
+template <typename T, size_t N>
+bool StateCache::IsBound(Shadow<T> (&shadows)[N], UINT slot, const T &value, Binding binding)
+{
+    if (slot < N)
+        return IsBound(shadows[slot], value, binding);
+
+    mStats.issued[binding]++;
+    mStats.totalIssued++;
+    return false;
+}
+
+void StateCache::VSSetShader(ID3D11VertexShader *shader)
+{
+    if (!IsBound(mVertexShader, shader, eVertexShader))
+        mContext->VSSetShader(shader, nullptr, 0);
+}
+
+void StateCache::PSSetShader(ID3D11PixelShader *shader)
+{
+    if (!IsBound(mPixelShader, shader, ePixelShader))
+        mContext->PSSetShader(shader, nullptr, 0);
+}
+
+void StateCache::IASetInputLayout(ID3D11InputLayout *layout)
+{
+    if (!IsBound(mInputLayout, layout, eInputLayout))
+        mContext->IASetInputLayout(layout);
+}
+
+void StateCache::IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY topology)
+{
+    if (!IsBound(mTopology, topology, eTopology))
+        mContext->IASetPrimitiveTopology(topology);
+}
+
+void StateCache::IASetVertexBuffer(UINT slot, ID3D11Buffer *buffer, UINT stride, UINT offset)
+{
+    if (!IsBound(mVertexBuffers, slot, VertexBufferBinding{ buffer, stride, offset }, eVertexBuffer))
+        mContext->IASetVertexBuffers(slot, 1, &buffer, &stride, &offset);
+}
+
+void StateCache::IASetIndexBuffer(ID3D11Buffer *buffer, DXGI_FORMAT format, UINT offset)
+{
+    if (!IsBound(mIndexBuffer, IndexBufferBinding{ buffer, format, offset }, eIndexBuffer))
+        mContext->IASetIndexBuffer(buffer, format, offset);
+}
+
+void StateCache::VSSetConstantBuffer(UINT slot, ID3D11Buffer *buffer)
+{
+    ConstantRange range;
+    range.buffer = buffer;
+    if (!IsBound(mVSConstants, slot, range, eVSConstants))
+        mContext->VSSetConstantBuffers(slot, 1, &buffer);
+}
+
+void StateCache::PSSetConstantBuffer(UINT slot, ID3D11Buffer *buffer)
+{
+    if (!IsBound(mPSConstants, slot, buffer, ePSConstants))
+        mContext->PSSetConstantBuffers(slot, 1, &buffer);
+}
+
+void StateCache::VSSetConstantRange(UINT slot, const ConstantRange &range)
+{
+    if (range.numConstants == 0)
+    {
+        VSSetConstantBuffer(slot, range.buffer);
+        return;
+    }
+
+    if (!mContext1)
+    {
+        if (!mRangeErrorLogged)
+            Log::Error(L"StateCache: Constant buffer range without ID3D11DeviceContext1");
+        mRangeErrorLogged = true;
+        return;
+    }
+
+    if (!IsBound(mVSConstants, slot, range, eVSConstants))
+        mContext1->VSSetConstantBuffers1(slot, 1, &range.buffer, &range.firstConstant, &range.numConstants);
+}
+
+void StateCache::VSSetShaderResource(UINT slot, ID3D11ShaderResourceView *view)
+{
+    if (!IsBound(mVSResources, slot, view, eVSResource))
+        mContext->VSSetShaderResources(slot, 1, &view);
+}
+
+void StateCache::PSSetShaderResource(UINT slot, ID3D11ShaderResourceView *view)
+{
+    if (!IsBound(mPSResources, slot, view, ePSResource))
+        mContext->PSSetShaderResources(slot, 1, &view);
+}
+
+void StateCache::PSSetSampler(UINT slot, ID3D11SamplerState *sampler)
+{
+    if (!IsBound(mPSSamplers, slot, sampler, ePSSampler))
+        mContext->PSSetSamplers(slot, 1, &sampler);
+}
+
+bool StateCache::DumpStats(const std::wstring &path) const
+{
+    std::ofstream file(Utils::WstringToString(path));
+    if (!file)
+    {
+        Log::Error(L"StateCache: Failed to open \"%s\" for writing", path.c_str());
+        return false;
+    }
+
+    const Stats &stats = mLastFrameStats;
+    file << "{\n  \"issued\": " << stats.totalIssued << ",\n  \"filtered\": " << stats.totalFiltered
+         << ",\n  \"bindings\": {\n";
+    for (int b = 0; b < eBindingCount; ++b)
+    {
+        file << "    \"" << BindingToString((Binding)b) << "\": { \"issued\": " << stats.issued[b]
+             << ", \"filtered\": " << stats.filtered[b] << " }" << ((b + 1 < eBindingCount) ? "," : "") << "\n";
+    }
+    file << "  }\n}\n";
+
+    if (!file)
+    {
+        Log::Error(L"StateCache: Failed to write \"%s\"", path.c_str());
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,146 @@
+#pragma once
+
+#include "constant_ring.hpp"
+
+// We are using an older version of DirectX headers which causes
+// "warning C4005: '...' : macro redefinition"
+#pragma warning(push)
+#pragma warning(disable: 4005)
+#include <d3d11_1.h>
+#pragma warning(pop)
+
+#include <string>
+#include <cstddef>
+
+// Shadows what is bound on one device context and drops calls that would bind it again.
+// Only sees calls made through it: after anything else touches the context, Invalidate()
+// makes the next call of every binding go through.
+class StateCache
+{
+public:
+
+    enum Binding
+    {
+        eVertexShader = 0,
+        ePixelShader,
+        eInputLayout,
+        eTopology,
+        eVertexBuffer,
+        eIndexBuffer,
+        eVSConstants,
+        ePSConstants,
+        eVSResource,
+        ePSResource,
+        ePSSampler,
+
+        eBindingCount
+    };
+    static const char* BindingToString(Binding binding);
+
+    struct Stats
+    {
+        size_t issued[eBindingCount] = {};
+        size_t filtered[eBindingCount] = {};
+        size_t totalIssued = 0;
+        size_t totalFiltered = 0;
+    };
+
+    // Slots above these are passed through unfiltered
+    static const UINT MaxVertexBuffers = 5;
+    static const UINT MaxConstantBuffers = 8;
+    static const UINT MaxResources = 8;
+    static const UINT MaxSamplers = 4;
+
+    ~StateCache() { Destroy(); }
+
+    bool Init(ID3D11DeviceContext *context);
+    void Destroy();
+    bool IsValid() const { return mContext != nullptr; }
+
+    ID3D11DeviceContext* GetContext() const { return mContext; }
+
+    // Forgets the shadowed state, every binding is issued again
+    void Invalidate();
+    // Keeps the stats of the frame that ended and invalidates, since the UI and Present()
+    // change the state between frames
+    void BeginFrame();
+
+    void VSSetShader(ID3D11VertexShader *shader);
+    void PSSetShader(ID3D11PixelShader *shader);
+    void IASetInputLayout(ID3D11InputLayout *layout);
+    void IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY topology);
+    void IASetVertexBuffer(UINT slot, ID3D11Buffer *buffer, UINT stride, UINT offset = 0);
+    void IASetIndexBuffer(ID3D11Buffer *buffer, DXGI_FORMAT format, UINT offset = 0);
+    void VSSetConstantBuffer(UINT slot, ID3D11Buffer *buffer);
+    void PSSetConstantBuffer(UINT slot, ID3D11Buffer *buffer);
+    // Needs ID3D11DeviceContext1, a range that can't be bound is dropped with an error
+    void VSSetConstantRange(UINT slot, const ConstantRange &range);
+    void VSSetShaderResource(UINT slot, ID3D11ShaderResourceView *view);
+    void PSSetShaderResource(UINT slot, ID3D11ShaderResourceView *view);
+    void PSSetSampler(UINT slot, ID3D11SamplerState *sampler);
+
+    // The frame in progress and the last complete one
+    const Stats& GetStats() const { return mStats; }
+    const Stats& GetLastFrameStats() const { return mLastFrameStats; }
+
+    // Last frame's counters per binding, as JSON
+    bool DumpStats(const std::wstring &path) const;
+
+private:
+
+    template <typename T>
+    struct Shadow
+    {
+        T       value = {};
+        bool    isKnown = false;
+    };
+
+    struct VertexBufferBinding
+    {
+        ID3D11Buffer*   buffer;
+        UINT            stride;
+        UINT            offset;
+
+        bool operator == (const VertexBufferBinding &other) const
+        {
+            return buffer == other.buffer && stride == other.stride && offset == other.offset;
+        }
+    };
+
+    struct IndexBufferBinding
+    {
+        ID3D11Buffer*   buffer;
+        DXGI_FORMAT     format;
+        UINT            offset;
+
+        bool operator == (const IndexBufferBinding &other) const
+        {
+            return buffer == other.buffer && format == other.format && offset == other.offset;
+        }
+    };
+
+    // True if the value is already bound; else shadows it, and the caller issues the call
+    template <typename T>
+    bool IsBound(Shadow<T> &shadow, const T &value, Binding binding);
+    template <typename T, size_t N>
+    bool IsBound(Shadow<T> (&shadows)[N], UINT slot, const T &value, Binding binding);
+
+    ID3D11DeviceContext*            mContext = nullptr;     // borrowed
+    ID3D11DeviceContext1*           mContext1 = nullptr;
+    bool                            mRangeErrorLogged = false;
+
+    Shadow<ID3D11VertexShader*>         mVertexShader;
+    Shadow<ID3D11PixelShader*>          mPixelShader;
+    Shadow<ID3D11InputLayout*>          mInputLayout;
+    Shadow<D3D11_PRIMITIVE_TOPOLOGY>    mTopology;
+    Shadow<VertexBufferBinding>         mVertexBuffers[MaxVertexBuffers];
+    Shadow<IndexBufferBinding>          mIndexBuffer;
+    Shadow<ConstantRange>               mVSConstants[MaxConstantBuffers];
+    Shadow<ID3D11Buffer*>               mPSConstants[MaxConstantBuffers];
+    Shadow<ID3D11ShaderResourceView*>   mVSResources[MaxResources];
+    Shadow<ID3D11ShaderResourceView*>   mPSResources[MaxResources];
+    Shadow<ID3D11SamplerState*>         mPSSamplers[MaxSamplers];
+
+    Stats                           mStats;
+    Stats                           mLastFrameStats;
+};
@@ -0,0 +1,270 @@
+#include "static_batcher.hpp"
+#include "vertex_streams.hpp"
+#include "log.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <cfloat>
+#include <utility>
+
+namespace
+{
+    // Spreads the low 10 bits of v so there are two zero bits between each
+    uint32_t SpreadBits(uint32_t v)
+    {
+        v &= 0x3FF;
+        v = (v | (v << 16)) & 0x030000FF;
+        v = (v | (v << 8))  & 0x0300F00F;
+        v = (v | (v << 4))  & 0x030C30C3;
+        v = (v | (v << 2))  & 0x09249249;
+        return v;
+    }
+
+    bool IsListTopology(D3D11_PRIMITIVE_TOPOLOGY topology)
+    {
+        return topology == D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST ||
+               topology == D3D11_PRIMITIVE_TOPOLOGY_LINELIST ||
+               topology == D3D11_PRIMITIVE_TOPOLOGY_POINTLIST;
+    }
+}
+
+bool StaticBatcher::Add(const SceneVertex *vertices, size_t vertexCount, const uint32_t *indices, size_t indexCount,
+                        D3D11_PRIMITIVE_TOPOLOGY topology, uint32_t material, FXMMATRIX world)
+{
+    if (mIsFinished)
+    {
+        Log::Error(L"StaticBatcher: Primitive added after Finish()");
+        return false;
+    }
+
+    if (!vertices || !indices || (vertexCount == 0) || (indexCount == 0) || !IsListTopology(topology))
+    {
+        mStats.rejected++;
+        return false;
+    }
+    for (size_t i = 0; i < indexCount; ++i)
+        if (indices[i] >= vertexCount)
+        {
+            mStats.rejected++;
+            return false;
+        }
+
+    // Find the batch, or start a new one if there is none or it is full
+    const uint64_t key = MakeBatchKey(material, topology);
+    auto it = mOpenBatches.find(key);
+    if ((it == mOpenBatches.end()) || (mBatches[it->second].vertices.size() + vertexCount > MaxBatchVertices))
+    {
+        const uint32_t batchIdx = (uint32_t)mBatches.size();
+        mBatches.emplace_back();
+        mBatches.back().material = material;
+        mBatches.back().topology = topology;
+        it = mOpenBatches.insert_or_assign(key, batchIdx).first;
+    }
+    Batch &batch = mBatches[it->second];
+
+    // Same transform as the vertex shader applies: normals and tangents go through the world
+    // matrix itself, the shader normalises them again
+    const uint32_t baseVertex = (uint32_t)batch.vertices.size();
+    XMVECTOR boundsMin = XMVectorReplicate(FLT_MAX);
+    XMVECTOR boundsMax = XMVectorReplicate(-FLT_MAX);
+    batch.vertices.resize(baseVertex + vertexCount);
+    for (size_t v = 0; v < vertexCount; ++v)
+    {
+        const SceneVertex &src = vertices[v];
+        SceneVertex &dst = batch.vertices[baseVertex + v];
+        dst = src;
+
+        const XMVECTOR pos = XMVector3Transform(XMLoadFloat3(&src.Pos), world);
+        XMStoreFloat3(&dst.Pos, pos);
+        boundsMin = XMVectorMin(boundsMin, pos);
+        boundsMax = XMVectorMax(boundsMax, pos);
+
+        XMStoreFloat3(&dst.Normal, XMVector3Normalize(XMVector3TransformNormal(XMLoadFloat3(&src.Normal), world)));
+        const XMVECTOR tangent = XMVector3Normalize(XMVector3TransformNormal(XMLoadFloat4(&src.Tangent), world));
+        XMStoreFloat4(&dst.Tangent, XMVectorSetW(tangent, src.Tangent.w));
+    }
+
+    PendingSubrange subrange;
+    subrange.firstIndex = (UINT)batch.indices.size();
+    subrange.indexCount = (UINT)indexCount;
+    XMStoreFloat3(&subrange.boundsMin, boundsMin);
+    XMStoreFloat3(&subrange.boundsMax, boundsMax);
+    batch.pending.push_back(subrange);
+
+    batch.indices.reserve(batch.indices.size() + indexCount);
+    for (size_t i = 0; i < indexCount; ++i)
+        batch.indices.push_back(baseVertex + indices[i]);
+
+    mStats.primitives++;
+    mStats.vertices += vertexCount;
+    mStats.indices += indexCount;
+    return true;
+}
+
+void StaticBatcher::Finish()
+{
+    if (mIsFinished)
+        return;
+    mIsFinished = true;
+    mOpenBatches.clear();
+
+    size_t subrangeCount = 0;
+    for (const auto &batch : mBatches)
+        subrangeCount += batch.pending.size();
+    mSubranges.clear();
+    mSubranges.reserve(subrangeCount);
+    mBounds.Resize(subrangeCount);
+
+    std::vector<std::pair<uint32_t, uint32_t>> order;   // Morton code, pending subrange
+    std::vector<uint32_t> sortedIndices;
+    for (uint32_t b = 0; b < (uint32_t)mBatches.size(); ++b)
+    {
+        Batch &batch = mBatches[b];
+
+        // Centres quantised to 10 bits per axis within the batch's bounds
+        XMVECTOR batchMin = XMVectorReplicate(FLT_MAX);
+        XMVECTOR batchMax = XMVectorReplicate(-FLT_MAX);
+        for (const auto &subrange : batch.pending)
+        {
+            batchMin = XMVectorMin(batchMin, XMLoadFloat3(&subrange.boundsMin));
+            batchMax = XMVectorMax(batchMax, XMLoadFloat3(&subrange.boundsMax));
+        }
+        const XMVECTOR scale = XMVectorReplicate(1023.0f) /
+                               XMVectorMax(batchMax - batchMin, XMVectorReplicate(1e-6f));
+
+        order.resize(batch.pending.size());
+        for (uint32_t i = 0; i < (uint32_t)batch.pending.size(); ++i)
+        {
+            const PendingSubrange &subrange = batch.pending[i];
+            const XMVECTOR center = (XMLoadFloat3(&subrange.boundsMin) + XMLoadFloat3(&subrange.boundsMax)) * 0.5f;
+            XMFLOAT3 cell;
+            XMStoreFloat3(&cell, XMVectorClamp((center - batchMin) * scale, XMVectorZero(), XMVectorReplicate(1023.0f)));
+            order[i].first = SpreadBits((uint32_t)cell.x) | (SpreadBits((uint32_t)cell.y) << 1) |
+                             (SpreadBits((uint32_t)cell.z) << 2);
+            order[i].second = i;
+        }
+        std::stable_sort(order.begin(), order.end(),
+                         [](const std::pair<uint32_t, uint32_t> &a, const std::pair<uint32_t, uint32_t> &b)
+                         { return a.first < b.first; });
+
+        // Indices rewritten in the new order
+        sortedIndices.clear();
+        sortedIndices.reserve(batch.indices.size());
+        for (const auto &entry : order)
+        {
+            const PendingSubrange &pending = batch.pending[entry.second];
+            mBounds.SetMinMax(mSubranges.size(), pending.boundsMin, pending.boundsMax);
+
+            Subrange subrange;
+            subrange.batch = b;
+            subrange.firstIndex = (UINT)sortedIndices.size();
+            subrange.indexCount = pending.indexCount;
+            mSubranges.push_back(subrange);
+
+            sortedIndices.insert(sortedIndices.end(), batch.indices.begin() + pending.firstIndex,
+                                 batch.indices.begin() + pending.firstIndex + pending.indexCount);
+        }
+        batch.indices.swap(sortedIndices);
+        batch.pending = std::vector<PendingSubrange>();
+    }
+
+    mStats.batches = mBatches.size();
+}
+
+bool StaticBatcher::CreateDeviceBuffers(ID3D11Device *device)
+{
+    if (!device)
+        return false;
+
+    if (!mIsFinished)
+        Finish();
+
+    std::vector<uint8_t> stream;
+    for (auto &batch : mBatches)
+    {
+        if (batch.vertexBuffer && batch.attributeBuffer && batch.indexBuffer)
+            continue;
+
+        D3D11_BUFFER_DESC bd;
+        ZeroMemory(&bd, sizeof(bd));
+        bd.Usage = D3D11_USAGE_IMMUTABLE;
+        bd.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+        D3D11_SUBRESOURCE_DATA initData;
+        ZeroMemory(&initData, sizeof(initData));
+
+        ID3D11Buffer** vertexBuffers[] = { &batch.vertexBuffer, &batch.attributeBuffer };
+        for (UINT s = 0; s < ARRAYSIZE(vertexBuffers); ++s)
+        {
+            if (*vertexBuffers[s])
+                continue;
+            VertexStreams::Extract(batch.vertices.data(), batch.vertices.size(), (VertexStreams::Stream)s, stream);
+            bd.ByteWidth = (UINT)stream.size();
+            initData.pSysMem = stream.data();
+            if (FAILED(device->CreateBuffer(&bd, &initData, vertexBuffers[s])))
+            {
+                Log::Error(L"StaticBatcher: Failed to create the vertex buffers of a %d vertex batch",
+                           batch.vertices.size());
+                return false;
+            }
+        }
+
+        bd.ByteWidth = (UINT)(sizeof(uint32_t) * batch.indices.size());
+        bd.BindFlags = D3D11_BIND_INDEX_BUFFER;
+        initData.pSysMem = batch.indices.data();
+        if (FAILED(device->CreateBuffer(&bd, &initData, &batch.indexBuffer)))
+        {
+            Log::Error(L"StaticBatcher: Failed to create the index buffer of a %d index batch",
+                       batch.indices.size());
+            return false;
+        }
+
+        batch.vertices = std::vector<SceneVertex>();
+        batch.indices = std::vector<uint32_t>();
+    }
+
+    return true;
+}
+
+void StaticBatcher::Destroy()
+{
+    for (auto &batch : mBatches)
+    {
+        Utils::ReleaseAndMakeNull(batch.vertexBuffer);
+        Utils::ReleaseAndMakeNull(batch.attributeBuffer);
+        Utils::ReleaseAndMakeNull(batch.indexBuffer);
+    }
+    mBatches.clear();
+    mOpenBatches.clear();
+    mSubranges.clear();
+    mBounds.Resize(0);
+    mIsFinished = false;
+    mStats = Stats();
+}
+
+void StaticBatcher::GetDrawRanges(const FrustumCuller::ViewMask *visibility, std::vector<DrawRange> &ranges) const
+{
+    ranges.clear();
+    for (uint32_t i = 0; i < (uint32_t)mSubranges.size(); ++i)
+    {
+        if (visibility && !visibility[i])
+            continue;
+
+        const Subrange &subrange = mSubranges[i];
+        if (!ranges.empty())
+        {
+            DrawRange &last = ranges.back();
+            if ((last.batch == subrange.batch) && (last.startIndex + last.indexCount == subrange.firstIndex))
+            {
+                last.indexCount += subrange.indexCount;
+                continue;
+            }
+        }
+
+        DrawRange range;
+        range.batch = subrange.batch;
+        range.startIndex = subrange.firstIndex;
+        range.indexCount = subrange.indexCount;
+        range.firstSubrange = i;
+        ranges.push_back(range);
+    }
+}
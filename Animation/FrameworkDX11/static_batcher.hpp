@@ -0,0 +1,129 @@
+#pragma once
+
+#include "scene_vertex.hpp"
+#include "frustum_culler.hpp"
+
+// We are using an older version of DirectX headers which causes
+// "warning C4005: '...' : macro redefinition"
+#pragma warning(push)
+#pragma warning(disable: 4005)
+#include <d3d11.h>
+#pragma warning(pop)
+
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+#include <cstddef>
+
+// Merges geometry that never moves into one vertex and index buffer per material and
+// topology, the vertices pre-transformed into world space, so a whole batch is drawn with an
+// identity world matrix. Every primitive added stays a subrange of its batch's indices with
+// its own world bounds: the subranges are culled like separate primitives, and the visible
+// ones are drawn as a few contiguous index ranges, one draw each.
+class StaticBatcher
+{
+public:
+
+    // A batch that would grow past this many vertices is closed and a new one started
+    static const size_t MaxBatchVertices = 1 << 22;
+
+    struct Stats
+    {
+        size_t primitives = 0;      // merged into a batch
+        size_t rejected = 0;        // strips, non-indexed or broken primitives, left to the caller
+        size_t batches = 0;
+        size_t vertices = 0;
+        size_t indices = 0;
+    };
+
+    // Visible indices of one batch, one draw
+    struct DrawRange
+    {
+        uint32_t    batch;
+        UINT        startIndex;
+        UINT        indexCount;
+        uint32_t    firstSubrange;  // the range starts with, for its bounds
+    };
+
+    ~StaticBatcher() { Destroy(); }
+
+    // Appends the primitive, transformed by 'world', to the batch of its material and
+    // topology. Only list topologies can be concatenated: anything else is rejected and
+    // has to be drawn on its own.
+    bool Add(const SceneVertex *vertices, size_t vertexCount, const uint32_t *indices, size_t indexCount,
+             D3D11_PRIMITIVE_TOPOLOGY topology, uint32_t material, FXMMATRIX world);
+
+    // Orders the subranges of each batch along a Morton curve of their centres, so primitives
+    // near each other are neighbours in the index buffer and merge into one range when seen
+    // together, and sets up their bounds. Nothing can be added afterwards.
+    void Finish();
+
+    // Immutable position, attribute and index buffers for every batch (static geometry has
+    // no skin stream); the CPU copies are dropped
+    bool CreateDeviceBuffers(ID3D11Device *device);
+    void Destroy();
+
+    bool IsEmpty() const { return mBatches.empty(); }
+    bool IsFinished() const { return mIsFinished; }
+
+    size_t GetBatchCount() const { return mBatches.size(); }
+    // Position stream, see VertexStreams
+    ID3D11Buffer* GetVertexBuffer(size_t batch) const { return mBatches[batch].vertexBuffer; }
+    ID3D11Buffer* GetAttributeBuffer(size_t batch) const { return mBatches[batch].attributeBuffer; }
+    ID3D11Buffer* GetIndexBuffer(size_t batch) const { return mBatches[batch].indexBuffer; }
+    D3D11_PRIMITIVE_TOPOLOGY GetTopology(size_t batch) const { return mBatches[batch].topology; }
+    uint32_t GetMaterial(size_t batch) const { return mBatches[batch].material; }
+
+    // Subranges are numbered batch by batch, in index buffer order
+    size_t GetSubrangeCount() const { return mSubranges.size(); }
+    // World bounds of every subrange, for the culler
+    const BoundsSoA& GetBounds() const { return mBounds; }
+
+    // Index ranges covering the subranges with a non-zero mask, neighbours merged.
+    // 'visibility' has one mask per subrange; nullptr draws everything.
+    void GetDrawRanges(const FrustumCuller::ViewMask *visibility, std::vector<DrawRange> &ranges) const;
+
+    const Stats& GetStats() const { return mStats; }
+
+private:
+
+    struct PendingSubrange
+    {
+        UINT        firstIndex;
+        UINT        indexCount;
+        XMFLOAT3    boundsMin;
+        XMFLOAT3    boundsMax;
+    };
+
+    struct Batch
+    {
+        uint32_t                        material = 0;
+        D3D11_PRIMITIVE_TOPOLOGY        topology = D3D11_PRIMITIVE_TOPOLOGY_UNDEFINED;
+        std::vector<SceneVertex>        vertices;
+        std::vector<uint32_t>           indices;
+        std::vector<PendingSubrange>    pending;        // until Finish()
+
+        ID3D11Buffer*                   vertexBuffer = nullptr;
+        ID3D11Buffer*                   attributeBuffer = nullptr;
+        ID3D11Buffer*                   indexBuffer = nullptr;
+    };
+
+    struct Subrange
+    {
+        uint32_t    batch;
+        UINT        firstIndex;
+        UINT        indexCount;
+    };
+
+    static uint64_t MakeBatchKey(uint32_t material, D3D11_PRIMITIVE_TOPOLOGY topology)
+    {
+        return ((uint64_t)material << 32) | (uint32_t)topology;
+    }
+
+    std::vector<Batch>                      mBatches;
+    std::unordered_map<uint64_t, uint32_t>  mOpenBatches;   // batch key -> batch still taking primitives
+    std::vector<Subrange>                   mSubranges;
+    BoundsSoA                               mBounds;
+    bool                                    mIsFinished = false;
+    Stats                                   mStats;
+};
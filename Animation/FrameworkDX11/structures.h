@@ -1,6 +1,7 @@
 #pragma once
 
 #include <DirectXMath.h>
+#include <cstdint>
 using namespace std;
 using namespace DirectX;
 #include "constants.h"
@@ -10,16 +11,88 @@ using namespace DirectX;
 //--------------------------------------------------------------------------------------
 
 
-struct ConstantBuffer
+// Constants are split by how often they change, each block in its own slot (see the
+// shaders). Matrices are stored transposed.
+
+// Set once per frame, VS and PS
+struct FrameConstants
+{
+	XMFLOAT4 vOutputColor;
+};
+
+// Set once per camera
+struct ViewConstants
 {
-	XMMATRIX mWorld;
 	XMMATRIX mView;
 	XMMATRIX mProjection;
-	XMFLOAT4 vOutputColor;
+};
+
+// Per draw, from the constant ring when the device supports it
+struct ObjectConstants
+{
+	XMMATRIX mWorld;
+};
+
+// Per skeleton and palette version, only the first bone count matrices are written
+struct SkinConstants
+{
 	XMMATRIX boneTransforms[max_bones];
-	unsigned int bone_count;
 };
 
+// What one upload cost with the single buffer the blocks above replace
+// (world, view, projection, colour, bones, bone count)
+constexpr size_t MonolithicConstantsSize = sizeof(XMMATRIX) * (3 + max_bones) + sizeof(XMFLOAT4) + 16;
+
+constexpr unsigned int ObjectConstantsSlot = 0;
+constexpr unsigned int FrameConstantsSlot = 3;
+constexpr unsigned int ViewConstantsSlot = 4;
+constexpr unsigned int SkinConstantsSlot = 5;
+
+// Flags of a MaterialData
+enum MaterialFlags
+{
+	MaterialAlphaMask = 1 << 0,
+	MaterialAlphaBlend = 1 << 1,
+	MaterialDoubleSided = 1 << 2,
+	MaterialBaseColorTexture = 1 << 3,
+	MaterialMetallicRoughnessTexture = 1 << 4,
+	MaterialNormalTexture = 1 << 5,
+	MaterialOcclusionTexture = 1 << 6,
+	MaterialEmissiveTexture = 1 << 7
+};
+
+// glTF metallic-roughness material, one entry of the material table (MaterialData in the
+// shader). Entries are compared byte by byte, so the padding has to stay zero.
+struct MaterialData
+{
+	XMFLOAT4	baseColorFactor = XMFLOAT4(1.0f, 1.0f, 1.0f, 1.0f);
+	//----------------------------------- (16 byte boundary)
+	XMFLOAT3	emissiveFactor = XMFLOAT3(0.0f, 0.0f, 0.0f);
+	float		metallicFactor = 1.0f;
+	//----------------------------------- (16 byte boundary)
+	float		roughnessFactor = 1.0f;
+	float		normalScale = 1.0f;
+	float		occlusionStrength = 1.0f;
+	float		alphaCutoff = 0.5f;
+	//----------------------------------- (16 byte boundary)
+	uint32_t	flags = 0;
+	uint32_t	padding[3] = {};
+	//----------------------------------- (16 byte boundary)
+};  // Total:                              64 bytes ( 4 * 16 )
+static_assert(sizeof(MaterialData) == 64, "MaterialData must match the shader's layout");
+
+// The whole table is one constant buffer, PS slot 2. A draw picks its entry with its start
+// instance, read back through an identity stream of material indices in vertex slot 2.
+constexpr unsigned int MaxMaterials = 256;
+constexpr unsigned int MaterialConstantsSlot = 2;
+constexpr unsigned int MaterialIndexStreamSlot = 2;
+
+// Vertex streams of the scene geometry (VertexStreams). Slot 1 is the instance stream of the
+// instanced draws.
+constexpr unsigned int PositionStreamSlot = 0;
+constexpr unsigned int AttributeStreamSlot = 3;
+constexpr unsigned int SkinStreamSlot = 4;
+
 
 
 enum LightType
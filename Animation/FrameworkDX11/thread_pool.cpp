@@ -0,0 +1,92 @@
+#include "thread_pool.hpp"
+
+ThreadPool::ThreadPool(unsigned int workerCount) :
+    mNextJob(0)
+{
+    mWorkers.reserve(workerCount);
+    for (unsigned int i = 0; i < workerCount; ++i)
+        mWorkers.emplace_back(&ThreadPool::WorkerMain, this, i + 1);
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mQuit = true;
+    }
+    mWake.notify_all();
+
+    for (auto &worker : mWorkers)
+        worker.join();
+}
+
+unsigned int ThreadPool::DefaultWorkerCount()
+{
+    const unsigned int hardwareThreads = std::thread::hardware_concurrency();
+    return (hardwareThreads > 2) ? hardwareThreads - 1 : 1;
+}
+
+void ThreadPool::ParallelFor(size_t count, const std::function<void(size_t, unsigned int)> &job)
+{
+    if (count == 0)
+        return;
+
+    // Not worth waking anybody
+    if (count == 1 || mWorkers.empty())
+    {
+        for (size_t i = 0; i < count; ++i)
+            job(i, 0);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mJob = &job;
+        mJobCount = count;
+        mNextJob.store(0);
+        mBusyWorkers = (unsigned int)mWorkers.size();
+        mGeneration++;
+    }
+    mWake.notify_all();
+
+    RunJobs(0);
+
+    // Every worker checks in, even one that found no job left, so none of them can still be
+    // looking at this loop when the next one starts
+    std::unique_lock<std::mutex> lock(mMutex);
+    mDone.wait(lock, [this]() { return mBusyWorkers == 0; });
+    mJob = nullptr;
+    mJobCount = 0;
+}
+
+void ThreadPool::WorkerMain(unsigned int threadIdx)
+{
+    uint64_t seenGeneration = 0;
+    for (;;)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            mWake.wait(lock, [&]() { return mQuit || mGeneration != seenGeneration; });
+            if (mQuit)
+                return;
+            seenGeneration = mGeneration;
+        }
+
+        RunJobs(threadIdx);
+
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (--mBusyWorkers == 0)
+            mDone.notify_one();
+    }
+}
+
+void ThreadPool::RunJobs(unsigned int threadIdx)
+{
+    for (;;)
+    {
+        const size_t i = mNextJob.fetch_add(1);
+        if (i >= mJobCount)
+            return;
+        (*mJob)(i, threadIdx);
+    }
+}
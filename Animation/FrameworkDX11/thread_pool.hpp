@@ -0,0 +1,52 @@
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <cstdint>
+#include <cstddef>
+
+// Fixed set of worker threads for data-parallel loops. The threads are started once and
+// sleep between loops, so ParallelFor() is cheap enough to call several times per frame.
+class ThreadPool
+{
+public:
+
+    // Workers in addition to the calling thread, which always takes part in ParallelFor()
+    explicit ThreadPool(unsigned int workerCount = DefaultWorkerCount());
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool& operator = (const ThreadPool &) = delete;
+
+    // One less than the hardware threads, at least 1
+    static unsigned int DefaultWorkerCount();
+
+    unsigned int GetThreadCount() const { return (unsigned int)mWorkers.size() + 1; }
+
+    // Calls job(i, threadIdx) for every i in [0, count) and returns when all calls are done.
+    // threadIdx < GetThreadCount() identifies the calling thread, e.g. to pick per-thread
+    // scratch data; 0 is the thread that called ParallelFor(). Not reentrant.
+    void ParallelFor(size_t count, const std::function<void(size_t, unsigned int)> &job);
+
+private:
+
+    void WorkerMain(unsigned int threadIdx);
+    void RunJobs(unsigned int threadIdx);
+
+    std::vector<std::thread>    mWorkers;
+
+    std::mutex                  mMutex;
+    std::condition_variable     mWake;
+    std::condition_variable     mDone;
+    uint64_t                    mGeneration = 0;    // bumped for every loop
+    unsigned int                mBusyWorkers = 0;
+    bool                        mQuit = false;
+
+    const std::function<void(size_t, unsigned int)> *mJob = nullptr;
+    size_t                      mJobCount = 0;
+    std::atomic<size_t>         mNextJob;
+};
@@ -0,0 +1,379 @@
+#include "tlsf_allocator.hpp"
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#include <algorithm>
+
+namespace
+{
+    // Index of the highest / lowest set bit, v is not 0
+    uint32_t HighestBit(uint32_t v)
+    {
+#if defined(_MSC_VER)
+        unsigned long idx;
+        _BitScanReverse(&idx, v);
+        return (uint32_t)idx;
+#else
+        return 31 - (uint32_t)__builtin_clz(v);
+#endif
+    }
+
+    uint32_t LowestBit(uint32_t v)
+    {
+#if defined(_MSC_VER)
+        unsigned long idx;
+        _BitScanForward(&idx, v);
+        return (uint32_t)idx;
+#else
+        return (uint32_t)__builtin_ctz(v);
+#endif
+    }
+}
+
+void TlsfAllocator::Reset(uint32_t capacity)
+{
+    mBlocks.clear();
+    mUnusedBlocks.clear();
+    mFirstBlock = InvalidBlock;
+    mFirstLevelMap = 0;
+    std::fill(std::begin(mSecondLevelMap), std::end(mSecondLevelMap), 0u);
+    for (auto &lists : mFreeLists)
+        std::fill(std::begin(lists), std::end(lists), InvalidBlock);
+    mCapacity = capacity;
+    mUsed = 0;
+    mAllocations = 0;
+    mFreeBlocks = 0;
+
+    if (capacity == 0)
+        return;
+
+    mFirstBlock = NewBlock();
+    Block &block = mBlocks[mFirstBlock];
+    block.offset = 0;
+    block.size = capacity;
+    block.prevPhysical = InvalidBlock;
+    block.nextPhysical = InvalidBlock;
+    InsertFree(mFirstBlock);
+}
+
+void TlsfAllocator::Mapping(uint32_t size, uint32_t &firstLevel, uint32_t &secondLevel)
+{
+    if (size < SmallBlockSize)
+    {
+        firstLevel = 0;
+        secondLevel = size;
+        return;
+    }
+
+    const uint32_t highest = HighestBit(size);
+    firstLevel = highest - SecondLevelBits + 1;
+    secondLevel = (size >> (highest - SecondLevelBits)) - SecondLevelCount;
+}
+
+TlsfAllocator::BlockId TlsfAllocator::FindFree(uint32_t size) const
+{
+    // Rounded up to the next size class, so any block of the class found is large enough
+    uint64_t rounded = size;
+    if (size >= SmallBlockSize)
+        rounded += (1ull << (HighestBit(size) - SecondLevelBits)) - 1;
+
+    uint32_t firstLevel, secondLevel;
+    if (rounded <= UINT32_MAX)
+    {
+        Mapping((uint32_t)rounded, firstLevel, secondLevel);
+
+        uint32_t secondLevelMap = mSecondLevelMap[firstLevel] & (~0u << secondLevel);
+        if (!secondLevelMap)
+        {
+            const uint32_t firstLevelMap = (firstLevel + 1 < 32) ? (mFirstLevelMap & (~0u << (firstLevel + 1))) : 0;
+            if (firstLevelMap)
+            {
+                firstLevel = LowestBit(firstLevelMap);
+                secondLevelMap = mSecondLevelMap[firstLevel];
+            }
+        }
+        if (secondLevelMap)
+            return mFreeLists[firstLevel][LowestBit(secondLevelMap)];
+    }
+
+    // Rounding skips the blocks of the request's own class, one of them may still fit
+    Mapping(size, firstLevel, secondLevel);
+    for (BlockId block = mFreeLists[firstLevel][secondLevel]; block != InvalidBlock; block = mBlocks[block].nextFree)
+        if (mBlocks[block].size >= size)
+            return block;
+    return InvalidBlock;
+}
+
+bool TlsfAllocator::Allocate(uint32_t size, Allocation &allocation)
+{
+    if (size == 0)
+        return false;
+
+    const BlockId blockIdx = FindFree(size);
+    if (blockIdx == InvalidBlock)
+        return false;
+    RemoveFree(blockIdx);
+
+    // The rest goes back as a free block right behind it
+    if (mBlocks[blockIdx].size > size)
+    {
+        const BlockId restIdx = NewBlock();
+        Block &block = mBlocks[blockIdx];
+        Block &rest = mBlocks[restIdx];
+        rest.offset = block.offset + size;
+        rest.size = block.size - size;
+        rest.prevPhysical = blockIdx;
+        rest.nextPhysical = block.nextPhysical;
+        if (block.nextPhysical != InvalidBlock)
+            mBlocks[block.nextPhysical].prevPhysical = restIdx;
+        block.nextPhysical = restIdx;
+        block.size = size;
+        InsertFree(restIdx);
+    }
+
+    Block &block = mBlocks[blockIdx];
+    block.isFree = false;
+    mUsed += size;
+    mAllocations++;
+
+    allocation.offset = block.offset;
+    allocation.size = size;
+    allocation.block = blockIdx;
+    return true;
+}
+
+void TlsfAllocator::Free(BlockId blockIdx)
+{
+    if ((blockIdx >= mBlocks.size()) || mBlocks[blockIdx].isFree)
+        return;
+
+    mUsed -= mBlocks[blockIdx].size;
+    mAllocations--;
+
+    // Merge with the free neighbours
+    const BlockId prevIdx = mBlocks[blockIdx].prevPhysical;
+    if ((prevIdx != InvalidBlock) && mBlocks[prevIdx].isFree)
+    {
+        RemoveFree(prevIdx);
+        Block &prev = mBlocks[prevIdx];
+        const Block &block = mBlocks[blockIdx];
+        prev.size += block.size;
+        prev.nextPhysical = block.nextPhysical;
+        if (block.nextPhysical != InvalidBlock)
+            mBlocks[block.nextPhysical].prevPhysical = prevIdx;
+        ReleaseBlock(blockIdx);
+        blockIdx = prevIdx;
+    }
+
+    const BlockId nextIdx = mBlocks[blockIdx].nextPhysical;
+    if ((nextIdx != InvalidBlock) && mBlocks[nextIdx].isFree)
+    {
+        RemoveFree(nextIdx);
+        Block &block = mBlocks[blockIdx];
+        const Block &next = mBlocks[nextIdx];
+        block.size += next.size;
+        block.nextPhysical = next.nextPhysical;
+        if (next.nextPhysical != InvalidBlock)
+            mBlocks[next.nextPhysical].prevPhysical = blockIdx;
+        ReleaseBlock(nextIdx);
+    }
+
+    InsertFree(blockIdx);
+}
+
+void TlsfAllocator::Defragment(std::vector<Relocation> &relocations)
+{
+    relocations.clear();
+
+    mFirstLevelMap = 0;
+    std::fill(std::begin(mSecondLevelMap), std::end(mSecondLevelMap), 0u);
+    for (auto &lists : mFreeLists)
+        std::fill(std::begin(lists), std::end(lists), InvalidBlock);
+    mFreeBlocks = 0;
+
+    // Used blocks keep their order and close up, the free ones are dropped
+    uint32_t cursor = 0;
+    BlockId lastUsed = InvalidBlock;
+    BlockId blockIdx = mFirstBlock;
+    mFirstBlock = InvalidBlock;
+    while (blockIdx != InvalidBlock)
+    {
+        Block &block = mBlocks[blockIdx];
+        const BlockId nextIdx = block.nextPhysical;
+        if (block.isFree)
+        {
+            ReleaseBlock(blockIdx);
+        }
+        else
+        {
+            if (block.offset != cursor)
+            {
+                relocations.push_back({ blockIdx, block.offset, cursor, block.size });
+                block.offset = cursor;
+            }
+            block.prevPhysical = lastUsed;
+            if (lastUsed != InvalidBlock)
+                mBlocks[lastUsed].nextPhysical = blockIdx;
+            else
+                mFirstBlock = blockIdx;
+            lastUsed = blockIdx;
+            cursor += block.size;
+        }
+        blockIdx = nextIdx;
+    }
+    if (lastUsed != InvalidBlock)
+        mBlocks[lastUsed].nextPhysical = InvalidBlock;
+
+    if (cursor < mCapacity)
+    {
+        const BlockId restIdx = NewBlock();
+        Block &rest = mBlocks[restIdx];
+        rest.offset = cursor;
+        rest.size = mCapacity - cursor;
+        rest.prevPhysical = lastUsed;
+        rest.nextPhysical = InvalidBlock;
+        if (lastUsed != InvalidBlock)
+            mBlocks[lastUsed].nextPhysical = restIdx;
+        else
+            mFirstBlock = restIdx;
+        InsertFree(restIdx);
+    }
+}
+
+TlsfAllocator::Stats TlsfAllocator::GetStats() const
+{
+    Stats stats;
+    stats.capacity = mCapacity;
+    stats.used = mUsed;
+    stats.allocations = mAllocations;
+    stats.freeBlocks = mFreeBlocks;
+
+    // The largest block is in the highest non-empty size class
+    if (mFirstLevelMap)
+    {
+        const uint32_t firstLevel = HighestBit(mFirstLevelMap);
+        const uint32_t secondLevel = HighestBit(mSecondLevelMap[firstLevel]);
+        for (BlockId block = mFreeLists[firstLevel][secondLevel]; block != InvalidBlock; block = mBlocks[block].nextFree)
+            stats.largestFree = (std::max)(stats.largestFree, mBlocks[block].size);
+    }
+    return stats;
+}
+
+bool TlsfAllocator::Validate() const
+{
+    uint32_t cursor = 0;
+    uint32_t used = 0;
+    size_t allocations = 0;
+    size_t freeBlocks = 0;
+    BlockId prevIdx = InvalidBlock;
+    for (BlockId blockIdx = mFirstBlock; blockIdx != InvalidBlock; blockIdx = mBlocks[blockIdx].nextPhysical)
+    {
+        const Block &block = mBlocks[blockIdx];
+        if ((block.offset != cursor) || (block.size == 0) || (block.prevPhysical != prevIdx))
+            return false;
+
+        if (block.isFree)
+        {
+            // Never two free blocks in a row, and each one in the list of its class
+            if ((prevIdx != InvalidBlock) && mBlocks[prevIdx].isFree)
+                return false;
+
+            uint32_t firstLevel, secondLevel;
+            Mapping(block.size, firstLevel, secondLevel);
+            BlockId listed = mFreeLists[firstLevel][secondLevel];
+            while ((listed != InvalidBlock) && (listed != blockIdx))
+                listed = mBlocks[listed].nextFree;
+            if (listed == InvalidBlock)
+                return false;
+            freeBlocks++;
+        }
+        else
+        {
+            used += block.size;
+            allocations++;
+        }
+
+        cursor += block.size;
+        prevIdx = blockIdx;
+    }
+    if ((cursor != mCapacity) || (used != mUsed) || (allocations != mAllocations) || (freeBlocks != mFreeBlocks))
+        return false;
+
+    // A bit is set exactly for the non-empty lists
+    for (uint32_t firstLevel = 0; firstLevel < FirstLevelCount; ++firstLevel)
+    {
+        for (uint32_t secondLevel = 0; secondLevel < SecondLevelCount; ++secondLevel)
+        {
+            const bool isListed = mFreeLists[firstLevel][secondLevel] != InvalidBlock;
+            if (isListed != ((mSecondLevelMap[firstLevel] >> secondLevel) & 1))
+                return false;
+        }
+        if ((mSecondLevelMap[firstLevel] != 0) != ((mFirstLevelMap >> firstLevel) & 1))
+            return false;
+    }
+    return true;
+}
+
+void TlsfAllocator::InsertFree(BlockId blockIdx)
+{
+    Block &block = mBlocks[blockIdx];
+    uint32_t firstLevel, secondLevel;
+    Mapping(block.size, firstLevel, secondLevel);
+
+    BlockId &head = mFreeLists[firstLevel][secondLevel];
+    block.isFree = true;
+    block.prevFree = InvalidBlock;
+    block.nextFree = head;
+    if (head != InvalidBlock)
+        mBlocks[head].prevFree = blockIdx;
+    head = blockIdx;
+
+    mSecondLevelMap[firstLevel] |= 1u << secondLevel;
+    mFirstLevelMap |= 1u << firstLevel;
+    mFreeBlocks++;
+}
+
+void TlsfAllocator::RemoveFree(BlockId blockIdx)
+{
+    Block &block = mBlocks[blockIdx];
+    uint32_t firstLevel, secondLevel;
+    Mapping(block.size, firstLevel, secondLevel);
+
+    if (block.prevFree != InvalidBlock)
+        mBlocks[block.prevFree].nextFree = block.nextFree;
+    else
+        mFreeLists[firstLevel][secondLevel] = block.nextFree;
+    if (block.nextFree != InvalidBlock)
+        mBlocks[block.nextFree].prevFree = block.prevFree;
+
+    if (mFreeLists[firstLevel][secondLevel] == InvalidBlock)
+    {
+        mSecondLevelMap[firstLevel] &= ~(1u << secondLevel);
+        if (!mSecondLevelMap[firstLevel])
+            mFirstLevelMap &= ~(1u << firstLevel);
+    }
+    block.isFree = false;
+    mFreeBlocks--;
+}
+
+TlsfAllocator::BlockId TlsfAllocator::NewBlock()
+{
+    if (!mUnusedBlocks.empty())
+    {
+        const BlockId blockIdx = mUnusedBlocks.back();
+        mUnusedBlocks.pop_back();
+        return blockIdx;
+    }
+
+    mBlocks.emplace_back();
+    return (BlockId)(mBlocks.size() - 1);
+}
+
+void TlsfAllocator::ReleaseBlock(BlockId blockIdx)
+{
+    // Freed entries read as free, so a stale Free() of them is ignored
+    mBlocks[blockIdx].isFree = true;
+    mUnusedBlocks.push_back(blockIdx);
+}
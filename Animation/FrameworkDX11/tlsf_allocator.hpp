@@ -0,0 +1,111 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+// Two-level segregated fit (TLSF) allocator over a range of units [0, capacity). It only hands
+// out offsets; what a unit is (a byte, a vertex, an index) is up to the owner, and nothing is
+// stored in the range itself. Allocate() and Free() are O(1): free blocks are kept in size
+// class lists found through two bitmaps, and a freed block is merged with its free neighbours
+// straight away. Needs no device, so it can be checked and timed on its own.
+class TlsfAllocator
+{
+public:
+
+    typedef uint32_t BlockId;
+    static const BlockId InvalidBlock = UINT32_MAX;
+
+    struct Allocation
+    {
+        uint32_t    offset = 0;
+        uint32_t    size = 0;
+        BlockId     block = InvalidBlock;
+    };
+
+    // A used block Defragment() moved; the owner copies what it holds
+    struct Relocation
+    {
+        BlockId     block;
+        uint32_t    oldOffset;
+        uint32_t    newOffset;
+        uint32_t    size;
+    };
+
+    struct Stats
+    {
+        uint32_t    capacity = 0;
+        uint32_t    used = 0;
+        uint32_t    largestFree = 0;
+        size_t      allocations = 0;
+        size_t      freeBlocks = 0;
+
+        // 0 while the free space is one block, towards 1 the more it is split up
+        float Fragmentation() const
+        {
+            const uint32_t free = capacity - used;
+            return free ? 1.0f - (float)largestFree / (float)free : 0.0f;
+        }
+    };
+
+    explicit TlsfAllocator(uint32_t capacity = 0) { Reset(capacity); }
+
+    // Drops every allocation, the whole range is one free block again
+    void Reset(uint32_t capacity);
+
+    bool Allocate(uint32_t size, Allocation &allocation);
+    void Free(BlockId block);
+
+    uint32_t GetOffset(BlockId block) const { return mBlocks[block].offset; }
+    uint32_t GetSize(BlockId block) const { return mBlocks[block].size; }
+    uint32_t GetCapacity() const { return mCapacity; }
+
+    // Packs the used blocks to the front, in the order they are in now, leaving a single free
+    // block at the end. Block ids stay valid; the blocks that moved are listed in 'relocations'.
+    void Defragment(std::vector<Relocation> &relocations);
+
+    Stats GetStats() const;
+
+    // Walks every block and checks the lists and bitmaps against it, for tests and benchmarks
+    bool Validate() const;
+
+private:
+
+    // Each power of two size range is split into 16 linear size classes
+    static const uint32_t SecondLevelBits = 4;
+    static const uint32_t SecondLevelCount = 1 << SecondLevelBits;
+    static const uint32_t SmallBlockSize = SecondLevelCount;           // below it, one class per size
+    static const uint32_t FirstLevelCount = 32 - SecondLevelBits + 1;
+
+    struct Block
+    {
+        uint32_t    offset;
+        uint32_t    size;
+        BlockId     prevPhysical;   // neighbours in the range
+        BlockId     nextPhysical;
+        BlockId     prevFree;       // neighbours in the size class list, free blocks only
+        BlockId     nextFree;
+        bool        isFree;
+    };
+
+    static void Mapping(uint32_t size, uint32_t &firstLevel, uint32_t &secondLevel);
+    // A free block of at least 'size' units, InvalidBlock if there is none
+    BlockId FindFree(uint32_t size) const;
+    void InsertFree(BlockId block);
+    void RemoveFree(BlockId block);
+    BlockId NewBlock();
+    void ReleaseBlock(BlockId block);
+
+    std::vector<Block>      mBlocks;
+    std::vector<BlockId>    mUnusedBlocks;  // entries of mBlocks to reuse
+    BlockId                 mFirstBlock = InvalidBlock;
+
+    uint32_t                mFirstLevelMap = 0;
+    uint32_t                mSecondLevelMap[FirstLevelCount];
+    BlockId                 mFreeLists[FirstLevelCount][SecondLevelCount];
+
+    uint32_t                mCapacity = 0;
+    uint32_t                mUsed = 0;
+    size_t                  mAllocations = 0;
+    size_t                  mFreeBlocks = 0;
+};
@@ -0,0 +1,94 @@
+#include "transform_hierarchy.hpp"
+
+#include <algorithm>
+
+TransformHierarchy::Index TransformHierarchy::Add(Index parent, FXMMATRIX local)
+{
+    const Index idx = (Index)mParents.size();
+
+    mParents.push_back((parent < idx) ? parent : InvalidIndex);
+    mLocal.emplace_back();
+    mWorld.emplace_back();
+    mDirty.push_back(1);
+    mWorldVersion.push_back(0);
+    XMStoreFloat4x4A(&mLocal.back(), local);
+
+    mFirstDirty = (std::min)(mFirstDirty, (size_t)idx);
+    return idx;
+}
+
+void TransformHierarchy::SetLocal(Index idx, FXMMATRIX local)
+{
+    XMStoreFloat4x4A(&mLocal[idx], local);
+    mDirty[idx] = 1;
+    mFirstDirty = (std::min)(mFirstDirty, (size_t)idx);
+}
+
+void TransformHierarchy::SetParent(Index idx, Index parent)
+{
+    mParents[idx] = (parent < idx) ? parent : InvalidIndex;
+    MarkDirty(idx);
+}
+
+void TransformHierarchy::MarkDirty(Index idx)
+{
+    mDirty[idx] = 1;
+    mFirstDirty = (std::min)(mFirstDirty, (size_t)idx);
+}
+
+void TransformHierarchy::UpdateWorld()
+{
+    mLastUpdateCount = 0;
+    if (mFirstDirty == SIZE_MAX)
+        return;
+
+    const size_t count = mParents.size();
+    const Index *parents = mParents.data();
+    const XMFLOAT4X4A *local = mLocal.data();
+    XMFLOAT4X4A *world = mWorld.data();
+    uint8_t *dirty = mDirty.data();
+
+    // Nothing before the first dirty node can change. Parents precede their children,
+    // so dirty[parent] already tells whether the parent's world moved in this pass.
+    for (size_t i = mFirstDirty; i < count; ++i)
+    {
+        const Index parent = parents[i];
+        if (!dirty[i])
+        {
+            if ((parent == InvalidIndex) || !dirty[parent])
+                continue;
+            dirty[i] = 1;
+        }
+
+        if (parent == InvalidIndex)
+            world[i] = local[i];
+        else
+            XMStoreFloat4x4A(&world[i], XMMatrixMultiply(XMLoadFloat4x4A(&local[i]), XMLoadFloat4x4A(&world[parent])));
+
+        mWorldVersion[i]++;
+        mLastUpdateCount++;
+    }
+
+    std::fill(mDirty.begin() + mFirstDirty, mDirty.end(), (uint8_t)0);
+    mFirstDirty = SIZE_MAX;
+}
+
+void TransformHierarchy::Reserve(size_t count)
+{
+    mParents.reserve(count);
+    mLocal.reserve(count);
+    mWorld.reserve(count);
+    mDirty.reserve(count);
+    mWorldVersion.reserve(count);
+}
+
+void TransformHierarchy::Clear()
+{
+    mParents.clear();
+    mLocal.clear();
+    mWorld.clear();
+    mDirty.clear();
+    mWorldVersion.clear();
+    mFirstDirty = SIZE_MAX;
+    mLastUpdateCount = 0;
+}
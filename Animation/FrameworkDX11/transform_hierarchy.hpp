@@ -0,0 +1,62 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <DirectXMath.h>
+
+using namespace DirectX;
+
+// Transforms of a whole scene graph in flat arrays, ordered so that every parent comes
+// before its children. World matrices are then computed in one linear pass, with no
+// recursion and no pointer chasing. Only nodes whose local matrix changed, and their
+// descendants, are recomputed; a frame where nothing moved costs one branch.
+class TransformHierarchy
+{
+public:
+
+    typedef uint32_t Index;
+    static const Index InvalidIndex = UINT32_MAX;
+
+    // 'parent' must already be in the hierarchy (or InvalidIndex for a root)
+    Index Add(Index parent, FXMMATRIX local);
+
+    void SetLocal(Index idx, FXMMATRIX local);
+    XMMATRIX GetLocal(Index idx) const { return XMLoadFloat4x4A(&mLocal[idx]); }
+    XMMATRIX GetWorld(Index idx) const { return XMLoadFloat4x4A(&mWorld[idx]); }
+    Index GetParent(Index idx) const { return mParents[idx]; }
+    // 'parent' must come before 'idx' (or be InvalidIndex); the node's world is recomputed
+    void SetParent(Index idx, Index parent);
+    // Recomputes the node's world (and its subtree's) on the next update, as if it had moved
+    void MarkDirty(Index idx);
+
+    // world[i] = local[i] * world[parent[i]], front to back, for the changed subtrees
+    void UpdateWorld();
+
+    // Incremented every time the node's world matrix is recomputed
+    uint32_t GetWorldVersion(Index idx) const { return mWorldVersion[idx]; }
+
+    // Nodes recomputed by the last UpdateWorld()
+    size_t GetLastUpdateCount() const { return mLastUpdateCount; }
+
+    size_t Size() const { return mParents.size(); }
+    void Reserve(size_t count);
+    void Clear();
+
+    // Nodes were added or moved in a way the owner could not patch in place (or it compacts
+    // the entries it no longer uses); it has to rebuild the arrays before the next update
+    void RequestRebuild() { mNeedsRebuild = true; }
+    bool NeedsRebuild() const { return mNeedsRebuild; }
+    void RebuildDone() { mNeedsRebuild = false; }
+
+private:
+
+    bool                        mNeedsRebuild = false;
+
+    std::vector<XMFLOAT4X4A>    mLocal;
+    std::vector<XMFLOAT4X4A>    mWorld;
+    std::vector<Index>          mParents;
+    std::vector<uint8_t>        mDirty;         // local changed; during UpdateWorld: world changed
+    std::vector<uint32_t>       mWorldVersion;
+    size_t                      mFirstDirty = SIZE_MAX;
+    size_t                      mLastUpdateCount = 0;
+};
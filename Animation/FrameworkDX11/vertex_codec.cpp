@@ -0,0 +1,391 @@
+#include "vertex_codec.hpp"
+
+#include <DirectXPackedVector.h>
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+
+using namespace DirectX::PackedVector;
+
+namespace
+{
+    // Byte offsets of the attributes within an encoded vertex
+    struct Layout
+    {
+        UINT position = 0;
+        UINT normal = 0;
+        UINT tangent = 0;
+        UINT uv = 0;
+        UINT joints = 0;
+        UINT weights = 0;
+        UINT stride = 0;
+    };
+
+    Layout GetLayout(const VertexCodec::Encoding &encoding)
+    {
+        Layout layout;
+        UINT offset = encoding.isQuantised ? 4 * sizeof(uint16_t) : 3 * sizeof(float);
+        layout.normal = offset;
+        offset += 2 * sizeof(int16_t);
+        layout.tangent = offset;
+        offset += 2 * sizeof(int16_t);
+        layout.uv = offset;
+        offset += 2 * sizeof(HALF);
+        if (encoding.isSkinned)
+        {
+            layout.joints = offset;
+            offset += encoding.hasWideJoints ? 4 * sizeof(uint16_t) : 4 * sizeof(uint8_t);
+            layout.weights = offset;
+            offset += 4 * sizeof(uint8_t);
+        }
+        layout.stride = offset;
+        return layout;
+    }
+
+    int16_t ToSnorm16(float v)
+    {
+        return (int16_t)std::lround((std::max)(-1.0f, (std::min)(1.0f, v)) * 32767.0f);
+    }
+
+    float FromSnorm16(int16_t v)
+    {
+        return (std::max)(-1.0f, (float)v / 32767.0f);
+    }
+
+    // Tangent y keeps 15 bits, the lowest one is set for a negative handedness. A shader
+    // reading it as snorm gets the integer back with round(y * 32767).
+    int16_t ToSnorm15WithSign(float v, float handedness)
+    {
+        const long q = std::lround((std::max)(-1.0f, (std::min)(1.0f, v)) * 16383.0f);
+        return (int16_t)(q * 2 + ((handedness < 0.0f) ? 1 : 0));
+    }
+
+    float FromSnorm15WithSign(int16_t v, float &handedness)
+    {
+        const int bit = v & 1;
+        handedness = bit ? -1.0f : 1.0f;
+        return (float)((v - bit) / 2) / 16383.0f;
+    }
+
+    XMVECTOR SafeNormalize3(FXMVECTOR v)
+    {
+        const float length = XMVectorGetX(XMVector3Length(v));
+        return (length > 1e-12f) ? v / length : XMVectorSet(0.0f, 0.0f, 1.0f, 0.0f);
+    }
+
+    float AngleDegrees(FXMVECTOR a, FXMVECTOR b)
+    {
+        // atan2 holds its precision for the tiny angles acos loses
+        const float sine = XMVectorGetX(XMVector3Length(XMVector3Cross(a, b)));
+        const float cosine = XMVectorGetX(XMVector3Dot(a, b));
+        return XMConvertToDegrees(std::atan2(sine, cosine));
+    }
+
+    template <typename T>
+    void Write(uint8_t *dst, const T &value) { memcpy(dst, &value, sizeof(T)); }
+
+    template <typename T>
+    T Read(const uint8_t *src) { T value; memcpy(&value, src, sizeof(T)); return value; }
+}
+
+XMFLOAT2 VertexCodec::OctEncode(FXMVECTOR direction)
+{
+    XMFLOAT3 n;
+    XMStoreFloat3(&n, direction);
+    const float sum = std::fabs(n.x) + std::fabs(n.y) + std::fabs(n.z);
+    float x = n.x / sum;
+    float y = n.y / sum;
+    if (n.z < 0.0f)
+    {
+        // Lower hemisphere folded over the diagonals
+        const float foldedX = (1.0f - std::fabs(y)) * ((x >= 0.0f) ? 1.0f : -1.0f);
+        const float foldedY = (1.0f - std::fabs(x)) * ((y >= 0.0f) ? 1.0f : -1.0f);
+        x = foldedX;
+        y = foldedY;
+    }
+    return XMFLOAT2(x, y);
+}
+
+XMVECTOR VertexCodec::OctDecode(float x, float y)
+{
+    const float z = 1.0f - std::fabs(x) - std::fabs(y);
+    if (z < 0.0f)
+    {
+        const float unfoldedX = (1.0f - std::fabs(y)) * ((x >= 0.0f) ? 1.0f : -1.0f);
+        const float unfoldedY = (1.0f - std::fabs(x)) * ((y >= 0.0f) ? 1.0f : -1.0f);
+        x = unfoldedX;
+        y = unfoldedY;
+    }
+    return XMVector3Normalize(XMVectorSet(x, y, z, 0.0f));
+}
+
+VertexCodec::Encoding VertexCodec::Choose(const SceneVertex *vertices, size_t count, const Options &options)
+{
+    Encoding encoding;
+
+    XMVECTOR boundsMin = XMVectorReplicate(FLT_MAX);
+    XMVECTOR boundsMax = XMVectorReplicate(-FLT_MAX);
+    std::vector<bool> isJointUsed;
+    for (size_t v = 0; v < count; ++v)
+    {
+        const SceneVertex &vertex = vertices[v];
+        const XMVECTOR pos = XMLoadFloat3(&vertex.Pos);
+        boundsMin = XMVectorMin(boundsMin, pos);
+        boundsMax = XMVectorMax(boundsMax, pos);
+
+        const uint32_t joints[4] = { vertex.Joints.x, vertex.Joints.y, vertex.Joints.z, vertex.Joints.w };
+        const float weights[4] = { vertex.Weights.x, vertex.Weights.y, vertex.Weights.z, vertex.Weights.w };
+        for (int k = 0; k < 4; ++k)
+        {
+            if (weights[k] == 0.0f)
+                continue;
+            encoding.isSkinned = true;
+            if (joints[k] >= isJointUsed.size())
+                isJointUsed.resize(joints[k] + 1, false);
+            isJointUsed[joints[k]] = true;
+        }
+    }
+
+    // Joints past 255 are renumbered through a palette of the ones the mesh uses, if they
+    // fit in 8 bits
+    if (isJointUsed.size() > UINT8_MAX + 1)
+    {
+        for (uint32_t joint = 0; joint < (uint32_t)isJointUsed.size(); ++joint)
+            if (isJointUsed[joint])
+                encoding.jointPalette.push_back(joint);
+        if (encoding.jointPalette.size() > UINT8_MAX + 1)
+        {
+            encoding.jointPalette.clear();
+            encoding.hasWideJoints = true;
+        }
+    }
+
+    // Rounding to 16 bits is off by at most half a step of the largest extent
+    if (options.allowQuantisedPositions && (count > 0))
+    {
+        XMFLOAT3 extent;
+        XMStoreFloat3(&extent, boundsMax - boundsMin);
+        const float maxExtent = (std::max)(extent.x, (std::max)(extent.y, extent.z));
+        if (maxExtent * 0.5f / 65535.0f <= options.maxPositionError)
+        {
+            encoding.isQuantised = true;
+            encoding.positionScale = extent;
+            XMStoreFloat3(&encoding.positionOffset, boundsMin);
+        }
+    }
+
+    encoding.stride = GetLayout(encoding).stride;
+    return encoding;
+}
+
+void VertexCodec::Encode(const SceneVertex *vertices, size_t count, const Encoding &encoding, std::vector<uint8_t> &out)
+{
+    const Layout layout = GetLayout(encoding);
+    out.assign(count * layout.stride, 0);
+
+    // Joint to palette slot
+    std::vector<uint8_t> paletteSlots;
+    for (size_t slot = 0; slot < encoding.jointPalette.size(); ++slot)
+    {
+        const uint32_t joint = encoding.jointPalette[slot];
+        if (joint >= paletteSlots.size())
+            paletteSlots.resize(joint + 1, 0);
+        paletteSlots[joint] = (uint8_t)slot;
+    }
+
+    const XMFLOAT3 &scale = encoding.positionScale;
+    const XMFLOAT3 &offset = encoding.positionOffset;
+    auto quantise = [](float value, float offset, float scale) -> uint16_t
+    {
+        if (scale <= 0.0f)
+            return 0;
+        const float unorm = (std::max)(0.0f, (std::min)(1.0f, (value - offset) / scale));
+        return (uint16_t)std::lround(unorm * 65535.0f);
+    };
+
+    for (size_t v = 0; v < count; ++v)
+    {
+        const SceneVertex &vertex = vertices[v];
+        uint8_t *dst = out.data() + v * layout.stride;
+
+        if (encoding.isQuantised)
+        {
+            const uint16_t pos[4] = { quantise(vertex.Pos.x, offset.x, scale.x),
+                                      quantise(vertex.Pos.y, offset.y, scale.y),
+                                      quantise(vertex.Pos.z, offset.z, scale.z), 0 };
+            Write(dst + layout.position, pos);
+        }
+        else
+            Write(dst + layout.position, vertex.Pos);
+
+        const XMFLOAT2 normal = OctEncode(SafeNormalize3(XMLoadFloat3(&vertex.Normal)));
+        const int16_t packedNormal[2] = { ToSnorm16(normal.x), ToSnorm16(normal.y) };
+        Write(dst + layout.normal, packedNormal);
+
+        const XMFLOAT2 tangent = OctEncode(SafeNormalize3(XMLoadFloat4(&vertex.Tangent)));
+        const int16_t packedTangent[2] = { ToSnorm16(tangent.x), ToSnorm15WithSign(tangent.y, vertex.Tangent.w) };
+        Write(dst + layout.tangent, packedTangent);
+
+        const HALF uv[2] = { XMConvertFloatToHalf(vertex.Tex.x), XMConvertFloatToHalf(vertex.Tex.y) };
+        Write(dst + layout.uv, uv);
+
+        if (!encoding.isSkinned)
+            continue;
+
+        // Joints without weight are written as 0, they may not fit the narrow indices
+        const uint32_t joints[4] = { vertex.Joints.x, vertex.Joints.y, vertex.Joints.z, vertex.Joints.w };
+        const float weights[4] = { vertex.Weights.x, vertex.Weights.y, vertex.Weights.z, vertex.Weights.w };
+        if (encoding.hasWideJoints)
+        {
+            uint16_t packedJoints[4];
+            for (int k = 0; k < 4; ++k)
+                packedJoints[k] = (weights[k] != 0.0f) ? (uint16_t)joints[k] : 0;
+            Write(dst + layout.joints, packedJoints);
+        }
+        else
+        {
+            uint8_t packedJoints[4];
+            for (int k = 0; k < 4; ++k)
+            {
+                if (weights[k] == 0.0f)
+                    packedJoints[k] = 0;
+                else
+                    packedJoints[k] = paletteSlots.empty() ? (uint8_t)joints[k] : paletteSlots[joints[k]];
+            }
+            Write(dst + layout.joints, packedJoints);
+        }
+
+        // Rounded weights are corrected on the largest one, so they still add up to 255
+        int packedWeights[4];
+        int sum = 0, largest = 0;
+        for (int k = 0; k < 4; ++k)
+        {
+            packedWeights[k] = (int)std::lround((std::max)(0.0f, (std::min)(1.0f, weights[k])) * 255.0f);
+            sum += packedWeights[k];
+            if (packedWeights[k] > packedWeights[largest])
+                largest = k;
+        }
+        if (sum > 0)
+            packedWeights[largest] = (std::max)(0, (std::min)(255, packedWeights[largest] + 255 - sum));
+        const uint8_t bytes[4] = { (uint8_t)packedWeights[0], (uint8_t)packedWeights[1],
+                                   (uint8_t)packedWeights[2], (uint8_t)packedWeights[3] };
+        Write(dst + layout.weights, bytes);
+    }
+}
+
+void VertexCodec::Decode(const uint8_t *data, size_t count, const Encoding &encoding, std::vector<SceneVertex> &out)
+{
+    const Layout layout = GetLayout(encoding);
+    out.resize(count);
+
+    for (size_t v = 0; v < count; ++v)
+    {
+        const uint8_t *src = data + v * layout.stride;
+        SceneVertex &vertex = out[v];
+        vertex = SceneVertex();
+
+        if (encoding.isQuantised)
+        {
+            uint16_t pos[4];
+            memcpy(pos, src + layout.position, sizeof(pos));
+            vertex.Pos.x = pos[0] / 65535.0f * encoding.positionScale.x + encoding.positionOffset.x;
+            vertex.Pos.y = pos[1] / 65535.0f * encoding.positionScale.y + encoding.positionOffset.y;
+            vertex.Pos.z = pos[2] / 65535.0f * encoding.positionScale.z + encoding.positionOffset.z;
+        }
+        else
+            vertex.Pos = Read<XMFLOAT3>(src + layout.position);
+
+        int16_t packedNormal[2];
+        memcpy(packedNormal, src + layout.normal, sizeof(packedNormal));
+        XMStoreFloat3(&vertex.Normal, OctDecode(FromSnorm16(packedNormal[0]), FromSnorm16(packedNormal[1])));
+
+        int16_t packedTangent[2];
+        memcpy(packedTangent, src + layout.tangent, sizeof(packedTangent));
+        float handedness;
+        const float tangentY = FromSnorm15WithSign(packedTangent[1], handedness);
+        XMStoreFloat4(&vertex.Tangent, XMVectorSetW(OctDecode(FromSnorm16(packedTangent[0]), tangentY), handedness));
+
+        HALF uv[2];
+        memcpy(uv, src + layout.uv, sizeof(uv));
+        vertex.Tex = XMFLOAT2(XMConvertHalfToFloat(uv[0]), XMConvertHalfToFloat(uv[1]));
+
+        if (!encoding.isSkinned)
+            continue;
+
+        if (encoding.hasWideJoints)
+        {
+            uint16_t joints[4];
+            memcpy(joints, src + layout.joints, sizeof(joints));
+            vertex.Joints = XMUINT4(joints[0], joints[1], joints[2], joints[3]);
+        }
+        else
+        {
+            uint8_t joints[4];
+            memcpy(joints, src + layout.joints, sizeof(joints));
+            const auto &palette = encoding.jointPalette;
+            if (palette.empty())
+                vertex.Joints = XMUINT4(joints[0], joints[1], joints[2], joints[3]);
+            else
+                vertex.Joints = XMUINT4(palette[joints[0]], palette[joints[1]], palette[joints[2]], palette[joints[3]]);
+        }
+
+        uint8_t weights[4];
+        memcpy(weights, src + layout.weights, sizeof(weights));
+        vertex.Weights = XMFLOAT4(weights[0] / 255.0f, weights[1] / 255.0f, weights[2] / 255.0f, weights[3] / 255.0f);
+    }
+}
+
+VertexCodec::Error VertexCodec::Measure(const SceneVertex *original, const SceneVertex *decoded, size_t count)
+{
+    Error error;
+    for (size_t v = 0; v < count; ++v)
+    {
+        const SceneVertex &a = original[v];
+        const SceneVertex &b = decoded[v];
+
+        XMFLOAT3 diff;
+        XMStoreFloat3(&diff, XMVectorAbs(XMLoadFloat3(&a.Pos) - XMLoadFloat3(&b.Pos)));
+        error.position = (std::max)(error.position, (std::max)(diff.x, (std::max)(diff.y, diff.z)));
+
+        error.normalDegrees = (std::max)(error.normalDegrees,
+                                         AngleDegrees(SafeNormalize3(XMLoadFloat3(&a.Normal)), XMLoadFloat3(&b.Normal)));
+        error.tangentDegrees = (std::max)(error.tangentDegrees,
+                                          AngleDegrees(SafeNormalize3(XMLoadFloat4(&a.Tangent)), XMVectorSetW(XMLoadFloat4(&b.Tangent), 0.0f)));
+        if ((a.Tangent.w < 0.0f) != (b.Tangent.w < 0.0f))
+            error.handednessFlips++;
+
+        error.uv = (std::max)(error.uv, (std::max)(std::fabs(a.Tex.x - b.Tex.x), std::fabs(a.Tex.y - b.Tex.y)));
+
+        const uint32_t jointsA[4] = { a.Joints.x, a.Joints.y, a.Joints.z, a.Joints.w };
+        const uint32_t jointsB[4] = { b.Joints.x, b.Joints.y, b.Joints.z, b.Joints.w };
+        const float weightsA[4] = { a.Weights.x, a.Weights.y, a.Weights.z, a.Weights.w };
+        const float weightsB[4] = { b.Weights.x, b.Weights.y, b.Weights.z, b.Weights.w };
+        for (int k = 0; k < 4; ++k)
+        {
+            error.weight = (std::max)(error.weight, std::fabs(weightsA[k] - weightsB[k]));
+            if ((weightsA[k] != 0.0f) && (jointsA[k] != jointsB[k]))
+                error.jointMismatches++;
+        }
+    }
+    return error;
+}
+
+size_t VertexCodec::GetInputLayout(const Encoding &encoding, UINT slot, D3D11_INPUT_ELEMENT_DESC *elements)
+{
+    const Layout layout = GetLayout(encoding);
+    size_t count = 0;
+    elements[count++] = { "POSITION", 0, encoding.isQuantised ? DXGI_FORMAT_R16G16B16A16_UNORM : DXGI_FORMAT_R32G32B32_FLOAT,
+                          slot, layout.position, D3D11_INPUT_PER_VERTEX_DATA, 0 };
+    elements[count++] = { "NORMAL", 0, DXGI_FORMAT_R16G16_SNORM, slot, layout.normal, D3D11_INPUT_PER_VERTEX_DATA, 0 };
+    elements[count++] = { "TANGENT", 0, DXGI_FORMAT_R16G16_SNORM, slot, layout.tangent, D3D11_INPUT_PER_VERTEX_DATA, 0 };
+    elements[count++] = { "TEXCOORD", 0, DXGI_FORMAT_R16G16_FLOAT, slot, layout.uv, D3D11_INPUT_PER_VERTEX_DATA, 0 };
+    if (encoding.isSkinned)
+    {
+        elements[count++] = { "BLENDINDICES", 0, encoding.hasWideJoints ? DXGI_FORMAT_R16G16B16A16_UINT : DXGI_FORMAT_R8G8B8A8_UINT,
+                              slot, layout.joints, D3D11_INPUT_PER_VERTEX_DATA, 0 };
+        elements[count++] = { "BLENDWEIGHT", 0, DXGI_FORMAT_R8G8B8A8_UNORM, slot, layout.weights, D3D11_INPUT_PER_VERTEX_DATA, 0 };
+    }
+    return count;
+}
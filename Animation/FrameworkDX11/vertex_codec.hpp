@@ -0,0 +1,86 @@
+#pragma once
+
+#include "scene_vertex.hpp"
+
+// We are using an older version of DirectX headers which causes
+// "warning C4005: '...' : macro redefinition"
+#pragma warning(push)
+#pragma warning(disable: 4005)
+#include <d3d11.h>
+#pragma warning(pop)
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+// Compact encodings of SceneVertex (80 bytes) for vertex buffers:
+//   position   float3, or unorm16x4 within the mesh bounds (w unused)
+//   normal     octahedral snorm16x2
+//   tangent    octahedral snorm16x2, the handedness in the lowest bit of y
+//   uv         half2
+//   joints     uint8x4, into the mesh's joint palette if an index is past 255,
+//              or uint16x4 if the mesh uses more than 256 joints   (skinned meshes only)
+//   weights    unorm8x4, rounded so they still sum to 1            (skinned meshes only)
+// which makes 20 to 32 bytes per vertex. The one exception is a mesh with float positions
+// and more than 256 joints: 36 bytes. The encoding is chosen per mesh, with the input
+// layout to match; the vertex shader has to undo the position quantisation and the
+// octahedral mapping itself, and a mesh with a palette needs its skin matrices in palette order.
+class VertexCodec
+{
+public:
+
+    static const size_t MaxInputElements = 6;
+
+    struct Options
+    {
+        bool    allowQuantisedPositions = true;
+        float   maxPositionError = 1e-3f;   // in model units; larger meshes keep float positions
+    };
+
+    struct Encoding
+    {
+        bool        isQuantised = false;    // unorm16 positions
+        bool        isSkinned = false;      // has joints and weights at all
+        bool        hasWideJoints = false;  // uint16 joint indices
+        UINT        stride = 0;
+
+        // Joint of each palette slot the uint8 indices refer to, ascending. Empty if the
+        // indices are the joints themselves.
+        std::vector<uint32_t> jointPalette;
+
+        // Quantised positions are decoded as unorm * scale + offset, before the world matrix
+        XMFLOAT3    positionScale = XMFLOAT3(1.0f, 1.0f, 1.0f);
+        XMFLOAT3    positionOffset = XMFLOAT3(0.0f, 0.0f, 0.0f);
+    };
+
+    // Largest difference of any vertex between the source and the decoded data
+    struct Error
+    {
+        float   position = 0.0f;            // model units
+        float   normalDegrees = 0.0f;
+        float   tangentDegrees = 0.0f;
+        size_t  handednessFlips = 0;
+        float   uv = 0.0f;
+        float   weight = 0.0f;
+        size_t  jointMismatches = 0;        // of joints with a non-zero weight
+    };
+
+    // Smallest encoding for the mesh within the options. Meshes without any skin weight
+    // drop the skin attributes.
+    static Encoding Choose(const SceneVertex *vertices, size_t count, const Options &options);
+    static Encoding Choose(const SceneVertex *vertices, size_t count) { return Choose(vertices, count, Options()); }
+
+    // 'out' gets count * encoding.stride bytes
+    static void Encode(const SceneVertex *vertices, size_t count, const Encoding &encoding, std::vector<uint8_t> &out);
+    static void Decode(const uint8_t *data, size_t count, const Encoding &encoding, std::vector<SceneVertex> &out);
+
+    static Error Measure(const SceneVertex *original, const SceneVertex *decoded, size_t count);
+
+    // Elements of the vertex buffer's input layout, all in 'slot', with the renderer's
+    // semantics; returns how many were written (up to MaxInputElements)
+    static size_t GetInputLayout(const Encoding &encoding, UINT slot, D3D11_INPUT_ELEMENT_DESC *elements);
+
+    // Octahedral mapping of a unit vector onto [-1, 1]^2 and back
+    static XMFLOAT2 OctEncode(FXMVECTOR direction);
+    static XMVECTOR OctDecode(float x, float y);
+};
@@ -0,0 +1,119 @@
+#include "vertex_streams.hpp"
+#include "structures.h"
+
+#include <cstring>
+
+static_assert(sizeof(PositionVertex) == 12, "PositionVertex must match the position stream's layout");
+static_assert(sizeof(AttributeVertex) == 36, "AttributeVertex must match the attribute stream's layout");
+static_assert(sizeof(SkinVertex) == 32, "SkinVertex must match the skin stream's layout");
+
+UINT VertexStreams::GetSlot(Stream stream)
+{
+    switch (stream)
+    {
+    case ePositionStream:   return PositionStreamSlot;
+    case eAttributeStream:  return AttributeStreamSlot;
+    case eSkinStream:       return SkinStreamSlot;
+    default:                return 0;
+    }
+}
+
+UINT VertexStreams::GetStride(Stream stream)
+{
+    switch (stream)
+    {
+    case ePositionStream:   return sizeof(PositionVertex);
+    case eAttributeStream:  return sizeof(AttributeVertex);
+    case eSkinStream:       return sizeof(SkinVertex);
+    default:                return 0;
+    }
+}
+
+UINT VertexStreams::GetVertexSize(bool isSkinned)
+{
+    UINT size = 0;
+    for (UINT stream = 0; stream < GetStreamCount(isSkinned); ++stream)
+        size += GetStride((Stream)stream);
+    return size;
+}
+
+VertexStreams::Layout VertexStreams::GetLayout(bool isSkinned, bool isDepthOnly)
+{
+    if (isDepthOnly)
+        return isSkinned ? eSkinnedDepthLayout : eDepthLayout;
+    return isSkinned ? eSkinnedLayout : eStaticLayout;
+}
+
+bool VertexStreams::HasSkin(const SceneVertex *vertices, size_t count)
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        const XMFLOAT4 &weights = vertices[i].Weights;
+        if ((weights.x != 0.0f) || (weights.y != 0.0f) || (weights.z != 0.0f) || (weights.w != 0.0f))
+            return true;
+    }
+    return false;
+}
+
+void VertexStreams::Extract(const SceneVertex *vertices, size_t count, Stream stream, std::vector<uint8_t> &out)
+{
+    out.resize(count * GetStride(stream));
+    switch (stream)
+    {
+    case ePositionStream:
+    {
+        PositionVertex *dst = reinterpret_cast<PositionVertex*>(out.data());
+        for (size_t i = 0; i < count; ++i)
+            dst[i].Pos = vertices[i].Pos;
+        break;
+    }
+    case eAttributeStream:
+    {
+        AttributeVertex *dst = reinterpret_cast<AttributeVertex*>(out.data());
+        for (size_t i = 0; i < count; ++i)
+        {
+            dst[i].Normal = vertices[i].Normal;
+            dst[i].Tangent = vertices[i].Tangent;
+            dst[i].Tex = vertices[i].Tex;
+        }
+        break;
+    }
+    case eSkinStream:
+    {
+        SkinVertex *dst = reinterpret_cast<SkinVertex*>(out.data());
+        for (size_t i = 0; i < count; ++i)
+        {
+            dst[i].Joints = vertices[i].Joints;
+            dst[i].Weights = vertices[i].Weights;
+        }
+        break;
+    }
+    default:
+        out.clear();
+        break;
+    }
+}
+
+size_t VertexStreams::GetInputLayout(Layout layout, D3D11_INPUT_ELEMENT_DESC *elements)
+{
+    size_t count = 0;
+    elements[count++] = { "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, PositionStreamSlot,
+                          offsetof(PositionVertex, Pos), D3D11_INPUT_PER_VERTEX_DATA, 0 };
+    if (!IsDepthOnly(layout))
+    {
+        elements[count++] = { "NORMAL", 0, DXGI_FORMAT_R32G32B32_FLOAT, AttributeStreamSlot,
+                              offsetof(AttributeVertex, Normal), D3D11_INPUT_PER_VERTEX_DATA, 0 };
+        elements[count++] = { "TANGENT", 0, DXGI_FORMAT_R32G32B32A32_FLOAT, AttributeStreamSlot,
+                              offsetof(AttributeVertex, Tangent), D3D11_INPUT_PER_VERTEX_DATA, 0 };
+        elements[count++] = { "TEXCOORD", 0, DXGI_FORMAT_R32G32_FLOAT, AttributeStreamSlot,
+                              offsetof(AttributeVertex, Tex), D3D11_INPUT_PER_VERTEX_DATA, 0 };
+    }
+    if (IsSkinned(layout))
+    {
+        elements[count++] = { "BLENDINDICES", 0, DXGI_FORMAT_R32G32B32A32_UINT, SkinStreamSlot,
+                              offsetof(SkinVertex, Joints), D3D11_INPUT_PER_VERTEX_DATA, 0 };
+        elements[count++] = { "BLENDWEIGHT", 0, DXGI_FORMAT_R32G32B32A32_FLOAT, SkinStreamSlot,
+                              offsetof(SkinVertex, Weights), D3D11_INPUT_PER_VERTEX_DATA, 0 };
+    }
+    return count;
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include "scene_vertex.hpp"
+
+// We are using an older version of DirectX headers which causes
+// "warning C4005: '...' : macro redefinition"
+#pragma warning(push)
+#pragma warning(disable: 4005)
+#include <d3d11.h>
+#pragma warning(pop)
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+// SceneVertex (80 bytes) split into one vertex buffer per group of attributes, so a pass
+// only fetches what its vertex shader reads:
+//   position     PositionVertex,  12 bytes, PositionStreamSlot    every pass
+//   attributes   AttributeVertex, 36 bytes, AttributeStreamSlot   shading passes
+//   skin         SkinVertex,      32 bytes, SkinStreamSlot        skinned meshes only
+// All streams of a mesh are indexed alike. Static meshes have no skin stream at all, and a
+// depth-only pass binds the positions alone (plus the skin of skinned meshes).
+class VertexStreams
+{
+public:
+
+    enum Stream
+    {
+        ePositionStream = 0,
+        eAttributeStream,
+        eSkinStream,
+
+        eStreamCount
+    };
+
+    // Input layouts of the scene geometry, each with its own vertex shader entry
+    enum Layout
+    {
+        eStaticLayout = 0,          // positions and attributes
+        eSkinnedLayout,             // positions, attributes and skin
+        eDepthLayout,               // positions
+        eSkinnedDepthLayout,        // positions and skin
+
+        eLayoutCount
+    };
+
+    static const size_t MaxInputElements = 6;
+
+    static UINT GetSlot(Stream stream);
+    static UINT GetStride(Stream stream);
+    // Leading streams a mesh has: without skin, the first two
+    static UINT GetStreamCount(bool isSkinned) { return isSkinned ? eStreamCount : eSkinStream; }
+    // Device bytes per vertex, all streams of the mesh
+    static UINT GetVertexSize(bool isSkinned);
+
+    static Layout GetLayout(bool isSkinned, bool isDepthOnly);
+    static bool IsSkinned(Layout layout) { return (layout == eSkinnedLayout) || (layout == eSkinnedDepthLayout); }
+    static bool IsDepthOnly(Layout layout) { return (layout == eDepthLayout) || (layout == eSkinnedDepthLayout); }
+
+    // Whether any vertex has a skin weight; meshes without one drop the skin stream
+    static bool HasSkin(const SceneVertex *vertices, size_t count);
+
+    // The stream's part of every vertex, count * GetStride(stream) bytes
+    static void Extract(const SceneVertex *vertices, size_t count, Stream stream, std::vector<uint8_t> &out);
+
+    // Per-vertex elements of the layout; returns how many were written (up to MaxInputElements).
+    // Per-instance elements are up to the caller.
+    static size_t GetInputLayout(Layout layout, D3D11_INPUT_ELEMENT_DESC *elements);
+};
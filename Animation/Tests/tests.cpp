@@ -0,0 +1,678 @@
+//--------------------------------------------------------------------------------------
+// File: tests.cpp
+//
+// Checks of the framework code that needs no device. Prints every failed check and
+// returns a non-zero exit code if there was one.
+//--------------------------------------------------------------------------------------
+
+#include "../FrameworkDX11/tlsf_allocator.hpp"
+#include "../FrameworkDX11/static_batcher.hpp"
+#include "../FrameworkDX11/vertex_codec.hpp"
+#include "../FrameworkDX11/transform_hierarchy.hpp"
+#include "../FrameworkDX11/QuaternionInterp.h"
+#include "../FrameworkDX11/AnimationLibrary.h"
+
+#include <cstdio>
+#include <cmath>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+    int sChecks = 0;
+    int sFailures = 0;
+
+    void Check(bool condition, const char *expression, const char *file, int line)
+    {
+        sChecks++;
+        if (condition)
+            return;
+        sFailures++;
+        printf("%s(%d): check failed: %s\n", file, line, expression);
+    }
+}
+
+#define CHECK(condition) Check((condition), #condition, __FILE__, __LINE__)
+
+//--------------------------------------------------------------------------------------
+// QuatInterp
+//--------------------------------------------------------------------------------------
+
+// Random rotation pairs, b within 'maxAngle' degrees of a
+static void MakeRotationPairs(size_t count, float maxAngle, std::vector<XMFLOAT4> &a, std::vector<XMFLOAT4> &b)
+{
+    std::mt19937 rng(11);
+    std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+    a.resize(count);
+    b.resize(count);
+    for (size_t i = 0; i < count; ++i)
+    {
+        const XMVECTOR q = XMQuaternionNormalize(XMVectorSet(unit(rng), unit(rng), unit(rng), unit(rng)));
+        const XMVECTOR axis = XMVector3Normalize(XMVectorSet(unit(rng), unit(rng), unit(rng), 0.0f));
+        const float angle = XMConvertToRadians(maxAngle) * (0.5f + 0.5f * unit(rng));
+        XMStoreFloat4(&a[i], q);
+        XMStoreFloat4(&b[i], XMQuaternionMultiply(q, XMQuaternionRotationAxis(axis, angle)));
+        // Either sign of b is the same rotation, the interpolation has to take the short way
+        if (i % 2)
+            XMStoreFloat4(&b[i], XMVectorNegate(XMLoadFloat4(&b[i])));
+    }
+}
+
+// Largest angle in degrees between the tier's results and slerp's
+static float MaxRotationError(const std::vector<XMFLOAT4> &a, const std::vector<XMFLOAT4> &b, RotationPrecision tier)
+{
+    const float ts[] = { 0.1f, 0.25f, 0.4f, 0.5f, 0.6f, 0.75f, 0.9f };
+    std::vector<XMFLOAT4> exact(a.size()), approx(a.size());
+    float maxError = 0.0f;
+    for (float t : ts)
+    {
+        QuatInterp::InterpolateN(a.data(), b.data(), t, exact.data(), a.size(), RotationPrecision::Slerp);
+        QuatInterp::InterpolateN(a.data(), b.data(), t, approx.data(), a.size(), tier);
+        for (size_t i = 0; i < a.size(); ++i)
+            maxError = (std::max)(maxError, QuatInterp::AngularDistance(XMLoadFloat4(&exact[i]), XMLoadFloat4(&approx[i])));
+    }
+    return XMConvertToDegrees(maxError);
+}
+
+static void TestRotationPrecision()
+{
+    const RotationPrecision tiers[] = { RotationPrecision::Slerp,
+                                        RotationPrecision::CorrectedNlerp,
+                                        RotationPrecision::Nlerp };
+
+    // Key to key rotations of an animation, and the blend between two unrelated poses
+    std::vector<XMFLOAT4> a, b;
+    MakeRotationPairs(1001, 30.0f, a, b);
+    const float keyNlerp = MaxRotationError(a, b, RotationPrecision::Nlerp);
+    CHECK(MaxRotationError(a, b, RotationPrecision::CorrectedNlerp) < 0.05f);
+    CHECK(keyNlerp < 0.1f);
+
+    std::vector<XMFLOAT4> wideA, wideB;
+    MakeRotationPairs(1001, 180.0f, wideA, wideB);
+    const float wideCorrected = MaxRotationError(wideA, wideB, RotationPrecision::CorrectedNlerp);
+    const float wideNlerp = MaxRotationError(wideA, wideB, RotationPrecision::Nlerp);
+    CHECK(wideCorrected < 0.05f);
+    CHECK(wideNlerp > keyNlerp);
+    CHECK(wideNlerp > 10.0f * wideCorrected);
+
+    // The batched evaluator matches the one at a time one, the tail that is not a multiple
+    // of four included, and returns unit quaternions
+    bool isSame = true, isUnit = true;
+    std::vector<XMFLOAT4> batched(wideA.size());
+    for (RotationPrecision tier : tiers)
+    {
+        QuatInterp::InterpolateN(wideA.data(), wideB.data(), 0.37f, batched.data(), batched.size(), tier);
+        for (size_t i = 0; i < batched.size(); ++i)
+        {
+            const XMVECTOR single = QuatInterp::Interpolate(XMLoadFloat4(&wideA[i]), XMLoadFloat4(&wideB[i]), 0.37f, tier);
+            isSame = isSame && (XMConvertToDegrees(QuatInterp::AngularDistance(single, XMLoadFloat4(&batched[i]))) < 0.01f);
+            isUnit = isUnit && (fabsf(XMVectorGetX(XMVector4Length(XMLoadFloat4(&batched[i]))) - 1.0f) < 1e-4f);
+        }
+    }
+    CHECK(isSame);
+    CHECK(isUnit);
+
+    // The end points are the inputs, up to the sign
+    const XMVECTOR start = QuatInterp::Interpolate(XMLoadFloat4(&wideA[1]), XMLoadFloat4(&wideB[1]), 0.0f, RotationPrecision::CorrectedNlerp);
+    const XMVECTOR end = QuatInterp::Interpolate(XMLoadFloat4(&wideA[1]), XMLoadFloat4(&wideB[1]), 1.0f, RotationPrecision::CorrectedNlerp);
+    CHECK(QuatInterp::AngularDistance(start, XMLoadFloat4(&wideA[1])) < 1e-3f);
+    CHECK(QuatInterp::AngularDistance(end, XMLoadFloat4(&wideB[1])) < 1e-3f);
+}
+
+//--------------------------------------------------------------------------------------
+// TlsfAllocator
+//--------------------------------------------------------------------------------------
+
+// No two live allocations overlap and all lie within the range
+static bool IsDisjoint(std::vector<TlsfAllocator::Allocation> allocations, uint32_t capacity)
+{
+    std::sort(allocations.begin(), allocations.end(),
+              [](const TlsfAllocator::Allocation &a, const TlsfAllocator::Allocation &b) { return a.offset < b.offset; });
+    uint64_t end = 0;
+    for (const auto &allocation : allocations)
+    {
+        if (allocation.offset < end)
+            return false;
+        end = (uint64_t)allocation.offset + allocation.size;
+    }
+    return end <= capacity;
+}
+
+static void TestTlsfFillAndFree()
+{
+    const uint32_t capacity = 4096;
+    TlsfAllocator tlsf(capacity);
+
+    std::vector<TlsfAllocator::Allocation> live;
+    TlsfAllocator::Allocation allocation;
+    while (tlsf.Allocate(64, allocation))
+    {
+        CHECK(allocation.size >= 64);
+        CHECK(tlsf.GetOffset(allocation.block) == allocation.offset);
+        live.push_back(allocation);
+    }
+    CHECK(live.size() == capacity / 64);
+    CHECK(IsDisjoint(live, capacity));
+    CHECK(tlsf.GetStats().used == capacity);
+    CHECK(tlsf.Validate());
+
+    // Freeing every other block leaves holes too small for a larger request
+    for (size_t i = 0; i < live.size(); i += 2)
+        tlsf.Free(live[i].block);
+    CHECK(tlsf.Validate());
+    CHECK(!tlsf.Allocate(128, allocation));
+
+    // ...until the neighbours are freed and merged with them
+    for (size_t i = 1; i < live.size(); i += 2)
+        tlsf.Free(live[i].block);
+    CHECK(tlsf.Validate());
+
+    const TlsfAllocator::Stats stats = tlsf.GetStats();
+    CHECK(stats.used == 0);
+    CHECK(stats.allocations == 0);
+    CHECK(stats.freeBlocks == 1);
+    CHECK(stats.largestFree == capacity);
+    CHECK(tlsf.Allocate(capacity, allocation) && (allocation.offset == 0));
+    CHECK(!tlsf.Allocate(1, allocation));
+}
+
+static void TestTlsfRandom()
+{
+    const uint32_t capacity = 1 << 20;
+    TlsfAllocator tlsf(capacity);
+
+    std::mt19937 rng(3);
+    std::vector<TlsfAllocator::Allocation> live;
+    bool isValid = true;
+    for (int op = 0; op < 20000; ++op)
+    {
+        if (!live.empty() && (rng() % 3 == 0))
+        {
+            const size_t victim = rng() % live.size();
+            tlsf.Free(live[victim].block);
+            live[victim] = live.back();
+            live.pop_back();
+        }
+        else
+        {
+            TlsfAllocator::Allocation allocation;
+            if (tlsf.Allocate(1 + rng() % 4000, allocation))
+                live.push_back(allocation);
+        }
+        if (op % 1000 == 0)
+            isValid = isValid && tlsf.Validate() && IsDisjoint(live, capacity);
+    }
+    CHECK(isValid);
+    CHECK(tlsf.Validate());
+    CHECK(IsDisjoint(live, capacity));
+    CHECK(tlsf.GetStats().allocations == live.size());
+}
+
+static void TestTlsfDefragment()
+{
+    const uint32_t capacity = 1 << 16;
+    TlsfAllocator tlsf(capacity);
+
+    std::mt19937 rng(9);
+    std::vector<TlsfAllocator::Allocation> live;
+    for (int i = 0; i < 400; ++i)
+    {
+        TlsfAllocator::Allocation allocation;
+        if (tlsf.Allocate(8 + rng() % 200, allocation))
+            live.push_back(allocation);
+    }
+    for (size_t i = 0; i < live.size(); i += 3)
+        tlsf.Free(live[i].block);
+    std::vector<TlsfAllocator::Allocation> kept;
+    for (size_t i = 0; i < live.size(); ++i)
+        if (i % 3 != 0)
+            kept.push_back(live[i]);
+
+    const uint32_t used = tlsf.GetStats().used;
+    std::vector<TlsfAllocator::Relocation> relocations;
+    tlsf.Defragment(relocations);
+    CHECK(tlsf.Validate());
+
+    // Sizes and order are kept, the used blocks are packed to the front
+    std::sort(kept.begin(), kept.end(),
+              [](const TlsfAllocator::Allocation &a, const TlsfAllocator::Allocation &b) { return a.offset < b.offset; });
+    uint32_t offset = 0;
+    bool isPacked = true;
+    for (const auto &allocation : kept)
+    {
+        isPacked = isPacked && (tlsf.GetSize(allocation.block) == allocation.size) &&
+                   (tlsf.GetOffset(allocation.block) == offset);
+        offset += allocation.size;
+    }
+    CHECK(isPacked);
+    CHECK(offset == used);
+
+    // Every block that moved is listed, with where it was
+    bool isListed = true;
+    for (const auto &allocation : kept)
+    {
+        if (tlsf.GetOffset(allocation.block) == allocation.offset)
+            continue;
+        const auto it = std::find_if(relocations.begin(), relocations.end(),
+                                     [&](const TlsfAllocator::Relocation &r) { return r.block == allocation.block; });
+        isListed = isListed && (it != relocations.end()) && (it->oldOffset == allocation.offset) &&
+                   (it->newOffset == tlsf.GetOffset(allocation.block)) && (it->size == allocation.size);
+    }
+    CHECK(isListed);
+
+    const TlsfAllocator::Stats stats = tlsf.GetStats();
+    CHECK(stats.freeBlocks == 1);
+    CHECK(stats.largestFree == capacity - used);
+}
+
+// Mesh-sized ranges streamed in and out, then a copy defragmented: the copy is packed and
+// keeps every size, the original is left as it was
+static void TestTlsfDefragmentCopy()
+{
+    const uint32_t capacity = 1 << 22;
+    TlsfAllocator tlsf(capacity);
+
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<float> logSize(std::log(24.0f), std::log(8192.0f));
+    std::vector<TlsfAllocator::Allocation> live;
+    for (int op = 0; op < 20000; ++op)
+    {
+        if (live.size() >= 1500)
+        {
+            const size_t victim = rng() % live.size();
+            tlsf.Free(live[victim].block);
+            live[victim] = live.back();
+            live.pop_back();
+        }
+        TlsfAllocator::Allocation allocation;
+        if (tlsf.Allocate((uint32_t)std::exp(logSize(rng)), allocation))
+            live.push_back(allocation);
+    }
+    const TlsfAllocator::Stats before = tlsf.GetStats();
+    CHECK(before.freeBlocks > 1);
+
+    TlsfAllocator packed = tlsf;
+    std::vector<TlsfAllocator::Relocation> relocations;
+    packed.Defragment(relocations);
+    CHECK(packed.Validate());
+    CHECK(packed.GetStats().freeBlocks == 1);
+    CHECK(!relocations.empty());
+
+    bool isKept = true;
+    for (const auto &allocation : live)
+        isKept = isKept && (packed.GetSize(allocation.block) == allocation.size) &&
+                 (tlsf.GetOffset(allocation.block) == allocation.offset);
+    CHECK(isKept);
+    CHECK(tlsf.Validate());
+    CHECK(tlsf.GetStats().freeBlocks == before.freeBlocks);
+}
+
+//--------------------------------------------------------------------------------------
+// StaticBatcher
+//--------------------------------------------------------------------------------------
+
+// 'count' unit cubes along x, every 'materialCount'th sharing a material
+static void AddCubes(StaticBatcher &batcher, size_t count, uint32_t materialCount)
+{
+    std::vector<SceneVertex> vertices(8);
+    for (size_t v = 0; v < vertices.size(); ++v)
+        vertices[v].Pos = XMFLOAT3((v & 1) ? 0.5f : -0.5f, (v & 2) ? 0.5f : -0.5f, (v & 4) ? 0.5f : -0.5f);
+    const uint32_t indices[36] =
+    {
+        0, 2, 1, 1, 2, 3,   4, 5, 6, 5, 7, 6,   0, 1, 4, 1, 5, 4,
+        2, 6, 3, 3, 6, 7,   0, 4, 2, 2, 4, 6,   1, 3, 5, 3, 7, 5,
+    };
+
+    for (size_t i = 0; i < count; ++i)
+        batcher.Add(vertices.data(), vertices.size(), indices, 36, D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST,
+                    (uint32_t)(i % materialCount), XMMatrixTranslation(2.0f * i, 0.0f, 0.0f));
+}
+
+// The ranges draw exactly the visible subranges: each one starts on a visible subrange,
+// none overlap, touching ranges of a batch were merged, and the index count adds up
+static bool CoversVisible(const StaticBatcher &batcher, const std::vector<FrustumCuller::ViewMask> &masks,
+                          const std::vector<StaticBatcher::DrawRange> &ranges)
+{
+    size_t visible = 0;
+    for (auto mask : masks)
+        visible += (mask != 0);
+
+    size_t indexCount = 0;
+    for (size_t r = 0; r < ranges.size(); ++r)
+    {
+        const auto &range = ranges[r];
+        if ((range.firstSubrange >= batcher.GetSubrangeCount()) || !masks[range.firstSubrange] ||
+            (range.batch >= batcher.GetBatchCount()) || (range.indexCount == 0))
+            return false;
+        if ((r > 0) && (ranges[r - 1].batch == range.batch) &&
+            (ranges[r - 1].startIndex + ranges[r - 1].indexCount >= range.startIndex))
+            return false;
+        indexCount += range.indexCount;
+    }
+    return indexCount == visible * 36;
+}
+
+static void TestStaticBatcherDrawRanges()
+{
+    const size_t cubeCount = 64;
+    StaticBatcher batcher;
+    AddCubes(batcher, cubeCount, 2);
+
+    // Strips can't be concatenated
+    const SceneVertex stripVertices[3] = {};
+    const uint32_t stripIndices[3] = { 0, 1, 2 };
+    CHECK(!batcher.Add(stripVertices, 3, stripIndices, 3, D3D11_PRIMITIVE_TOPOLOGY_TRIANGLESTRIP, 0, XMMatrixIdentity()));
+
+    batcher.Finish();
+    CHECK(batcher.GetBatchCount() == 2);
+    CHECK(batcher.GetSubrangeCount() == cubeCount);
+    CHECK(batcher.GetStats().primitives == cubeCount);
+    CHECK(batcher.GetStats().rejected == 1);
+
+    std::vector<StaticBatcher::DrawRange> ranges;
+
+    // Everything visible: one draw per batch
+    batcher.GetDrawRanges(nullptr, ranges);
+    CHECK(ranges.size() == batcher.GetBatchCount());
+    std::vector<FrustumCuller::ViewMask> masks(cubeCount, 1);
+    batcher.GetDrawRanges(masks.data(), ranges);
+    CHECK(ranges.size() == batcher.GetBatchCount());
+    CHECK(CoversVisible(batcher, masks, ranges));
+
+    // Nothing visible
+    std::fill(masks.begin(), masks.end(), (FrustumCuller::ViewMask)0);
+    batcher.GetDrawRanges(masks.data(), ranges);
+    CHECK(ranges.empty());
+
+    // Every other subrange: none can merge
+    for (size_t i = 0; i < cubeCount; ++i)
+        masks[i] = (i % 2) ? 1 : 0;
+    batcher.GetDrawRanges(masks.data(), ranges);
+    CHECK(ranges.size() == cubeCount / 2);
+    CHECK(CoversVisible(batcher, masks, ranges));
+
+    // Random masks, any view bit counts
+    std::mt19937 rng(13);
+    bool isCovered = true;
+    for (int pass = 0; pass < 100; ++pass)
+    {
+        for (auto &mask : masks)
+            mask = (FrustumCuller::ViewMask)(rng() % 4);
+        batcher.GetDrawRanges(masks.data(), ranges);
+        isCovered = isCovered && CoversVisible(batcher, masks, ranges);
+    }
+    CHECK(isCovered);
+}
+
+//--------------------------------------------------------------------------------------
+// VertexCodec
+//--------------------------------------------------------------------------------------
+
+// Random vertices within 'extent', skinned to joints [firstJoint, firstJoint + jointCount)
+static std::vector<SceneVertex> MakeVertices(size_t count, float extent, uint32_t firstJoint, uint32_t jointCount)
+{
+    std::mt19937 rng(5);
+    std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+    std::uniform_real_distribution<float> uv(0.0f, 4.0f);
+
+    std::vector<SceneVertex> vertices(count);
+    for (auto &vertex : vertices)
+    {
+        vertex.Pos = XMFLOAT3(unit(rng) * extent * 0.5f, unit(rng) * extent * 0.5f, unit(rng) * extent * 0.5f);
+        const XMVECTOR normal = XMVector3Normalize(XMVectorSet(unit(rng), unit(rng), unit(rng), 0.0f));
+        const XMVECTOR tangent = XMVector3Normalize(XMVector3Cross(normal, XMVector3Normalize(XMVectorSet(unit(rng), unit(rng), unit(rng), 0.0f))));
+        XMStoreFloat3(&vertex.Normal, normal);
+        XMStoreFloat4(&vertex.Tangent, XMVectorSetW(tangent, (rng() & 1) ? 1.0f : -1.0f));
+        vertex.Tex = XMFLOAT2(uv(rng), uv(rng));
+
+        if (jointCount == 0)
+            continue;
+        const uint32_t influences = 1 + rng() % 4;
+        float weights[4] = {}, sum = 0.0f;
+        uint32_t joints[4] = {};
+        for (uint32_t k = 0; k < influences; ++k)
+        {
+            weights[k] = 0.05f + (unit(rng) + 1.0f);
+            joints[k] = firstJoint + rng() % jointCount;
+            sum += weights[k];
+        }
+        vertex.Weights = XMFLOAT4(weights[0] / sum, weights[1] / sum, weights[2] / sum, weights[3] / sum);
+        vertex.Joints = XMUINT4(joints[0], joints[1], joints[2], joints[3]);
+    }
+    return vertices;
+}
+
+// Encodes and decodes the vertices, and checks the errors against the precision of the
+// encoding: half a quantisation step of the positions, 16 / 15 bit octahedral directions,
+// half floats below 4, unorm8 weights, exact joints
+static VertexCodec::Encoding CheckRoundTrip(const std::vector<SceneVertex> &vertices, float extent)
+{
+    const VertexCodec::Encoding encoding = VertexCodec::Choose(vertices.data(), vertices.size());
+
+    std::vector<uint8_t> encoded;
+    std::vector<SceneVertex> decoded;
+    VertexCodec::Encode(vertices.data(), vertices.size(), encoding, encoded);
+    CHECK(encoded.size() == vertices.size() * encoding.stride);
+    VertexCodec::Decode(encoded.data(), vertices.size(), encoding, decoded);
+    CHECK(decoded.size() == vertices.size());
+
+    const VertexCodec::Error error = VertexCodec::Measure(vertices.data(), decoded.data(), vertices.size());
+    const float positionBound = encoding.isQuantised ? extent * 0.5f / 65535.0f * 1.01f + 1e-6f : 0.0f;
+    CHECK(error.position <= positionBound);
+    CHECK(error.normalDegrees < 0.02f);
+    CHECK(error.tangentDegrees < 0.04f);
+    CHECK(error.handednessFlips == 0);
+    CHECK(error.uv <= 4.0f / 2048.0f);
+    CHECK(error.weight <= 3.0f / 255.0f);
+    CHECK(error.jointMismatches == 0);
+
+    D3D11_INPUT_ELEMENT_DESC elements[VertexCodec::MaxInputElements];
+    CHECK(VertexCodec::GetInputLayout(encoding, 0, elements) == (encoding.isSkinned ? 6u : 4u));
+    return encoding;
+}
+
+static void TestVertexCodec()
+{
+    const size_t count = 5000;
+
+    // Small static mesh: quantised, no skin
+    VertexCodec::Encoding encoding = CheckRoundTrip(MakeVertices(count, 4.0f, 0, 0), 4.0f);
+    CHECK(encoding.isQuantised && !encoding.isSkinned);
+    CHECK(encoding.stride == 20);
+
+    // Large static mesh: float positions
+    encoding = CheckRoundTrip(MakeVertices(count, 2000.0f, 0, 0), 2000.0f);
+    CHECK(!encoding.isQuantised);
+    CHECK(encoding.stride == 24);
+
+    // Skinned, joints below 256: uint8 joints, no palette
+    encoding = CheckRoundTrip(MakeVertices(count, 2.0f, 0, 64), 2.0f);
+    CHECK(encoding.isSkinned && !encoding.hasWideJoints && encoding.jointPalette.empty());
+    CHECK(encoding.stride == 28);
+
+    // Joints 100-299: still uint8, through a palette of the 200 used ones
+    encoding = CheckRoundTrip(MakeVertices(count, 2.0f, 100, 200), 2.0f);
+    CHECK(!encoding.hasWideJoints);
+    CHECK(encoding.jointPalette.size() == 200);
+    CHECK(std::is_sorted(encoding.jointPalette.begin(), encoding.jointPalette.end()));
+    CHECK(encoding.stride == 28);
+
+    // More than 256 joints used: uint16 joints, the only case past 32 bytes
+    encoding = CheckRoundTrip(MakeVertices(count, 2.0f, 0, 300), 2.0f);
+    CHECK(encoding.hasWideJoints && encoding.jointPalette.empty());
+    CHECK(encoding.stride == 32);
+    encoding = CheckRoundTrip(MakeVertices(count, 2000.0f, 0, 300), 2000.0f);
+    CHECK(encoding.hasWideJoints && !encoding.isQuantised);
+    CHECK(encoding.stride == 36);
+
+    // The axes and the folded corners of the octahedron map back onto themselves
+    const XMVECTOR directions[] =
+    {
+        XMVectorSet(1.0f, 0.0f, 0.0f, 0.0f), XMVectorSet(0.0f, -1.0f, 0.0f, 0.0f),
+        XMVectorSet(0.0f, 0.0f, 1.0f, 0.0f), XMVectorSet(0.0f, 0.0f, -1.0f, 0.0f),
+        XMVector3Normalize(XMVectorSet(-1.0f, 1.0f, -1.0f, 0.0f)),
+    };
+    for (const auto &direction : directions)
+    {
+        const XMFLOAT2 oct = VertexCodec::OctEncode(direction);
+        const XMVECTOR decoded = VertexCodec::OctDecode(oct.x, oct.y);
+        CHECK(XMVectorGetX(XMVector3Dot(direction, decoded)) > 0.99999f);
+    }
+}
+
+//--------------------------------------------------------------------------------------
+// TransformHierarchy
+//--------------------------------------------------------------------------------------
+
+static float WorldX(const TransformHierarchy &hierarchy, TransformHierarchy::Index idx)
+{
+    return XMVectorGetX(hierarchy.GetWorld(idx).r[3]);
+}
+
+// Reparenting in place, the way SceneGraph patches the flattened order
+static void TestTransformHierarchyReparent()
+{
+    TransformHierarchy hierarchy;
+    const auto a = hierarchy.Add(TransformHierarchy::InvalidIndex, XMMatrixTranslation(1.0f, 0.0f, 0.0f));
+    const auto b = hierarchy.Add(TransformHierarchy::InvalidIndex, XMMatrixTranslation(10.0f, 0.0f, 0.0f));
+    const auto c = hierarchy.Add(b, XMMatrixTranslation(100.0f, 0.0f, 0.0f));
+    hierarchy.UpdateWorld();
+    CHECK(hierarchy.GetLastUpdateCount() == 3);
+    CHECK(WorldX(hierarchy, c) == 110.0f);
+
+    // Under a parent that comes first only the entry changes, and only its subtree is updated
+    hierarchy.SetParent(b, a);
+    hierarchy.UpdateWorld();
+    CHECK(hierarchy.GetLastUpdateCount() == 2);
+    CHECK(WorldX(hierarchy, c) == 111.0f);
+
+    // Under a later one the subtree goes to the end, and the old entries stop following it
+    const auto d = hierarchy.Add(TransformHierarchy::InvalidIndex, XMMatrixTranslation(1000.0f, 0.0f, 0.0f));
+    const auto b2 = hierarchy.Add(d, hierarchy.GetLocal(b));
+    const auto c2 = hierarchy.Add(b2, hierarchy.GetLocal(c));
+    hierarchy.SetParent(b, TransformHierarchy::InvalidIndex);
+    hierarchy.UpdateWorld();
+    CHECK(WorldX(hierarchy, c2) == 1110.0f);
+    const uint32_t version = hierarchy.GetWorldVersion(c2);
+    hierarchy.SetLocal(a, XMMatrixTranslation(2.0f, 0.0f, 0.0f));
+    hierarchy.UpdateWorld();
+    CHECK(hierarchy.GetLastUpdateCount() == 1);
+    CHECK(hierarchy.GetWorldVersion(c2) == version);
+
+    // A parent that does not come first is refused
+    hierarchy.SetParent(a, c2);
+    CHECK(hierarchy.GetParent(a) == TransformHierarchy::InvalidIndex);
+
+    // A marked node is recomputed as if it had moved
+    hierarchy.UpdateWorld();
+    hierarchy.MarkDirty(c2);
+    hierarchy.UpdateWorld();
+    CHECK(hierarchy.GetLastUpdateCount() == 1);
+}
+
+//--------------------------------------------------------------------------------------
+// AnimationLibrary
+//--------------------------------------------------------------------------------------
+
+// Model with 'count' one-channel translation clips, all with the same name
+static tinygltf::Model MakeClipModel(int count)
+{
+    const float data[] = { 0.0f, 1.0f,   0.0f, 0.0f, 0.0f,   1.0f, 2.0f, 3.0f };
+
+    tinygltf::Model model;
+    model.nodes.resize(1);
+
+    tinygltf::Buffer buffer;
+    buffer.data.resize(sizeof(data));
+    memcpy(buffer.data.data(), data, sizeof(data));
+    model.buffers.push_back(buffer);
+
+    tinygltf::BufferView view;
+    view.buffer = 0;
+    view.byteOffset = 0;
+    view.byteLength = sizeof(data);
+    model.bufferViews.push_back(view);
+
+    tinygltf::Accessor times;
+    times.bufferView = 0;
+    times.byteOffset = 0;
+    times.componentType = TINYGLTF_COMPONENT_TYPE_FLOAT;
+    times.type = TINYGLTF_TYPE_SCALAR;
+    times.count = 2;
+    model.accessors.push_back(times);
+
+    tinygltf::Accessor values = times;
+    values.byteOffset = 2 * sizeof(float);
+    values.type = TINYGLTF_TYPE_VEC3;
+    model.accessors.push_back(values);
+
+    for (int i = 0; i < count; ++i)
+    {
+        tinygltf::AnimationSampler sampler;
+        sampler.input = 0;
+        sampler.output = 1;
+
+        tinygltf::AnimationChannel channel;
+        channel.sampler = 0;
+        channel.target_node = 0;
+        channel.target_path = "translation";
+
+        tinygltf::Animation animation;
+        animation.name = "Walk";
+        animation.samplers.push_back(sampler);
+        animation.channels.push_back(channel);
+        model.animations.push_back(animation);
+    }
+    return model;
+}
+
+// A glTF clip is the same library entry whether it came through LoadFromGltf or Add
+static void TestAnimationLibraryKeys()
+{
+    AnimationLibrary &library = AnimationLibrary::Get();
+    const tinygltf::Model model = MakeClipModel(2);
+
+    const std::vector<ClipHandle> loaded = library.LoadFromGltf(model, L"keys_a.gltf");
+    CHECK(loaded.size() == 2);
+    CHECK(loaded.size() == 2 && loaded[0] != loaded[1]); // same name, different animations
+
+    Animation second;
+    CHECK(second.LoadFromGltf(model, 1));
+    const ClipHandle added = library.Add(std::move(second), L"keys_a.gltf");
+    CHECK(loaded.size() == 2 && added == loaded[1]);
+
+    // ...and the other way round
+    Animation first;
+    CHECK(first.LoadFromGltf(model, 0));
+    const ClipHandle addedFirst = library.Add(std::move(first), L"keys_b.gltf");
+    const std::vector<ClipHandle> loadedAfter = library.LoadFromGltf(model, L"keys_b.gltf");
+    CHECK(loadedAfter.size() == 2 && loadedAfter[0] == addedFirst);
+
+    // Clips built in code share by name, and never with a glTF clip of the same source
+    Animation walk;
+    walk.m_name = "0";
+    const ClipHandle built = library.Add(std::move(walk), L"keys_b.gltf");
+    Animation walkAgain;
+    walkAgain.m_name = "0";
+    CHECK(library.Add(std::move(walkAgain), L"keys_b.gltf") == built);
+    CHECK(built != addedFirst);
+}
+
+//--------------------------------------------------------------------------------------
+int main()
+{
+    TestRotationPrecision();
+    TestTlsfFillAndFree();
+    TestTlsfRandom();
+    TestTlsfDefragment();
+    TestTlsfDefragmentCopy();
+    TestStaticBatcherDrawRanges();
+    TestVertexCodec();
+    TestTransformHierarchyReparent();
+    TestAnimationLibraryKeys();
+
+    printf("%d checks, %d failed\n", sChecks, sFailures);
+    return sFailures ? 1 : 0;
+}